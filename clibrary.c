@@ -5,8 +5,6 @@
 
 /* endian-ness checking */
 static const int __ENDIAN_CHECK__ = 1;
-static int BigEndian;
-static int LittleEndian;
 
 
 /* global initialisation for libraries */
@@ -19,17 +17,280 @@ void LibraryInit(Picoc *pc)
         (union AnyValue*)&pc->VersionString, false);
 
     /* define endian-ness macros */
-    BigEndian = ((*(char*)&__ENDIAN_CHECK__) == 0);
-    LittleEndian = ((*(char*)&__ENDIAN_CHECK__) == 1);
+    pc->BigEndian = ((*(char*)&__ENDIAN_CHECK__) == 0);
+    pc->LittleEndian = ((*(char*)&__ENDIAN_CHECK__) == 1);
 
     VariableDefinePlatformVar(pc, NULL, "BIG_ENDIAN", &pc->IntType,
-        (union AnyValue*)&BigEndian, false);
+        (union AnyValue*)&pc->BigEndian, false);
     VariableDefinePlatformVar(pc, NULL, "LITTLE_ENDIAN", &pc->IntType,
-        (union AnyValue*)&LittleEndian, false);
+        (union AnyValue*)&pc->LittleEndian, false);
 }
 
+/* skip white space in a library prototype */
+static const char *LibrarySkipSpace(const char *Pos)
+{
+    while (isspace((unsigned char)*Pos))
+        Pos++;
+
+    return Pos;
+}
+
+/* get the next word of a library prototype, returning its length */
+static int LibraryGetWord(const char **Pos, const char **Word)
+{
+    const char *End = LibrarySkipSpace(*Pos);
+
+    *Word = End;
+    while (isalnum((unsigned char)*End) || *End == '_')
+        End++;
+
+    *Pos = End;
+    return End - *Word;
+}
+
+#define LIBRARY_WORD_IS(Word, Len, Str) \
+    ((Len) == sizeof(Str)-1 && strncmp((Word), (Str), (Len)) == 0)
+
+/* scan a type and optional identifier from a library prototype. This
+    understands the plain declarations used in the library tables - base
+    types, typedef names, struct/union tags and pointers. Anything else
+    returns NULL so the caller can fall back to the full parser */
+static struct ValueType *LibraryScanType(Picoc *pc, const char **Pos,
+    char **Identifier)
+{
+    int Len;
+    int Unsigned = false;
+    int IntSpecifier = false;
+    int Longs = 0;
+    int Short = false;
+    int Char = false;
+    const char *Word;
+    const char *Before;
+    struct ValueType *Typ = NULL;
+    struct Value *TypeValue;
+
+    *Identifier = pc->StrEmpty;
+
+    /* the type specifiers */
+    for (;;) {
+        Before = *Pos;
+        Len = LibraryGetWord(Pos, &Word);
+        if (Len == 0)
+            break;
+
+        if (LIBRARY_WORD_IS(Word, Len, "const") ||
+                LIBRARY_WORD_IS(Word, Len, "volatile"))
+            continue;
+        else if (LIBRARY_WORD_IS(Word, Len, "unsigned"))
+            Unsigned = IntSpecifier = true;
+        else if (LIBRARY_WORD_IS(Word, Len, "signed") ||
+                LIBRARY_WORD_IS(Word, Len, "int"))
+            IntSpecifier = true;
+        else if (LIBRARY_WORD_IS(Word, Len, "long")) {
+            Longs++;
+            IntSpecifier = true;
+        } else if (LIBRARY_WORD_IS(Word, Len, "short"))
+            Short = IntSpecifier = true;
+        else if (LIBRARY_WORD_IS(Word, Len, "char"))
+            Char = IntSpecifier = true;
+        else if (Typ != NULL || IntSpecifier) {
+            /* this must be the identifier */
+            *Pos = Before;
+            break;
+        } else if (LIBRARY_WORD_IS(Word, Len, "void"))
+            Typ = &pc->VoidType;
+        else if (LIBRARY_WORD_IS(Word, Len, "float"))
+            Typ = &pc->FloatType;
+        else if (LIBRARY_WORD_IS(Word, Len, "double"))
+            Typ = &pc->DoubleType;
+        else if (LIBRARY_WORD_IS(Word, Len, "struct") ||
+                LIBRARY_WORD_IS(Word, Len, "union")) {
+            enum BaseType Base = (*Word == 's') ? TypeStruct : TypeUnion;
+
+            Len = LibraryGetWord(Pos, &Word);
+            if (Len == 0)
+                return NULL;
+
+            Typ = TypeGetMatching(pc, NULL, &pc->UberType, Base, 0,
+                TableStrRegister2(pc, Word, Len), true);
+        } else if (TableGet(&pc->GlobalTable, TableStrRegister2(pc, Word, Len),
+                    &TypeValue, NULL, NULL, NULL) &&
+                TypeValue->Typ == &pc->TypeType)
+            Typ = TypeValue->Val->Typ;
+        else
+            return NULL;
+    }
+
+    if (Typ == NULL) {
+        if (!IntSpecifier)
+            return NULL;
+
+        if (Char)
+            Typ = Unsigned ? &pc->UnsignedCharType : &pc->CharType;
+        else if (Short)
+            Typ = Unsigned ? &pc->UnsignedShortType : &pc->ShortType;
+        else if (Longs > 1)
+            Typ = Unsigned ? &pc->UnsignedLongLongType : &pc->LongLongType;
+        else if (Longs == 1)
+            Typ = Unsigned ? &pc->UnsignedLongType : &pc->LongType;
+        else
+            Typ = Unsigned ? &pc->UnsignedIntType : &pc->IntType;
+    } else if (IntSpecifier)
+        return NULL;
+
+    /* pointers, ignoring const/volatile pointer qualifiers */
+    for (;;) {
+        *Pos = LibrarySkipSpace(*Pos);
+        if (**Pos == '*') {
+            Typ = TypeGetMatching(pc, NULL, Typ, TypePointer, 0, pc->StrEmpty,
+                true);
+            (*Pos)++;
+        } else {
+            Before = *Pos;
+            Len = LibraryGetWord(Pos, &Word);
+            if (LIBRARY_WORD_IS(Word, Len, "const") ||
+                    LIBRARY_WORD_IS(Word, Len, "volatile"))
+                continue;
+
+            if (Len > 0)
+                *Identifier = TableStrRegister2(pc, Word, Len);
+            else
+                *Pos = Before;
+            break;
+        }
+    }
+
+    /* array bounds and function pointers are left to the parser */
+    *Pos = LibrarySkipSpace(*Pos);
+    if (**Pos == '[' || (**Pos == '(' && *Identifier == pc->StrEmpty))
+        return NULL;
+
+    return Typ;
+}
+
+/* add a library function straight from its prototype without lexing
+    and parsing it. Returns false if the prototype needs the full parser */
+static int LibraryAddPrototype(Picoc *pc, const struct LibraryFunction *Func,
+    char *IntrinsicName)
+{
+    int Count;
+    int NumParams = 0;
+    int VarArgs = false;
+    const char *Pos = Func->Prototype;
+    char *Identifier;
+    char *ParamName[PARAMETER_MAX];
+    struct ValueType *ReturnType;
+    struct ValueType *ParamType[PARAMETER_MAX];
+    struct Value *FuncValue;
+
+    ReturnType = LibraryScanType(pc, &Pos, &Identifier);
+    if (ReturnType == NULL || Identifier == pc->StrEmpty || *Pos != '(')
+        return false;
+
+    Pos = LibrarySkipSpace(Pos+1);
+    while (*Pos != ')') {
+        if (strncmp(Pos, "...", 3) == 0) {
+            VarArgs = true;
+            Pos = LibrarySkipSpace(Pos+3);
+            break;
+        }
+
+        if (NumParams == PARAMETER_MAX)
+            return false;
+
+        ParamType[NumParams] = LibraryScanType(pc, &Pos, &ParamName[NumParams]);
+        if (ParamType[NumParams] == NULL)
+            return false;
+
+        /* "(void)" isn't a real parameter at all */
+        if (ParamType[NumParams] != &pc->VoidType)
+            NumParams++;
+
+        if (*Pos != ',')
+            break;
+
+        Pos = LibrarySkipSpace(Pos+1);
+    }
+
+    if (*Pos != ')' || *LibrarySkipSpace(Pos+1) != ';')
+        return false;
+
+    /* lay out the definition the same way ParseFunctionDefinition() does */
+    FuncValue = VariableAllocValueAndData(pc, NULL,
+        sizeof(struct FuncDef) + sizeof(struct ValueType*)*NumParams +
+        sizeof(const char*)*NumParams,
+        false, NULL, true);
+    FuncValue->Typ = &pc->FunctionType;
+    FuncValue->Val->FuncDef.ReturnType = ReturnType;
+    FuncValue->Val->FuncDef.NumParams = NumParams;
+    FuncValue->Val->FuncDef.VarArgs = VarArgs;
+    FuncValue->Val->FuncDef.ParamType =
+        (struct ValueType**)((char*)FuncValue->Val+sizeof(struct FuncDef));
+    FuncValue->Val->FuncDef.ParamName =
+        (char**)((char*)FuncValue->Val->FuncDef.ParamType +
+            sizeof(struct ValueType*)*NumParams);
+    FuncValue->Val->FuncDef.Intrinsic = Func->Func;
+
+    for (Count = 0; Count < NumParams; Count++) {
+        FuncValue->Val->FuncDef.ParamType[Count] = ParamType[Count];
+        FuncValue->Val->FuncDef.ParamName[Count] = ParamName[Count];
+    }
+
+    if (!TableSet(pc, &pc->GlobalTable, Identifier, FuncValue, IntrinsicName,
+            0, 0))
+        ProgramFailNoParser(pc, "'%s' is already defined", Identifier);
+
+    return true;
+}
+
+#ifdef DEBUG_LIBRARY
+/* check the definition LibraryAddPrototype() made for a library function
+    against the one ParseFunctionDefinition() makes from the same prototype */
+static void LibraryCheckPrototype(Picoc *pc, const struct LibraryFunction *Func,
+    char *IntrinsicName)
+{
+    struct ParseState Parser;
+    int Count;
+    int Same;
+    char *Identifier;
+    struct ValueType *ReturnType;
+    struct Value *Scanned;
+    struct Value *Parsed;
+    void *Tokens;
+
+    Tokens = LexAnalyse(pc, (const char*)IntrinsicName, Func->Prototype,
+        strlen((char*)Func->Prototype), NULL);
+    LexInitParser(&Parser, pc, Func->Prototype, Tokens, IntrinsicName, true,
+        false);
+    TypeParse(&Parser, &ReturnType, &Identifier, NULL, NULL, NULL);
+
+    /* move the scanned definition out of the way of the parsed one */
+    Scanned = TableDelete(pc, &pc->GlobalTable, Identifier);
+    Parsed = ParseFunctionDefinition(&Parser, ReturnType, Identifier);
+
+    Same = Scanned->Val->FuncDef.ReturnType == Parsed->Val->FuncDef.ReturnType &&
+        Scanned->Val->FuncDef.NumParams == Parsed->Val->FuncDef.NumParams &&
+        Scanned->Val->FuncDef.VarArgs == Parsed->Val->FuncDef.VarArgs;
+    for (Count = 0; Same && Count < Scanned->Val->FuncDef.NumParams; Count++)
+        Same = Scanned->Val->FuncDef.ParamType[Count] ==
+                Parsed->Val->FuncDef.ParamType[Count] &&
+            Scanned->Val->FuncDef.ParamName[Count] ==
+                Parsed->Val->FuncDef.ParamName[Count];
+
+    if (!Same) {
+        fprintf(stderr, "library prototype \"%s\" isn't read the same way "
+            "as the parser reads it\n", Func->Prototype);
+        exit(1);
+    }
+
+    VariableFree(pc, TableDelete(pc, &pc->GlobalTable, Identifier));
+    TableSet(pc, &pc->GlobalTable, Identifier, Scanned, IntrinsicName, 0, 0);
+    HeapFreeMem(pc, Tokens);
+}
+#endif
+
 /* add a library */
-void LibraryAdd(Picoc *pc, struct LibraryFunction *FuncList)
+void LibraryAdd(Picoc *pc, const struct LibraryFunction *FuncList)
 {
     struct ParseState Parser;
     int Count;
@@ -41,6 +302,13 @@ void LibraryAdd(Picoc *pc, struct LibraryFunction *FuncList)
 
     /* read all the library definitions */
     for (Count = 0; FuncList[Count].Prototype != NULL; Count++) {
+        if (LibraryAddPrototype(pc, &FuncList[Count], IntrinsicName)) {
+#ifdef DEBUG_LIBRARY
+            LibraryCheckPrototype(pc, &FuncList[Count], IntrinsicName);
+#endif
+            continue;
+        }
+
         Tokens = LexAnalyse(pc,
             (const char*)IntrinsicName, FuncList[Count].Prototype,
             strlen((char*)FuncList[Count].Prototype), NULL);
@@ -53,6 +321,121 @@ void LibraryAdd(Picoc *pc, struct LibraryFunction *FuncList)
     }
 }
 
+/* native functions bound with dlbind() are called through one of these.
+    on x86-64 and arm64 integers and pointers go in integer registers and
+    floating point values in floating point registers, each in order
+    whatever order they're mixed in, so passing the most of each that fit
+    in registers suits any function that only takes those */
+typedef long (*NativeIntFunc)(long, long, long, long, long, long,
+    double, double, double, double, double, double, double, double);
+typedef double (*NativeFPFunc)(long, long, long, long, long, long,
+    double, double, double, double, double, double, double, double);
+
+/* a float argument or result is in the low half of its register */
+union NativeFP {
+    double Double;
+    float Float;
+};
+
+/* can a parameter or return value of type Typ go to or from a native
+    function. counts it in *NumInt or *NumFP according to which kind of
+    register it needs */
+int LibraryNativeType(struct ValueType *Typ, int *NumInt, int *NumFP)
+{
+    if (Typ->Base == TypeFloat || Typ->Base == TypeDouble) {
+        (*NumFP)++;
+        return true;
+    }
+
+    if ((Typ->Base >= TypeInt && Typ->Base <= TypeUnsignedLongLong) ||
+            Typ->Base == TypePointer) {
+        (*NumInt)++;
+        return true;
+    }
+
+    return false;
+}
+
+/* call a native function bound with dlbind() */
+void LibraryCallNative(struct ParseState *Parser, struct FuncDef *Func,
+    struct Value *ReturnValue, struct Value **Param, int NumArgs)
+{
+    long Int[NATIVE_INT_ARGS];
+    union NativeFP FP[NATIVE_FP_ARGS];
+    union NativeFP FPResult;
+    long IntResult;
+    int NumInt = 0;
+    int NumFP = 0;
+    int Count;
+
+    memset(Int, '\0', sizeof(Int));
+    memset(FP, '\0', sizeof(FP));
+    for (Count = 0; Count < NumArgs; Count++) {
+        if (Param[Count]->Typ->Base == TypeFloat)
+            FP[NumFP++].Float = Param[Count]->Val->Float;
+        else if (Param[Count]->Typ->Base == TypeDouble)
+            FP[NumFP++].Double = Param[Count]->Val->Double;
+        else if (Param[Count]->Typ->Base == TypePointer)
+            Int[NumInt++] = (long)Param[Count]->Val->Pointer;
+        else
+            Int[NumInt++] = ExpressionCoerceInteger(Param[Count]);
+    }
+
+    if (IS_FP(ReturnValue)) {
+        FPResult.Double = ((NativeFPFunc)Func->Native)(Int[0], Int[1], Int[2],
+            Int[3], Int[4], Int[5], FP[0].Double, FP[1].Double, FP[2].Double,
+            FP[3].Double, FP[4].Double, FP[5].Double, FP[6].Double,
+            FP[7].Double);
+        if (ReturnValue->Typ->Base == TypeFloat)
+            ReturnValue->Val->Float = FPResult.Float;
+        else
+            ReturnValue->Val->Double = FPResult.Double;
+        return;
+    }
+
+    IntResult = ((NativeIntFunc)Func->Native)(Int[0], Int[1], Int[2], Int[3],
+        Int[4], Int[5], FP[0].Double, FP[1].Double, FP[2].Double,
+        FP[3].Double, FP[4].Double, FP[5].Double, FP[6].Double, FP[7].Double);
+
+    switch (ReturnValue->Typ->Base) {
+    case TypeInt:
+        ReturnValue->Val->Integer = (int)IntResult;
+        break;
+    case TypeShort:
+        ReturnValue->Val->ShortInteger = (short)IntResult;
+        break;
+    case TypeChar:
+        ReturnValue->Val->Character = (char)IntResult;
+        break;
+    case TypeLong:
+        ReturnValue->Val->LongInteger = IntResult;
+        break;
+    case TypeLongLong:
+        ReturnValue->Val->LongLongInteger = IntResult;
+        break;
+    case TypeUnsignedInt:
+        ReturnValue->Val->UnsignedInteger = (unsigned int)IntResult;
+        break;
+    case TypeUnsignedShort:
+        ReturnValue->Val->UnsignedShortInteger = (unsigned short)IntResult;
+        break;
+    case TypeUnsignedChar:
+        ReturnValue->Val->UnsignedCharacter = (unsigned char)IntResult;
+        break;
+    case TypeUnsignedLong:
+        ReturnValue->Val->UnsignedLongInteger = (unsigned long)IntResult;
+        break;
+    case TypeUnsignedLongLong:
+        ReturnValue->Val->UnsignedLongLongInteger = (unsigned long)IntResult;
+        break;
+    case TypePointer:
+        ReturnValue->Val->Pointer = (void*)IntResult;
+        break;
+    default:
+        break;
+    }
+}
+
 /* print a type to a stream without using printf/sprintf */
 void PrintType(struct ValueType *Typ, IOFILE *Stream)
 {
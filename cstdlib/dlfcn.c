@@ -0,0 +1,156 @@
+/* dlfcn.h - shared libraries. as well as the usual dlopen() and friends
+ * there's dlbind(), which takes a function prototype, finds the function in
+ * a library and makes it callable from the program like any other, so hot
+ * code can be moved into a compiled library without rebuilding picoc.
+ * bound functions can take and return numbers and pointers, which covers
+ * passing structs by pointer - see LibraryCallNative() */
+#include <dlfcn.h>
+
+#include "../interpreter.h"
+
+
+void DlfcnOpen(struct ParseState *Parser, struct Value *ReturnValue,
+    struct Value **Param, int NumArgs)
+{
+    ReturnValue->Val->Pointer = dlopen(Param[0]->Val->Pointer,
+        Param[1]->Val->Integer);
+}
+
+void DlfcnClose(struct ParseState *Parser, struct Value *ReturnValue,
+    struct Value **Param, int NumArgs)
+{
+    ReturnValue->Val->Integer = dlclose(Param[0]->Val->Pointer);
+}
+
+void DlfcnError(struct ParseState *Parser, struct Value *ReturnValue,
+    struct Value **Param, int NumArgs)
+{
+    ReturnValue->Val->Pointer = dlerror();
+}
+
+void DlfcnSym(struct ParseState *Parser, struct Value *ReturnValue,
+    struct Value **Param, int NumArgs)
+{
+    ReturnValue->Val->Pointer = dlsym(Param[0]->Val->Pointer,
+        Param[1]->Val->Pointer);
+}
+
+/* dlbind(Handle, "double Dot(double *a, double *b, int n)") - returns 0,
+    or -1 if the library doesn't have the function, as dlerror() says */
+void DlfcnBind(struct ParseState *Parser, struct Value *ReturnValue,
+    struct Value **Param, int NumArgs)
+{
+    Picoc *pc = Parser->pc;
+    const char *Prototype = Param[1]->Val->Pointer;
+    char *FileName = TableStrRegister(pc, "dlbind");
+    char *Source;
+    char *Identifier;
+    void *Tokens;
+    void *Symbol;
+    int Length;
+    int NumInt = 0;
+    int NumFP = 0;
+    int Count;
+    struct ParseState BindParser;
+    struct ValueType *ReturnType;
+    struct Value *FuncValue;
+    struct Value *OldValue;
+    struct StackFrame *Frame;
+    struct FuncDef *Func;
+
+#if !defined(__x86_64__) && !defined(__aarch64__)
+    ProgramFail(Parser, "dlbind() isn't supported on this processor");
+#endif
+
+    if (Prototype == NULL)
+        ProgramFail(Parser, "dlbind() needs a function prototype");
+
+    /* the prototype doesn't need its semicolon */
+    Length = strlen(Prototype);
+    Source = HeapAllocMem(pc, Length + 2);
+    if (Source == NULL)
+        ProgramFail(Parser, "(DlfcnBind) out of memory");
+
+    strcpy(Source, Prototype);
+    strcpy(&Source[Length], ";");
+    Tokens = LexAnalyse(pc, FileName, Source, Length + 1, NULL);
+    LexInitParser(&BindParser, pc, Source, Tokens, FileName, true, false);
+    TypeParse(&BindParser, &ReturnType, &Identifier, NULL, NULL, NULL);
+    if (Identifier == pc->StrEmpty ||
+            LexGetToken(&BindParser, NULL, false) != TokenOpenBracket)
+        ProgramFail(&BindParser, "function prototype expected");
+
+    Symbol = dlsym(Param[0]->Val->Pointer, Identifier);
+    if (Symbol == NULL) {
+        HeapFreeMem(pc, Tokens);
+        HeapFreeMem(pc, Source);
+        ReturnValue->Val->Integer = -1;
+        return;
+    }
+
+    /* the program's own prototype for it is replaced */
+    if (TableGet(&pc->GlobalTable, Identifier, &OldValue, NULL, NULL, NULL)) {
+        if (OldValue->Typ != &pc->FunctionType ||
+                OldValue->Val->FuncDef.Body.Pos != NULL ||
+                OldValue->Val->FuncDef.Intrinsic != NULL ||
+                OldValue->Val->FuncDef.Native != NULL)
+            ProgramFail(Parser, "'%s' is already defined", Identifier);
+
+        VariableFree(pc, TableDelete(pc, &pc->GlobalTable, Identifier));
+    }
+
+    /* it's a global function, whichever function this is called from */
+    Frame = THREAD(pc)->TopStackFrame;
+    THREAD(pc)->TopStackFrame = NULL;
+    FuncValue = ParseFunctionDefinition(&BindParser, ReturnType, Identifier);
+    THREAD(pc)->TopStackFrame = Frame;
+
+    Func = &FuncValue->Val->FuncDef;
+    if (Func->VarArgs)
+        ProgramFail(&BindParser, "can't bind a function with variable arguments");
+
+    for (Count = 0; Count < Func->NumParams; Count++) {
+        if (!LibraryNativeType(Func->ParamType[Count], &NumInt, &NumFP))
+            ProgramFail(&BindParser, "can't pass %t to a native function",
+                Func->ParamType[Count]);
+    }
+
+    if (NumInt > NATIVE_INT_ARGS || NumFP > NATIVE_FP_ARGS)
+        ProgramFail(&BindParser,
+            "a native function can have %d integer or pointer and %d floating point parameters",
+            NATIVE_INT_ARGS, NATIVE_FP_ARGS);
+
+    NumInt = NumFP = 0;
+    if (ReturnType != &pc->VoidType &&
+            !LibraryNativeType(ReturnType, &NumInt, &NumFP))
+        ProgramFail(&BindParser, "a native function can't return %t",
+            ReturnType);
+
+    /* this is how POSIX suggests turning a symbol into a function pointer */
+    *(void **)&Func->Native = Symbol;
+    HeapFreeMem(pc, Tokens);
+    HeapFreeMem(pc, Source);
+    ReturnValue->Val->Integer = 0;
+}
+
+/* all dlfcn.h functions */
+const struct LibraryFunction DlfcnFunctions[] =
+{
+    {DlfcnOpen, "void *dlopen(char *, int);"},
+    {DlfcnClose, "int dlclose(void *);"},
+    {DlfcnError, "char *dlerror();"},
+    {DlfcnSym, "void *dlsym(void *, char *);"},
+    {DlfcnBind, "int dlbind(void *, char *);"},
+    {NULL, NULL}
+};
+
+/* all dlfcn.h constants */
+const struct LibraryConstant DlfcnConstants[] =
+{
+    {"NULL", TypeInt, 0},
+    {"RTLD_LAZY", TypeInt, RTLD_LAZY},
+    {"RTLD_NOW", TypeInt, RTLD_NOW},
+    {"RTLD_GLOBAL", TypeInt, RTLD_GLOBAL},
+    {"RTLD_LOCAL", TypeInt, RTLD_LOCAL},
+    {NULL}
+};
@@ -4,21 +4,6 @@
 #include "../interpreter.h"
 
 
-static double M_EValue = 2.7182818284590452354;   /* e */
-static double M_LOG2EValue = 1.4426950408889634074;   /* log_2 e */
-static double M_LOG10EValue = 0.43429448190325182765;  /* log_10 e */
-static double M_LN2Value = 0.69314718055994530942;  /* log_e 2 */
-static double M_LN10Value = 2.30258509299404568402;  /* log_e 10 */
-static double M_PIValue = 3.14159265358979323846;  /* pi */
-static double M_PI_2Value = 1.57079632679489661923;  /* pi/2 */
-static double M_PI_4Value = 0.78539816339744830962;  /* pi/4 */
-static double M_1_PIValue = 0.31830988618379067154;  /* 1/pi */
-static double M_2_PIValue = 0.63661977236758134308;  /* 2/pi */
-static double M_2_SQRTPIValue = 1.12837916709551257390;  /* 2/sqrt(pi) */
-static double M_SQRT2Value = 1.41421356237309504880;  /* sqrt(2) */
-static double M_SQRT1_2Value =  0.70710678118654752440;  /* 1/sqrt(2) */
-
-
 void MathSin(struct ParseState *Parser, struct Value *ReturnValue,
     struct Value **Param, int NumArgs)
 {
@@ -160,7 +145,7 @@ void MathFloor(struct ParseState *Parser, struct Value *ReturnValue,
 }
 
 /* all math.h functions */
-struct LibraryFunction MathFunctions[] =
+const struct LibraryFunction MathFunctions[] =
 {
      {MathAcos, "double acos(double);"},
      {MathAsin, "double asin(double);"},
@@ -188,33 +173,21 @@ struct LibraryFunction MathFunctions[] =
      {NULL,  NULL }
 };
 
-/* creates various system-dependent definitions */
-void MathSetupFunc(Picoc *pc)
-{
-    VariableDefinePlatformVar(pc, NULL, "M_E", &pc->DoubleType,
-        (union AnyValue*)&M_EValue, false);
-    VariableDefinePlatformVar(pc, NULL, "M_LOG2E", &pc->DoubleType,
-        (union AnyValue*)&M_LOG2EValue, false);
-    VariableDefinePlatformVar(pc, NULL, "M_LOG10E", &pc->DoubleType,
-        (union AnyValue*)&M_LOG10EValue, false);
-    VariableDefinePlatformVar(pc, NULL, "M_LN2", &pc->DoubleType,
-        (union AnyValue*)&M_LN2Value, false);
-    VariableDefinePlatformVar(pc, NULL, "M_LN10", &pc->DoubleType,
-        (union AnyValue*)&M_LN10Value, false);
-    VariableDefinePlatformVar(pc, NULL, "M_PI", &pc->DoubleType,
-        (union AnyValue*)&M_PIValue, false);
-    VariableDefinePlatformVar(pc, NULL, "M_PI_2", &pc->DoubleType,
-        (union AnyValue*)&M_PI_2Value, false);
-    VariableDefinePlatformVar(pc, NULL, "M_PI_4", &pc->DoubleType,
-        (union AnyValue*)&M_PI_4Value, false);
-    VariableDefinePlatformVar(pc, NULL, "M_1_PI", &pc->DoubleType,
-        (union AnyValue*)&M_1_PIValue, false);
-    VariableDefinePlatformVar(pc, NULL, "M_2_PI", &pc->DoubleType,
-        (union AnyValue*)&M_2_PIValue, false);
-    VariableDefinePlatformVar(pc, NULL, "M_2_SQRTPI", &pc->DoubleType,
-        (union AnyValue*)&M_2_SQRTPIValue, false);
-    VariableDefinePlatformVar(pc, NULL, "M_SQRT2", &pc->DoubleType,
-        (union AnyValue*)&M_SQRT2Value, false);
-    VariableDefinePlatformVar(pc, NULL, "M_SQRT1_2", &pc->DoubleType,
-        (union AnyValue*)&M_SQRT1_2Value, false);
-}
+/* all math.h constants */
+const struct LibraryConstant MathConstants[] =
+{
+    {"M_E", TypeDouble, 0, 2.7182818284590452354},  /* e */
+    {"M_LOG2E", TypeDouble, 0, 1.4426950408889634074},  /* log_2 e */
+    {"M_LOG10E", TypeDouble, 0, 0.43429448190325182765},  /* log_10 e */
+    {"M_LN2", TypeDouble, 0, 0.69314718055994530942},  /* log_e 2 */
+    {"M_LN10", TypeDouble, 0, 2.30258509299404568402},  /* log_e 10 */
+    {"M_PI", TypeDouble, 0, 3.14159265358979323846},  /* pi */
+    {"M_PI_2", TypeDouble, 0, 1.57079632679489661923},  /* pi/2 */
+    {"M_PI_4", TypeDouble, 0, 0.78539816339744830962},  /* pi/4 */
+    {"M_1_PI", TypeDouble, 0, 0.31830988618379067154},  /* 1/pi */
+    {"M_2_PI", TypeDouble, 0, 0.63661977236758134308},  /* 2/pi */
+    {"M_2_SQRTPI", TypeDouble, 0, 1.12837916709551257390},  /* 2/sqrt(pi) */
+    {"M_SQRT2", TypeDouble, 0, 1.41421356237309504880},  /* sqrt(2) */
+    {"M_SQRT1_2", TypeDouble, 0, 0.70710678118654752440},  /* 1/sqrt(2) */
+    {NULL}
+};
@@ -0,0 +1,260 @@
+/* pthread.h - threads, mutexes, condition variables and atomic operations on
+ * ints. the threads are real host threads, see thread.c. mutexes and
+ * condition variables are native ones kept in the program's own memory, and
+ * a zeroed one is ready to use, so globals and calloc()ed ones don't need
+ * initializing. waits give up every so often to see if the program's ending,
+ * so exit() on one thread isn't held up by another one waiting */
+#include <pthread.h>
+#include <errno.h>
+
+#include "../interpreter.h"
+
+
+/* pthread_create(&Thread, Attr, Function, Arg) - the function and its
+    argument come as variable arguments since they can't be declared */
+void PthreadCreate(struct ParseState *Parser, struct Value *ReturnValue,
+    struct Value **Param, int NumArgs)
+{
+    struct Value *FuncValue;
+    struct Value *ArgValue;
+    void *Arg = NULL;
+    int ID;
+
+    if (NumArgs < 3)
+        ProgramFail(Parser, "pthread_create() needs a function to run");
+
+    FuncValue = (struct Value*)((char*)Param[1] +
+        MEM_ALIGN(sizeof(struct Value) + TypeStackSizeValue(Param[1])));
+
+    if (NumArgs > 3) {
+        ArgValue = (struct Value*)((char*)FuncValue +
+            MEM_ALIGN(sizeof(struct Value) + TypeStackSizeValue(FuncValue)));
+        if (ArgValue->Typ->Base == TypePointer)
+            Arg = ArgValue->Val->Pointer;
+        else if (ArgValue->Typ->Base == TypeArray)
+            Arg = (void*)&ArgValue->Val->ArrayMem[0];
+        else if (IS_INTEGER_NUMERIC(ArgValue))
+            Arg = (void*)(intptr_t)ExpressionCoerceInteger(ArgValue);
+        else
+            ProgramFail(Parser, "a thread's argument should be a pointer");
+    }
+
+    ReturnValue->Val->Integer = ThreadStart(Parser, FuncValue, Arg, &ID);
+    if (ReturnValue->Val->Integer == 0 && Param[0]->Val->Pointer != NULL)
+        *(int*)Param[0]->Val->Pointer = ID;
+}
+
+void PthreadJoin(struct ParseState *Parser, struct Value *ReturnValue,
+    struct Value **Param, int NumArgs)
+{
+    ReturnValue->Val->Integer = ThreadJoin(Parser, Param[0]->Val->Integer,
+        Param[1]->Val->Pointer);
+}
+
+void PthreadSelf(struct ParseState *Parser, struct Value *ReturnValue,
+    struct Value **Param, int NumArgs)
+{
+    ReturnValue->Val->Integer = ThreadID(Parser->pc);
+}
+
+void PthreadEqual(struct ParseState *Parser, struct Value *ReturnValue,
+    struct Value **Param, int NumArgs)
+{
+    ReturnValue->Val->Integer =
+        Param[0]->Val->Integer == Param[1]->Val->Integer;
+}
+
+void PthreadExit(struct ParseState *Parser, struct Value *ReturnValue,
+    struct Value **Param, int NumArgs)
+{
+    ThreadFinish(Parser->pc, Param[0]->Val->Pointer);
+}
+
+void PthreadMutexInit(struct ParseState *Parser, struct Value *ReturnValue,
+    struct Value **Param, int NumArgs)
+{
+    ReturnValue->Val->Integer = pthread_mutex_init(Param[0]->Val->Pointer,
+        NULL);
+}
+
+void PthreadMutexDestroy(struct ParseState *Parser, struct Value *ReturnValue,
+    struct Value **Param, int NumArgs)
+{
+    ReturnValue->Val->Integer = pthread_mutex_destroy(Param[0]->Val->Pointer);
+}
+
+void PthreadMutexLock(struct ParseState *Parser, struct Value *ReturnValue,
+    struct Value **Param, int NumArgs)
+{
+    ReturnValue->Val->Integer = ThreadWaitLock(Parser->pc,
+        Param[0]->Val->Pointer);
+}
+
+void PthreadMutexTrylock(struct ParseState *Parser, struct Value *ReturnValue,
+    struct Value **Param, int NumArgs)
+{
+    ReturnValue->Val->Integer = pthread_mutex_trylock(Param[0]->Val->Pointer);
+}
+
+void PthreadMutexUnlock(struct ParseState *Parser, struct Value *ReturnValue,
+    struct Value **Param, int NumArgs)
+{
+    ReturnValue->Val->Integer = pthread_mutex_unlock(Param[0]->Val->Pointer);
+}
+
+void PthreadCondInit(struct ParseState *Parser, struct Value *ReturnValue,
+    struct Value **Param, int NumArgs)
+{
+    ReturnValue->Val->Integer = pthread_cond_init(Param[0]->Val->Pointer,
+        NULL);
+}
+
+void PthreadCondDestroy(struct ParseState *Parser, struct Value *ReturnValue,
+    struct Value **Param, int NumArgs)
+{
+    ReturnValue->Val->Integer = pthread_cond_destroy(Param[0]->Val->Pointer);
+}
+
+void PthreadCondWait(struct ParseState *Parser, struct Value *ReturnValue,
+    struct Value **Param, int NumArgs)
+{
+    ReturnValue->Val->Integer = ThreadWait(Parser->pc, Param[0]->Val->Pointer,
+        Param[1]->Val->Pointer);
+}
+
+void PthreadCondSignal(struct ParseState *Parser, struct Value *ReturnValue,
+    struct Value **Param, int NumArgs)
+{
+    ReturnValue->Val->Integer = pthread_cond_signal(Param[0]->Val->Pointer);
+}
+
+void PthreadCondBroadcast(struct ParseState *Parser, struct Value *ReturnValue,
+    struct Value **Param, int NumArgs)
+{
+    ReturnValue->Val->Integer = pthread_cond_broadcast(Param[0]->Val->Pointer);
+}
+
+void PthreadFetchAndAdd(struct ParseState *Parser, struct Value *ReturnValue,
+    struct Value **Param, int NumArgs)
+{
+    ReturnValue->Val->Integer = __sync_fetch_and_add(
+        (int*)Param[0]->Val->Pointer, Param[1]->Val->Integer);
+}
+
+void PthreadFetchAndSub(struct ParseState *Parser, struct Value *ReturnValue,
+    struct Value **Param, int NumArgs)
+{
+    ReturnValue->Val->Integer = __sync_fetch_and_sub(
+        (int*)Param[0]->Val->Pointer, Param[1]->Val->Integer);
+}
+
+void PthreadAddAndFetch(struct ParseState *Parser, struct Value *ReturnValue,
+    struct Value **Param, int NumArgs)
+{
+    ReturnValue->Val->Integer = __sync_add_and_fetch(
+        (int*)Param[0]->Val->Pointer, Param[1]->Val->Integer);
+}
+
+void PthreadSubAndFetch(struct ParseState *Parser, struct Value *ReturnValue,
+    struct Value **Param, int NumArgs)
+{
+    ReturnValue->Val->Integer = __sync_sub_and_fetch(
+        (int*)Param[0]->Val->Pointer, Param[1]->Val->Integer);
+}
+
+void PthreadBoolCompareAndSwap(struct ParseState *Parser,
+    struct Value *ReturnValue, struct Value **Param, int NumArgs)
+{
+    ReturnValue->Val->Integer = __sync_bool_compare_and_swap(
+        (int*)Param[0]->Val->Pointer, Param[1]->Val->Integer,
+        Param[2]->Val->Integer);
+}
+
+void PthreadValCompareAndSwap(struct ParseState *Parser,
+    struct Value *ReturnValue, struct Value **Param, int NumArgs)
+{
+    ReturnValue->Val->Integer = __sync_val_compare_and_swap(
+        (int*)Param[0]->Val->Pointer, Param[1]->Val->Integer,
+        Param[2]->Val->Integer);
+}
+
+void PthreadLockTestAndSet(struct ParseState *Parser,
+    struct Value *ReturnValue, struct Value **Param, int NumArgs)
+{
+    ReturnValue->Val->Integer = __sync_lock_test_and_set(
+        (int*)Param[0]->Val->Pointer, Param[1]->Val->Integer);
+}
+
+void PthreadLockRelease(struct ParseState *Parser, struct Value *ReturnValue,
+    struct Value **Param, int NumArgs)
+{
+    __sync_lock_release((int*)Param[0]->Val->Pointer);
+}
+
+void PthreadSynchronize(struct ParseState *Parser, struct Value *ReturnValue,
+    struct Value **Param, int NumArgs)
+{
+    __sync_synchronize();
+}
+
+/* handy structure definitions */
+const char PthreadDefs[] = "\
+typedef int pthread_t; \
+typedef struct __pthread_mutex pthread_mutex_t; \
+typedef struct __pthread_cond pthread_cond_t; \
+";
+
+/* all pthread.h functions */
+const struct LibraryFunction PthreadFunctions[] =
+{
+    {PthreadCreate, "int pthread_create(pthread_t *, void *, ...);"},
+    {PthreadJoin, "int pthread_join(pthread_t, void **);"},
+    {PthreadSelf, "pthread_t pthread_self();"},
+    {PthreadEqual, "int pthread_equal(pthread_t, pthread_t);"},
+    {PthreadExit, "void pthread_exit(void *);"},
+    {PthreadMutexInit, "int pthread_mutex_init(pthread_mutex_t *, void *);"},
+    {PthreadMutexDestroy, "int pthread_mutex_destroy(pthread_mutex_t *);"},
+    {PthreadMutexLock, "int pthread_mutex_lock(pthread_mutex_t *);"},
+    {PthreadMutexTrylock, "int pthread_mutex_trylock(pthread_mutex_t *);"},
+    {PthreadMutexUnlock, "int pthread_mutex_unlock(pthread_mutex_t *);"},
+    {PthreadCondInit, "int pthread_cond_init(pthread_cond_t *, void *);"},
+    {PthreadCondDestroy, "int pthread_cond_destroy(pthread_cond_t *);"},
+    {PthreadCondWait, "int pthread_cond_wait(pthread_cond_t *, pthread_mutex_t *);"},
+    {PthreadCondSignal, "int pthread_cond_signal(pthread_cond_t *);"},
+    {PthreadCondBroadcast, "int pthread_cond_broadcast(pthread_cond_t *);"},
+    {PthreadFetchAndAdd, "int __sync_fetch_and_add(int *, int);"},
+    {PthreadFetchAndSub, "int __sync_fetch_and_sub(int *, int);"},
+    {PthreadAddAndFetch, "int __sync_add_and_fetch(int *, int);"},
+    {PthreadSubAndFetch, "int __sync_sub_and_fetch(int *, int);"},
+    {PthreadBoolCompareAndSwap, "int __sync_bool_compare_and_swap(int *, int, int);"},
+    {PthreadValCompareAndSwap, "int __sync_val_compare_and_swap(int *, int, int);"},
+    {PthreadLockTestAndSet, "int __sync_lock_test_and_set(int *, int);"},
+    {PthreadLockRelease, "void __sync_lock_release(int *);"},
+    {PthreadSynchronize, "void __sync_synchronize();"},
+    {NULL, NULL}
+};
+
+/* all pthread.h constants */
+const struct LibraryConstant PthreadConstants[] =
+{
+    {"NULL", TypeInt, 0},
+    {"EAGAIN", TypeInt, EAGAIN},
+    {"EBUSY", TypeInt, EBUSY},
+    {"EDEADLK", TypeInt, EDEADLK},
+    {"EINVAL", TypeInt, EINVAL},
+    {"ESRCH", TypeInt, ESRCH},
+    {NULL}
+};
+
+/* make mutexes and condition variables the same size as native ones */
+void PthreadSetupFunc(Picoc *pc)
+{
+    struct ValueType *Typ;
+
+    Typ = TypeCreateOpaqueStruct(pc, NULL,
+        TableStrRegister(pc, "__pthread_mutex"), sizeof(pthread_mutex_t));
+    Typ->AlignBytes = pc->CharPtrType->AlignBytes;
+    Typ = TypeCreateOpaqueStruct(pc, NULL,
+        TableStrRegister(pc, "__pthread_cond"), sizeof(pthread_cond_t));
+    Typ->AlignBytes = pc->CharPtrType->AlignBytes;
+}
@@ -1,5 +1,6 @@
 /*  */
 #include <stdio.h>
+#include <stdarg.h>
 #include <errno.h>
 #include <inttypes.h>
 
@@ -7,35 +8,55 @@
 
 #define MAX_FORMAT (80)
 #define MAX_SCANF_ARGS (10)
+#define GETS_MAX (255)  /* arbitrary maximum size of a gets() file */
+#define STDIO_OUT_BUFFER (512)  /* printf() output is written in pieces this big */
+#define STDIO_FORMAT_LOCAL (1024)   /* room for compiling a format on the stack */
 
-static int Stdio_ZeroValue = 0;
-static int EOFValue = EOF;
-static int SEEK_SETValue = SEEK_SET;
-static int SEEK_CURValue = SEEK_CUR;
-static int SEEK_ENDValue = SEEK_END;
-static int BUFSIZValue = BUFSIZ;
-static int FILENAME_MAXValue = FILENAME_MAX;
-static int _IOFBFValue = _IOFBF;
-static int _IOLBFValue = _IOLBF;
-static int _IONBFValue = _IONBF;
-static int L_tmpnamValue = L_tmpnam;
-static int GETS_MAXValue = 255;  /* arbitrary maximum size of a gets() file */
-
-static FILE *stdinValue;
-static FILE *stdoutValue;
-static FILE *stderrValue;
-
-
-/* our own internal output stream which can output to FILE * or strings */
+
+/* our own internal output stream which can output to FILE * or strings.
+    output to a FILE * is collected in Buffer and written in one go */
 typedef struct StdOutStreamStruct
 {
     FILE *FilePtr;
     char *StrOutPtr;
     int StrOutLen;
     int CharCount;
+    int BufferLen;
+    char Buffer[STDIO_OUT_BUFFER];
 
 } StdOutStream;
 
+/* what a piece of a compiled printf() format is */
+enum StdioPieceKind
+{
+    StdioPieceText,             /* plain text from the format */
+    StdioPieceSpecial,          /* a conversion which takes no argument */
+    StdioPieceArg               /* a conversion of the next argument */
+};
+
+/* a piece of a compiled printf() format */
+struct StdioFormatPiece
+{
+    int Kind;
+    struct ValueType *ShowType; /* the type to show an argument as */
+    int Start;                  /* where plain text starts in the format, or
+                                    a conversion in Text[], or the character
+                                    of a special conversion */
+    int Len;
+};
+
+/* a printf() format split up into plain text and conversions, so that one
+    which is used over and over is only looked through once */
+struct StdioFormat
+{
+    const char *Format;         /* the format this was compiled from */
+    struct StdioFormat *Next;   /* the next in the same hash chain */
+    int NumPieces;
+    int TextLen;
+    struct StdioFormatPiece *Piece;
+    char *Text;                 /* the conversions, each null-terminated */
+};
+
 /* our representation of varargs within picoc */
 struct StdVararg
 {
@@ -47,9 +68,18 @@ struct StdVararg
 void BasicIOInit(Picoc *pc)
 {
     pc->CStdOut = stdout;
-    stdinValue = stdin;
-    stdoutValue = stdout;
-    stderrValue = stderr;
+    pc->StdinValue = stdin;
+    pc->StdoutValue = stdout;
+    pc->StderrValue = stderr;
+}
+
+/* write out anything buffered for a FILE * */
+void StdioOutFlush(StdOutStream *Stream)
+{
+    if (Stream->BufferLen > 0) {
+        fwrite(Stream->Buffer, 1, Stream->BufferLen, Stream->FilePtr);
+        Stream->BufferLen = 0;
+    }
 }
 
 /* output a single character to either a FILE * or a string */
@@ -57,70 +87,123 @@ void StdioOutPutc(int OutCh, StdOutStream *Stream)
 {
     if (Stream->FilePtr != NULL) {
         /* output to stdio stream */
-        putc(OutCh, Stream->FilePtr);
-        Stream->CharCount++;
-    } else if (Stream->StrOutLen < 0 || Stream->StrOutLen > 1) {
-        /* output to a string */
-        *Stream->StrOutPtr = OutCh;
-        Stream->StrOutPtr++;
-
-        if (Stream->StrOutLen > 1)
-            Stream->StrOutLen--;
+        if (Stream->BufferLen == STDIO_OUT_BUFFER)
+            StdioOutFlush(Stream);
 
+        Stream->Buffer[Stream->BufferLen++] = OutCh;
         Stream->CharCount++;
+    } else {
+        /* output to a string. what doesn't fit is still counted, since
+            snprintf() returns the length it would have written */
+        Stream->CharCount++;
+        if (Stream->StrOutLen < 0 || Stream->StrOutLen > 1) {
+            *Stream->StrOutPtr = OutCh;
+            Stream->StrOutPtr++;
+
+            if (Stream->StrOutLen > 1)
+                Stream->StrOutLen--;
+        }
     }
 }
 
-/* output a string to either a FILE * or a string */
-void StdioOutPuts(const char *Str, StdOutStream *Stream)
+/* output Len characters to either a FILE * or a string */
+void StdioOutWrite(const char *Str, int Len, StdOutStream *Stream)
 {
     if (Stream->FilePtr != NULL) {
         /* output to stdio stream */
-        fputs(Str, Stream->FilePtr);
-    } else {
-        /* output to a string */
-        while (*Str != '\0') {
-            if (Stream->StrOutLen < 0 || Stream->StrOutLen > 1) {
-                /* output to a string */
-                *Stream->StrOutPtr = *Str;
-                Str++;
-                Stream->StrOutPtr++;
-
-                if (Stream->StrOutLen > 1)
-                    Stream->StrOutLen--;
-
-                Stream->CharCount++;
+        if (Stream->BufferLen + Len > STDIO_OUT_BUFFER) {
+            StdioOutFlush(Stream);
+            if (Len > STDIO_OUT_BUFFER) {
+                fwrite(Str, 1, Len, Stream->FilePtr);
+                Stream->CharCount += Len;
+                return;
             }
         }
+
+        memcpy(&Stream->Buffer[Stream->BufferLen], Str, Len);
+        Stream->BufferLen += Len;
+        Stream->CharCount += Len;
+    } else {
+        /* output to a string, leaving room for the terminator. it's all
+            counted even if it's cut short, like in StdioOutFormat() */
+        Stream->CharCount += Len;
+        if (Stream->StrOutLen >= 0 && Len > Stream->StrOutLen - 1)
+            Len = Stream->StrOutLen > 1 ? Stream->StrOutLen - 1 : 0;
+
+        memcpy(Stream->StrOutPtr, Str, Len);
+        Stream->StrOutPtr += Len;
+        if (Stream->StrOutLen > 1)
+            Stream->StrOutLen -= Len;
     }
 }
 
-/* printf-style format of an int or other word-sized object */
-void StdioFprintfWord(StdOutStream *Stream, const char *Format, unsigned int Value)
+/* output a string to either a FILE * or a string */
+void StdioOutPuts(const char *Str, StdOutStream *Stream)
+{
+    StdioOutWrite(Str, strlen(Str), Stream);
+}
+
+/* printf-style format of one value to either a FILE * or a string. output
+    to a FILE * is formatted straight into the buffer */
+void StdioOutFormat(StdOutStream *Stream, const char *Format, ...)
 {
-    if (Stream->FilePtr != NULL)
-        Stream->CharCount += fprintf(Stream->FilePtr, Format, Value);
-    else if (Stream->StrOutLen >= 0) {
+    va_list Args;
+    va_list Again;
+    int Space;
+    int CCount;
+
+    va_start(Args, Format);
+    if (Stream->FilePtr != NULL) {
+        va_copy(Again, Args);
+        Space = STDIO_OUT_BUFFER - Stream->BufferLen;
+        CCount = vsnprintf(&Stream->Buffer[Stream->BufferLen], Space, Format,
+            Args);
+        if (CCount >= Space) {
+            /* it didn't fit, so make room or write it directly */
+            StdioOutFlush(Stream);
+            if (CCount < STDIO_OUT_BUFFER)
+                vsnprintf(Stream->Buffer, STDIO_OUT_BUFFER, Format, Again);
+            else {
+                vfprintf(Stream->FilePtr, Format, Again);
+                CCount = -CCount;
+            }
+        }
+
+        va_end(Again);
+        if (CCount > 0)
+            Stream->BufferLen += CCount;
+        else
+            CCount = -CCount;
+
+        Stream->CharCount += CCount;
+    } else if (Stream->StrOutLen >= 0) {
 #ifndef WIN32
-		int CCount = snprintf(Stream->StrOutPtr, Stream->StrOutLen,
-            Format, Value);
+        CCount = vsnprintf(Stream->StrOutPtr, Stream->StrOutLen, Format, Args);
 #else
-		int CCount = _snprintf(Stream->StrOutPtr, Stream->StrOutLen,
-            Format, Value);
+        CCount = _vsnprintf(Stream->StrOutPtr, Stream->StrOutLen, Format, Args);
 #endif
-		Stream->StrOutPtr += CCount;
-        Stream->StrOutLen -= CCount;
+        /* the whole length is counted, but if it was cut short only what
+            fitted was written */
         Stream->CharCount += CCount;
+        if (CCount > Stream->StrOutLen - 1)
+            CCount = Stream->StrOutLen > 1 ? Stream->StrOutLen - 1 : 0;
+
+        Stream->StrOutPtr += CCount;
+        Stream->StrOutLen -= CCount;
     } else {
-        int CCount = sprintf(Stream->StrOutPtr, Format, Value);
+        CCount = vsprintf(Stream->StrOutPtr, Format, Args);
         Stream->CharCount += CCount;
         Stream->StrOutPtr += CCount;
     }
+
+    va_end(Args);
 }
 
-/* printf-style format of a long */
-void StdioFprintfLong(StdOutStream *Stream, const char *Format, uint64_t Value) {
-    char PlatformFormat[MAX_FORMAT+1], *FPos = PlatformFormat;
+/* translate a conversion of a long into the platform's own format for a
+    64-bit value, returning its length */
+static int StdioFormatLong(const char *Format, char *PlatformFormat)
+{
+    char *FPos = PlatformFormat;
 
     while (*Format) {
         char *UseFormat = NULL;
@@ -158,298 +241,358 @@ void StdioFprintfLong(StdOutStream *Stream, const char *Format, uint64_t Value)
         }
     }
 
-    if (Stream->FilePtr != NULL)
-        Stream->CharCount += fprintf(Stream->FilePtr, PlatformFormat, Value);
-    else if (Stream->StrOutLen >= 0) {
-#ifndef WIN32
-        int CCount = snprintf(Stream->StrOutPtr, Stream->StrOutLen, PlatformFormat, Value);
-#else
-        int CCount = _snprintf(Stream->StrOutPtr, Stream->StrOutLen, PlatformFormat, Value);
-#endif
-        Stream->StrOutPtr += CCount;
-        Stream->StrOutLen -= CCount;
-        Stream->CharCount += CCount;
-    } else {
-        int CCount = sprintf(Stream->StrOutPtr, PlatformFormat, Value);
-        Stream->CharCount += CCount;
-        Stream->StrOutPtr += CCount;
+    *FPos = '\0';
+    return FPos - PlatformFormat;
+}
+
+/* add a piece to a format being compiled, or just count it if there's
+    nowhere to put it yet */
+static void StdioFormatAdd(struct StdioFormat *Compiled, int Kind,
+    struct ValueType *ShowType, const char *Text, int Start, int Len)
+{
+    struct StdioFormatPiece *Piece;
+
+    if (Compiled->Piece != NULL) {
+        Piece = &Compiled->Piece[Compiled->NumPieces];
+        Piece->Kind = Kind;
+        Piece->ShowType = ShowType;
+        Piece->Len = Len;
+        if (Text == NULL)
+            Piece->Start = Start;
+        else {
+            /* conversions keep their own null-terminated copy */
+            Piece->Start = Compiled->TextLen;
+            memcpy(&Compiled->Text[Compiled->TextLen], Text, Len + 1);
+        }
     }
+
+    Compiled->NumPieces++;
+    if (Text != NULL)
+        Compiled->TextLen += Len + 1;
 }
 
-/* printf-style format of a floating point number */
-void StdioFprintfFP(StdOutStream *Stream, const char *Format, double Value)
+/* split a format into plain text and conversions. the first pass, with
+    Compiled->Piece NULL, just counts them */
+static void StdioFormatCompile(Picoc *pc, struct StdioFormat *Compiled)
 {
-    if (Stream->FilePtr != NULL)
-        Stream->CharCount += fprintf(Stream->FilePtr, Format, Value);
-    else if (Stream->StrOutLen >= 0) {
-#ifndef WIN32
-        int CCount = snprintf(Stream->StrOutPtr, Stream->StrOutLen,
-            Format, Value);
-#else
-        int CCount = _snprintf(Stream->StrOutPtr, Stream->StrOutLen,
-            Format, Value);
-#endif
-		Stream->StrOutPtr += CCount;
-        Stream->StrOutLen -= CCount;
-        Stream->CharCount += CCount;
-    } else {
-        int CCount = sprintf(Stream->StrOutPtr, Format, Value);
-        Stream->CharCount += CCount;
-        Stream->StrOutPtr += CCount;
+    const char *Format = Compiled->Format;
+    const char *FPos = Format;
+    const char *Plain;
+    char OneFormatBuf[MAX_FORMAT+1];
+    char PlatformFormat[MAX_FORMAT+4];
+    int OneFormatCount;
+    int ShowLong;
+    int Len;
+    struct ValueType *ShowType;
+
+    Compiled->NumPieces = 0;
+    Compiled->TextLen = 0;
+    while (*FPos != '\0') {
+        if (*FPos != '%') {
+            /* everything up to the next conversion */
+            for (Plain = FPos; *FPos != '%' && *FPos != '\0'; FPos++) {
+            }
+
+            StdioFormatAdd(Compiled, StdioPieceText, NULL, NULL,
+                Plain - Format, FPos - Plain);
+            continue;
+        }
+
+        /* work out what type we're printing */
+        FPos++;
+        ShowType = NULL;
+        ShowLong = 0;
+        OneFormatBuf[0] = '%';
+        OneFormatCount = 1;
+
+        do {
+            switch (*FPos) {
+            case 'd':
+            case 'i':
+                if (ShowLong == 1)
+                    ShowType = &pc->LongType;
+                else if (ShowLong > 1)
+                    ShowType = &pc->LongLongType;
+                else
+                    ShowType = &pc->IntType;
+                break;
+            case 'u':
+            case 'o':
+            case 'x':
+            case 'X':
+                if (ShowLong == 1)
+                    ShowType = &pc->UnsignedLongType;
+                else if (ShowLong > 1)
+                    ShowType = &pc->UnsignedLongLongType;
+                else
+                    ShowType = &pc->UnsignedIntType;
+                break; /* integer base conversions */
+            case 'l':
+                ShowLong++;
+                break; /* long integer */
+            case 'e':
+            case 'E':
+            case 'f':
+            case 'F':
+            case 'g':
+            case 'G':
+                ShowType = &pc->DoubleType;
+                break;      /* double, exponent, fixed-point or flexible */
+            case 'a':
+            case 'A':
+                ShowType = &pc->IntType;
+                break;     /* hexadecimal, 0x- format */
+            case 'c':
+                ShowType = &pc->IntType;
+                break;     /* character */
+            case 's':
+                ShowType = pc->CharPtrType;
+                break;  /* string */
+            case 'p':
+                ShowType = pc->VoidPtrType;
+                break;  /* pointer */
+            case 'n':   /* number of characters written */
+            case 'm':   /* strerror(errno) */
+            case '%':   /* just a '%' character */
+            case '\0':  /* end of format string */
+                ShowType = &pc->VoidType;
+                break;
+            }
+
+            /* copy one character of format across to the OneFormatBuf */
+            if (*FPos != 'l') {
+                OneFormatBuf[OneFormatCount] = *FPos;
+                OneFormatCount++;
+            }
+
+            if (ShowType == &pc->VoidType) {
+                /* special conversions just keep their character */
+                StdioFormatAdd(Compiled, StdioPieceSpecial, ShowType, NULL,
+                    *FPos, 0);
+                if (*FPos == '\0')
+                    return;
+            }
+
+            FPos++;
+
+        } while (ShowType == NULL && OneFormatCount < MAX_FORMAT);
+
+        if (ShowType != &pc->VoidType) {
+            /* null-terminate the buffer */
+            OneFormatBuf[OneFormatCount] = '\0';
+            if (ShowType == &pc->LongType || ShowType == &pc->LongLongType ||
+                    ShowType == &pc->UnsignedLongType ||
+                    ShowType == &pc->UnsignedLongLongType) {
+                Len = StdioFormatLong(OneFormatBuf, PlatformFormat);
+                StdioFormatAdd(Compiled, StdioPieceArg, ShowType,
+                    PlatformFormat, 0, Len);
+            } else
+                StdioFormatAdd(Compiled, StdioPieceArg, ShowType,
+                    OneFormatBuf, 0, OneFormatCount);
+        }
     }
 }
 
-/* printf-style format of a pointer */
-void StdioFprintfPointer(StdOutStream *Stream, const char *Format, void *Value)
+/* compile a format into Memory if it fits in Size bytes, or otherwise
+    into memory from the heap. returns NULL if that can't be had */
+static struct StdioFormat *StdioFormatMake(Picoc *pc, const char *Format,
+    void *Memory, int Size)
 {
-    if (Stream->FilePtr != NULL)
-        Stream->CharCount += fprintf(Stream->FilePtr, Format, Value);
-    else if (Stream->StrOutLen >= 0) {
-#ifndef WIN32
-        int CCount = snprintf(Stream->StrOutPtr, Stream->StrOutLen,
-            Format, Value);
-#else
-		int CCount = _snprintf(Stream->StrOutPtr, Stream->StrOutLen,
-            Format, Value);
-#endif
-        Stream->StrOutPtr += CCount;
-        Stream->StrOutLen -= CCount;
-        Stream->CharCount += CCount;
-    } else {
-        int CCount = sprintf(Stream->StrOutPtr, Format, Value);
-        Stream->CharCount += CCount;
-        Stream->StrOutPtr += CCount;
+    struct StdioFormat Counted;
+    struct StdioFormat *Compiled;
+    int NeedSize;
+
+    Counted.Format = Format;
+    Counted.Piece = NULL;
+    StdioFormatCompile(pc, &Counted);
+    NeedSize = sizeof(struct StdioFormat) +
+        sizeof(struct StdioFormatPiece) * Counted.NumPieces + Counted.TextLen;
+    if (NeedSize <= Size)
+        Compiled = Memory;
+    else {
+        Compiled = HeapAllocMem(pc, NeedSize);
+        if (Compiled == NULL)
+            return NULL;
+    }
+
+    Compiled->Format = Format;
+    Compiled->Next = NULL;
+    Compiled->Piece = (struct StdioFormatPiece *)&Compiled[1];
+    Compiled->Text = (char *)&Compiled->Piece[Counted.NumPieces];
+    StdioFormatCompile(pc, Compiled);
+    return Compiled;
+}
+
+/* find the compiled form of a string literal used as a format, compiling it
+    the first time it's seen. other formats might change so they aren't
+    kept, and get NULL */
+static struct StdioFormat *StdioFormatGet(Picoc *pc, const char *Format)
+{
+    int Hash = (unsigned long)Format % PRINTF_FORMAT_TABLE_SIZE;
+    struct StdioFormat *Compiled;
+
+    ThreadLock(pc);
+    for (Compiled = pc->PrintfFormats[Hash]; Compiled != NULL;
+            Compiled = Compiled->Next) {
+        if (Compiled->Format == Format)
+            break;
+    }
+
+    if (Compiled == NULL &&
+            VariableStringLiteralGet(pc, (char *)Format) != NULL) {
+        Compiled = StdioFormatMake(pc, Format, NULL, 0);
+        if (Compiled != NULL) {
+            Compiled->Next = pc->PrintfFormats[Hash];
+            pc->PrintfFormats[Hash] = Compiled;
+        }
+    }
+
+    ThreadUnlock(pc);
+    return Compiled;
+}
+
+/* print the arguments as a compiled format says */
+static void StdioFormatRun(Picoc *pc, struct StdioFormat *Compiled,
+    StdOutStream *SOStream, struct StdVararg *Args)
+{
+    struct Value *ThisArg = Args->Param[0];
+    struct StdioFormatPiece *Piece;
+    struct StdioFormatPiece *End = &Compiled->Piece[Compiled->NumPieces];
+    struct ValueType *ShowType;
+    const char *OneFormat;
+    int ArgCount = 0;
+
+    for (Piece = Compiled->Piece; Piece < End; Piece++) {
+        if (Piece->Kind == StdioPieceText) {
+            StdioOutWrite(&Compiled->Format[Piece->Start], Piece->Len,
+                SOStream);
+            continue;
+        }
+
+        if (Piece->Kind == StdioPieceSpecial) {
+            /* do special actions depending on the conversion type */
+            switch (Piece->Start) {
+            case 'm':
+                StdioOutPuts(strerror(errno), SOStream);
+                break;
+            case '%':
+            case '\0':
+                StdioOutPutc(Piece->Start, SOStream);
+                break;
+            case 'n':
+                ThisArg = (struct Value*)((char*)ThisArg +
+                    MEM_ALIGN(sizeof(struct Value) + TypeStackSizeValue(ThisArg)));
+                if (ThisArg->Typ->Base == TypeArray &&
+                                ThisArg->Typ->FromType->Base == TypeInt)
+                    *(int *)ThisArg->Val->Pointer = SOStream->CharCount;
+                break;
+            }
+            continue;
+        }
+
+        if (ArgCount >= Args->NumArgs) {
+            StdioOutPuts("XXX", SOStream);
+            continue;
+        }
+
+        /* print this argument */
+        ThisArg = (struct Value*)((char*)ThisArg +
+            MEM_ALIGN(sizeof(struct Value)+TypeStackSizeValue(ThisArg)));
+        ShowType = Piece->ShowType;
+        OneFormat = &Compiled->Text[Piece->Start];
+        ArgCount++;
+
+        if (ShowType == &pc->LongType || ShowType == &pc->LongLongType) {
+            /* show a signed long or long long */
+            if (IS_NUMERIC_COERCIBLE(ThisArg))
+                StdioOutFormat(SOStream, OneFormat,
+                    (int64_t)ExpressionCoerceInteger(ThisArg));
+            else
+                StdioOutPuts("XXX", SOStream);
+        } else if (ShowType == &pc->UnsignedLongType ||
+                ShowType == &pc->UnsignedLongLongType) {
+            /* show an unsigned long or long long */
+            if (IS_NUMERIC_COERCIBLE(ThisArg))
+                StdioOutFormat(SOStream, OneFormat,
+                    (uint64_t)ExpressionCoerceUnsignedInteger(ThisArg));
+            else
+                StdioOutPuts("XXX", SOStream);
+        } else if (ShowType == &pc->IntType) {
+            /* show a signed integer */
+            if (IS_NUMERIC_COERCIBLE(ThisArg))
+                StdioOutFormat(SOStream, OneFormat,
+                    (int)ExpressionCoerceInteger(ThisArg));
+            else
+                StdioOutPuts("XXX", SOStream);
+        } else if (ShowType == &pc->UnsignedIntType) {
+            /* show an unsigned integer */
+            if (IS_NUMERIC_COERCIBLE(ThisArg))
+                StdioOutFormat(SOStream, OneFormat,
+                    (unsigned int)ExpressionCoerceUnsignedInteger(ThisArg));
+            else
+                StdioOutPuts("XXX", SOStream);
+        } else if (ShowType == &pc->DoubleType) {
+            /* show a floating point number */
+            if (IS_NUMERIC_COERCIBLE(ThisArg))
+                StdioOutFormat(SOStream, OneFormat, ExpressionCoerceFP(ThisArg));
+            else
+                StdioOutPuts("XXX", SOStream);
+        } else if (ShowType == pc->CharPtrType) {
+            if (ThisArg->Typ->Base == TypePointer)
+                StdioOutFormat(SOStream, OneFormat, ThisArg->Val->Pointer);
+            else if (ThisArg->Typ->Base == TypeArray &&
+                        ThisArg->Typ->FromType->Base == TypeChar)
+                StdioOutFormat(SOStream, OneFormat, &ThisArg->Val->ArrayMem[0]);
+            else
+                StdioOutPuts("XXX", SOStream);
+        } else if (ShowType == pc->VoidPtrType) {
+            if (ThisArg->Typ->Base == TypePointer)
+                StdioOutFormat(SOStream, OneFormat, ThisArg->Val->Pointer);
+            else if (ThisArg->Typ->Base == TypeArray)
+                StdioOutFormat(SOStream, OneFormat, &ThisArg->Val->ArrayMem[0]);
+            else
+                StdioOutPuts("XXX", SOStream);
+        }
     }
 }
 
 /* internal do-anything v[s][n]printf() formatting system with output
-    to strings or FILE * */
+    to strings or FILE *. string literal formats are compiled the first time
+    they're used, others every time */
 int StdioBasePrintf(struct ParseState *Parser, FILE *Stream, char *StrOut,
     int StrOutLen, char *Format, struct StdVararg *Args)
 {
-    struct Value *ThisArg = Args->Param[0];
-    int ArgCount = 0;
-    char *FPos;
-    char OneFormatBuf[MAX_FORMAT+1];
-    int OneFormatCount;
-	int ShowLong = 0;
-    struct ValueType *ShowType;
+    ALIGN_TYPE Local[STDIO_FORMAT_LOCAL / sizeof(ALIGN_TYPE)];
+    struct StdioFormat *Compiled;
+    struct StdioFormat *Temporary = NULL;
     StdOutStream SOStream;
     Picoc *pc = Parser->pc;
 
     if (Format == NULL)
         Format = "[null format]\n";
 
-    FPos = Format;
+    Compiled = StdioFormatGet(pc, Format);
+    if (Compiled == NULL) {
+        Compiled = StdioFormatMake(pc, Format, Local, sizeof(Local));
+        if (Compiled == NULL)
+            ProgramFail(Parser, "(StdioBasePrintf) out of memory");
+
+        if ((void *)Compiled != (void *)Local)
+            Temporary = Compiled;
+    }
+
     SOStream.FilePtr = Stream;
     SOStream.StrOutPtr = StrOut;
     SOStream.StrOutLen = StrOutLen;
     SOStream.CharCount = 0;
+    SOStream.BufferLen = 0;
+    StdioFormatRun(pc, Compiled, &SOStream, Args);
 
-    while (*FPos != '\0') {
-        if (*FPos == '%') {
-            /* work out what type we're printing */
-            FPos++;
-            ShowType = NULL;
-            OneFormatBuf[0] = '%';
-            OneFormatCount = 1;
-
-            do {
-                switch (*FPos) {
-                case 'd':
-                case 'i':
-                    if (ShowLong == 1) {
-                        ShowLong = 0;
-                        ShowType = &pc->LongType;
-                    } else if (ShowLong > 1) {
-                        ShowLong = 0;
-                        ShowType = &pc->LongLongType;
-                    } else {
-                        ShowType = &pc->IntType;
-                    }
-                    break;
-                case 'u':
-                    if (ShowLong == 1) {
-                        ShowLong = 0;
-                        ShowType = &pc->UnsignedLongType;
-                    } else if (ShowLong > 1) {
-                        ShowLong = 0;
-                        ShowType = &pc->UnsignedLongLongType;
-                    } else {
-                        ShowType = &pc->UnsignedIntType;
-                    }
-                    break;
-                case 'o':
-                case 'x':
-                case 'X':
-                    if (ShowLong == 1) {
-                        ShowLong = 0;
-                        ShowType = &pc->UnsignedLongType;
-                    } else if (ShowLong > 1) {
-                        ShowLong = 0;
-                        ShowType = &pc->UnsignedLongLongType;
-                    } else {
-                        ShowType = &pc->UnsignedIntType;
-                    }
-                    break; /* integer base conversions */
-                case 'l':
-                    ShowLong++;
-                    break; /* long integer */
-                case 'e':
-                case 'E':
-                    ShowType = &pc->DoubleType;
-                    break;      /* double, exponent form */
-                case 'f':
-                case 'F':
-                    ShowType = &pc->DoubleType;
-                    break;      /* double, fixed-point */
-                case 'g':
-                case 'G':
-                    ShowType = &pc->DoubleType;
-                    break;      /* double, flexible format */
-                case 'a':
-                case 'A':
-                    ShowType = &pc->IntType;
-                    break;     /* hexadecimal, 0x- format */
-                case 'c':
-                    ShowType = &pc->IntType;
-                break;     /* character */
-                case 's':
-                    ShowType = pc->CharPtrType;
-                    break;  /* string */
-                case 'p':
-                    ShowType = pc->VoidPtrType;
-                    break;  /* pointer */
-                case 'n':
-                    ShowType = &pc->VoidType;
-                    break;    /* number of characters written */
-                case 'm':
-                    ShowType = &pc->VoidType;
-                    break;    /* strerror(errno) */
-                case '%':
-                    ShowType = &pc->VoidType;
-                    break;    /* just a '%' character */
-                case '\0':
-                    ShowType = &pc->VoidType;
-                    break;    /* end of format string */
-                }
-
-                /* copy one character of format across to the OneFormatBuf */
-                if (*FPos != 'l') {
-                    OneFormatBuf[OneFormatCount] = *FPos;
-                    OneFormatCount++;
-                }
-                /* do special actions depending on the conversion type */
-                if (ShowType == &pc->VoidType) {
-                    switch (*FPos) {
-                    case 'm':
-                        StdioOutPuts(strerror(errno), &SOStream);
-                        break;
-                    case '%':
-                        StdioOutPutc(*FPos, &SOStream);
-                        break;
-                    case '\0':
-                        OneFormatBuf[OneFormatCount] = '\0';
-                        StdioOutPutc(*FPos, &SOStream);
-                        break;
-                    case 'n':
-                        ThisArg = (struct Value*)((char*)ThisArg +
-                            MEM_ALIGN(sizeof(struct Value) + TypeStackSizeValue(ThisArg)));
-                        if (ThisArg->Typ->Base == TypeArray &&
-                                        ThisArg->Typ->FromType->Base == TypeInt)
-                            *(int *)ThisArg->Val->Pointer = SOStream.CharCount;
-                        break;
-                    }
-                }
-
-                FPos++;
-
-            } while (ShowType == NULL && OneFormatCount < MAX_FORMAT);
-
-            if (ShowType != &pc->VoidType) {
-                if (ArgCount >= Args->NumArgs)
-                    StdioOutPuts("XXX", &SOStream);
-                else {
-                    /* null-terminate the buffer */
-                    OneFormatBuf[OneFormatCount] = '\0';
-
-                    /* print this argument */
-                    ThisArg = (struct Value*)((char*)ThisArg +
-                        MEM_ALIGN(sizeof(struct Value)+TypeStackSizeValue(ThisArg)));
-
-                    if (ShowType == &pc->LongType) {
-                        /* show a signed long */
-                        if (IS_NUMERIC_COERCIBLE(ThisArg))
-                                StdioFprintfLong(&SOStream, OneFormatBuf, ThisArg->Val->LongInteger);
-                        else
-                            StdioOutPuts("XXX", &SOStream);
-                    } else if (ShowType == &pc->UnsignedLongType) {
-                        /* show a unsigned long */
-                        if (IS_NUMERIC_COERCIBLE(ThisArg))
-                            StdioFprintfLong(&SOStream, OneFormatBuf, ThisArg->Val->UnsignedLongInteger);
-                        else
-                            StdioOutPuts("XXX", &SOStream);
-                    } else if (ShowType == &pc->LongLongType) {
-                        /* show a signed long long */
-                        if (IS_NUMERIC_COERCIBLE(ThisArg))
-                            StdioFprintfLong(&SOStream, OneFormatBuf, ThisArg->Val->LongLongInteger);
-                        else
-                            StdioOutPuts("XXX", &SOStream);
-                    } else if (ShowType == &pc->UnsignedLongLongType) {
-                        /* show an unsigned long long */
-                        if (IS_NUMERIC_COERCIBLE(ThisArg))
-                            StdioFprintfLong(&SOStream, OneFormatBuf, ThisArg->Val->UnsignedLongLongInteger);
-                        else
-                            StdioOutPuts("XXX", &SOStream);
-                    } else if (ShowType == &pc->IntType) {
-                        /* show a signed integer */
-                        if (IS_NUMERIC_COERCIBLE(ThisArg))
-                                StdioFprintfWord(&SOStream, OneFormatBuf, (int)ExpressionCoerceInteger(ThisArg));
-                        else
-                            StdioOutPuts("XXX", &SOStream);
-                    } else if (ShowType == &pc->UnsignedIntType) {
-                        /* show an unsigned integer */
-                        if (IS_NUMERIC_COERCIBLE(ThisArg))
-                            StdioFprintfWord(&SOStream, OneFormatBuf, (unsigned int)ExpressionCoerceUnsignedInteger(ThisArg));
-                        else
-                            StdioOutPuts("XXX", &SOStream);
-                    } else if (ShowType == &pc->FloatType || ShowType == &pc->DoubleType) {
-                        /* show a floating point number */
-                        if (IS_NUMERIC_COERCIBLE(ThisArg))
-                            StdioFprintfFP(&SOStream, OneFormatBuf,
-                                ExpressionCoerceFP(ThisArg));
-                        else
-                            StdioOutPuts("XXX", &SOStream);
-                    } else if (ShowType == pc->CharPtrType) {
-                        if (ThisArg->Typ->Base == TypePointer)
-                            StdioFprintfPointer(&SOStream, OneFormatBuf,
-                                ThisArg->Val->Pointer);
-                        else if (ThisArg->Typ->Base == TypeArray &&
-                                    ThisArg->Typ->FromType->Base == TypeChar)
-                            StdioFprintfPointer(&SOStream, OneFormatBuf,
-                                &ThisArg->Val->ArrayMem[0]);
-                        else
-                            StdioOutPuts("XXX", &SOStream);
-                    } else if (ShowType == pc->VoidPtrType) {
-                        if (ThisArg->Typ->Base == TypePointer)
-                            StdioFprintfPointer(&SOStream, OneFormatBuf,
-                                ThisArg->Val->Pointer);
-                        else if (ThisArg->Typ->Base == TypeArray)
-                            StdioFprintfPointer(&SOStream, OneFormatBuf,
-                                &ThisArg->Val->ArrayMem[0]);
-                        else
-                            StdioOutPuts("XXX", &SOStream);
-                    }
-
-                    ArgCount++;
-                }
-            }
-        } else {
-            /* just output a normal character */
-            StdioOutPutc(*FPos, &SOStream);
-            FPos++;
-        }
-    }
+    if (Temporary != NULL)
+        HeapFreeMem(pc, Temporary);
+
+    if (SOStream.FilePtr != NULL)
+        StdioOutFlush(&SOStream);
 
     /* null-terminate */
     if (SOStream.StrOutPtr != NULL && SOStream.StrOutLen > 0)
@@ -501,6 +644,7 @@ void StdioFopen(struct ParseState *Parser, struct Value *ReturnValue,
 {
     ReturnValue->Val->Pointer = fopen(Param[0]->Val->Pointer,
         Param[1]->Val->Pointer);
+    StdlibAddResource(Parser->pc, ReturnValue->Val->Pointer, true);
 }
 
 void StdioFreopen(struct ParseState *Parser, struct Value *ReturnValue,
@@ -508,11 +652,16 @@ void StdioFreopen(struct ParseState *Parser, struct Value *ReturnValue,
 {
     ReturnValue->Val->Pointer = freopen(Param[0]->Val->Pointer,
         Param[1]->Val->Pointer, Param[2]->Val->Pointer);
+
+    /* the stream's closed if it can't be opened again */
+    if (ReturnValue->Val->Pointer == NULL)
+        StdlibRemoveResource(Parser->pc, Param[2]->Val->Pointer);
 }
 
 void StdioFclose(struct ParseState *Parser, struct Value *ReturnValue,
     struct Value **Param, int NumArgs)
 {
+    StdlibRemoveResource(Parser->pc, Param[0]->Val->Pointer);
     ReturnValue->Val->Integer = fclose(Param[0]->Val->Pointer);
 }
 
@@ -566,6 +715,7 @@ void StdioTmpfile(struct ParseState *Parser, struct Value *ReturnValue,
     struct Value **Param, int NumArgs)
 {
     ReturnValue->Val->Pointer = tmpfile();
+    StdlibAddResource(Parser->pc, ReturnValue->Val->Pointer, true);
 }
 
 void StdioClearerr(struct ParseState *Parser, struct Value *ReturnValue,
@@ -659,7 +809,8 @@ void StdioPutc(struct ParseState *Parser, struct Value *ReturnValue,
 void StdioPutchar(struct ParseState *Parser, struct Value *ReturnValue,
     struct Value **Param, int NumArgs)
 {
-    ReturnValue->Val->Integer = putchar(Param[0]->Val->Integer);
+    ReturnValue->Val->Integer = fputc(Param[0]->Val->Integer,
+        Parser->pc->StdoutValue);
 }
 
 void StdioSetbuf(struct ParseState *Parser, struct Value *ReturnValue,
@@ -685,14 +836,19 @@ void StdioUngetc(struct ParseState *Parser, struct Value *ReturnValue,
 void StdioPuts(struct ParseState *Parser, struct Value *ReturnValue,
     struct Value **Param, int NumArgs)
 {
-    ReturnValue->Val->Integer = puts(Param[0]->Val->Pointer);
+    FILE *Stream = Parser->pc->StdoutValue;
+
+    if (fputs(Param[0]->Val->Pointer, Stream) == EOF)
+        ReturnValue->Val->Integer = EOF;
+    else
+        ReturnValue->Val->Integer = fputc('\n', Stream);
 }
 
 void StdioGets(struct ParseState *Parser, struct Value *ReturnValue,
     struct Value **Param, int NumArgs)
 {
     ReturnValue->Val->Pointer = fgets(Param[0]->Val->Pointer,
-        GETS_MAXValue, stdin);
+        GETS_MAX, Parser->pc->StdinValue);
     if (ReturnValue->Val->Pointer != NULL) {
         char *EOLPos = strchr(Param[0]->Val->Pointer, '\n');
         if (EOLPos != NULL)
@@ -703,7 +859,7 @@ void StdioGets(struct ParseState *Parser, struct Value *ReturnValue,
 void StdioGetchar(struct ParseState *Parser, struct Value *ReturnValue,
     struct Value **Param, int NumArgs)
 {
-    ReturnValue->Val->Integer = getchar();
+    ReturnValue->Val->Integer = fgetc(Parser->pc->StdinValue);
 }
 
 void StdioPrintf(struct ParseState *Parser, struct Value *ReturnValue,
@@ -713,14 +869,14 @@ void StdioPrintf(struct ParseState *Parser, struct Value *ReturnValue,
 
     PrintfArgs.Param = Param;
     PrintfArgs.NumArgs = NumArgs - 1;
-    ReturnValue->Val->Integer = StdioBasePrintf(Parser, stdout, NULL, 0,
+    ReturnValue->Val->Integer = StdioBasePrintf(Parser, Parser->pc->StdoutValue, NULL, 0,
         Param[0]->Val->Pointer, &PrintfArgs);
 }
 
 void StdioVprintf(struct ParseState *Parser, struct Value *ReturnValue,
     struct Value **Param, int NumArgs)
 {
-    ReturnValue->Val->Integer = StdioBasePrintf(Parser, stdout, NULL, 0,
+    ReturnValue->Val->Integer = StdioBasePrintf(Parser, Parser->pc->StdoutValue, NULL, 0,
         Param[0]->Val->Pointer, Param[1]->Val->Pointer);
 }
 
@@ -772,7 +928,7 @@ void StdioScanf(struct ParseState *Parser, struct Value *ReturnValue,
 
     ScanfArgs.Param = Param;
     ScanfArgs.NumArgs = NumArgs - 1;
-    ReturnValue->Val->Integer = StdioBaseScanf(Parser, stdin, NULL,
+    ReturnValue->Val->Integer = StdioBaseScanf(Parser, Parser->pc->StdinValue, NULL,
         Param[0]->Val->Pointer, &ScanfArgs);
 }
 
@@ -817,7 +973,7 @@ void StdioVsnprintf(struct ParseState *Parser, struct Value *ReturnValue,
 void StdioVscanf(struct ParseState *Parser, struct Value *ReturnValue,
     struct Value **Param, int NumArgs)
 {
-    ReturnValue->Val->Integer = StdioBaseScanf(Parser, stdin, NULL,
+    ReturnValue->Val->Integer = StdioBaseScanf(Parser, Parser->pc->StdinValue, NULL,
         Param[0]->Val->Pointer, Param[1]->Val->Pointer);
 }
 
@@ -841,8 +997,26 @@ typedef struct __va_listStruct va_list; \
 typedef struct __FILEStruct FILE;\
 ";
 
+/* all stdio constants */
+const struct LibraryConstant StdioConstants[] =
+{
+    {"EOF", TypeInt, EOF},
+    {"SEEK_SET", TypeInt, SEEK_SET},
+    {"SEEK_CUR", TypeInt, SEEK_CUR},
+    {"SEEK_END", TypeInt, SEEK_END},
+    {"BUFSIZ", TypeInt, BUFSIZ},
+    {"FILENAME_MAX", TypeInt, FILENAME_MAX},
+    {"_IOFBF", TypeInt, _IOFBF},
+    {"_IOLBF", TypeInt, _IOLBF},
+    {"_IONBF", TypeInt, _IONBF},
+    {"L_tmpnam", TypeInt, L_tmpnam},
+    {"GETS_MAX", TypeInt, GETS_MAX},
+    {"NULL", TypeInt, 0},
+    {NULL}
+};
+
 /* all stdio functions */
-struct LibraryFunction StdioFunctions[] =
+const struct LibraryFunction StdioFunctions[] =
 {
     {StdioFopen, "FILE *fopen(char *, char *);"},
     {StdioFreopen, "FILE *freopen(char *, char *, FILE *);"},
@@ -914,42 +1088,13 @@ void StdioSetupFunc(Picoc *pc)
     TypeCreateOpaqueStruct(pc, NULL, TableStrRegister(pc, "__va_listStruct"),
         sizeof(FILE));
 
-    /* define EOF equal to the system EOF */
-    VariableDefinePlatformVar(pc, NULL, "EOF", &pc->IntType,
-        (union AnyValue*)&EOFValue, false);
-    VariableDefinePlatformVar(pc, NULL, "SEEK_SET", &pc->IntType,
-        (union AnyValue*)&SEEK_SETValue, false);
-    VariableDefinePlatformVar(pc, NULL, "SEEK_CUR", &pc->IntType,
-        (union AnyValue*)&SEEK_CURValue, false);
-    VariableDefinePlatformVar(pc, NULL, "SEEK_END", &pc->IntType,
-        (union AnyValue*)&SEEK_ENDValue, false);
-    VariableDefinePlatformVar(pc, NULL, "BUFSIZ", &pc->IntType,
-        (union AnyValue*)&BUFSIZValue, false);
-    VariableDefinePlatformVar(pc, NULL, "FILENAME_MAX", &pc->IntType,
-        (union AnyValue*)&FILENAME_MAXValue, false);
-    VariableDefinePlatformVar(pc, NULL, "_IOFBF", &pc->IntType,
-        (union AnyValue*)&_IOFBFValue, false);
-    VariableDefinePlatformVar(pc, NULL, "_IOLBF", &pc->IntType,
-        (union AnyValue*)&_IOLBFValue, false);
-    VariableDefinePlatformVar(pc, NULL, "_IONBF", &pc->IntType,
-        (union AnyValue*)&_IONBFValue, false);
-    VariableDefinePlatformVar(pc, NULL, "L_tmpnam", &pc->IntType,
-        (union AnyValue*)&L_tmpnamValue, false);
-    VariableDefinePlatformVar(pc, NULL, "GETS_MAX", &pc->IntType,
-        (union AnyValue*)&GETS_MAXValue, false);
-
     /* define stdin, stdout and stderr */
     VariableDefinePlatformVar(pc, NULL, "stdin", FilePtrType,
-        (union AnyValue*)&stdinValue, false);
+        (union AnyValue*)&pc->StdinValue, false);
     VariableDefinePlatformVar(pc, NULL, "stdout", FilePtrType,
-        (union AnyValue*)&stdoutValue, false);
+        (union AnyValue*)&pc->StdoutValue, false);
     VariableDefinePlatformVar(pc, NULL, "stderr", FilePtrType,
-        (union AnyValue*)&stderrValue, false);
-
-    /* define NULL, true and false */
-    if (!VariableDefined(pc, TableStrRegister(pc, "NULL")))
-        VariableDefinePlatformVar(pc, NULL, "NULL", &pc->IntType,
-            (union AnyValue*)&Stdio_ZeroValue, false);
+        (union AnyValue*)&pc->StderrValue, false);
 }
 
 /* portability-related I/O calls */
@@ -973,3 +1118,21 @@ void PrintFP(double Num, FILE *Stream)
     fprintf(Stream, "%f", Num);
 }
 
+
+/* free the compiled printf() formats */
+void StdioCleanup(Picoc *pc)
+{
+    struct StdioFormat *Compiled;
+    struct StdioFormat *Next;
+    int Count;
+
+    for (Count = 0; Count < PRINTF_FORMAT_TABLE_SIZE; Count++) {
+        for (Compiled = pc->PrintfFormats[Count]; Compiled != NULL;
+                Compiled = Next) {
+            Next = Compiled->Next;
+            HeapFreeMem(pc, Compiled);
+        }
+
+        pc->PrintfFormats[Count] = NULL;
+    }
+}
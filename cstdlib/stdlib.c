@@ -2,9 +2,207 @@
 #include <stdlib.h>
 
 #include "../interpreter.h"
+#include "../stats.h"
 
+#define RESOURCE_TABLE_MIN_SIZE 64      /* a power of two */
 
-static int Stdlib_ZeroValue = 0;
+/* a block the program's allocated or a FILE it's opened, which PicocReset()
+    and PicocCleanup() give back if the program doesn't */
+struct StdlibResource {
+    struct StdlibResource *Next;
+    void *Pointer;
+    char IsFile;
+    char Kept;                  /* it was there at the reset point */
+};
+
+/* an instance's resources, hashed by address. threads the program starts
+    share them, so they're only changed with the shared lock held */
+struct StdlibResources {
+    struct StdlibResource **Table;
+    unsigned int Size;
+    unsigned int Count;
+    struct StdlibResource *FreeList;    /* records to use again */
+};
+
+
+static unsigned int StdlibResourceKey(struct StdlibResources *Resources,
+    void *Pointer)
+{
+    return (unsigned int)(((uintptr_t)Pointer / 16) * 2654435761u) &
+        (Resources->Size - 1);
+}
+
+/* keep the table no more than full, doubling it when it would be. returns
+    false if there's no memory for it */
+static int StdlibResourcesGrow(struct StdlibResources *Resources)
+{
+    struct StdlibResource **OldTable = Resources->Table;
+    struct StdlibResource **NewTable;
+    struct StdlibResource *Resource;
+    unsigned int OldSize = Resources->Size;
+    unsigned int Count;
+
+    NewTable = calloc(OldSize == 0 ? RESOURCE_TABLE_MIN_SIZE : OldSize * 2,
+        sizeof(struct StdlibResource *));
+    if (NewTable == NULL)
+        return false;
+
+    Resources->Table = NewTable;
+    Resources->Size = OldSize == 0 ? RESOURCE_TABLE_MIN_SIZE : OldSize * 2;
+    for (Count = 0; Count < OldSize; Count++) {
+        while (OldTable[Count] != NULL) {
+            Resource = OldTable[Count];
+            OldTable[Count] = Resource->Next;
+            Resource->Next = NewTable[StdlibResourceKey(Resources, Resource->Pointer)];
+            NewTable[StdlibResourceKey(Resources, Resource->Pointer)] = Resource;
+        }
+    }
+
+    free(OldTable);
+    return true;
+}
+
+/* remember a block or FILE the program's been given. one that can't be
+    remembered for lack of memory is just never given back */
+void StdlibAddResource(Picoc *pc, void *Pointer, int IsFile)
+{
+    struct StdlibResources *Resources;
+    struct StdlibResource *Resource;
+    unsigned int Key;
+
+    if (Pointer == NULL)
+        return;
+
+    ThreadLock(pc);
+    if (pc->Resources == NULL)
+        pc->Resources = calloc(1, sizeof(struct StdlibResources));
+
+    Resources = pc->Resources;
+    if (Resources == NULL || (Resources->Count >= Resources->Size &&
+            !StdlibResourcesGrow(Resources))) {
+        ThreadUnlock(pc);
+        return;
+    }
+
+    Resource = Resources->FreeList;
+    if (Resource != NULL)
+        Resources->FreeList = Resource->Next;
+    else if ((Resource = malloc(sizeof(struct StdlibResource))) == NULL) {
+        ThreadUnlock(pc);
+        return;
+    }
+
+    Key = StdlibResourceKey(Resources, Pointer);
+    Resource->Pointer = Pointer;
+    Resource->IsFile = IsFile;
+    Resource->Kept = false;
+    Resource->Next = Resources->Table[Key];
+    Resources->Table[Key] = Resource;
+    Resources->Count++;
+    ThreadUnlock(pc);
+}
+
+/* forget a block or FILE the program's giving back. it has to be forgotten
+    before it's freed or closed, or another thread could be given the same
+    address in between */
+void StdlibRemoveResource(Picoc *pc, void *Pointer)
+{
+    struct StdlibResources *Resources = pc->Resources;
+    struct StdlibResource **Link;
+    struct StdlibResource *Resource;
+
+    if (Resources == NULL || Pointer == NULL)
+        return;
+
+    ThreadLock(pc);
+    for (Link = &Resources->Table[StdlibResourceKey(Resources, Pointer)];
+            *Link != NULL; Link = &(*Link)->Next) {
+        if ((*Link)->Pointer == Pointer) {
+            Resource = *Link;
+            *Link = Resource->Next;
+            Resource->Next = Resources->FreeList;
+            Resources->FreeList = Resource;
+            Resources->Count--;
+            break;
+        }
+    }
+    ThreadUnlock(pc);
+}
+
+/* does the program have any blocks or FILEs it hasn't given back */
+int StdlibHasResources(Picoc *pc)
+{
+    return pc->Resources != NULL && pc->Resources->Count > 0;
+}
+
+/* keep everything the program has now across PicocReset(), since the
+    globals at the reset point may point to it */
+void StdlibKeepResources(Picoc *pc)
+{
+    struct StdlibResources *Resources = pc->Resources;
+    struct StdlibResource *Resource;
+    unsigned int Count;
+
+    if (Resources == NULL)
+        return;
+
+    for (Count = 0; Count < Resources->Size; Count++) {
+        for (Resource = Resources->Table[Count]; Resource != NULL;
+                Resource = Resource->Next)
+            Resource->Kept = true;
+    }
+}
+
+/* free the blocks and close the FILEs the program didn't - all of them, or
+    only those since the reset point. the program's threads have to have
+    been stopped */
+void StdlibReleaseResources(Picoc *pc, int All)
+{
+    struct StdlibResources *Resources = pc->Resources;
+    struct StdlibResource **Link;
+    struct StdlibResource *Resource;
+    unsigned int Count;
+
+    if (Resources == NULL)
+        return;
+
+    for (Count = 0; Count < Resources->Size; Count++) {
+        Link = &Resources->Table[Count];
+        while (*Link != NULL) {
+            Resource = *Link;
+            if (Resource->Kept && !All) {
+                Link = &Resource->Next;
+                continue;
+            }
+
+            if (Resource->IsFile)
+                fclose(Resource->Pointer);
+            else {
+                /* the stats outlive a reset, so they're told */
+                if (!All)
+                    stats_log_heap_release(pc, Resource->Pointer);
+                free(Resource->Pointer);
+            }
+
+            *Link = Resource->Next;
+            Resource->Next = Resources->FreeList;
+            Resources->FreeList = Resource;
+            Resources->Count--;
+        }
+    }
+
+    if (All) {
+        while (Resources->FreeList != NULL) {
+            Resource = Resources->FreeList;
+            Resources->FreeList = Resource->Next;
+            free(Resource);
+        }
+
+        free(Resources->Table);
+        free(Resources);
+        pc->Resources = NULL;
+    }
+}
 
 
 void StdlibAtof(struct ParseState *Parser, struct Value *ReturnValue,
@@ -55,6 +253,9 @@ void StdlibMalloc(struct ParseState *Parser, struct Value *ReturnValue,
     struct Value **Param, int NumArgs)
 {
     ReturnValue->Val->Pointer = malloc(Param[0]->Val->Integer);
+    StdlibAddResource(Parser->pc, ReturnValue->Val->Pointer, false);
+    stats_log_heap_allocation(Parser, NULL, ReturnValue->Val->Pointer,
+        Param[0]->Val->Integer);
 }
 
 void StdlibCalloc(struct ParseState *Parser, struct Value *ReturnValue,
@@ -62,31 +263,51 @@ void StdlibCalloc(struct ParseState *Parser, struct Value *ReturnValue,
 {
     ReturnValue->Val->Pointer = calloc(Param[0]->Val->Integer,
         Param[1]->Val->Integer);
+    StdlibAddResource(Parser->pc, ReturnValue->Val->Pointer, false);
+    stats_log_heap_allocation(Parser, NULL, ReturnValue->Val->Pointer,
+        (size_t)Param[0]->Val->Integer * Param[1]->Val->Integer);
 }
 
 void StdlibRealloc(struct ParseState *Parser, struct Value *ReturnValue,
     struct Value **Param, int NumArgs)
 {
+    StdlibRemoveResource(Parser->pc, Param[0]->Val->Pointer);
     ReturnValue->Val->Pointer = realloc(Param[0]->Val->Pointer,
         Param[1]->Val->Integer);
+    if (ReturnValue->Val->Pointer != NULL)
+        StdlibAddResource(Parser->pc, ReturnValue->Val->Pointer, false);
+    else if (Param[1]->Val->Integer != 0)
+        StdlibAddResource(Parser->pc, Param[0]->Val->Pointer, false);
+    stats_log_heap_allocation(Parser, Param[0]->Val->Pointer,
+        ReturnValue->Val->Pointer, Param[1]->Val->Integer);
 }
 
 void StdlibFree(struct ParseState *Parser, struct Value *ReturnValue,
     struct Value **Param, int NumArgs)
 {
+    StdlibRemoveResource(Parser->pc, Param[0]->Val->Pointer);
+    stats_log_heap_free(Parser, Param[0]->Val->Pointer);
     free(Param[0]->Val->Pointer);
 }
 
 void StdlibRand(struct ParseState *Parser, struct Value *ReturnValue,
     struct Value **Param, int NumArgs)
 {
+#ifndef WIN32
+    ReturnValue->Val->Integer = rand_r(&Parser->pc->RandSeed);
+#else
     ReturnValue->Val->Integer = rand();
+#endif
 }
 
 void StdlibSrand(struct ParseState *Parser, struct Value *ReturnValue,
     struct Value **Param, int NumArgs)
 {
+#ifndef WIN32
+    Parser->pc->RandSeed = Param[0]->Val->Integer;
+#else
     srand(Param[0]->Val->Integer);
+#endif
 }
 
 void StdlibAbort(struct ParseState *Parser, struct Value *ReturnValue,
@@ -113,15 +334,71 @@ void StdlibSystem(struct ParseState *Parser, struct Value *ReturnValue,
     ReturnValue->Val->Integer = system(Param[0]->Val->Pointer);
 }
 
-#if 0
+/* the comparison function of the qsort() or bsearch() running on this
+    thread, as the C library doesn't pass it anything to say */
+static PLATFORM_THREAD_LOCAL struct Callback *StdlibComparison;
+
+static int StdlibCompare(const void *Left, const void *Right)
+{
+    struct Callback *Compare = StdlibComparison;
+    int Result;
+
+    Compare->Param[0]->Val->Pointer = (void*)Left;
+    Compare->Param[1]->Val->Pointer = (void*)Right;
+    Result = (int)ExpressionCoerceInteger(ExpressionCallbackRun(Compare));
+
+    /* the comparison function might have sorted something itself, or been
+        stopped while a task on this thread did */
+    StdlibComparison = Compare;
+    return Result;
+}
+
+/* set up a call back to the comparison function, which comes as a
+    variable argument after Last since it can't be declared */
+static void StdlibCompareStart(struct ParseState *Parser,
+    struct Callback *Compare, struct Value *Last, int NumArgs, int Needed)
+{
+    struct Value *FuncValue;
+
+    if (NumArgs <= Needed)
+        ProgramFail(Parser, "a comparison function is needed");
+
+    FuncValue = (struct Value*)((char*)Last +
+        MEM_ALIGN(sizeof(struct Value) + TypeStackSizeValue(Last)));
+    ExpressionCallbackStart(Parser, Compare, FuncValue, 2);
+    if (Compare->Param[0]->Typ->Base != TypePointer ||
+            Compare->Param[1]->Typ->Base != TypePointer ||
+            !IS_INTEGER_NUMERIC(Compare->ReturnValue))
+        ProgramFail(Parser,
+            "the comparison function should take two pointers and return an int");
+}
+
+void StdlibQsort(struct ParseState *Parser, struct Value *ReturnValue,
+    struct Value **Param, int NumArgs)
+{
+    struct Callback Compare;
+
+    StdlibCompareStart(Parser, &Compare, Param[2], NumArgs, 3);
+    StdlibComparison = &Compare;
+    qsort(Param[0]->Val->Pointer, Param[1]->Val->Integer,
+        Param[2]->Val->Integer, StdlibCompare);
+    StdlibComparison = NULL;
+    ExpressionCallbackEnd(&Compare);
+}
+
 void StdlibBsearch(struct ParseState *Parser, struct Value *ReturnValue,
     struct Value **Param, int NumArgs)
 {
+    struct Callback Compare;
+
+    StdlibCompareStart(Parser, &Compare, Param[3], NumArgs, 4);
+    StdlibComparison = &Compare;
     ReturnValue->Val->Pointer = bsearch(Param[0]->Val->Pointer,
-        Param[1]->Val->Pointer, Param[2]->Val->Integer, Param[3]->Val->Integer,
-        (int (*)())Param[4]->Val->Pointer);
+        Param[1]->Val->Pointer, Param[2]->Val->Integer,
+        Param[3]->Val->Integer, StdlibCompare);
+    StdlibComparison = NULL;
+    ExpressionCallbackEnd(&Compare);
 }
-#endif
 
 void StdlibAbs(struct ParseState *Parser, struct Value *ReturnValue,
     struct Value **Param, int NumArgs)
@@ -165,7 +442,7 @@ typedef struct { \
 #endif
 
 /* all stdlib.h functions */
-struct LibraryFunction StdlibFunctions[] =
+const struct LibraryFunction StdlibFunctions[] =
 {
     {StdlibAtof, "float atof(char *);"},
     {StdlibStrtof, "float strtof(char *,char **);"},
@@ -184,8 +461,8 @@ struct LibraryFunction StdlibFunctions[] =
     {StdlibExit, "void exit(int);"},
     {StdlibGetenv, "char *getenv(char *);"},
     {StdlibSystem, "int system(char *);"},
-/*    {StdlibBsearch, "void *bsearch(void *,void *,int,int,int (*)());"}, */
-/*    {StdlibQsort, "void *qsort(void *,int,int,int (*)());"}, */
+    {StdlibBsearch, "void *bsearch(void *,void *,int,int,...);"},
+    {StdlibQsort, "void qsort(void *,int,int,...);"},
     {StdlibAbs, "int abs(int);"},
     {StdlibLabs, "int labs(int);"},
 #if 0
@@ -195,12 +472,10 @@ struct LibraryFunction StdlibFunctions[] =
     {NULL, NULL}
 };
 
-/* creates various system-dependent definitions */
-void StdlibSetupFunc(Picoc *pc)
+/* all stdlib.h constants */
+const struct LibraryConstant StdlibConstants[] =
 {
-    /* define NULL, TRUE and FALSE */
-    if (!VariableDefined(pc, TableStrRegister(pc, "NULL")))
-        VariableDefinePlatformVar(pc, NULL, "NULL", &pc->IntType,
-            (union AnyValue*)&Stdlib_ZeroValue, false);
-}
+    {"NULL", TypeInt, 0},
+    {NULL}
+};
 
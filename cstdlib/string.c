@@ -4,8 +4,6 @@
 #include "../interpreter.h"
 
 
-static int String_ZeroValue = 0;
-
 void StringStrcpy(struct ParseState *Parser, struct Value *ReturnValue,
     struct Value **Param, int NumArgs)
 {
@@ -163,8 +161,13 @@ void StringStrstr(struct ParseState *Parser, struct Value *ReturnValue,
 void StringStrtok(struct ParseState *Parser, struct Value *ReturnValue,
     struct Value **Param, int NumArgs)
 {
-    ReturnValue->Val->Pointer = strtok(Param[0]->Val->Pointer,
-        Param[1]->Val->Pointer);
+#ifndef WIN32
+    ReturnValue->Val->Pointer = strtok_r(Param[0]->Val->Pointer,
+        Param[1]->Val->Pointer, &Parser->pc->StrtokLast);
+#else
+    ReturnValue->Val->Pointer = strtok_s(Param[0]->Val->Pointer,
+        Param[1]->Val->Pointer, &Parser->pc->StrtokLast);
+#endif
 }
 
 void StringStrxfrm(struct ParseState *Parser, struct Value *ReturnValue,
@@ -179,6 +182,7 @@ void StringStrdup(struct ParseState *Parser, struct Value *ReturnValue,
     struct Value **Param, int NumArgs)
 {
     ReturnValue->Val->Pointer = (void*)strdup(Param[0]->Val->Pointer);
+    StdlibAddResource(Parser->pc, ReturnValue->Val->Pointer, false);
 }
 
 void StringStrtok_r(struct ParseState *Parser, struct Value *ReturnValue,
@@ -190,7 +194,7 @@ void StringStrtok_r(struct ParseState *Parser, struct Value *ReturnValue,
 #endif
 
 /* all string.h functions */
-struct LibraryFunction StringFunctions[] =
+const struct LibraryFunction StringFunctions[] =
 {
 #ifndef WIN32
 	{StringIndex,   "char *index(char *,int);"},
@@ -225,12 +229,10 @@ struct LibraryFunction StringFunctions[] =
     {NULL,          NULL }
 };
 
-/* creates various system-dependent definitions */
-void StringSetupFunc(Picoc *pc)
+/* all string.h constants */
+const struct LibraryConstant StringConstants[] =
 {
-    /* define NULL */
-    if (!VariableDefined(pc, TableStrRegister(pc, "NULL")))
-        VariableDefinePlatformVar(pc, NULL, "NULL", &pc->IntType,
-            (union AnyValue*)&String_ZeroValue, false);
-}
+    {"NULL", TypeInt, 0},
+    {NULL}
+};
 
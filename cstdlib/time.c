@@ -4,20 +4,17 @@
 #include "../interpreter.h"
 
 
-static int CLOCKS_PER_SECValue = CLOCKS_PER_SEC;
-
-#ifdef CLK_PER_SEC
-static int CLK_PER_SECValue = CLK_PER_SEC;
-#endif
-
-#ifdef CLK_TCK
-static int CLK_TCKValue = CLK_TCK;
-#endif
-
 void StdAsctime(struct ParseState *Parser, struct Value *ReturnValue,
     struct Value **Param, int NumArgs)
 {
-    ReturnValue->Val->Pointer = asctime(Param[0]->Val->Pointer);
+#ifndef WIN32
+    ReturnValue->Val->Pointer = asctime_r(Param[0]->Val->Pointer,
+        Parser->pc->TimeString);
+#else
+    asctime_s(Parser->pc->TimeString, sizeof(Parser->pc->TimeString),
+        Param[0]->Val->Pointer);
+    ReturnValue->Val->Pointer = Parser->pc->TimeString;
+#endif
 }
 
 void StdClock(struct ParseState *Parser, struct Value *ReturnValue,
@@ -29,7 +26,14 @@ void StdClock(struct ParseState *Parser, struct Value *ReturnValue,
 void StdCtime(struct ParseState *Parser, struct Value *ReturnValue,
     struct Value **Param, int NumArgs)
 {
-    ReturnValue->Val->Pointer = ctime(Param[0]->Val->Pointer);
+#ifndef WIN32
+    ReturnValue->Val->Pointer = ctime_r(Param[0]->Val->Pointer,
+        Parser->pc->TimeString);
+#else
+    ctime_s(Parser->pc->TimeString, sizeof(Parser->pc->TimeString),
+        Param[0]->Val->Pointer);
+    ReturnValue->Val->Pointer = Parser->pc->TimeString;
+#endif
 }
 
 void StdDifftime(struct ParseState *Parser, struct Value *ReturnValue,
@@ -42,13 +46,25 @@ void StdDifftime(struct ParseState *Parser, struct Value *ReturnValue,
 void StdGmtime(struct ParseState *Parser, struct Value *ReturnValue,
     struct Value **Param, int NumArgs)
 {
-    ReturnValue->Val->Pointer = gmtime(Param[0]->Val->Pointer);
+#ifndef WIN32
+    ReturnValue->Val->Pointer = gmtime_r(Param[0]->Val->Pointer,
+        &Parser->pc->TimeValue);
+#else
+    gmtime_s(&Parser->pc->TimeValue, Param[0]->Val->Pointer);
+    ReturnValue->Val->Pointer = &Parser->pc->TimeValue;
+#endif
 }
 
 void StdLocaltime(struct ParseState *Parser, struct Value *ReturnValue,
     struct Value **Param, int NumArgs)
 {
-    ReturnValue->Val->Pointer = localtime(Param[0]->Val->Pointer);
+#ifndef WIN32
+    ReturnValue->Val->Pointer = localtime_r(Param[0]->Val->Pointer,
+        &Parser->pc->TimeValue);
+#else
+    localtime_s(&Parser->pc->TimeValue, Param[0]->Val->Pointer);
+    ReturnValue->Val->Pointer = &Parser->pc->TimeValue;
+#endif
 }
 
 void StdMktime(struct ParseState *Parser, struct Value *ReturnValue,
@@ -101,7 +117,7 @@ typedef int clock_t;\
 ";
 
 /* all string.h functions */
-struct LibraryFunction StdTimeFunctions[] =
+const struct LibraryFunction StdTimeFunctions[] =
 {
     {StdAsctime, "char *asctime(struct tm *);"},
     {StdClock, "time_t clock();"},
@@ -120,6 +136,18 @@ struct LibraryFunction StdTimeFunctions[] =
     {NULL, NULL}
 };
 
+/* all time.h constants */
+const struct LibraryConstant StdTimeConstants[] =
+{
+    {"CLOCKS_PER_SEC", TypeInt, CLOCKS_PER_SEC},
+#ifdef CLK_PER_SEC
+    {"CLK_PER_SEC", TypeInt, CLK_PER_SEC},
+#endif
+#ifdef CLK_TCK
+    {"CLK_TCK", TypeInt, CLK_TCK},
+#endif
+    {NULL}
+};
 
 /* creates various system-dependent definitions */
 void StdTimeSetupFunc(Picoc *pc)
@@ -127,17 +155,5 @@ void StdTimeSetupFunc(Picoc *pc)
     /* make a "struct tm" which is the same size as a native tm structure */
     TypeCreateOpaqueStruct(pc, NULL, TableStrRegister(pc, "tm"),
         sizeof(struct tm));
-
-    /* define CLK_PER_SEC etc. */
-    VariableDefinePlatformVar(pc, NULL, "CLOCKS_PER_SEC", &pc->IntType,
-        (union AnyValue*)&CLOCKS_PER_SECValue, false);
-#ifdef CLK_PER_SEC
-    VariableDefinePlatformVar(pc, NULL, "CLK_PER_SEC", &pc->IntType,
-        (union AnyValue*)&CLK_PER_SECValue, false);
-#endif
-#ifdef CLK_TCK
-    VariableDefinePlatformVar(pc, NULL, "CLK_TCK", &pc->IntType,
-        (union AnyValue*)&CLK_TCKValue, false);
-#endif
 }
 
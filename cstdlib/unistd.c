@@ -5,8 +5,6 @@
 #include "../interpreter.h"
 
 
-static int ZeroValue = 0;
-
 void UnistdAccess(struct ParseState *Parser, struct Value *ReturnValue,
     struct Value **Param, int NumArgs)
 {
@@ -497,7 +495,7 @@ typedef int intptr_t;\
 ";
 
 /* all unistd.h functions */
-struct LibraryFunction UnistdFunctions[] =
+const struct LibraryFunction UnistdFunctions[] =
 {
     {UnistdAccess, "int access(char*, int);"},
     {UnistdAlarm, "unsigned int alarm(unsigned int);"},
@@ -586,16 +584,18 @@ struct LibraryFunction UnistdFunctions[] =
     {NULL, NULL}
 };
 
+/* all unistd.h constants */
+const struct LibraryConstant UnistdConstants[] =
+{
+    {"NULL", TypeInt, 0},
+    {NULL}
+};
+
 /* creates various system-dependent definitions */
 extern char *optarg;
 extern int optind, opterr, optopt;
 void UnistdSetupFunc(Picoc *pc)
 {
-    /* define NULL */
-    if (!VariableDefined(pc, TableStrRegister(pc, "NULL")))
-        VariableDefinePlatformVar(pc, NULL, "NULL", &pc->IntType,
-            (union AnyValue*)&ZeroValue, false);
-
     /* define optarg and friends */
     VariableDefinePlatformVar(pc, NULL, "optarg", pc->CharPtrType,
         (union AnyValue *)&optarg, true);
@@ -103,10 +103,9 @@ void DebugCheckStatement(struct ParseState *Parser)
     Picoc *pc = Parser->pc;
 
     /* has the user manually pressed break? */
-    if (pc->DebugManualBreak) {
+    if (PlatformBreakPending(pc)) {
         PlatformPrintf(pc->CStdOut, "break\n");
         DoBreak = true;
-        pc->DebugManualBreak = false;
     }
 
     /* is this a breakpoint location? */
@@ -47,7 +47,7 @@ struct OpPrecedence {
 
 /* NOTE: the order of this array must correspond exactly to the order of
     these tokens in enum LexToken */
-static struct OpPrecedence OperatorPrecedence[] = {
+static const struct OpPrecedence OperatorPrecedence[] = {
     /* TokenNone, */ {0, 0, 0, "none"},
     /* TokenComma, */ {0, 0, 0, ","},
     /* TokenAssign, */ {0, 0, 2, "="},
@@ -100,8 +100,6 @@ static struct OpPrecedence OperatorPrecedence[] = {
 static void ExpressionStackShow(Picoc *pc, struct ExpressionStack *StackTop);
 #endif
 static int IsTypeToken(struct ParseState * Parser, enum LexToken t, struct Value * LexValue);
-static long long ExpressionAssignInt(struct ParseState *Parser, struct Value *DestValue, long long FromInt, int After);
-static double ExpressionAssignFP(struct ParseState *Parser, struct Value *DestValue, double FromFP);
 static void ExpressionStackPushValueNode(struct ParseState *Parser, struct ExpressionStack **StackTop, struct Value *ValueLoc);
 static struct Value *ExpressionStackPushValueByType(struct ParseState *Parser, struct ExpressionStack **StackTop, struct ValueType *PushType);
 static void ExpressionStackPushValue(struct ParseState *Parser, struct ExpressionStack **StackTop, struct Value *PushValue);
@@ -116,6 +114,7 @@ static void ExpressionColonOperator(struct ParseState *Parser, struct Expression
 static void ExpressionPrefixOperator(struct ParseState *Parser, struct ExpressionStack **StackTop, enum LexToken Op, struct Value *TopValue);
 static void ExpressionPostfixOperator(struct ParseState *Parser, struct ExpressionStack **StackTop, enum LexToken Op, struct Value *TopValue);
 static void ExpressionInfixOperator(struct ParseState *Parser, struct ExpressionStack **StackTop, enum LexToken Op, struct Value *BottomValue, struct Value *TopValue);
+static int ExpressionFusedInfixOperator(struct ParseState *Parser, struct ExpressionStack **StackTop, enum LexToken Op, struct Value *BottomValue, struct Value *TopValue, int Precedence);
 static void ExpressionStackCollapse(struct ParseState *Parser, struct ExpressionStack **StackTop, int Precedence, int *IgnorePrecedence);
 static void ExpressionStackPushOperator(struct ParseState *Parser, struct ExpressionStack **StackTop, enum OperatorOrder Order, enum LexToken Token, int Precedence);
 static void ExpressionParseMacroCall(struct ParseState *Parser, struct ExpressionStack **StackTop, const char *MacroName, struct MacroDef *MDef);
@@ -126,7 +125,7 @@ static void ExpressionParseFunctionCall(struct ParseState *Parser, struct Expres
 /* show the contents of the expression stack */
 void ExpressionStackShow(Picoc *pc, struct ExpressionStack *StackTop)
 {
-    printf("Expression stack [0x%lx,0x%lx]: ", (long long)pc->HeapStackTop, (long long)StackTop);
+    printf("Expression stack [0x%lx,0x%lx]: ", (long long)THREAD(pc)->HeapStackTop, (long long)StackTop);
 
     while (StackTop != NULL) {
         if (StackTop->Order == OrderNone) {
@@ -765,7 +764,9 @@ void ExpressionAssign(struct ParseState *Parser, struct Value *DestValue,
                     DestValue->Typ->ArraySize,
                     strlen(SourceValue->Val->Pointer));
 #endif
-            memcpy((void*)DestValue->Val, SourceValue->Val->Pointer,
+            /* strncpy() doesn't read past the end of a shorter string, and
+                zero fills the rest of the array like C does */
+            strncpy((char*)DestValue->Val, SourceValue->Val->Pointer,
                 TypeSizeValue(DestValue, false));
             break;
         }
@@ -1502,12 +1503,116 @@ void ExpressionInfixOperator(struct ParseState *Parser,
         ProgramFail(Parser, "invalid operation");
 }
 
+/* whether an operator on two ints can be fused with the operator that
+    uses its result. these are the ones the fused path evaluates itself */
+static int ExpressionFusible(union ExpressionHash First, union ExpressionHash Next)
+{
+    if (First.Components.Type != ExpressionInfix ||
+            First.Components.TopType != TypeInt ||
+            First.Components.BottomType != TypeInt ||
+            Next.Components.Type != ExpressionInfix ||
+            Next.Components.Op >= FUSION_OPERATORS ||
+            Next.Components.Op == TokenNone ||
+            Next.Components.Op == TokenComma ||
+            Next.Components.Op == TokenQuestionMark ||
+            Next.Components.Op == TokenColon)
+        return false;
+
+    switch (First.Components.Op) {
+    case TokenPlus: case TokenMinus: case TokenAsterisk: case TokenSlash:
+    case TokenModulus: case TokenAmpersand: case TokenArithmeticOr:
+    case TokenArithmeticExor: case TokenEqual: case TokenNotEqual:
+    case TokenLessThan: case TokenGreaterThan: case TokenLessEqual:
+    case TokenGreaterEqual:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* evaluate an operator on two ints and then, straight away, the operator
+    below it on the stack which takes its result. the result is passed to
+    it in a value of our own rather than being pushed on the stack and
+    popped again. this only happens for pairs PicocLoadExpressionFusions()
+    has read, and which the stack collapse would have run one after the
+    other anyway. returns the second operator's precedence, or -1 if the
+    pair isn't fused and nothing's been done */
+int ExpressionFusedInfixOperator(struct ParseState *Parser,
+    struct ExpressionStack **StackTop, enum LexToken Op,
+    struct Value *BottomValue, struct Value *TopValue, int Precedence)
+{
+    Picoc *pc = Parser->pc;
+    struct ExpressionStack *NextOperator = *StackTop;
+    struct Value *NextBottomValue;
+    struct Value Result;
+    union AnyValue ResultValue;
+    long long TopInt;
+    long long BottomInt;
+    long long ResultInt;
+    int ResultIsInt = true;
+
+    if (NextOperator == NULL || NextOperator->Order != OrderInfix ||
+            NextOperator->Precedence < Precedence ||
+            NextOperator->Next == NULL || Op >= FUSION_OPERATORS ||
+            TopValue->Typ != &pc->IntType || BottomValue->Typ != &pc->IntType ||
+            !pc->ExpressionFusions[Op * FUSION_OPERATORS + NextOperator->Op])
+        return -1;
+
+    stats_log_expression_evaluation(Parser, ExpressionInfix, Op, BottomValue, TopValue);
+
+    /* the same results, and result types, as ExpressionInfixOperator() */
+    TopInt = TopValue->Val->Integer;
+    BottomInt = BottomValue->Val->Integer;
+    switch (Op) {
+    case TokenPlus: ResultInt = BottomInt + TopInt; break;
+    case TokenMinus: ResultInt = BottomInt - TopInt; break;
+    case TokenAsterisk: ResultInt = BottomInt * TopInt; break;
+    case TokenSlash: ResultInt = BottomInt / TopInt; break;
+    case TokenModulus: ResultInt = BottomInt % TopInt; break;
+    case TokenAmpersand: ResultInt = BottomInt & TopInt; break;
+    case TokenArithmeticOr: ResultInt = BottomInt | TopInt; break;
+    case TokenArithmeticExor: ResultInt = BottomInt ^ TopInt; break;
+    case TokenEqual: ResultInt = BottomInt == TopInt; ResultIsInt = false; break;
+    case TokenNotEqual: ResultInt = BottomInt != TopInt; ResultIsInt = false; break;
+    case TokenLessThan: ResultInt = BottomInt < TopInt; ResultIsInt = false; break;
+    case TokenGreaterThan: ResultInt = BottomInt > TopInt; ResultIsInt = false; break;
+    case TokenLessEqual: ResultInt = BottomInt <= TopInt; ResultIsInt = false; break;
+    case TokenGreaterEqual: ResultInt = BottomInt >= TopInt; ResultIsInt = false; break;
+    default:
+        ProgramFail(Parser, "invalid operation");
+        return -1;
+    }
+
+    memset(&Result, '\0', sizeof(Result));
+    Result.Val = &ResultValue;
+    ResultValue.LongLongInteger = 0;
+    if (ResultIsInt) {
+        Result.Typ = &pc->IntType;
+        ResultValue.Integer = (int)ResultInt;
+    } else {
+        Result.Typ = &pc->LongLongType;
+        ResultValue.LongLongInteger = ResultInt;
+    }
+
+    /* pop the next operator and its bottom value as the collapse would */
+    NextBottomValue = NextOperator->Next->Val;
+    HeapPopStack(pc, NULL, sizeof(struct ExpressionStack));
+    HeapPopStack(pc, NextBottomValue, sizeof(struct ExpressionStack) +
+        sizeof(struct Value) + TypeStackSizeValue(NextBottomValue));
+    *StackTop = NextOperator->Next->Next;
+
+    ExpressionInfixOperator(Parser, StackTop, NextOperator->Op,
+        NextBottomValue, &Result);
+    return NextOperator->Precedence;
+}
+
 /* take the contents of the expression stack and compute the top until
     there's nothing greater than the given precedence */
 void ExpressionStackCollapse(struct ParseState *Parser,
     struct ExpressionStack **StackTop, int Precedence, int *IgnorePrecedence)
 {
     int FoundPrecedence = Precedence;
+    int FusedPrecedence;
     struct Value *TopValue;
     struct Value *BottomValue;
     struct ExpressionStack *TopStackNode = *StackTop;
@@ -1610,7 +1715,15 @@ void ExpressionStackCollapse(struct ParseState *Parser,
                     *StackTop = TopOperatorNode->Next->Next;
 
                     /* do the infix operation */
-                    if (Parser->Mode == RunModeRun /* && FoundPrecedence <= *IgnorePrecedence */) {
+                    if (Parser->Mode == RunModeRun && Parser->pc->ExpressionFusions != NULL &&
+                            (FusedPrecedence = ExpressionFusedInfixOperator(Parser,
+                            StackTop, TopOperatorNode->Op, BottomValue, TopValue,
+                            Precedence)) >= 0) {
+                        /* it ran with the next operator, so carry on from that */
+                        if (FoundPrecedence <= *IgnorePrecedence)
+                            *IgnorePrecedence = DEEP_PRECEDENCE;
+                        FoundPrecedence = FusedPrecedence;
+                    } else if (Parser->Mode == RunModeRun /* && FoundPrecedence <= *IgnorePrecedence */) {
                         /* run the operator */
                         ExpressionInfixOperator(Parser, StackTop,
                             TopOperatorNode->Op, BottomValue, TopValue);
@@ -1687,6 +1800,8 @@ void ExpressionGetStructElement(struct ParseState *Parser,
         char *DerefDataLoc = (char *)ParamVal->Val;
         struct Value *MemberValue = NULL;
         struct Value *Result;
+        /* a member of a read-only struct is read-only too */
+        int IsLValue = Token == TokenArrow || ParamVal->IsLValue;
 
         /* if we're doing '->' dereference the struct pointer first */
         if (Token == TokenArrow)
@@ -1713,7 +1828,7 @@ void ExpressionGetStructElement(struct ParseState *Parser,
 
         /* make the result value for this member only */
         Result = VariableAllocValueFromExistingData(Parser, MemberValue->Typ,
-            (void*)(DerefDataLoc + MemberValue->Val->Integer), true,
+            (void*)(DerefDataLoc + MemberValue->Val->Integer), IsLValue,
             (StructVal != NULL) ? StructVal->LValueFrom : NULL);
         ExpressionStackPushValueNode(Parser, StackTop, Result);
     }
@@ -2075,8 +2190,8 @@ void ExpressionParseMacroCall(struct ParseState *Parser,
         ParserCopy(&MacroParser, &MDef->Body);
         MacroParser.Mode = Parser->Mode;
         VariableStackFrameAdd(Parser, MacroName, 0);
-        Parser->pc->TopStackFrame->NumParams = ArgCount;
-        Parser->pc->TopStackFrame->ReturnValue = ReturnValue;
+        THREAD(Parser->pc)->TopStackFrame->NumParams = ArgCount;
+        THREAD(Parser->pc)->TopStackFrame->ReturnValue = ReturnValue;
         for (Count = 0; Count < MDef->NumParams; Count++)
             VariableDefine(Parser->pc, Parser, MDef->ParamName[Count],
                 ParamArray[Count], NULL, true);
@@ -2169,58 +2284,36 @@ void ExpressionParseFunctionCall(struct ParseState *Parser,
 
     if (RunIt) {
         /* run the function */
-        stats_log_function_entry(Parser, ArgCount);
+        stats_log_function_entry(Parser, FuncName, ArgCount);
 
         if (ArgCount < FuncValue->Val->FuncDef.NumParams)
             ProgramFail(Parser, "not enough arguments to '%s'", FuncName);
 
-        if (FuncValue->Val->FuncDef.Intrinsic == NULL) {
+        if (FuncValue->Val->FuncDef.Native != NULL) {
+            /* call a native function bound with dlbind() */
+            LibraryCallNative(Parser, &FuncValue->Val->FuncDef, ReturnValue,
+                ParamArray, ArgCount);
+        } else if (FuncValue->Val->FuncDef.Intrinsic == NULL) {
             /* run a user-defined function */
             int Count;
-            int OldScopeID = Parser->ScopeID;
-            struct ParseState FuncParser;
+            struct Value *Params[PARAMETER_MAX];
 
             if (FuncValue->Val->FuncDef.Body.Pos == NULL)
                 ProgramFail(Parser,
                     "ExpressionParseFunctionCall FuncName: '%s' is undefined",
                     FuncName);
 
-            ParserCopy(&FuncParser, &FuncValue->Val->FuncDef.Body);
-            VariableStackFrameAdd(Parser, FuncName,
-                FuncValue->Val->FuncDef.Intrinsic ? FuncValue->Val->FuncDef.NumParams : 0);
-            Parser->pc->TopStackFrame->NumParams = ArgCount;
-            Parser->pc->TopStackFrame->ReturnValue = ReturnValue;
-
-            /* Function parameters should not go out of scope */
-            Parser->ScopeID = -1;
+            ExpressionCallFrameAdd(Parser, FuncName, &FuncValue->Val->FuncDef,
+                ParamArray, ArgCount, ReturnValue, Params);
 
+            /* If passing an array, set the function internal data pointer to the external data */
             ArrayParamsCount = 0;
             for (Count = 0; Count < FuncValue->Val->FuncDef.NumParams; Count++) {
-                struct Value *var = VariableDefine(Parser->pc, Parser,
-                    FuncValue->Val->FuncDef.ParamName[Count], ParamArray[Count],
-                    NULL, true);
-                /* If passing an array, set the function internal data pointer to the external data */
-                if (var->Typ->Base == TypeArray)
-                    var->Val = ArrayParams[ArrayParamsCount++]->Val;
-            }
-
-            Parser->ScopeID = OldScopeID;
-
-            if (ParseStatement(&FuncParser, true, false, NULL) != ParseResultOk)
-                ProgramFail(&FuncParser, "function body expected");
-
-            if (RunIt) {
-                if (FuncParser.Mode == RunModeRun &&
-                        FuncValue->Val->FuncDef.ReturnType != &Parser->pc->VoidType)
-                    ProgramFail(&FuncParser,
-                        "no value returned from a function returning %t",
-                        FuncValue->Val->FuncDef.ReturnType);
-
-                else if (FuncParser.Mode == RunModeGoto)
-                    ProgramFail(&FuncParser, "couldn't find goto label '%s'",
-                        FuncParser.SearchGotoLabel);
+                if (Params[Count]->Typ->Base == TypeArray)
+                    Params[Count]->Val = ArrayParams[ArrayParamsCount++]->Val;
             }
 
+            ExpressionCallBody(&FuncValue->Val->FuncDef);
             VariableStackFramePop(Parser);
         } else {
             // FIXME: too many parameters?
@@ -2236,6 +2329,107 @@ void ExpressionParseFunctionCall(struct ParseState *Parser,
     Parser->Mode = OldMode;
 }
 
+/* add a stack frame for a call to the user-defined function Func with
+    NumArgs arguments and define its parameters in it, each copied from Args
+    if it isn't NULL. the new parameters are stored in Params if it isn't
+    NULL */
+void ExpressionCallFrameAdd(struct ParseState *Parser, const char *FuncName,
+    struct FuncDef *Func, struct Value **Args, int NumArgs,
+    struct Value *ReturnValue, struct Value **Params)
+{
+    Picoc *pc = Parser->pc;
+    int OldScopeID = Parser->ScopeID;
+    struct Value *Param;
+    int Count;
+
+    VariableStackFrameAdd(Parser, FuncName, 0);
+    THREAD(pc)->TopStackFrame->NumParams = NumArgs;
+    THREAD(pc)->TopStackFrame->ReturnValue = ReturnValue;
+
+    /* function parameters should not go out of scope */
+    Parser->ScopeID = -1;
+    for (Count = 0; Count < Func->NumParams; Count++) {
+        if (Args != NULL)
+            Param = VariableDefine(pc, Parser, Func->ParamName[Count],
+                Args[Count], NULL, true);
+        else
+            Param = VariableDefine(pc, Parser, Func->ParamName[Count],
+                NULL, Func->ParamType[Count], true);
+
+        if (Params != NULL)
+            Params[Count] = Param;
+    }
+
+    Parser->ScopeID = OldScopeID;
+}
+
+/* run the body of the user-defined function Func in the stack frame
+    ExpressionCallFrameAdd() made for it */
+void ExpressionCallBody(struct FuncDef *Func)
+{
+    struct ParseState FuncParser;
+
+    ParserCopy(&FuncParser, &Func->Body);
+    if (ParseStatement(&FuncParser, true, false, NULL) != ParseResultOk)
+        ProgramFail(&FuncParser, "function body expected");
+
+    if (FuncParser.Mode == RunModeRun &&
+            Func->ReturnType != &FuncParser.pc->VoidType)
+        ProgramFail(&FuncParser, "no value returned from a function returning %t",
+            Func->ReturnType);
+    else if (FuncParser.Mode == RunModeGoto)
+        ProgramFail(&FuncParser, "couldn't find goto label '%s'",
+            FuncParser.SearchGotoLabel);
+}
+
+/* get ready to call the function in FuncValue, which has to take NumParams
+    parameters, from a library function. this sets up a stack frame for it
+    which every call with ExpressionCallbackRun() uses */
+void ExpressionCallbackStart(struct ParseState *Parser,
+    struct Callback *Callback, struct Value *FuncValue, int NumParams)
+{
+    Picoc *pc = Parser->pc;
+    struct FuncDef *Func;
+
+    if (FuncValue->Typ->Base != TypeFunction)
+        ProgramFail(Parser, "%t is not a function - can't call", FuncValue->Typ);
+
+    Func = &FuncValue->Val->FuncDef;
+    if (Func->Intrinsic != NULL || Func->Native != NULL)
+        ProgramFail(Parser, "a library function can't be called back");
+
+    if (Func->Body.Pos == NULL)
+        ProgramFail(Parser, "the function called back isn't defined");
+
+    if (Func->NumParams != NumParams || Func->VarArgs)
+        ProgramFail(Parser, "the function called back should take %d parameters",
+            NumParams);
+
+    ParserCopy(&Callback->Parser, Parser);
+    Callback->Func = Func;
+    Callback->ReturnValue = VariableAllocValueFromType(pc, Parser,
+        Func->ReturnType, false, NULL, false);
+    ExpressionCallFrameAdd(&Callback->Parser,
+        VariableFuncName(pc, FuncValue, "callback"), Func, NULL, NumParams,
+        Callback->ReturnValue, Callback->Param);
+}
+
+/* call the function with whatever's in Callback->Param. the body runs in
+    the same frame each time, so its locals are only made on the first call,
+    like those in a loop */
+struct Value *ExpressionCallbackRun(struct Callback *Callback)
+{
+    ExpressionCallBody(Callback->Func);
+    return Callback->ReturnValue;
+}
+
+/* throw away the callback's stack frame */
+void ExpressionCallbackEnd(struct Callback *Callback)
+{
+    VariableStackFramePop(&Callback->Parser);
+    VariableStackPop(&Callback->Parser, Callback->ReturnValue);
+}
+
 /* parse an expression */
 long long ExpressionParseInt(struct ParseState *Parser)
 {
@@ -2256,3 +2450,68 @@ long long ExpressionParseInt(struct ParseState *Parser)
     return Result;
 }
 
+/* read a file of expression n-grams which picoc -g wrote and fuse each
+    pair of operators in them that ExpressionFusedInfixOperator() handles,
+    adding to any already fused. programs have to be parsed after this for
+    it to work. returns how many pairs were added, or -1 if the file can't
+    be read */
+int PicocLoadExpressionFusions(Picoc *pc, const char *FileName)
+{
+    FILE *In = fopen(FileName, "r");
+    union ExpressionHash Hashes[STATS_NGRAM_MAX];
+    char Line[256];
+    char *Pos;
+    int AtLineStart = true;
+    int NumFused = 0;
+    int Length;
+    int Count;
+
+    if (In == NULL)
+        return -1;
+
+    if (pc->ExpressionFusions == NULL) {
+        pc->ExpressionFusions = calloc(FUSION_OPERATORS * FUSION_OPERATORS, 1);
+        if (pc->ExpressionFusions == NULL) {
+            fclose(In);
+            return -1;
+        }
+    }
+
+    /* each line is a count, a length and the hashes, separated by commas.
+        the rest of it, and lines starting with '#', are for people */
+    while (fgets(Line, sizeof(Line), In) != NULL) {
+        int WasLineStart = AtLineStart;
+
+        AtLineStart = strchr(Line, '\n') != NULL;
+        if (!WasLineStart || Line[0] == '#')
+            continue;
+
+        strtoul(Line, &Pos, 10);
+        Length = strtol(Pos, &Pos, 10);
+        if (Length > STATS_NGRAM_MAX)
+            Length = STATS_NGRAM_MAX;
+
+        for (Count = 0; Count < Length; Count++) {
+            Hashes[Count].Hash = strtoul(Pos, &Pos, 10);
+            if (*Pos == ',')
+                Pos++;
+        }
+
+        for (Count = 0; Count + 1 < Length; Count++) {
+            unsigned char *Fused;
+
+            if (!ExpressionFusible(Hashes[Count], Hashes[Count+1]))
+                continue;
+
+            Fused = &pc->ExpressionFusions[Hashes[Count].Components.Op *
+                FUSION_OPERATORS + Hashes[Count+1].Components.Op];
+            if (!*Fused) {
+                *Fused = true;
+                NumFused++;
+            }
+        }
+    }
+
+    fclose(In);
+    return NumFused;
+}
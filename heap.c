@@ -25,16 +25,13 @@ void HeapInit(Picoc *pc, int StackOrHeapSize)
     int AlignOffset = 0;
 
     pc->HeapMemory = malloc(StackOrHeapSize);
+    pc->HeapSize = StackOrHeapSize;
     pc->HeapBottom = NULL;  /* the bottom of the (downward-growing) heap */
-    pc->StackFrame = NULL;  /* the current stack frame */
-    pc->HeapStackTop = NULL;  /* the top of the stack */
 
     while (((unsigned long)&pc->HeapMemory[AlignOffset] & (sizeof(ALIGN_TYPE)-1)) != 0)
         AlignOffset++;
 
-    pc->StackFrame = &(pc->HeapMemory)[AlignOffset];
-    pc->HeapStackTop = &(pc->HeapMemory)[AlignOffset];
-    *(void**)(pc->StackFrame) = NULL;
+    HeapInitStack(&pc->MainThread, &(pc->HeapMemory)[AlignOffset], NULL);
     pc->HeapBottom =
         &(pc->HeapMemory)[StackOrHeapSize-sizeof(ALIGN_TYPE)+AlignOffset];
     pc->FreeListBig = NULL;
@@ -42,25 +39,43 @@ void HeapInit(Picoc *pc, int StackOrHeapSize)
         pc->FreeListBucket[Count] = NULL;
 }
 
+/* set up an empty stack for a thread, from Start up to End or up to the
+    heap if End is NULL. Start must be aligned */
+void HeapInitStack(struct ThreadState *Thread, void *Start, void *End)
+{
+    Thread->StackStart = Start;
+    Thread->StackEnd = End;
+    Thread->StackFrame = Start;  /* the current stack frame */
+    Thread->HeapStackTop = Start;  /* the top of the stack */
+    *(void**)(Thread->StackFrame) = NULL;
+}
+
 void HeapCleanup(Picoc *pc)
 {
-    free(pc->HeapMemory);
+    if (pc->ImageMapping != NULL)
+        PlatformUnmapImage(pc->ImageMapping, pc->ImageMappingSize);
+    else
+        free(pc->HeapMemory);
+
+    free(pc->ResetPoint);
 }
 
 /* allocate some space on the stack, in the current stack frame
  * clears memory. can return NULL if out of stack space */
 void *HeapAllocStack(Picoc *pc, int Size)
 {
-    char *NewMem = pc->HeapStackTop;
-    char *NewTop = (char*)pc->HeapStackTop + MEM_ALIGN(Size);
+    struct ThreadState *Thread = THREAD(pc);
+    char *NewMem = Thread->HeapStackTop;
+    char *NewTop = (char*)Thread->HeapStackTop + MEM_ALIGN(Size);
 #ifdef DEBUG_HEAP
     printf("HeapAllocStack(%ld) at 0x%lx\n", (unsigned long)MEM_ALIGN(Size),
-        (unsigned long)pc->HeapStackTop);
+        (unsigned long)Thread->HeapStackTop);
 #endif
-    if (NewTop > (char*)pc->HeapBottom)
+    if (NewTop > (char*)(Thread->StackEnd != NULL ? Thread->StackEnd :
+            pc->HeapBottom))
         return NULL;
 
-    pc->HeapStackTop = (void*)NewTop;
+    Thread->HeapStackTop = (void*)NewTop;
     memset((void*)NewMem, '\0', Size);
     return NewMem;
 }
@@ -68,26 +83,28 @@ void *HeapAllocStack(Picoc *pc, int Size)
 /* allocate some space on the stack, in the current stack frame */
 void HeapUnpopStack(Picoc *pc, int Size)
 {
+    struct ThreadState *Thread = THREAD(pc);
 #ifdef DEBUG_HEAP
     printf("HeapUnpopStack(%ld) at 0x%lx\n", (unsigned long)MEM_ALIGN(Size),
-        (unsigned long)pc->HeapStackTop);
+        (unsigned long)Thread->HeapStackTop);
 #endif
-    pc->HeapStackTop = (void*)((char*)pc->HeapStackTop + MEM_ALIGN(Size));
+    Thread->HeapStackTop = (void*)((char*)Thread->HeapStackTop + MEM_ALIGN(Size));
 }
 
 /* free some space at the top of the stack */
 int HeapPopStack(Picoc *pc, void *Addr, int Size)
 {
+    struct ThreadState *Thread = THREAD(pc);
     int ToLose = MEM_ALIGN(Size);
-    if (ToLose > ((char*)pc->HeapStackTop - (char*)&(pc->HeapMemory)[0]))
+    if (ToLose > ((char*)Thread->HeapStackTop - (char*)Thread->StackStart))
         return false;
 
 #ifdef DEBUG_HEAP
     printf("HeapPopStack(0x%lx, %ld) back to 0x%lx\n", (unsigned long)Addr,
-        (unsigned long)MEM_ALIGN(Size), (unsigned long)pc->HeapStackTop - ToLose);
+        (unsigned long)MEM_ALIGN(Size), (unsigned long)Thread->HeapStackTop - ToLose);
 #endif
-    pc->HeapStackTop = (void*)((char*)pc->HeapStackTop - ToLose);
-    assert(Addr == NULL || pc->HeapStackTop == Addr);
+    Thread->HeapStackTop = (void*)((char*)Thread->HeapStackTop - ToLose);
+    assert(Addr == NULL || Thread->HeapStackTop == Addr);
 
     return true;
 }
@@ -95,12 +112,13 @@ int HeapPopStack(Picoc *pc, void *Addr, int Size)
 /* push a new stack frame on to the stack */
 void HeapPushStackFrame(Picoc *pc)
 {
+    struct ThreadState *Thread = THREAD(pc);
 #ifdef DEBUG_HEAP
-    printf("Adding stack frame at 0x%lx\n", (unsigned long)pc->HeapStackTop);
+    printf("Adding stack frame at 0x%lx\n", (unsigned long)Thread->HeapStackTop);
 #endif
-    *(void**)pc->HeapStackTop = pc->StackFrame;
-    pc->StackFrame = pc->HeapStackTop;
-    pc->HeapStackTop = (void*)((char*)pc->HeapStackTop +
+    *(void**)Thread->HeapStackTop = Thread->StackFrame;
+    Thread->StackFrame = Thread->HeapStackTop;
+    Thread->HeapStackTop = (void*)((char*)Thread->HeapStackTop +
         MEM_ALIGN(sizeof(ALIGN_TYPE)));
 }
 
@@ -108,28 +126,156 @@ void HeapPushStackFrame(Picoc *pc)
     frame. can return NULL */
 int HeapPopStackFrame(Picoc *pc)
 {
-    if (*(void**)pc->StackFrame != NULL) {
-        pc->HeapStackTop = pc->StackFrame;
-        pc->StackFrame = *(void**)pc->StackFrame;
+    struct ThreadState *Thread = THREAD(pc);
+
+    if (*(void**)Thread->StackFrame != NULL) {
+        Thread->HeapStackTop = Thread->StackFrame;
+        Thread->StackFrame = *(void**)Thread->StackFrame;
 #ifdef DEBUG_HEAP
         printf("Popping stack frame back to 0x%lx\n",
-            (unsigned long)pc->HeapStackTop);
+            (unsigned long)Thread->HeapStackTop);
 #endif
         return true;
     } else
         return false;
 }
 
+/* allocate from the private heap. a private heap keeps everything inside
+    the stack area, growing down from the top, so the whole instance can be
+    saved as an image */
+static void *HeapAllocPrivate(Picoc *pc, int Size)
+{
+    struct AllocNode *NewMem = NULL;
+    struct AllocNode **FreeNode;
+    unsigned int AllocSize;
+    int Bucket;
+    void *ReturnMem;
+
+    if (Size == 0)
+        return NULL;
+
+    assert(Size > 0);
+
+    /* make sure we have enough space for an AllocNode */
+    AllocSize = MEM_ALIGN(Size) + MEM_ALIGN(sizeof(NewMem->Size));
+    if (AllocSize < sizeof(struct AllocNode))
+        AllocSize = sizeof(struct AllocNode);
+
+    Bucket = AllocSize >> 2;
+    if (Bucket < FREELIST_BUCKETS && pc->FreeListBucket[Bucket] != NULL) {
+        /* try to allocate from a freelist bucket first */
+#ifdef DEBUG_HEAP
+        printf("allocating %d(%d) from bucket", Size, AllocSize);
+#endif
+        NewMem = pc->FreeListBucket[Bucket];
+        pc->FreeListBucket[Bucket] = NewMem->NextFree;
+        NewMem->Size = AllocSize;
+    } else if (pc->FreeListBig != NULL) {
+        /* grab the first item from the "big" freelist we can fit in */
+        for (FreeNode = &pc->FreeListBig;
+                *FreeNode != NULL && (*FreeNode)->Size < AllocSize;
+                FreeNode = &(*FreeNode)->NextFree) {
+        }
+
+        if (*FreeNode != NULL) {
+            NewMem = *FreeNode;
+            if (NewMem->Size - AllocSize < SPLIT_MEM_THRESHOLD) {
+                /* close in size - reduce fragmentation by not splitting */
+                *FreeNode = NewMem->NextFree;
+            } else {
+                /* split this big memory chunk */
+                NewMem = (void*)((char*)NewMem + NewMem->Size - AllocSize);
+                (*FreeNode)->Size -= AllocSize;
+                NewMem->Size = AllocSize;
+            }
+        }
+    }
+
+    if (NewMem == NULL) {
+        /* couldn't allocate from a freelist - try to increase the size
+            of the heap area */
+        if ((char*)pc->HeapBottom - AllocSize <
+                (char*)pc->MainThread.HeapStackTop)
+            return NULL;
+
+        pc->HeapBottom = (void*)((char*)pc->HeapBottom - AllocSize);
+        NewMem = pc->HeapBottom;
+        NewMem->Size = AllocSize;
+    }
+
+    ReturnMem = (void*)((char*)NewMem + MEM_ALIGN(sizeof(NewMem->Size)));
+    memset(ReturnMem, '\0', AllocSize - MEM_ALIGN(sizeof(NewMem->Size)));
+#ifdef DEBUG_HEAP
+    printf("HeapAllocMem(%d) = 0x%lx\n", Size, (unsigned long)ReturnMem);
+#endif
+    return ReturnMem;
+}
+
 /* allocate some dynamically allocated memory. memory is cleared.
     can return NULL if out of memory */
 void *HeapAllocMem(Picoc *pc, int Size)
 {
-    return calloc(Size, 1);
+    void *ReturnMem;
+
+    if (!pc->PrivateHeap)
+        return calloc(Size, 1);
+
+    ThreadLock(pc);
+    ReturnMem = HeapAllocPrivate(pc, Size);
+    ThreadUnlock(pc);
+    return ReturnMem;
+}
+
+/* give memory back to the private heap */
+static void HeapFreePrivate(Picoc *pc, void *Mem)
+{
+    struct AllocNode *MemNode;
+    int Bucket;
+
+    if (Mem == NULL)
+        return;
+
+    MemNode = (struct AllocNode*)((char*)Mem - MEM_ALIGN(sizeof(MemNode->Size)));
+    Bucket = MemNode->Size >> 2;
+#ifdef DEBUG_HEAP
+    printf("HeapFreeMem(0x%lx)\n", (unsigned long)Mem);
+#endif
+    assert((unsigned char*)MemNode >= &(pc->HeapMemory)[0] &&
+        (void*)MemNode >= pc->HeapBottom);
+
+    if ((void*)MemNode == pc->HeapBottom) {
+        /* pop it off the bottom of the heap, reducing the heap size */
+        pc->HeapBottom = (void*)((char*)pc->HeapBottom + MemNode->Size);
+    } else if (Bucket < FREELIST_BUCKETS) {
+        /* we can fit it in a bucket */
+        MemNode->NextFree = pc->FreeListBucket[Bucket];
+        pc->FreeListBucket[Bucket] = MemNode;
+    } else {
+        /* put it in the big memory freelist */
+        MemNode->NextFree = pc->FreeListBig;
+        pc->FreeListBig = MemNode;
+    }
+}
+
+/* how many bytes a block from the private heap really has, which can be
+    more than was asked for */
+int HeapMemSize(void *Mem)
+{
+    struct AllocNode *MemNode;
+
+    MemNode = (struct AllocNode*)((char*)Mem - MEM_ALIGN(sizeof(MemNode->Size)));
+    return MemNode->Size - MEM_ALIGN(sizeof(MemNode->Size));
 }
 
 /* free some dynamically allocated memory */
 void HeapFreeMem(Picoc *pc, void *Mem)
 {
-    free(Mem);
-}
+    if (!pc->PrivateHeap) {
+        free(Mem);
+        return;
+    }
 
+    ThreadLock(pc);
+    HeapFreePrivate(pc, Mem);
+    ThreadUnlock(pc);
+}
@@ -0,0 +1,478 @@
+/* picoc images - a fully initialised instance saved to a file, so that
+ * another process can map it in rather than starting up from scratch.
+ *
+ * an image holds a copy of the Picoc structure and the used parts of its
+ * stack area, which must be a private heap so that nothing the instance
+ * owns lives anywhere else (see PicocInitializeForImage()). pointers aren't
+ * marked in memory so they're found conservatively when saving - any
+ * aligned pointer-sized word, or any at all within the packed tokens, which
+ * points into the old stack area, the old Picoc structure or picoc's own
+ * code and static data gets a relocation. pointers to anything else, like
+ * memory from the guest's malloc() or an open FILE, can't be saved, so the
+ * save fails if the program has any of these or a word looks like a
+ * pointer into the host's heap, or if two pointers found overlap.
+ *
+ * the same parts of an instance are also kept in memory as a reset point,
+ * which PicocReset() copies back to run another program from a clean
+ * state. nothing moves so there's nothing to relocate. the host's part of
+ * the Picoc structure, from ResetPoint on, is left out of both. */
+#include "picoc.h"
+#include "interpreter.h"
+#include "stats.h"
+
+#define IMAGE_ALIGN (65536)     /* a multiple of any page size we'll meet */
+
+/* how much of the Picoc structure is the program's - the rest is the
+    host's, see struct Picoc_Struct */
+#define IMAGE_STATE_SIZE (offsetof(Picoc, ResetPoint))
+
+/* also used to find picoc in memory, and to check it's the same build */
+static const char ImageMagic[16] = "picoc image 1\n";
+
+/* the areas pointers can be in or point to */
+enum ImageArea {
+    ImageAreaHeap,              /* the stack and heap area */
+    ImageAreaPicoc,             /* the Picoc structure itself */
+    ImageAreaProgram,           /* picoc's code and static data */
+    ImageAreaCount
+};
+
+/* a pointer which has to be adjusted on loading */
+struct ImageRelocation {
+    unsigned int Offset;        /* where it is within its area */
+    unsigned char Area;         /* the area it's in */
+    unsigned char Target;       /* the area it points to */
+};
+
+/* the start of an image file. it's followed by the relocations and then,
+    at HeapOffset, by the stack area with the unused part left as a hole */
+struct ImageHeader {
+    char Magic[16];
+    char Version[64];
+    unsigned long ProgramSize;  /* these two check it's the same picoc build */
+    unsigned long ProgramOffset;
+    unsigned long Base[ImageAreaCount];     /* where the areas were saved from */
+    unsigned long Size[ImageAreaCount];
+    unsigned long NumRelocations;
+    unsigned long HeapOffset;
+    unsigned long MappingSize;
+    Picoc State;
+};
+
+/* part of the stack area, as offsets from its start */
+struct ImageRange {
+    unsigned long From;
+    unsigned long To;
+};
+
+/* what's needed while looking for pointers to save */
+struct ImageScanner {
+    FILE *ImageFile;
+    struct ImageHeader *Header;
+    struct ImageRange *Tokens;      /* the blocks of tokens, in order */
+    int NumTokens;
+    unsigned long HostHeapBase;     /* where the host's malloc() heap is */
+    unsigned long HostHeapSize;
+    unsigned long NumRelocations;
+    const char *Error;              /* why the image can't be saved */
+};
+
+/* the state to go back to on a reset */
+struct ResetPoint {
+    Picoc State;
+    unsigned long StackUsed;
+    unsigned long HeapUsedFrom;
+    unsigned char Memory[1];    /* the used stack and then the used heap */
+};
+
+
+/* find the pointers in some memory and write relocations for them.
+    returns false, with the reason in Scanner->Error, if it finds one which
+    can't be saved */
+static int ImageScan(struct ImageScanner *Scanner, enum ImageArea Area,
+    unsigned char *Mem, unsigned long From, unsigned long To)
+{
+    struct ImageHeader *Header = Scanner->Header;
+    struct ImageRange *Tokens = Scanner->Tokens;
+    struct ImageRange *TokensEnd = &Scanner->Tokens[Scanner->NumTokens];
+    unsigned long Offset;
+    unsigned long RelocatedTo = From;   /* the end of the last pointer */
+    unsigned long Ptr;
+    struct ImageRelocation Relocation;
+    int Target;
+
+    for (Offset = From; Offset + sizeof(Ptr) <= To; Offset++) {
+        /* only tokens have pointers which aren't aligned */
+        if (Area == ImageAreaHeap) {
+            while (Tokens < TokensEnd && Tokens->To <= Offset)
+                Tokens++;
+        }
+
+        if ((Header->Base[Area] + Offset) % sizeof(Ptr) != 0 &&
+                (Area != ImageAreaHeap || Tokens == TokensEnd ||
+                Offset < Tokens->From))
+            continue;
+
+        memcpy(&Ptr, &Mem[Offset], sizeof(Ptr));
+        for (Target = 0; Target < ImageAreaCount; Target++) {
+            if (Ptr >= Header->Base[Target] &&
+                    Ptr - Header->Base[Target] <= Header->Size[Target])
+                break;
+        }
+
+        if (Target == ImageAreaCount) {
+            if (Ptr - Scanner->HostHeapBase < Scanner->HostHeapSize) {
+                Scanner->Error = "it points to memory outside the instance";
+                return false;
+            }
+
+            continue;
+        }
+
+        if (Offset < RelocatedTo) {
+            Scanner->Error = "it has pointers which overlap";
+            return false;
+        }
+
+        Relocation.Offset = Offset;
+        Relocation.Area = Area;
+        Relocation.Target = Target;
+        fwrite(&Relocation, sizeof(Relocation), 1, Scanner->ImageFile);
+        Scanner->NumRelocations++;
+        RelocatedTo = Offset + sizeof(Ptr);
+    }
+
+    return true;
+}
+
+static int ImageRangeCompare(const void *A, const void *B)
+{
+    const struct ImageRange *RangeA = A;
+    const struct ImageRange *RangeB = B;
+
+    return (RangeA->From > RangeB->From) - (RangeA->From < RangeB->From);
+}
+
+/* add a block of tokens to the list of them if it's in the stack area */
+static void ImageAddTokens(Picoc *pc, struct ImageScanner *Scanner,
+    void *Tokens)
+{
+    struct ImageRange *Range = &Scanner->Tokens[Scanner->NumTokens];
+
+    if ((unsigned char*)Tokens < pc->HeapMemory ||
+            (unsigned char*)Tokens >= &pc->HeapMemory[pc->HeapSize])
+        return;
+
+    Range->From = (unsigned char*)Tokens - pc->HeapMemory;
+    Range->To = Range->From + HeapMemSize(Tokens);
+    Scanner->NumTokens++;
+}
+
+/* find the blocks of tokens the program was parsed into. returns false if
+    there's no memory for the list */
+static int ImageFindTokens(Picoc *pc, struct ImageScanner *Scanner)
+{
+    struct CleanupTokenNode *Node;
+    struct TokenLine *Line;
+    int Count = 0;
+
+    for (Node = pc->CleanupTokenList; Node != NULL; Node = Node->Next)
+        Count++;
+    for (Line = pc->InteractiveHead; Line != NULL; Line = Line->Next)
+        Count++;
+
+    Scanner->Tokens = malloc(sizeof(struct ImageRange) * (Count + 1));
+    if (Scanner->Tokens == NULL)
+        return false;
+
+    for (Node = pc->CleanupTokenList; Node != NULL; Node = Node->Next)
+        ImageAddTokens(pc, Scanner, Node->Tokens);
+    for (Line = pc->InteractiveHead; Line != NULL; Line = Line->Next)
+        ImageAddTokens(pc, Scanner, Line->Tokens);
+
+    qsort(Scanner->Tokens, Scanner->NumTokens, sizeof(struct ImageRange),
+        &ImageRangeCompare);
+    return true;
+}
+
+/* save an instance to an image file. it must have been initialized with
+    PicocInitializeForImage() and can't be running a function */
+void PicocSaveImage(Picoc *pc, const char *FileName)
+{
+    struct ImageHeader *Header;
+    FILE *ImageFile;
+    unsigned long StackUsed = (char*)pc->MainThread.HeapStackTop - (char*)pc->HeapMemory;
+    unsigned long HeapUsedFrom = (char*)pc->HeapBottom - (char*)pc->HeapMemory;
+    unsigned long RelocationsEnd;
+    unsigned long ProgramBase;
+    unsigned long ProgramSize;
+    struct ImageScanner Scanner;
+
+    if (!pc->PrivateHeap)
+        ProgramFailNoParser(pc, "can't save an image - use PicocInitializeForImage()\n");
+
+    if (pc->MainThread.TopStackFrame != NULL)
+        ProgramFailNoParser(pc, "can't save an image while a function is running\n");
+
+    if (StdlibHasResources(pc))
+        ProgramFailNoParser(pc, "can't save an image while the program has "
+            "memory from malloc() or an open file\n");
+
+    if (!PlatformImageRange((void*)&ImageMagic[0], &ProgramBase, &ProgramSize))
+        ProgramFailNoParser(pc, "images aren't supported on this platform\n");
+
+    memset(&Scanner, '\0', sizeof(Scanner));
+    if (!PlatformHostHeapRange(&Scanner.HostHeapBase, &Scanner.HostHeapSize))
+        Scanner.HostHeapSize = 0;
+
+    Header = calloc(1, sizeof(*Header));
+    if (Header == NULL || !ImageFindTokens(pc, &Scanner)) {
+        free(Header);
+        ProgramFailNoParser(pc, "out of memory\n");
+    }
+
+    ImageFile = fopen(FileName, "wb");
+    if (ImageFile == NULL) {
+        free(Header);
+        free(Scanner.Tokens);
+        ProgramFailNoParser(pc, "can't write image %s\n", FileName);
+    }
+
+    memcpy(Header->Magic, ImageMagic, sizeof(ImageMagic));
+    strncpy(Header->Version, PICOC_VERSION, sizeof(Header->Version) - 1);
+    Header->ProgramSize = ProgramSize;
+    Header->ProgramOffset = (unsigned long)&ImageMagic[0] - ProgramBase;
+    Header->Base[ImageAreaHeap] = (unsigned long)pc->HeapMemory;
+    Header->Size[ImageAreaHeap] = pc->HeapSize;
+    Header->Base[ImageAreaPicoc] = (unsigned long)pc;
+    Header->Size[ImageAreaPicoc] = sizeof(Picoc);
+    Header->Base[ImageAreaProgram] = ProgramBase;
+    Header->Size[ImageAreaProgram] = ProgramSize;
+
+    /* the host's part, like the exit point, belongs to whoever loads the
+        image, so it's left zeroed */
+    memcpy(&Header->State, pc, IMAGE_STATE_SIZE);
+    Header->State.HostCalls = 0;
+    Header->State.HostCallTopStackFrame = NULL;
+    Header->State.HostCallStackFrame = NULL;
+    Header->State.HostCallHeapStackTop = NULL;
+    Header->State.MainThread.TaskCountdown = 0;
+
+    /* the relocations follow the header */
+    fseek(ImageFile, sizeof(*Header), SEEK_SET);
+    Scanner.ImageFile = ImageFile;
+    Scanner.Header = Header;
+    if (!ImageScan(&Scanner, ImageAreaPicoc, (unsigned char*)&Header->State,
+                0, sizeof(Picoc)) ||
+            !ImageScan(&Scanner, ImageAreaHeap, pc->HeapMemory, 0,
+                StackUsed) ||
+            !ImageScan(&Scanner, ImageAreaHeap, pc->HeapMemory, HeapUsedFrom,
+                pc->HeapSize)) {
+        fclose(ImageFile);
+        remove(FileName);
+        free(Header);
+        free(Scanner.Tokens);
+        ProgramFailNoParser(pc, "can't save an image - %s\n", Scanner.Error);
+    }
+
+    free(Scanner.Tokens);
+    Header->NumRelocations = Scanner.NumRelocations;
+
+    /* put the stack area at the same offset within a page as it was in
+        memory, so it can be mapped back at the same address */
+    RelocationsEnd = sizeof(*Header) +
+        Header->NumRelocations * sizeof(struct ImageRelocation);
+    Header->HeapOffset = (RelocationsEnd + IMAGE_ALIGN - 1) / IMAGE_ALIGN *
+        IMAGE_ALIGN + Header->Base[ImageAreaHeap] % IMAGE_ALIGN;
+    Header->MappingSize = Header->HeapOffset + pc->HeapSize;
+
+    fseek(ImageFile, Header->HeapOffset, SEEK_SET);
+    fwrite(pc->HeapMemory, 1, StackUsed, ImageFile);
+    fseek(ImageFile, Header->HeapOffset + HeapUsedFrom, SEEK_SET);
+    fwrite(&pc->HeapMemory[HeapUsedFrom], 1, pc->HeapSize - HeapUsedFrom,
+        ImageFile);
+
+    fseek(ImageFile, 0, SEEK_SET);
+    fwrite(Header, sizeof(*Header), 1, ImageFile);
+    free(Header);
+
+    if (ferror(ImageFile) | fclose(ImageFile))
+        ProgramFailNoParser(pc, "can't write image %s\n", FileName);
+}
+
+/* re-hash the members of every struct and union */
+static void ImageRehashTypes(struct ValueType *Typ)
+{
+    for (; Typ != NULL; Typ = Typ->Next) {
+        if (Typ->Members != NULL)
+            TableRehash(Typ->Members);
+
+        ImageRehashTypes(Typ->DerivedTypeList);
+    }
+}
+
+/* reconnect a loaded instance to this process */
+static void ImageRebind(Picoc *pc, int HeapMoved)
+{
+    struct IncludeLibrary *ThisInclude;
+
+    /* tables are hashed on the addresses of their keys */
+    if (HeapMoved) {
+        TableRehash(&pc->GlobalTable);
+        TableRehash(&pc->StringLiteralTable);
+        TableRehash(&pc->ReservedWordTable);
+        TableRehash(&pc->ConstantTable);
+        TableRehash(&pc->LibraryConstantTable);
+        ImageRehashTypes(pc->UberType.DerivedTypeList);
+    }
+
+    /* point platform variables at this process's copies, by running the
+        setup for the libraries again */
+    pc->ImageRebind = true;
+    PlatformInit(pc);
+    BasicIOInit(pc);
+    LibraryInit(pc);
+    for (ThisInclude = pc->IncludeLibList; ThisInclude != NULL;
+            ThisInclude = ThisInclude->NextLib) {
+        if (ThisInclude->SetupFunction != NULL &&
+                VariableDefined(pc, ThisInclude->IncludeName))
+            (*ThisInclude->SetupFunction)(pc);
+    }
+    pc->ImageRebind = false;
+}
+
+/* initialize an instance from an image file instead of with
+    PicocInitialize(). returns false if the image can't be used with this
+    build of picoc */
+int PicocLoadImage(Picoc *pc, const char *FileName)
+{
+    struct ImageHeader Header;
+    struct ImageHeader *Mapped;
+    struct ImageRelocation *Relocation;
+    FILE *ImageFile;
+    unsigned long NewBase[ImageAreaCount];
+    unsigned long ProgramBase;
+    unsigned long ProgramSize;
+    unsigned long Ptr;
+    unsigned long Count;
+    unsigned char *Area;
+
+    /* check the header before mapping anything */
+    ImageFile = fopen(FileName, "rb");
+    if (ImageFile == NULL)
+        return false;
+
+    Count = fread(&Header, 1, sizeof(Header), ImageFile);
+    fclose(ImageFile);
+    if (Count != sizeof(Header) ||
+            memcmp(Header.Magic, ImageMagic, sizeof(ImageMagic)) != 0 ||
+            strncmp(Header.Version, PICOC_VERSION, sizeof(Header.Version) - 1) != 0 ||
+            !PlatformImageRange((void*)&ImageMagic[0], &ProgramBase, &ProgramSize) ||
+            Header.ProgramSize != ProgramSize ||
+            Header.ProgramOffset != (unsigned long)&ImageMagic[0] - ProgramBase ||
+            Header.Size[ImageAreaPicoc] != sizeof(Picoc))
+        return false;
+
+    Mapped = PlatformMapImage(FileName,
+        (void*)(Header.Base[ImageAreaHeap] - Header.HeapOffset),
+        Header.MappingSize);
+    if (Mapped == NULL)
+        return false;
+
+    memcpy(pc, &Mapped->State, sizeof(Picoc));
+    NewBase[ImageAreaHeap] = (unsigned long)Mapped + Header.HeapOffset;
+    NewBase[ImageAreaPicoc] = (unsigned long)pc;
+    NewBase[ImageAreaProgram] = ProgramBase;
+
+    /* adjust the pointers */
+    Relocation = (struct ImageRelocation*)&Mapped[1];
+    for (Count = 0; Count < Header.NumRelocations; Count++, Relocation++) {
+        if (Relocation->Area >= ImageAreaCount ||
+                Relocation->Target >= ImageAreaCount ||
+                Relocation->Offset + sizeof(Ptr) > Header.Size[Relocation->Area] ||
+                (Relocation->Area == ImageAreaPicoc &&
+                Relocation->Offset % sizeof(Ptr) != 0)) {
+            PlatformUnmapImage(Mapped, Header.MappingSize);
+            memset(pc, '\0', sizeof(Picoc));
+            return false;
+        }
+
+        if (NewBase[Relocation->Target] == Header.Base[Relocation->Target])
+            continue;   /* it's at the same address - leave the page alone */
+
+        Area = (Relocation->Area == ImageAreaPicoc) ? (unsigned char*)pc :
+            (unsigned char*)NewBase[ImageAreaHeap];
+        memcpy(&Ptr, &Area[Relocation->Offset], sizeof(Ptr));
+        Ptr = Ptr - Header.Base[Relocation->Target] +
+            NewBase[Relocation->Target];
+        memcpy(&Area[Relocation->Offset], &Ptr, sizeof(Ptr));
+    }
+
+    pc->ImageMapping = Mapped;
+    pc->ImageMappingSize = Header.MappingSize;
+    ImageRebind(pc, NewBase[ImageAreaHeap] != Header.Base[ImageAreaHeap]);
+    PicocSetResetPoint(pc);
+
+    return true;
+}
+
+/* remember the current state of an instance for PicocReset(). it must
+    have been initialized with PicocInitializeForImage() or loaded from an
+    image, either of which sets a reset point to begin with */
+void PicocSetResetPoint(Picoc *pc)
+{
+    struct ResetPoint *Reset;
+    unsigned long StackUsed = (char*)pc->MainThread.HeapStackTop - (char*)pc->HeapMemory;
+    unsigned long HeapUsedFrom = (char*)pc->HeapBottom - (char*)pc->HeapMemory;
+
+    if (!pc->PrivateHeap)
+        ProgramFailNoParser(pc, "can't set a reset point - use PicocInitializeForImage()\n");
+
+    if (pc->MainThread.TopStackFrame != NULL)
+        ProgramFailNoParser(pc, "can't set a reset point while a function is running\n");
+
+    Reset = malloc(sizeof(*Reset) + StackUsed + pc->HeapSize - HeapUsedFrom);
+    if (Reset == NULL)
+        ProgramFailNoParser(pc, "out of memory\n");
+
+    free(pc->ResetPoint);
+    pc->ResetPoint = NULL;
+    StdlibKeepResources(pc);
+    memcpy(&Reset->State, pc, IMAGE_STATE_SIZE);
+    Reset->StackUsed = StackUsed;
+    Reset->HeapUsedFrom = HeapUsedFrom;
+    memcpy(&Reset->Memory[0], pc->HeapMemory, StackUsed);
+    memcpy(&Reset->Memory[StackUsed], &pc->HeapMemory[HeapUsedFrom],
+        pc->HeapSize - HeapUsedFrom);
+    pc->ResetPoint = Reset;
+}
+
+/* put an instance back to its reset point, throwing away everything since
+    then - globals, functions, types, tokens and the stack. the string
+    table, libraries and anything else set up before the reset point are
+    kept, and so is the host's part of the instance - the exit point, stats
+    settings, stats collected so far, profiling samples and any task. any
+    threads the program started are stopped first, and the blocks it
+    allocated and FILEs it opened since the reset point are freed and
+    closed */
+void PicocReset(Picoc *pc)
+{
+    struct ResetPoint *Reset = pc->ResetPoint;
+    long TaskCountdown = pc->MainThread.TaskCountdown;
+
+    if (Reset == NULL)
+        ProgramFailNoParser(pc, "can't reset - use PicocInitializeForImage()\n");
+
+    ThreadCleanup(pc);
+    StdlibReleaseResources(pc, false);
+
+    memcpy(pc, &Reset->State, IMAGE_STATE_SIZE);
+    memcpy(pc->HeapMemory, &Reset->Memory[0], Reset->StackUsed);
+    memcpy(&pc->HeapMemory[Reset->HeapUsedFrom],
+        &Reset->Memory[Reset->StackUsed], pc->HeapSize - Reset->HeapUsedFrom);
+
+    /* a task keeps its place in the slice it's running */
+    pc->MainThread.TaskCountdown = TaskCountdown;
+    ProfileReset(pc);
+    stats_reset(pc);
+}
@@ -8,18 +8,30 @@
 /* initialize the built-in include libraries */
 void IncludeInit(Picoc *pc)
 {
-    IncludeRegister(pc, "ctype.h", NULL, &StdCtypeFunctions[0], NULL);
-    IncludeRegister(pc, "errno.h", &StdErrnoSetupFunc, NULL, NULL);
+    IncludeRegister(pc, "ctype.h", NULL, &StdCtypeFunctions[0], NULL, NULL);
+    IncludeRegister(pc, "errno.h", &StdErrnoSetupFunc, NULL,
+        &StdErrnoConstants[0], NULL);
 # ifndef NO_FP
-    IncludeRegister(pc, "math.h", &MathSetupFunc, &MathFunctions[0], NULL);
+    IncludeRegister(pc, "math.h", NULL, &MathFunctions[0],
+        &MathConstants[0], NULL);
 # endif
-    IncludeRegister(pc, "stdbool.h", &StdboolSetupFunc, NULL, StdboolDefs);
-    IncludeRegister(pc, "stdio.h", &StdioSetupFunc, &StdioFunctions[0], StdioDefs);
-    IncludeRegister(pc, "stdlib.h", &StdlibSetupFunc, &StdlibFunctions[0], NULL);
-    IncludeRegister(pc, "string.h", &StringSetupFunc, &StringFunctions[0], NULL);
-    IncludeRegister(pc, "time.h", &StdTimeSetupFunc, &StdTimeFunctions[0], StdTimeDefs);
+    IncludeRegister(pc, "stdbool.h", NULL, NULL, &StdboolConstants[0],
+        StdboolDefs);
+    IncludeRegister(pc, "stdio.h", &StdioSetupFunc, &StdioFunctions[0],
+        &StdioConstants[0], StdioDefs);
+    IncludeRegister(pc, "stdlib.h", NULL, &StdlibFunctions[0],
+        &StdlibConstants[0], NULL);
+    IncludeRegister(pc, "string.h", NULL, &StringFunctions[0],
+        &StringConstants[0], NULL);
+    IncludeRegister(pc, "time.h", &StdTimeSetupFunc, &StdTimeFunctions[0],
+        &StdTimeConstants[0], StdTimeDefs);
 # ifndef WIN32
-    IncludeRegister(pc, "unistd.h", &UnistdSetupFunc, &UnistdFunctions[0], UnistdDefs);
+    IncludeRegister(pc, "unistd.h", &UnistdSetupFunc, &UnistdFunctions[0],
+        &UnistdConstants[0], UnistdDefs);
+    IncludeRegister(pc, "pthread.h", &PthreadSetupFunc, &PthreadFunctions[0],
+        &PthreadConstants[0], PthreadDefs);
+    IncludeRegister(pc, "dlfcn.h", NULL, &DlfcnFunctions[0],
+        &DlfcnConstants[0], NULL);
 # endif
 }
 
@@ -40,13 +52,27 @@ void IncludeCleanup(Picoc *pc)
 
 /* register a new build-in include file */
 void IncludeRegister(Picoc *pc, const char *IncludeName,
-    void (*SetupFunction)(Picoc *pc), struct LibraryFunction *FuncList,
-    const char *SetupCSource)
+    void (*SetupFunction)(Picoc *pc), const struct LibraryFunction *FuncList,
+    const struct LibraryConstant *ConstList, const char *SetupCSource)
 {
     struct IncludeLibrary *NewLib = HeapAllocMem(pc, sizeof(struct IncludeLibrary));
+    const struct LibraryConstant *Constant;
+
+    /* the lexer marks these names wherever they're used, and they only
+        become constants once the library's included. names shared between
+        libraries, like NULL, are only added once */
+    if (ConstList != NULL) {
+        for (Constant = ConstList; Constant->Name != NULL; Constant++)
+            TableSet(pc, &pc->LibraryConstantTable,
+                TableStrRegister(pc, Constant->Name),
+                (struct Value*)Constant, NULL, 0, 0);
+    }
+
     NewLib->IncludeName = TableStrRegister(pc, IncludeName);
     NewLib->SetupFunction = SetupFunction;
     NewLib->FuncList = FuncList;
+    NewLib->ConstList = ConstList;
+    NewLib->ConstantsAdded = false;
     NewLib->SetupCSource = SetupCSource;
     NewLib->NextLib = pc->IncludeLibList;
     pc->IncludeLibList = NewLib;
@@ -61,6 +87,35 @@ void PicocIncludeAllSystemHeaders(Picoc *pc)
         IncludeFile(pc, ThisInclude->IncludeName);
 }
 
+/* make a predefined library's constants visible to the program. the
+    lexer's already marked the names which might be constants, so this is
+    done when the #include is parsed rather than when it's tokenised, and
+    an #include which an #if leaves out adds nothing */
+static void IncludeAddConstants(Picoc *pc, const char *FileName)
+{
+    struct IncludeLibrary *LInclude;
+    const struct LibraryConstant *Constant;
+
+    for (LInclude = pc->IncludeLibList; LInclude != NULL;
+            LInclude = LInclude->NextLib) {
+        if (strcmp(LInclude->IncludeName, FileName) == 0) {
+            if (LInclude->ConstList == NULL || LInclude->ConstantsAdded)
+                return;
+
+            /* constants such as NULL are shared between several
+                libraries, so duplicates are quietly ignored */
+            for (Constant = LInclude->ConstList; Constant->Name != NULL;
+                    Constant++)
+                TableSet(pc, &pc->ConstantTable,
+                    TableStrRegister(pc, Constant->Name),
+                    (struct Value*)Constant, NULL, 0, 0);
+
+            LInclude->ConstantsAdded = true;
+            return;
+        }
+    }
+}
+
 /* include one of a number of predefined libraries, or perhaps an actual file */
 void IncludeFile(Picoc *pc, char *FileName)
 {
@@ -75,6 +130,9 @@ void IncludeFile(Picoc *pc, char *FileName)
             if (!VariableDefined(pc, FileName)) {
                 VariableDefine(pc, NULL, FileName, NULL, &pc->VoidType, false);
 
+                /* define any constants */
+                IncludeAddConstants(pc, FileName);
+
                 /* run an extra startup function if there is one */
                 if (LInclude->SetupFunction != NULL)
                     (*LInclude->SetupFunction)(pc);
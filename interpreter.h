@@ -190,9 +190,16 @@ enum LexToken {
                TokenVolatileType,
                TokenHashPragma,
                TokenUnderscorePragma,
-               TokenConstType
+               TokenConstType,
+    /* only in tokenised code - an identifier which names a library
+        constant, which LexGetRawToken() turns into the constant if the
+        library's been included */
+               TokenLibraryConstant
 };
 
+/* the operators, which are the tokens before this, can be fused in pairs */
+#define FUSION_OPERATORS (TokenOpenBracket)
+
 /* used in dynamic memory allocation */
 struct AllocNode {
     unsigned int Size;
@@ -210,6 +217,21 @@ enum RunMode {
     RunModeGoto                 /* searching for a goto label */
 };
 
+/* what the cost profile counts, see profile.c */
+enum ProfileCost {
+    CostStatements,             /* statements run */
+    CostTokens,                 /* tokens fetched by LexGetToken() */
+    CostExpressions,            /* operators evaluated */
+    CostStackBytes,             /* bytes of variables put on the stack */
+    CostSkipTokens,             /* tokens fetched in each run mode but */
+    CostReturnTokens,           /* RunModeRun, in the same order */
+    CostCaseSearchTokens,
+    CostBreakTokens,
+    CostContinueTokens,
+    CostGotoTokens,
+    CostKinds
+};
+
 /* parser state - has all this detail so we can parse nested files */
 struct ParseState {
     Picoc *pc;                  /* the picoc instance this parser is a part of */
@@ -225,6 +247,7 @@ struct ParseState {
     short int HashIfEvaluateToLevel;    /* if we're not evaluating an if branch,
                                           what the last evaluated level was */
     char DebugMode;             /* debugging mode */
+    char Stats;                 /* what stats are collected, see stats.h */
     int ScopeID;   /* for keeping track of local variables (free them after t
                       hey go out of scope) */
 };
@@ -279,6 +302,8 @@ struct FuncDef {
     struct ValueType **ParamType;   /* array of parameter types */
     char **ParamName;               /* array of parameter names */
     void (*Intrinsic)();            /* intrinsic call address or NULL */
+    void (*Native)(void);           /* native function bound with dlbind()
+                                        or NULL */
     struct ParseState Body;         /* lexical tokens of the function body if
                                         not intrinsic */
 };
@@ -369,13 +394,40 @@ struct StackFrame {
     struct StackFrame *PreviousStackFrame;  /* the next lower stack frame */
 };
 
+/* a program function a library function calls over and over, like a
+    qsort() comparison. its stack frame is only set up once */
+#define CALLBACK_MAX_PARAMS (4)
+struct Callback {
+    struct ParseState Parser;       /* the library function's caller */
+    struct FuncDef *Func;
+    struct Value *ReturnValue;
+    struct Value *Param[CALLBACK_MAX_PARAMS];   /* set these before each call */
+};
+
+/* a "#pragma picoc parallel for" loop, see ParseParallelFor() */
+#define PARALLEL_MAX_REDUCTIONS (8)
+struct ParallelLoop {
+    struct ParseState Body;         /* the statement run for each iteration */
+    const char *FuncName;           /* the function the loop's in */
+    struct Table *Locals;           /* its locals, or NULL outside a function */
+    char *Ident;                    /* the loop variable */
+    struct ValueType *IdentType;
+    long long Start;                /* the first iteration */
+    long long End;                  /* one past the last */
+    int NumThreads;                 /* from num_threads(), or 0 for one per core */
+    int NumReductions;
+    char *Reduction[PARALLEL_MAX_REDUCTIONS];       /* reduction(+:...) */
+    struct Value *ReductionValue[PARALLEL_MAX_REDUCTIONS];
+};
+
 /* lexer state */
 enum LexMode {
     LexModeNormal,
     LexModeHashInclude,
     LexModeHashDefine,
     LexModeHashDefineSpace,
-    LexModeHashDefineSpaceIdent
+    LexModeHashDefineSpaceIdent,
+    LexModeHashIfdef
 };
 
 struct LexState {
@@ -395,6 +447,15 @@ struct LibraryFunction {
     const char *Prototype;
 };
 
+/* library constant definition - the lexer turns these into literals
+    rather than them being defined as variables */
+struct LibraryConstant {
+    const char *Name;
+    enum BaseType Base;         /* TypeInt or TypeDouble */
+    int IntValue;
+    double FPValue;
+};
+
 /* output stream-type specific state information */
 union OutputStreamInfo {
     struct StringOutputStream {
@@ -434,7 +495,9 @@ struct TokenLine {
 struct IncludeLibrary {
     char *IncludeName;
     void (*SetupFunction)(Picoc *pc);
-    struct LibraryFunction *FuncList;
+    const struct LibraryFunction *FuncList;
+    const struct LibraryConstant *ConstList;
+    int ConstantsAdded;
     const char *SetupCSource;
     struct IncludeLibrary *NextLib;
 };
@@ -443,6 +506,22 @@ struct IncludeLibrary {
 #define SPLIT_MEM_THRESHOLD (16)    /* don't split memory which is close in size */
 #define BREAKPOINT_TABLE_SIZE (21)
 
+/* the parts of an instance which each thread running the program has its
+    own copy of. THREAD() finds the one for the current thread */
+struct ThreadState {
+    struct StackFrame *TopStackFrame;
+    void *StackFrame;           /* the current stack frame */
+    void *HeapStackTop;         /* the top of the stack */
+    void *StackStart;           /* the bottom of this thread's stack area */
+    void *StackEnd;             /* its top, or NULL to grow up to the heap */
+    union AnyValue LexAnyValue;
+    struct Value LexValue;
+    long TaskCountdown;         /* statements until the task looks at its slice */
+#if defined(UNIX_HOST) || defined(WIN32)
+    jmp_buf ExitBuf;            /* where a thread the program started ends */
+#endif
+};
+
 
 /* the entire state of the picoc system */
 struct Picoc_Struct {
@@ -456,17 +535,20 @@ struct Picoc_Struct {
     struct TokenLine *InteractiveTail;
     struct TokenLine *InteractiveCurrentLine;
     int LexUseStatementPrompt;
-    union AnyValue LexAnyValue;
-    struct Value LexValue;
     struct Table ReservedWordTable;
     struct TableEntry *ReservedWordHashTable[RESERVED_WORD_TABLE_SIZE];
+    struct Table ConstantTable;     /* the included libraries' constants */
+    struct TableEntry *ConstantHashTable[CONSTANT_TABLE_SIZE];
+    struct Table LibraryConstantTable;  /* every library's constants */
+    struct TableEntry *LibraryConstantHashTable[CONSTANT_TABLE_SIZE];
 
     /* the table of string literal values */
     struct Table StringLiteralTable;
     struct TableEntry *StringLiteralHashTable[STRING_LITERAL_TABLE_SIZE];
 
-    /* the stack */
-    struct StackFrame *TopStackFrame;
+    /* the stack, stack frames and anything else the main thread has to
+        itself */
+    struct ThreadState MainThread;
 
     /* the value passed to exit() */
     int PicocExitValue;
@@ -477,11 +559,26 @@ struct Picoc_Struct {
     /* heap memory */
     unsigned char *HeapMemory;  /* stack memory since our heap is malloc()ed */
     void *HeapBottom;           /* the bottom of the (downward-growing) heap */
-    void *StackFrame;           /* the current stack frame */
-    void *HeapStackTop;         /* the top of the stack */
 
     struct AllocNode *FreeListBucket[FREELIST_BUCKETS]; /* we keep a pool of freelist buckets to reduce fragmentation */
     struct AllocNode *FreeListBig;    /* free memory which doesn't fit in a bucket */
+    int HeapSize;               /* the size of the stack and heap area */
+    int PrivateHeap;            /* allocate from the stack area instead of malloc() */
+
+    /* images */
+    void *ImageMapping;         /* the image file we're mapped from, if any */
+    size_t ImageMappingSize;
+    int ImageRebind;            /* redefining platform variables after loading */
+
+    /* functions the host is calling, see PicocCallFunction(). the stack's
+        put back as it was before the outermost call if the call fails */
+    int HostCalls;
+    struct StackFrame *HostCallTopStackFrame;
+    void *HostCallStackFrame;
+    void *HostCallHeapStackTop;
+
+    /* the ID the next thread the program starts gets, see thread.c */
+    int NextThreadID;
 
     /* types */
     struct ValueType UberType;
@@ -507,16 +604,26 @@ struct Picoc_Struct {
     struct ValueType *CharPtrPtrType;
     struct ValueType *CharArrayType;
     struct ValueType *VoidPtrType;
+    char StructTempName[7];     /* names for anonymous structs and enums */
+    char EnumTempName[7];
 
     /* debugger */
     struct Table BreakpointTable;
     struct TableEntry *BreakpointHashTable[BREAKPOINT_TABLE_SIZE];
     int BreakpointCount;
-    int DebugManualBreak;
+    int DebugBreakCount;        /* break signals we've already handled */
 
     /* C library */
     int BigEndian;
     int LittleEndian;
+    FILE *StdinValue;
+    FILE *StdoutValue;
+    FILE *StderrValue;
+    char *StrtokLast;           /* where strtok() got to */
+    unsigned int RandSeed;      /* the state of rand() */
+    struct StdioFormat *PrintfFormats[PRINTF_FORMAT_TABLE_SIZE];  /* compiled printf() formats, see stdio.c */
+    struct tm TimeValue;        /* returned by gmtime() and localtime() */
+    char TimeString[26];        /* returned by asctime() and ctime() */
 
     IOFILE *CStdOut;
     IOFILE CStdOutBase;
@@ -524,24 +631,61 @@ struct Picoc_Struct {
     /* the picoc version string */
     const char *VersionString;
 
+    /* string table */
+    struct Table StringTable;
+    struct TableEntry *StringHashTable[STRING_TABLE_SIZE];
+    char *StrEmpty;
+
+    /* everything from here on belongs to the host, or lasts only as long
+        as one program's run, so PicocReset() keeps it as it is. a reset
+        point is just the part of the structure before ResetPoint */
+    void *ResetPoint;           /* the state PicocReset() goes back to */
+
     /* exit longjump buffer */
 #if defined(UNIX_HOST) || defined(WIN32)
     jmp_buf PicocExitBuf;
 #endif
 
-    /* string table */
-    struct Table StringTable;
-    struct TableEntry *StringHashTable[STRING_TABLE_SIZE];
-    char *StrEmpty;
+    /* tasks */
+    struct PicocTask *Task;     /* running a slice at a time, see task.c */
+
+    /* threads the program has started, see thread.c. they're all stopped
+        before a reset */
+    struct ProgramThread *Threads;
+    void *SharedLock;           /* held while changing anything shared */
+    void *ThreadFinished;       /* signalled when a thread finishes */
+    volatile int ThreadsExiting;    /* the program's ending */
+    struct ParallelPool *Parallel;  /* threads for parallel for loops */
+
+    /* blocks and FILEs the program hasn't given back, see stdlib.c. those
+        since the reset point are given back by a reset */
+    struct StdlibResources *Resources;
 
     /* stats */
     int CollectStats;
     int CollectFullExpressions;
+    int CollectExpressionNgrams;
     int PrintStats;
     int PrintExpressions;
     int PrintMemory;
+    int ReportHeapLeaks;        /* list what the program never freed at cleanup */
+    struct StatsState *Stats;   /* what's been collected, see stats.c */
+
+    /* pairs of operators evaluated together, a byte for each pair of the
+        first FUSION_OPERATORS tokens. see PicocLoadExpressionFusions() */
+    unsigned char *ExpressionFusions;
+
+    /* profilers, see profile.c */
+    struct ProfileState *Profile;   /* samples taken */
+    struct CostState *Costs;        /* what each function and line cost */
+    struct TraceState *Trace;       /* calls and loops being written out */
 };
 
+/* the thread running the program - the main thread unless it's one the
+    program started itself */
+extern PLATFORM_THREAD_LOCAL struct ThreadState *ThreadCurrent;
+#define THREAD(pc) (ThreadCurrent != NULL ? ThreadCurrent : &(pc)->MainThread)
+
 /* table.c */
 extern void TableInit(Picoc *pc);
 extern char *TableStrRegister(Picoc *pc, const char *Str);
@@ -556,10 +700,12 @@ extern struct Value *TableDelete(Picoc *pc, struct Table *Tbl, const char *Key);
 extern char *TableSetIdentifier(Picoc *pc, struct Table *Tbl, const char *Ident,
     int IdentLen);
 extern void TableStrFree(Picoc *pc);
+extern void TableRehash(struct Table *Tbl);
 
 /* lex.c */
 extern void LexInit(Picoc *pc);
 extern void LexCleanup(Picoc *pc);
+extern void LexInitValue(struct ThreadState *Thread);
 extern void *LexAnalyse(Picoc *pc, const char *FileName, const char *Source,
     int SourceLen, int *TokenLen);
 extern void LexInitParser(struct ParseState *Parser, Picoc *pc,
@@ -587,13 +733,27 @@ extern void ParserCopyPos(struct ParseState *To, struct ParseState *From);
 extern void ParserCopy(struct ParseState *To, struct ParseState *From);
 
 /* expression.c */
+/* the following is defined in picoc.h:
+ * int PicocLoadExpressionFusions(const char *FileName); */
 extern int ExpressionParse(struct ParseState *Parser, struct Value **Result);
 extern long long ExpressionParseInt(struct ParseState *Parser);
 extern void ExpressionAssign(struct ParseState *Parser, struct Value *DestValue,
     struct Value *SourceValue, int Force, const char *FuncName, int ParamNo, int AllowPointerCoercion);
+extern long long ExpressionAssignInt(struct ParseState *Parser,
+    struct Value *DestValue, long long FromInt, int After);
+extern double ExpressionAssignFP(struct ParseState *Parser,
+    struct Value *DestValue, double FromFP);
 extern long long ExpressionCoerceInteger(struct Value *Val);
 extern unsigned long long ExpressionCoerceUnsignedInteger(struct Value *Val);
 extern double ExpressionCoerceFP(struct Value *Val);
+extern void ExpressionCallFrameAdd(struct ParseState *Parser,
+    const char *FuncName, struct FuncDef *Func, struct Value **Args,
+    int NumArgs, struct Value *ReturnValue, struct Value **Params);
+extern void ExpressionCallBody(struct FuncDef *Func);
+extern void ExpressionCallbackStart(struct ParseState *Parser,
+    struct Callback *Callback, struct Value *FuncValue, int NumParams);
+extern struct Value *ExpressionCallbackRun(struct Callback *Callback);
+extern void ExpressionCallbackEnd(struct Callback *Callback);
 
 /* type.c */
 extern void TypeInit(Picoc *pc);
@@ -625,6 +785,7 @@ extern void ShowBigList(Picoc *pc);
 #endif
 extern void HeapInit(Picoc *pc, int StackSize);
 extern void HeapCleanup(Picoc *pc);
+extern void HeapInitStack(struct ThreadState *Thread, void *Start, void *End);
 extern void *HeapAllocStack(Picoc *pc, int Size);
 extern int HeapPopStack(Picoc *pc, void *Addr, int Size);
 extern void HeapUnpopStack(Picoc *pc, int Size);
@@ -632,6 +793,7 @@ extern void HeapPushStackFrame(Picoc *pc);
 extern int HeapPopStackFrame(Picoc *pc);
 extern void *HeapAllocMem(Picoc *pc, int Size);
 extern void HeapFreeMem(Picoc *pc, void *Mem);
+extern int HeapMemSize(void *Mem);
 
 /* variable.c */
 extern void VariableInit(Picoc *pc);
@@ -663,6 +825,8 @@ extern void VariableGet(Picoc *pc, struct ParseState *Parser, const char *Ident,
     struct Value **LVal);
 extern void VariableDefinePlatformVar(Picoc *pc, struct ParseState *Parser,
     char *Ident, struct ValueType *Typ, union AnyValue *FromValue, int IsWritable);
+extern const char *VariableFuncName(Picoc *pc, struct Value *FuncValue,
+    const char *Default);
 extern void VariableStackFrameAdd(struct ParseState *Parser, const char *FuncName,
     int NumParams);
 extern void VariableStackFramePop(struct ParseState *Parser);
@@ -677,7 +841,7 @@ extern void VariableScopeEnd(struct ParseState *Parser, int ScopeID, int PrevSco
 /* clibrary.c */
 extern void BasicIOInit(Picoc *pc);
 extern void LibraryInit(Picoc *pc);
-extern void LibraryAdd(Picoc *pc, struct LibraryFunction *FuncList);
+extern void LibraryAdd(Picoc *pc, const struct LibraryFunction *FuncList);
 extern void CLibraryInit(Picoc *pc);
 extern void PrintCh(char OutCh, IOFILE *Stream);
 extern void PrintSimpleInt(long long Num, IOFILE *Stream);
@@ -688,12 +852,17 @@ extern void PrintFP(double Num, IOFILE *Stream);
 extern void PrintType(struct ValueType *Typ, IOFILE *Stream);
 extern void LibPrintf(struct ParseState *Parser, struct Value *ReturnValue,
   struct Value **Param, int NumArgs);
+extern int LibraryNativeType(struct ValueType *Typ, int *NumInt, int *NumFP);
+extern void LibraryCallNative(struct ParseState *Parser, struct FuncDef *Func,
+  struct Value *ReturnValue, struct Value **Param, int NumArgs);
 
 /* platform.c */
 /* the following are defined in picoc.h:
  * void PicocCallMain(int argc, char **argv);
  * int PicocPlatformSetExitPoint();
  * void PicocInitialize(int StackSize);
+ * void PicocInitializeForImage(int StackSize);
+ * void PicocSetOutput(FILE *Stream);
  * void PicocCleanup();
  * void PicocPlatformScanFile(const char *FileName);
  * extern int PicocExitValue; */
@@ -705,6 +874,10 @@ extern void AssignFail(struct ParseState *Parser, const char *Format,
 extern void LexFail(Picoc *pc, struct LexState *Lexer, const char *Message, ...);
 extern void PlatformInit(Picoc *pc);
 extern void PlatformCleanup(Picoc *pc);
+extern void PlatformEndHostCalls(Picoc *pc);
+#ifdef DEBUGGER
+extern int PlatformBreakPending(Picoc *pc);
+#endif
 extern char *PlatformGetLine(char *Buf, int MaxLen, const char *Prompt);
 extern int PlatformGetCharacter();
 extern void PlatformPutc(unsigned char OutCh, union OutputStreamInfo *);
@@ -713,13 +886,80 @@ extern void PlatformVPrintf(IOFILE *Stream, const char *Format, va_list Args);
 extern void PlatformExit(Picoc *pc, int ExitVal);
 extern char *PlatformMakeTempName(Picoc *pc, char *TempNameBuffer);
 extern void PlatformLibraryInit(Picoc *pc);
+extern int PlatformImageRange(void *Addr, unsigned long *Base,
+    unsigned long *Size);
+extern int PlatformHostHeapRange(unsigned long *Base, unsigned long *Size);
+extern void *PlatformMapImage(const char *FileName, void *Hint, size_t Size);
+extern void PlatformUnmapImage(void *Mapping, size_t Size);
+extern void *PlatformTaskCreate(Picoc *pc, void (*Entry)(Picoc *pc),
+    int StackSize);
+extern void PlatformTaskEnter(void *Context);
+extern void PlatformTaskLeave(void *Context);
+extern void PlatformTaskFree(void *Context);
+extern unsigned long PlatformMicroseconds(void);
+
+/* image.c */
+/* the following are defined in picoc.h:
+ * void PicocSaveImage(const char *FileName);
+ * int PicocLoadImage(const char *FileName);
+ * void PicocSetResetPoint();
+ * void PicocReset(); */
+
+/* task.c */
+/* the following are defined in picoc.h:
+ * int PicocTaskStart(void (*Body)(Picoc *pc, void *Arg), void *Arg, int StackSize);
+ * int PicocTaskRun(long Statements, long Microseconds);
+ * void PicocTaskYield();
+ * void PicocTaskEnd(); */
+extern void TaskCountdownExpired(Picoc *pc);
+
+/* thread.c */
+extern void ThreadLock(Picoc *pc);
+extern void ThreadUnlock(Picoc *pc);
+extern int ThreadStart(struct ParseState *Parser, struct Value *FuncValue,
+    void *Arg, int *ID);
+extern int ThreadJoin(struct ParseState *Parser, int ID, void **Result);
+extern int ThreadID(Picoc *pc);
+extern void ThreadFinish(Picoc *pc, void *Result);
+extern int ThreadWait(Picoc *pc, void *Cond, void *Mutex);
+extern int ThreadWaitLock(Picoc *pc, void *Mutex);
+extern void ThreadCheck(Picoc *pc);
+extern void ThreadExit(Picoc *pc);
+extern void ThreadStopAll(Picoc *pc);
+extern void ThreadCleanup(Picoc *pc);
+extern void ThreadParallelFor(struct ParseState *Parser,
+    struct ParallelLoop *Loop);
+
+/* profile.c */
+/* the following are defined in picoc.h:
+ * int PicocProfileStart(int Rate);
+ * void PicocProfileStop();
+ * long PicocProfileWrite(FILE *Out);
+ * int PicocProfileCosts();
+ * void PicocProfileWriteCosts(FILE *Table, FILE *Callgrind, const char *Command);
+ * int PicocProfileTrace(FILE *Out);
+ * int PicocProfileTraceStop(); */
+extern volatile sig_atomic_t ProfileDue;
+extern void ProfileSample(struct ParseState *Parser);
+extern void ProfileCostStatement(struct ParseState *Parser);
+extern void ProfileCostToken(struct ParseState *Parser);
+extern void ProfileCostAdd(struct ParseState *Parser, enum ProfileCost Cost,
+    int Amount);
+extern void ProfileCostEntry(struct ParseState *Parser, const char *FuncName);
+extern void ProfileCostExit(struct ParseState *Parser);
+extern void ProfileTraceCall(struct ParseState *Parser, const char *FuncName);
+extern void ProfileTraceLoop(struct ParseState *Parser, const char *Kind,
+    int Line);
+extern void ProfileTraceEnd(struct ParseState *Parser);
+extern void ProfileReset(Picoc *pc);
+extern void ProfileCleanup(Picoc *pc);
 
 /* include.c */
 extern void IncludeInit(Picoc *pc);
 extern void IncludeCleanup(Picoc *pc);
 extern void IncludeRegister(Picoc *pc, const char *IncludeName,
-    void (*SetupFunction)(Picoc *pc), struct LibraryFunction *FuncList,
-    const char *SetupCSource);
+    void (*SetupFunction)(Picoc *pc), const struct LibraryFunction *FuncList,
+    const struct LibraryConstant *ConstList, const char *SetupCSource);
 extern void IncludeFile(Picoc *pc, char *Filename);
 /* the following is defined in picoc.h:
  * void PicocIncludeAllSystemHeaders(); */
@@ -731,44 +971,64 @@ extern void DebugCleanup(Picoc *pc);
 extern void DebugCheckStatement(struct ParseState *Parser);
 extern void DebugSetBreakpoint(struct ParseState *Parser);
 extern int DebugClearBreakpoint(struct ParseState *Parser);
-extern void DebugStep(void)
+extern void DebugStep(void);
 #endif
 
 /* stdio.c */
 extern const char StdioDefs[];
-extern struct LibraryFunction StdioFunctions[];
+extern const struct LibraryFunction StdioFunctions[];
+extern const struct LibraryConstant StdioConstants[];
 extern void StdioSetupFunc(Picoc *pc);
+extern void StdioCleanup(Picoc *pc);
 
 /* math.c */
-extern struct LibraryFunction MathFunctions[];
-extern void MathSetupFunc(Picoc *pc);
+extern const struct LibraryFunction MathFunctions[];
+extern const struct LibraryConstant MathConstants[];
 
 /* string.c */
-extern struct LibraryFunction StringFunctions[];
-extern void StringSetupFunc(Picoc *pc);
+extern const struct LibraryFunction StringFunctions[];
+extern const struct LibraryConstant StringConstants[];
 
 /* stdlib.c */
-extern struct LibraryFunction StdlibFunctions[];
-extern void StdlibSetupFunc(Picoc *pc);
+extern const struct LibraryFunction StdlibFunctions[];
+extern const struct LibraryConstant StdlibConstants[];
+extern void StdlibAddResource(Picoc *pc, void *Pointer, int IsFile);
+extern void StdlibRemoveResource(Picoc *pc, void *Pointer);
+extern int StdlibHasResources(Picoc *pc);
+extern void StdlibKeepResources(Picoc *pc);
+extern void StdlibReleaseResources(Picoc *pc, int All);
 
 /* time.c */
 extern const char StdTimeDefs[];
-extern struct LibraryFunction StdTimeFunctions[];
+extern const struct LibraryFunction StdTimeFunctions[];
+extern const struct LibraryConstant StdTimeConstants[];
 extern void StdTimeSetupFunc(Picoc *pc);
 
 /* errno.c */
+extern const struct LibraryConstant StdErrnoConstants[];
 extern void StdErrnoSetupFunc(Picoc *pc);
 
 /* ctype.c */
-extern struct LibraryFunction StdCtypeFunctions[];
+extern const struct LibraryFunction StdCtypeFunctions[];
 
 /* stdbool.c */
 extern const char StdboolDefs[];
-extern void StdboolSetupFunc(Picoc *pc);
+extern const struct LibraryConstant StdboolConstants[];
 
 /* unistd.c */
 extern const char UnistdDefs[];
-extern struct LibraryFunction UnistdFunctions[];
+extern const struct LibraryFunction UnistdFunctions[];
+extern const struct LibraryConstant UnistdConstants[];
 extern void UnistdSetupFunc(Picoc *pc);
 
+/* pthread.c */
+extern const char PthreadDefs[];
+extern const struct LibraryFunction PthreadFunctions[];
+extern const struct LibraryConstant PthreadConstants[];
+extern void PthreadSetupFunc(Picoc *pc);
+
+/* dlfcn.c */
+extern const struct LibraryFunction DlfcnFunctions[];
+extern const struct LibraryConstant DlfcnConstants[];
+
 #endif /* INTERPRETER_H */
@@ -2,6 +2,7 @@
 
 #include <limits.h>
 #include "interpreter.h"
+#include "stats.h"
 
 
 #define isCidstart(c) (isalpha(c) || (c)=='_' || (c)=='#')
@@ -27,6 +28,8 @@
 static enum LexToken LexCheckReservedWord(Picoc *pc, const char *Word);
 static enum LexToken LexGetNumber(Picoc *pc, struct LexState *Lexer, struct Value *Value);
 static enum LexToken LexGetWord(Picoc *pc, struct LexState *Lexer, struct Value *Value);
+static enum LexToken LexGetConstant(Picoc *pc, const struct LibraryConstant *Constant,
+    struct Value *Value);
 static unsigned char LexUnEscapeCharacterConstant(const char **From,
     unsigned char FirstChar, int Base);
 static unsigned char LexUnEscapeCharacter(const char **From, const char *End);
@@ -54,7 +57,7 @@ struct ReservedWord {
     enum LexToken Token;
 };
 
-static struct ReservedWord ReservedWords[] = {
+static const struct ReservedWord ReservedWords[] = {
     /* wtf, when optimizations are set escaping certain chars is required or they disappear */
     {"#define", TokenHashDefine},
     {"#else", TokenHashElse},
@@ -118,13 +121,43 @@ void LexInit(Picoc *pc)
             (struct Value*)&ReservedWords[Count], NULL, 0, 0);
     }
 
-    pc->LexValue.Typ = NULL;
-    pc->LexValue.Val = &pc->LexAnyValue;
-    pc->LexValue.LValueFrom = false;
-    pc->LexValue.ValOnHeap = false;
-    pc->LexValue.ValOnStack = false;
-    pc->LexValue.AnyValOnHeap = false;
-    pc->LexValue.IsLValue = false;
+    TableInitTable(&pc->ConstantTable, &pc->ConstantHashTable[0],
+        CONSTANT_TABLE_SIZE, true);
+    TableInitTable(&pc->LibraryConstantTable, &pc->LibraryConstantHashTable[0],
+        CONSTANT_TABLE_SIZE, true);
+
+    LexInitValue(&pc->MainThread);
+}
+
+/* set up the value a thread's tokens are unpacked into */
+void LexInitValue(struct ThreadState *Thread)
+{
+    Thread->LexValue.Typ = NULL;
+    Thread->LexValue.Val = &Thread->LexAnyValue;
+    Thread->LexValue.LValueFrom = false;
+    Thread->LexValue.ValOnHeap = false;
+    Thread->LexValue.ValOnStack = false;
+    Thread->LexValue.AnyValOnHeap = false;
+    Thread->LexValue.IsLValue = false;
+}
+
+/* free a table of library constants. the constants themselves are static
+    so just the entries go */
+static void LexFreeConstants(Picoc *pc, struct Table *Constants)
+{
+    int Count;
+    struct TableEntry *Entry;
+    struct TableEntry *NextEntry;
+
+    for (Count = 0; Count < Constants->Size; Count++) {
+        for (Entry = Constants->HashTable[Count]; Entry != NULL;
+                Entry = NextEntry) {
+            NextEntry = Entry->Next;
+            HeapFreeMem(pc, Entry);
+        }
+
+        Constants->HashTable[Count] = NULL;
+    }
 }
 
 /* deallocate */
@@ -138,6 +171,9 @@ void LexCleanup(Picoc *pc)
             Count++)
         TableDelete(pc, &pc->ReservedWordTable,
             TableStrRegister(pc, ReservedWords[Count].Word));
+
+    LexFreeConstants(pc, &pc->ConstantTable);
+    LexFreeConstants(pc, &pc->LibraryConstantTable);
 }
 
 /* check if a word is a reserved word - used while scanning */
@@ -322,6 +358,7 @@ enum LexToken LexGetWord(Picoc *pc, struct LexState *Lexer, struct Value *Value)
 {
     const char *StartPos = Lexer->Pos;
     enum LexToken Token;
+    struct Value *ConstValue;
 
     do {
         LEXER_INC(Lexer);
@@ -338,6 +375,10 @@ enum LexToken LexGetWord(Picoc *pc, struct LexState *Lexer, struct Value *Value)
     case TokenHashDefine:
         Lexer->Mode = LexModeHashDefine;
         break;
+    case TokenHashIfdef:
+    case TokenHashIfndef:
+        Lexer->Mode = LexModeHashIfdef;
+        break;
     default:
         break;
     }
@@ -345,12 +386,40 @@ enum LexToken LexGetWord(Picoc *pc, struct LexState *Lexer, struct Value *Value)
     if (Token != TokenNone)
         return Token;
 
+    /* a name which might be a library constant is marked, but whether it
+        is depends on which #includes are really parsed, which isn't known
+        until then */
     if (Lexer->Mode == LexModeHashDefineSpace)
         Lexer->Mode = LexModeHashDefineSpaceIdent;
+    else if (Lexer->Mode == LexModeHashIfdef)
+        Lexer->Mode = LexModeNormal;
+    else if (TableGet(&pc->LibraryConstantTable, Value->Val->Identifier,
+            &ConstValue, NULL, NULL, NULL))
+        return TokenLibraryConstant;
 
     return TokenIdentifier;
 }
 
+/* get a library constant as a literal, if there's somewhere to put it -
+    used while parsing */
+enum LexToken LexGetConstant(Picoc *pc, const struct LibraryConstant *Constant,
+    struct Value *Value)
+{
+    if (Constant->Base == TypeDouble) {
+        if (Value != NULL) {
+            Value->Typ = &pc->DoubleType;
+            Value->Val->Double = Constant->FPValue;
+        }
+        return TokenDoubleConstant;
+    }
+
+    if (Value != NULL) {
+        Value->Typ = &pc->IntType;
+        Value->Val->Integer = Constant->IntValue;
+    }
+    return TokenIntegerConstant;
+}
+
 /* unescape a character from an octal character constant */
 unsigned char LexUnEscapeCharacterConstant(const char **From,
     unsigned char FirstChar, int Base)
@@ -545,7 +614,7 @@ enum LexToken LexScanGetToken(Picoc *pc, struct LexState *Lexer,
 
     /* scan for a token */
     do {
-        *Value = &pc->LexValue;
+        *Value = &THREAD(pc)->LexValue;
         while (Lexer->Pos != Lexer->End && isspace((int)*Lexer->Pos)) {
             if (*Lexer->Pos == '\n') {
                 Lexer->Line++;
@@ -690,6 +759,7 @@ int LexTokenSize(enum LexToken Token)
 {
     switch (Token) {
     case TokenIdentifier:
+    case TokenLibraryConstant:
     case TokenStringConstant:
             return sizeof(char*);
     case TokenIntegerConstant:
@@ -809,6 +879,7 @@ void LexInitParser(struct ParseState *Parser, Picoc *pc, const char *SourceText,
     Parser->CharacterPos = 0;
     Parser->SourceText = SourceText;
     Parser->DebugMode = EnableDebugger;
+    Parser->Stats = stats_parser_flags(pc, FileName);
 }
 
 /* get the next token, without pre-processing */
@@ -817,6 +888,8 @@ enum LexToken LexGetRawToken(struct ParseState *Parser, struct Value **Value,
 {
     int ValueSize;
     char *Prompt = NULL;
+    char *Identifier;
+    struct Value *ConstValue = NULL;
     enum LexToken Token = TokenNone;
     Picoc *pc = Parser->pc;
 
@@ -896,55 +969,72 @@ enum LexToken LexGetRawToken(struct ParseState *Parser, struct Value **Value,
 
     Parser->CharacterPos = *((unsigned char*)Parser->Pos + 1);
     ValueSize = LexTokenSize(Token);
+    if (Token == TokenLibraryConstant) {
+        /* it's a constant if its library's been included by now, and the
+            program hasn't #defined the name itself */
+        memcpy((void*)&Identifier,
+            (void*)((char*)Parser->Pos+TOKEN_DATA_OFFSET), sizeof(char*));
+        if (TableGet(&pc->ConstantTable, Identifier, &ConstValue, NULL, NULL,
+                NULL))
+            Token = LexGetConstant(pc, (const struct LibraryConstant*)ConstValue,
+                Value != NULL ? &THREAD(pc)->LexValue : NULL);
+        else
+            Token = TokenIdentifier;
+    }
+
     if (ValueSize > 0) {
         /* this token requires a value - unpack it */
         if (Value != NULL) {
+            struct Value *LexValue = &THREAD(pc)->LexValue;
+
             switch (Token) {
             case TokenStringConstant:
-                pc->LexValue.Typ = pc->CharPtrType;
+                LexValue->Typ = pc->CharPtrType;
                 break;
             case TokenIdentifier:
-                pc->LexValue.Typ = NULL;
+                LexValue->Typ = NULL;
                 break;
             case TokenIntegerConstant:
-                pc->LexValue.Typ = &pc->IntType;
+                LexValue->Typ = &pc->IntType;
                 break;
             case TokenUnsignedIntegerConstant:
-                pc->LexValue.Typ = &pc->UnsignedIntType;
+                LexValue->Typ = &pc->UnsignedIntType;
                 break;
             case TokenLongIntegerConstant:
-                pc->LexValue.Typ = &pc->LongType;
+                LexValue->Typ = &pc->LongType;
                 break;
             case TokenUnsignedLongIntegerConstant:
-                pc->LexValue.Typ = &pc->UnsignedLongType;
+                LexValue->Typ = &pc->UnsignedLongType;
                 break;
             case TokenLongLongIntegerConstant:
-                pc->LexValue.Typ = &pc->LongLongType;
+                LexValue->Typ = &pc->LongLongType;
                 break;
             case TokenUnsignedLongLongIntegerConstant:
-                pc->LexValue.Typ = &pc->UnsignedLongLongType;
+                LexValue->Typ = &pc->UnsignedLongLongType;
                 break;
             case TokenCharacterConstant:
-                pc->LexValue.Typ = &pc->CharType;
+                LexValue->Typ = &pc->CharType;
                 break;
             case TokenFloatConstant:
-                pc->LexValue.Typ = &pc->FloatType;
+                LexValue->Typ = &pc->FloatType;
                 break;
             case TokenDoubleConstant:
-                pc->LexValue.Typ = &pc->DoubleType;
+                LexValue->Typ = &pc->DoubleType;
                 break;
             default:
                 break;
             }
 
-            pc->LexValue.Val->UnsignedLongLongInteger = 0;
-            memcpy((void*)pc->LexValue.Val,
-                (void*)((char*)Parser->Pos+TOKEN_DATA_OFFSET), ValueSize);
-            pc->LexValue.ValOnHeap = false;
-            pc->LexValue.ValOnStack = false;
-            pc->LexValue.IsLValue = false;
-            pc->LexValue.LValueFrom = NULL;
-            *Value = &pc->LexValue;
+            if (ConstValue == NULL) {
+                LexValue->Val->UnsignedLongLongInteger = 0;
+                memcpy((void*)LexValue->Val,
+                    (void*)((char*)Parser->Pos+TOKEN_DATA_OFFSET), ValueSize);
+            }
+            LexValue->ValOnHeap = false;
+            LexValue->ValOnStack = false;
+            LexValue->IsLValue = false;
+            LexValue->LValueFrom = NULL;
+            *Value = LexValue;
         }
 
         if (IncPos)
@@ -982,6 +1072,8 @@ void LexHashIfdef(struct ParseState *Parser, int IfNot)
 
     /* is the identifier defined? */
     IsDefined = TableGet(&Parser->pc->GlobalTable, IdentValue->Val->Identifier,
+        &SavedValue, NULL, NULL, NULL) ||
+        TableGet(&Parser->pc->ConstantTable, IdentValue->Val->Identifier,
         &SavedValue, NULL, NULL, NULL);
     if (Parser->HashIfEvaluateToLevel == Parser->HashIfLevel &&
             ((IsDefined && !IfNot) || (!IsDefined && IfNot))) {
@@ -1166,6 +1258,8 @@ enum LexToken LexGetToken(struct ParseState *Parser, struct Value **Value,
     int TryNextToken;
     enum LexToken Token;
 
+    stats_log_token_fetch(Parser);
+
     /* implements the pre-processor #if commands */
     do {
         int WasPreProcToken = true;
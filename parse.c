@@ -12,7 +12,9 @@ static void ParseDeclarationAssignment(struct ParseState *Parser,
     struct Value *NewVariable, int DoAssignment);
 static int ParseDeclaration(struct ParseState *Parser, enum LexToken Token);
 static void ParseMacroDefinition(struct ParseState *Parser);
-static void ParsePragma(struct ParseState *Parser);
+static int ParsePragma(struct ParseState *Parser);
+static void ParseParallelFor(struct ParseState *Parser,
+    struct ParallelLoop *Loop);
 static void ParseFor(struct ParseState *Parser);
 static enum RunMode ParseBlock(struct ParseState *Parser, int AbsorbOpenBrace,
     int Condition);
@@ -89,7 +91,7 @@ struct Value *ParseFunctionDefinition(struct ParseState *Parser,
     struct ParseState FuncBody;
     Picoc *pc = Parser->pc;
 
-    if (pc->TopStackFrame != NULL)
+    if (THREAD(pc)->TopStackFrame != NULL)
         ProgramFail(Parser, "nested function definitions are not allowed");
 
     LexGetToken(Parser, NULL, true);  /* open bracket */
@@ -455,14 +457,104 @@ void ParseMacroDefinition(struct ParseState *Parser)
     if (!TableSet(Parser->pc, &Parser->pc->GlobalTable, MacroNameStr, MacroValue,
                 (char *)Parser->FileName, Parser->Line, Parser->CharacterPos))
         ProgramFail(Parser, "'%s' is already defined", MacroNameStr);
+
+    /* the program's own #define replaces a library constant */
+    TableDelete(Parser->pc, &Parser->pc->ConstantTable, MacroNameStr);
+}
+
+/* get the next token on a pragma's line, or TokenEndOfLine at the end */
+static enum LexToken ParsePragmaToken(struct ParseState *Parser,
+    struct Value **Value)
+{
+    enum LexToken Token = (enum LexToken)*(unsigned char*)Parser->Pos;
+
+    if (Token == TokenEndOfLine || Token == TokenEOF)
+        return TokenEndOfLine;
+
+    return LexGetToken(Parser, Value, true);
+}
+
+/* is the next token on a pragma's line the identifier Word? */
+static int ParsePragmaWord(struct ParseState *Parser, const char *Word)
+{
+    struct Value *LexerValue;
+
+    return ParsePragmaToken(Parser, &LexerValue) == TokenIdentifier &&
+        LexerValue->Val->Identifier == TableStrRegister(Parser->pc, Word);
+}
+
+/* parse the clauses of "#pragma picoc parallel for" */
+static void ParseParallelClauses(struct ParseState *Parser,
+    struct ParallelLoop *Loop)
+{
+    enum LexToken Token;
+    struct Value *LexerValue;
+    char *Clause;
+
+    while ((Token = ParsePragmaToken(Parser, &LexerValue)) != TokenEndOfLine) {
+        if (Token != TokenIdentifier)
+            ProgramFail(Parser, "parallel for clause expected");
+
+        Clause = LexerValue->Val->Identifier;
+        if (LexGetToken(Parser, NULL, true) != TokenOpenBracket)
+            ProgramFail(Parser, "'(' expected");
+
+        if (Clause == TableStrRegister(Parser->pc, "reduction")) {
+            if (LexGetToken(Parser, NULL, true) != TokenPlus)
+                ProgramFail(Parser, "only '+' reductions are supported");
+
+            if (LexGetToken(Parser, NULL, true) != TokenColon)
+                ProgramFail(Parser, "':' expected");
+
+            do {
+                if (LexGetToken(Parser, &LexerValue, true) != TokenIdentifier)
+                    ProgramFail(Parser, "identifier expected");
+
+                if (Loop->NumReductions == PARALLEL_MAX_REDUCTIONS)
+                    ProgramFail(Parser, "too many reductions (%d allowed)",
+                        PARALLEL_MAX_REDUCTIONS);
+
+                Loop->Reduction[Loop->NumReductions++] =
+                    LexerValue->Val->Identifier;
+                Token = LexGetToken(Parser, NULL, true);
+            } while (Token == TokenComma);
+
+            if (Token != TokenCloseBracket)
+                ProgramFail(Parser, "')' expected");
+        } else if (Clause == TableStrRegister(Parser->pc, "num_threads")) {
+            Loop->NumThreads = (int)ExpressionParseInt(Parser);
+            if (LexGetToken(Parser, NULL, true) != TokenCloseBracket)
+                ProgramFail(Parser, "')' expected");
+        } else
+            ProgramFail(Parser, "unknown parallel for clause '%s'", Clause);
+    }
 }
 
-/* parse a pragma */
-void ParsePragma(struct ParseState *Parser)
+/* parse a pragma. returns true if it was "#pragma picoc parallel for",
+    in which case the loop after it has been parsed too */
+int ParsePragma(struct ParseState *Parser)
 {
+    struct ParseState Start;
+    struct ParallelLoop Loop;
+
+    ParserCopy(&Start, Parser);
+    if (ParsePragmaWord(Parser, "picoc") &&
+            ParsePragmaWord(Parser, "parallel") &&
+            ParsePragmaToken(Parser, NULL) == TokenFor) {
+        memset(&Loop, '\0', sizeof(Loop));
+        ParseParallelClauses(Parser, &Loop);
+        if (LexGetToken(Parser, NULL, true) != TokenFor)
+            ProgramFail(Parser, "'for' expected after parallel for pragma");
+
+        ParseParallelFor(Parser, &Loop);
+        return true;
+    }
+
     /* consume tokens until we hit the end of a line */
     /* (not ideal for _Pragma() but it'll do for now) */
+    ParserCopy(Parser, &Start);
     LexToEndOfMacro(Parser);
+    return false;
 }
 
 /* copy the entire parser state */
@@ -497,6 +589,9 @@ void ParseFor(struct ParseState *Parser)
 
     int WasPreprocessor = false;
 
+    if (OldMode == RunModeRun)
+        stats_log_loop_begin(Parser, "for", Parser->Line);
+
     if (LexGetToken(Parser, NULL, true) != TokenOpenBracket)
         ProgramFail(Parser, "'(' expected");
 
@@ -580,6 +675,113 @@ void ParseFor(struct ParseState *Parser)
 
     if (Parser->Mode == RunModeRun || OldMode == RunModeRun)
         stats_log_loop_exit(Parser);
+
+    if (OldMode == RunModeRun)
+        stats_log_loop_end(Parser);
+}
+
+/* parse a "for" loop after "#pragma picoc parallel for". its iterations are
+    shared out between threads, each with its own copy of the loop variable
+    and reduction variables, so it has to count up by one from an integer:
+    "for (i = a; i < b; i++)" or the same with "int i", "<=", "++i" or
+    "i += 1". break, return and goto can't leave it */
+void ParseParallelFor(struct ParseState *Parser, struct ParallelLoop *Loop)
+{
+    Picoc *pc = Parser->pc;
+    struct StackFrame *Frame = THREAD(pc)->TopStackFrame;
+    struct Value *LexerValue;
+    struct Value *Var;
+    enum LexToken Token;
+    enum LexToken Compare;
+    enum RunMode OldMode = Parser->Mode;
+    long long Limit;
+    int Count;
+    int WasPreprocessor = false;
+    int PrevScopeID = 0;
+    int ScopeID;
+
+    if (Parser->Mode != RunModeRun) {
+        /* just skip over it as usual */
+        ParseFor(Parser);
+        return;
+    }
+
+    ScopeID = VariableScopeBegin(Parser, &PrevScopeID);
+    if (LexGetToken(Parser, NULL, true) != TokenOpenBracket)
+        ProgramFail(Parser, "'(' expected");
+
+    if (ParseStatement(Parser, false, true, NULL) != ParseResultOk)
+        ProgramFail(Parser, "statement expected");
+
+    if (LexGetToken(Parser, NULL, true) != TokenSemicolon)
+        ProgramFail(Parser, "';' expected");
+
+    /* the condition */
+    if (LexGetToken(Parser, &LexerValue, true) != TokenIdentifier)
+        ProgramFail(Parser, "a parallel for needs a loop variable");
+
+    Loop->Ident = LexerValue->Val->Identifier;
+    VariableGet(pc, Parser, Loop->Ident, &Var);
+    if (!IS_INTEGER_NUMERIC(Var))
+        ProgramFail(Parser, "a parallel for's loop variable has to be an integer");
+
+    Compare = LexGetToken(Parser, NULL, true);
+    if (Compare != TokenLessThan && Compare != TokenLessEqual)
+        ProgramFail(Parser, "a parallel for has to count up with '<' or '<='");
+
+    Limit = ExpressionParseInt(Parser);
+    if (LexGetToken(Parser, NULL, true) != TokenSemicolon)
+        ProgramFail(Parser, "';' expected");
+
+    /* the increment */
+    Token = LexGetToken(Parser, &LexerValue, true);
+    if (Token == TokenIncrement)
+        Token = LexGetToken(Parser, &LexerValue, true) == TokenIdentifier &&
+            LexerValue->Val->Identifier == Loop->Ident ? TokenIncrement : TokenNone;
+    else if (Token == TokenIdentifier &&
+            LexerValue->Val->Identifier == Loop->Ident) {
+        Token = LexGetToken(Parser, NULL, true);
+        if (Token == TokenAddAssign)
+            Token = LexGetToken(Parser, &LexerValue, true) == TokenIntegerConstant &&
+                LexerValue->Val->Integer == 1 ? TokenIncrement : TokenNone;
+    }
+
+    if (Token != TokenIncrement)
+        ProgramFail(Parser, "a parallel for has to count up by one");
+
+    if (LexGetToken(Parser, NULL, true) != TokenCloseBracket)
+        ProgramFail(Parser, "')' expected");
+
+    /* skip over the statement, leaving the threads to run it */
+    ParserCopy(&Loop->Body, Parser);
+    Parser->Mode = RunModeSkip;
+    do {
+        if (ParseStatement(Parser, true, false, &WasPreprocessor) != ParseResultOk)
+            ProgramFail(Parser, "statement expected");
+    } while (WasPreprocessor);
+    Parser->Mode = OldMode;
+
+    for (Count = 0; Count < Loop->NumReductions; Count++) {
+        VariableGet(pc, Parser, Loop->Reduction[Count],
+            &Loop->ReductionValue[Count]);
+        if (!IS_NUMERIC_COERCIBLE(Loop->ReductionValue[Count]) ||
+                Loop->Reduction[Count] == Loop->Ident)
+            ProgramFail(Parser, "can't reduce '%s'", Loop->Reduction[Count]);
+    }
+
+    Loop->FuncName = Frame != NULL ? Frame->FuncName : "parallel for";
+    Loop->Locals = Frame != NULL ? &Frame->LocalTable : NULL;
+    Loop->IdentType = Var->Typ;
+    Loop->Start = ExpressionCoerceInteger(Var);
+    Loop->End = Compare == TokenLessEqual ? Limit + 1 : Limit;
+    if (Loop->End > Loop->Start) {
+        ThreadParallelFor(Parser, Loop);
+
+        /* leave the loop variable where a serial loop would have */
+        ExpressionAssignInt(Parser, Var, Loop->End, false);
+    }
+
+    VariableScopeEnd(Parser, ScopeID, PrevScopeID);
 }
 
 /* parse a block of code and return what mode it returned in */
@@ -649,6 +851,23 @@ enum ParseResult ParseStatement(struct ParseState *Parser,
         DebugCheckStatement(Parser);
 #endif
 
+    if (Parser->Mode == RunModeRun) {
+        struct ThreadState *Thread = THREAD(Parser->pc);
+
+        /* if the host is running us a slice at a time, see if the slice
+            is up */
+        if (Thread->TaskCountdown != 0 && --Thread->TaskCountdown == 0)
+            TaskCountdownExpired(Parser->pc);
+
+        /* stop if another thread has ended the program */
+        if (Parser->pc->ThreadsExiting)
+            ThreadCheck(Parser->pc);
+
+        /* take a profiling sample if the timer's said one is due */
+        if (ProfileDue)
+            ProfileSample(Parser);
+    }
+
     if (WasPreprocessor)
         *WasPreprocessor = false;
 
@@ -730,6 +949,8 @@ enum ParseResult ParseStatement(struct ParseState *Parser,
         {
             struct ParseState PreConditional;
             enum RunMode PreMode = Parser->Mode;
+            if (PreMode == RunModeRun)
+                stats_log_loop_begin(Parser, "while", Parser->Line);
             if (LexGetToken(Parser, NULL, true) != TokenOpenBracket)
                 ProgramFail(Parser, "'(' expected");
             ParserCopyPos(&PreConditional, Parser);
@@ -747,6 +968,8 @@ enum ParseResult ParseStatement(struct ParseState *Parser,
             } while (Parser->Mode == RunModeRun && Condition);
             if (Parser->Mode == RunModeBreak)
                 Parser->Mode = PreMode;
+            if (PreMode == RunModeRun)
+                stats_log_loop_end(Parser);
             CheckTrailingSemicolon = false;
         }
         break;
@@ -755,6 +978,8 @@ enum ParseResult ParseStatement(struct ParseState *Parser,
             struct ParseState PreStatement;
             enum RunMode PreMode = Parser->Mode;
             ParserCopyPos(&PreStatement, Parser);
+            if (PreMode == RunModeRun)
+                stats_log_loop_begin(Parser, "do", Parser->Line);
             do {
                 ParserCopyPos(Parser, &PreStatement);
                 do {
@@ -773,6 +998,8 @@ enum ParseResult ParseStatement(struct ParseState *Parser,
             } while (Condition && Parser->Mode == RunModeRun);
             if (Parser->Mode == RunModeBreak)
                 Parser->Mode = PreMode;
+            if (PreMode == RunModeRun)
+                stats_log_loop_end(Parser);
         }
         break;
     case TokenFor:
@@ -869,16 +1096,16 @@ enum ParseResult ParseStatement(struct ParseState *Parser,
         break;
     case TokenReturn:
         if (Parser->Mode == RunModeRun) {
-            if (!Parser->pc->TopStackFrame ||
-                    Parser->pc->TopStackFrame->ReturnValue->Typ->Base != TypeVoid) {
+            if (!THREAD(Parser->pc)->TopStackFrame ||
+                    THREAD(Parser->pc)->TopStackFrame->ReturnValue->Typ->Base != TypeVoid) {
                 if (!ExpressionParse(Parser, &CValue))
                     ProgramFail(Parser, "value required in return");
-                if (!Parser->pc->TopStackFrame) /* return from top-level program? */
+                if (!THREAD(Parser->pc)->TopStackFrame) /* return from top-level program? */
                     PlatformExit(Parser->pc, ExpressionCoerceInteger(CValue));
                 else {
-                    stats_log_expression_evaluation(Parser, ExpressionReturn, TokenAssign, Parser->pc->TopStackFrame->ReturnValue, CValue);
+                    stats_log_expression_evaluation(Parser, ExpressionReturn, TokenAssign, THREAD(Parser->pc)->TopStackFrame->ReturnValue, CValue);
                     ExpressionAssign(Parser,
-                        Parser->pc->TopStackFrame->ReturnValue, CValue, true,
+                        THREAD(Parser->pc)->TopStackFrame->ReturnValue, CValue, true,
                         NULL, 0, false);
                 }
                 VariableStackPop(Parser, CValue);
@@ -922,9 +1149,8 @@ enum ParseResult ParseStatement(struct ParseState *Parser,
         }
     case TokenHashPragma:
     case TokenUnderscorePragma:
-        ParsePragma(Parser);
         CheckTrailingSemicolon = false;
-        if (WasPreprocessor)
+        if (!ParsePragma(Parser) && WasPreprocessor)
             *WasPreprocessor = true;
         break;
     default:
@@ -5,6 +5,11 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#endif
+#ifdef UNIX_HOST
+#include <pthread.h>
+#include <unistd.h>
 #endif
 
 /* include only picoc.h here - should be able to use it with only the
@@ -19,21 +24,545 @@
 /* Override via STACKSIZE environment variable */
 #define PICOC_STACK_SIZE (32*1024*1024)
 
+
+/* batch mode - runs every job in a manifest on a pool of worker threads.
+ * each worker keeps a warm instance, put back with PicocReset() between
+ * jobs, so jobs don't pay for starting up. a manifest line is like a picoc
+ * command line, optionally followed by a file the output has to match:
+ *
+ *   [-s] <file1.c>... [- <arg1>...] [> <expected output>]
+ *
+ * a job without a file to match has to exit with 0 instead. blank lines
+ * and lines starting with '#' are ignored. without threads (on WIN32) the
+ * jobs are run one after another */
+struct BatchJob {
+    char **Tokens;              /* the manifest line, cut up */
+    char **Files;               /* the files to scan */
+    int NumFiles;
+    char **Args;                /* what main() gets, starting with "-" */
+    int NumArgs;
+    const char *Expected;       /* file the output has to match, or NULL */
+    int Script;                 /* run with -s rather than calling main() */
+    char *Output;               /* everything the job printed */
+    size_t OutputSize;
+    int ExitValue;
+    double Time;                /* wall time in seconds */
+    int Failed;
+};
+
+struct Batch {
+    struct BatchJob *Jobs;
+    int NumJobs;
+    int NextJob;
+    int StackSize;
+#ifdef UNIX_HOST
+    pthread_mutex_t Lock;
+#endif
+};
+
+/* a worker has a warm instance for programs and one, with every system
+    header already included, for scripts. they're set up on first use */
+struct BatchWorker {
+#ifdef UNIX_HOST
+    pthread_t Thread;
+#endif
+    struct Batch *Batch;
+    Picoc *Instance[2];
+};
+
+
+/* seconds from some fixed point */
+static double BatchTime(void)
+{
+#ifdef UNIX_HOST
+    struct timespec Now;
+
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return Now.tv_sec + Now.tv_nsec / 1e9;
+#else
+    return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+/* read a whole file into a null-terminated buffer */
+static char *BatchReadFile(const char *FileName, size_t *Size)
+{
+    FILE *InFile = fopen(FileName, "rb");
+    char *Text;
+    long Length;
+
+    if (InFile == NULL)
+        return NULL;
+
+    fseek(InFile, 0, SEEK_END);
+    Length = ftell(InFile);
+    rewind(InFile);
+    Text = malloc(Length + 1);
+    if (Text != NULL) {
+        *Size = fread(Text, 1, Length, InFile);
+        Text[*Size] = '\0';
+    }
+
+    fclose(InFile);
+    return Text;
+}
+
+/* squeeze each run of spaces into one and drop them at the ends of lines,
+    so output is compared the way "diff -b" does in tests/Makefile */
+static size_t BatchSqueezeSpaces(char *Text, size_t Size)
+{
+    size_t From;
+    size_t To = 0;
+
+    for (From = 0; From < Size; From++) {
+        if (Text[From] == ' ' || Text[From] == '\t' || Text[From] == '\r') {
+            while (From + 1 < Size && (Text[From+1] == ' ' ||
+                    Text[From+1] == '\t' || Text[From+1] == '\r'))
+                From++;
+            if (From + 1 < Size && Text[From+1] != '\n')
+                Text[To++] = ' ';
+        } else
+            Text[To++] = Text[From];
+    }
+
+    return To;
+}
+
+/* split a manifest into jobs. the lines are cut up in place, so Manifest
+    has to last as long as the jobs do */
+static int BatchParseManifest(struct Batch *Batch, const char *FileName,
+    char *Manifest)
+{
+    char *Line = Manifest;
+    int LineNo = 0;
+
+    Batch->Jobs = NULL;
+    Batch->NumJobs = 0;
+    while (Line != NULL && *Line != '\0') {
+        char *End = strchr(Line, '\n');
+        char **Tokens;
+        char *Pos;
+        int NumTokens = 0;
+        int Token = 0;
+        struct BatchJob *Job;
+
+        LineNo++;
+        if (End != NULL)
+            *End++ = '\0';
+
+        /* cut the line into tokens */
+        for (Pos = Line; *Pos != '\0'; NumTokens++) {
+            while (*Pos == ' ' || *Pos == '\t' || *Pos == '\r')
+                Pos++;
+            if (*Pos == '\0' || *Pos == '#')
+                break;
+            while (*Pos != '\0' && *Pos != ' ' && *Pos != '\t' && *Pos != '\r')
+                Pos++;
+        }
+
+        if (NumTokens == 0) {
+            Line = End;
+            continue;
+        }
+
+        Tokens = calloc(NumTokens + 1, sizeof(char*));
+        for (Pos = Line; Token < NumTokens; Token++) {
+            while (*Pos == ' ' || *Pos == '\t' || *Pos == '\r')
+                Pos++;
+            Tokens[Token] = Pos;
+            while (*Pos != '\0' && *Pos != ' ' && *Pos != '\t' && *Pos != '\r')
+                Pos++;
+            if (*Pos != '\0')
+                *Pos++ = '\0';
+        }
+
+        Batch->Jobs = realloc(Batch->Jobs,
+            (Batch->NumJobs + 1) * sizeof(struct BatchJob));
+        Job = &Batch->Jobs[Batch->NumJobs++];
+        memset(Job, 0, sizeof(struct BatchJob));
+        Job->Tokens = Tokens;
+        Job->Files = Tokens;
+
+        Token = 0;
+        if (strcmp(Tokens[0], "-s") == 0) {
+            Job->Script = true;
+            Job->Files++;
+            Token++;
+        }
+
+        for (; Token < NumTokens && strcmp(Tokens[Token], "-") != 0 &&
+                strcmp(Tokens[Token], ">") != 0; Token++)
+            Job->NumFiles++;
+
+        Job->Args = &Tokens[Token];
+        for (; Token < NumTokens && strcmp(Tokens[Token], ">") != 0; Token++)
+            Job->NumArgs++;
+
+        if (Token < NumTokens) {
+            /* the argument list stops here, as argv[argc] must be NULL */
+            Tokens[Token] = NULL;
+            if (Token + 2 != NumTokens) {
+                fprintf(stderr, "%s:%d: '>' must be followed by one file\n",
+                    FileName, LineNo);
+                return false;
+            }
+            Job->Expected = Tokens[Token + 1];
+        }
+
+        if (Job->NumFiles == 0) {
+            fprintf(stderr, "%s:%d: no files to run\n", FileName, LineNo);
+            return false;
+        }
+
+        Line = End;
+    }
+
+    return true;
+}
+
+/* run a job on one of the worker's instances, keeping its output */
+static void BatchRunJob(struct BatchWorker *Worker, struct BatchJob *Job)
+{
+    Picoc *pc = Worker->Instance[Job->Script];
+    double StartTime = BatchTime();
+    FILE *Stream;
+    int Count;
+
+    if (pc == NULL) {
+        pc = malloc(sizeof(Picoc));
+        PicocInitializeForImage(pc, Worker->Batch->StackSize);
+        if (Job->Script) {
+            PicocIncludeAllSystemHeaders(pc);
+            PicocSetResetPoint(pc);
+        }
+        Worker->Instance[Job->Script] = pc;
+    }
+
+    PicocReset(pc);
+#ifdef UNIX_HOST
+    Stream = open_memstream(&Job->Output, &Job->OutputSize);
+#else
+    Stream = tmpfile();
+#endif
+    if (Stream == NULL) {
+        fprintf(stderr, "can't capture the output of %s\n", Job->Files[0]);
+        Job->Failed = true;
+        return;
+    }
+
+    PicocSetOutput(pc, Stream);
+    if (PicocPlatformSetExitPoint(pc) == 0) {
+        for (Count = 0; Count < Job->NumFiles; Count++)
+            PicocPlatformScanFile(pc, Job->Files[Count]);
+
+        if (!Job->Script)
+            PicocCallMain(pc, Job->NumArgs, Job->Args);
+    }
+
+    Job->ExitValue = pc->PicocExitValue;
+#ifdef UNIX_HOST
+    fclose(Stream);
+#else
+    Job->OutputSize = ftell(Stream);
+    rewind(Stream);
+    Job->Output = malloc(Job->OutputSize + 1);
+    Job->OutputSize = fread(Job->Output, 1, Job->OutputSize, Stream);
+    fclose(Stream);
+#endif
+    Job->Time = BatchTime() - StartTime;
+
+    if (Job->Expected != NULL) {
+        size_t ExpectedSize;
+        char *Expected = BatchReadFile(Job->Expected, &ExpectedSize);
+        char *Output = malloc(Job->OutputSize + 1);
+        size_t OutputSize;
+
+        if (Expected != NULL && Output != NULL) {
+            memcpy(Output, Job->Output, Job->OutputSize);
+            OutputSize = BatchSqueezeSpaces(Output, Job->OutputSize);
+            ExpectedSize = BatchSqueezeSpaces(Expected, ExpectedSize);
+            Job->Failed = ExpectedSize != OutputSize ||
+                memcmp(Expected, Output, OutputSize) != 0;
+        } else
+            Job->Failed = true;
+
+        free(Expected);
+        free(Output);
+    } else {
+        /* with nothing to match, a job that couldn't load or that stopped
+            with an error, or any other exit value, has failed */
+        Job->Failed = Job->ExitValue != 0;
+    }
+}
+
+/* take jobs until there are none left */
+static void *BatchWorkerMain(void *Arg)
+{
+    struct BatchWorker *Worker = Arg;
+    struct Batch *Batch = Worker->Batch;
+    int Count;
+
+    for (;;) {
+        int JobNo;
+
+#ifdef UNIX_HOST
+        pthread_mutex_lock(&Batch->Lock);
+#endif
+        JobNo = Batch->NextJob++;
+#ifdef UNIX_HOST
+        pthread_mutex_unlock(&Batch->Lock);
+#endif
+        if (JobNo >= Batch->NumJobs)
+            break;
+
+        BatchRunJob(Worker, &Batch->Jobs[JobNo]);
+    }
+
+    for (Count = 0; Count < 2; Count++) {
+        if (Worker->Instance[Count] != NULL) {
+            PicocCleanup(Worker->Instance[Count]);
+            free(Worker->Instance[Count]);
+        }
+    }
+
+    return NULL;
+}
+
+/* run a manifest and print what happened. returns true if every job with
+    an expected output matched it and every other job exited with 0 */
+static int BatchRun(const char *FileName, int NumThreads, int StackSize)
+{
+    struct Batch Batch;
+    struct BatchWorker *Workers;
+    char *Manifest;
+    size_t ManifestSize;
+    double StartTime;
+    double Time;
+    int Failures = 0;
+    int Count;
+
+    Manifest = BatchReadFile(FileName, &ManifestSize);
+    if (Manifest == NULL) {
+        fprintf(stderr, "can't read manifest %s\n", FileName);
+        return false;
+    }
+
+    if (!BatchParseManifest(&Batch, FileName, Manifest))
+        return false;
+
+#ifdef UNIX_HOST
+    if (NumThreads <= 0)
+        NumThreads = sysconf(_SC_NPROCESSORS_ONLN);
+#else
+    NumThreads = 1;
+#endif
+    if (NumThreads > Batch.NumJobs)
+        NumThreads = Batch.NumJobs;
+    if (NumThreads < 1)
+        NumThreads = 1;
+
+    Batch.NextJob = 0;
+    Batch.StackSize = StackSize;
+    Workers = calloc(NumThreads, sizeof(struct BatchWorker));
+    StartTime = BatchTime();
+#ifdef UNIX_HOST
+    pthread_mutex_init(&Batch.Lock, NULL);
+    for (Count = 0; Count < NumThreads; Count++) {
+        Workers[Count].Batch = &Batch;
+        if (pthread_create(&Workers[Count].Thread, NULL, BatchWorkerMain,
+                &Workers[Count]) != 0) {
+            fprintf(stderr, "can't create thread %d\n", Count);
+            exit(1);
+        }
+    }
+
+    for (Count = 0; Count < NumThreads; Count++)
+        pthread_join(Workers[Count].Thread, NULL);
+
+    pthread_mutex_destroy(&Batch.Lock);
+#else
+    Workers[0].Batch = &Batch;
+    BatchWorkerMain(&Workers[0]);
+#endif
+    Time = BatchTime() - StartTime;
+
+    /* the output of any job that isn't checked, or that failed its check */
+    for (Count = 0; Count < Batch.NumJobs; Count++) {
+        struct BatchJob *Job = &Batch.Jobs[Count];
+
+        if (Job->Expected == NULL || Job->Failed) {
+            printf("==> %s <==\n", Job->Files[0]);
+            if (Job->Output != NULL)
+                fwrite(Job->Output, 1, Job->OutputSize, stdout);
+        }
+    }
+
+    printf("%10s %6s %-6s %s\n", "time (ms)", "exit", "result", "job");
+    for (Count = 0; Count < Batch.NumJobs; Count++) {
+        struct BatchJob *Job = &Batch.Jobs[Count];
+
+        printf("%10.3f %6d %-6s %s\n", Job->Time * 1000, Job->ExitValue,
+            Job->Failed ? "FAILED" : Job->Expected == NULL ? "-" : "ok",
+            Job->Files[0]);
+        if (Job->Failed)
+            Failures++;
+
+        free(Job->Output);
+        free(Job->Tokens);
+    }
+
+    printf("%d jobs, %d failed, %.3f s on %d thread%s - %.1f scripts/sec\n",
+        Batch.NumJobs, Failures, Time, NumThreads, NumThreads == 1 ? "" : "s",
+        Time > 0 ? Batch.NumJobs / Time : 0.0);
+
+    free(Batch.Jobs);
+    free(Workers);
+    free(Manifest);
+
+    return Failures == 0;
+}
+
+/* write the stats reports picoc -j asked for. Files are the program's
+    source files */
+static int WriteStats(Picoc *pc, const char *FileName, int Reports,
+    char **Files, int NumFiles)
+{
+    FILE *Out = fopen(FileName, "w");
+
+    if (Out == NULL) {
+        fprintf(stderr, "can't write stats to %s\n", FileName);
+        return false;
+    }
+
+    stats_write_json(pc, Out, Reports, Files, NumFiles, pc->PicocExitValue);
+    if (fclose(Out) != 0) {
+        fprintf(stderr, "can't write stats to %s\n", FileName);
+        return false;
+    }
+
+    return true;
+}
+
+/* write the samples picoc -p took */
+static int WriteProfile(Picoc *pc, const char *FileName)
+{
+    FILE *Out = fopen(FileName, "w");
+
+    PicocProfileStop(pc);
+    if (Out == NULL) {
+        fprintf(stderr, "can't write profile to %s\n", FileName);
+        return false;
+    }
+
+    PicocProfileWrite(pc, Out);
+    if (fclose(Out) != 0) {
+        fprintf(stderr, "can't write profile to %s\n", FileName);
+        return false;
+    }
+
+    return true;
+}
+
+/* write the expression n-grams picoc -g collected */
+static int WriteExpressionNgrams(Picoc *pc, const char *FileName, int Top)
+{
+    FILE *Out = fopen(FileName, "w");
+
+    if (Out == NULL) {
+        fprintf(stderr, "can't write expression n-grams to %s\n", FileName);
+        return false;
+    }
+
+    stats_write_expression_ngrams(pc, Out, Top);
+    if (fclose(Out) != 0) {
+        fprintf(stderr, "can't write expression n-grams to %s\n", FileName);
+        return false;
+    }
+
+    return true;
+}
+
+/* print the costs picoc -P counted and write them for callgrind viewers */
+static int WriteCosts(Picoc *pc, const char *FileName, char **Files,
+    int NumFiles)
+{
+    FILE *Out = fopen(FileName, "w");
+    char Command[1024] = "picoc";
+    size_t Len = strlen(Command);
+    int Count;
+
+    if (Out == NULL) {
+        fprintf(stderr, "can't write costs to %s\n", FileName);
+        return false;
+    }
+
+    for (Count = 0; Count < NumFiles && Len < sizeof(Command); Count++)
+        Len += snprintf(&Command[Len], sizeof(Command) - Len, " %s",
+            Files[Count]);
+
+    PicocProfileWriteCosts(pc, stdout, Out, Command);
+    if (fclose(Out) != 0) {
+        fprintf(stderr, "can't write costs to %s\n", FileName);
+        return false;
+    }
+
+    return true;
+}
+
+/* finish the trace picoc -T wrote as the program ran */
+static int WriteTrace(Picoc *pc, FILE *Out, const char *FileName)
+{
+    int Written = PicocProfileTraceStop(pc);
+
+    if (fclose(Out) != 0 || !Written) {
+        fprintf(stderr, "can't write the trace to %s\n", FileName);
+        return false;
+    }
+
+    return true;
+}
+
 int main(int argc, char **argv)
 {
     int ParamCount = 1;
     int DontRunMain = false;
     int CollectStats = false;
     long StatsType = 0;
+    int StatsReports = STATS_REPORTS_DEFAULT;
+    char *StatsFile = NULL;
+    char *ProfileFile = NULL;
+    char *CostsFile = NULL;
+    char *NgramsFile = NULL;
+    char *ChainsFile = NULL;
+    char *TraceFile = NULL;
+    FILE *TraceOut = NULL;
+    int NgramsTop = STATS_NGRAMS_TOP;
+    int FirstFile;
+    int NumFiles;
     int StackSize = getenv("STACKSIZE") ? atoi(getenv("STACKSIZE")) : PICOC_STACK_SIZE;
     Picoc pc;
 
-    if (argc < 2 || strcmp(argv[ParamCount], "-h") == 0) {
+    if (argc < 2 || strcmp(argv[ParamCount], "-h") == 0 ||
+            (strcmp(argv[ParamCount], "-w") == 0 && argc < 3) ||
+            (strcmp(argv[ParamCount], "-b") == 0 && argc < 3) ||
+            (strcmp(argv[ParamCount], "-l") == 0 && argc < 4)) {
         printf(PICOC_VERSION "  \n"
                "Format:\n\n"
                "> picoc <file1.c>... [- <arg1>...]          : run a program, calls main() as the entry point\n"
                "> picoc -s <file1.c>... [- <arg1>...]       : run a script, runs the program without calling main()\n"
                "> picoc -d[type] <file1.c>... [- <arg1>...] : run a program, outputting debugging stats\n"
+               "> picoc -j[type,...] <json> <file1.c>...    : run a program, writing stats reports to a JSON file\n"
+               "> picoc -p[rate] <folded> <file1.c>...      : run a program, writing profiling samples as folded stacks\n"
+               "> picoc -P <callgrind> <file1.c>...         : run a program, printing what each function and line cost\n"
+               "> picoc -T <trace> <file1.c>...             : run a program, tracing its calls and loops for Perfetto\n"
+               "> picoc -m <file1.c>... [- <arg1>...]       : run a program, listing the heap memory it never freed\n"
+               "> picoc -g[top] <ngrams> <file1.c>...       : run a program, writing its most common runs of expressions\n"
+               "> picoc -f <ngrams> <file1.c>...            : run a program, fusing the operators in an n-gram file\n"
+               "> picoc -x <chains> <file1.c>...            : run a program, streaming its full expression chains to a file\n"
+               "> picoc -X <chains>                         : print the expression chains in a file, then quit\n"
+               "> picoc -w <image> <file1.c>...             : save an image with all system headers and the files loaded\n"
+               "> picoc -l <image> [option] <file1.c>...    : start from an image, then any of the options above\n"
+               "> picoc -b <manifest> [-n <threads>]        : run each job in a manifest on a pool of threads\n"
                "> picoc -r                                  : output list of run modes, then quit\n"
                "> picoc -t                                  : output list of tokens, then quit\n"
                "> picoc -y                                  : output list of basic types, then quit\n"
@@ -48,7 +577,39 @@ int main(int argc, char **argv)
         return 0;
     }
 
-    PicocInitialize(&pc, StackSize);
+    if (strcmp(argv[ParamCount], "-b") == 0) {
+        int NumThreads = 0;
+
+        if (argc > 4 && strcmp(argv[3], "-n") == 0)
+            NumThreads = atoi(argv[4]);
+
+        return !BatchRun(argv[2], NumThreads, StackSize);
+    }
+
+    if (strcmp(argv[ParamCount], "-w") == 0) {
+        PicocInitializeForImage(&pc, StackSize);
+        PicocIncludeAllSystemHeaders(&pc);
+        if (PicocPlatformSetExitPoint(&pc)) {
+            PicocCleanup(&pc);
+            return pc.PicocExitValue;
+        }
+
+        for (ParamCount += 2; ParamCount < argc; ParamCount++)
+            PicocPlatformScanFile(&pc, argv[ParamCount]);
+
+        PicocSaveImage(&pc, argv[2]);
+        PicocCleanup(&pc);
+        return 0;
+    }
+
+    if (strcmp(argv[ParamCount], "-l") == 0) {
+        if (!PicocLoadImage(&pc, argv[ParamCount+1])) {
+            fprintf(stderr, "can't load image %s\n", argv[ParamCount+1]);
+            return 1;
+        }
+        ParamCount += 2;
+    } else
+        PicocInitialize(&pc, StackSize);
 
     if (strcmp(argv[ParamCount], "-s") == 0) {
         DontRunMain = true;
@@ -63,7 +624,20 @@ int main(int argc, char **argv)
     } else if (strncmp(argv[ParamCount], "-y", 2) == 0) {
         stats_print_types_list();
         return 0;
+    } else if (strcmp(argv[ParamCount], "-X") == 0) {
+        PicocCleanup(&pc);
+        if (argc < ParamCount + 2 || !stats_print_expression_chains_file(argv[ParamCount+1])) {
+            fprintf(stderr, "can't read expression chains from %s\n",
+                argc < ParamCount + 2 ? "nowhere" : argv[ParamCount+1]);
+            return 1;
+        }
+        return 0;
     } else if (strncmp(argv[ParamCount], "-d", 2) == 0) {
+#ifdef NO_STATS
+        fprintf(stderr, "this picoc was built with NO_STATS, so it can't collect stats\n");
+        PicocCleanup(&pc);
+        return 1;
+#endif
         if (strlen(argv[ParamCount]) > 2) {
             StatsType = strtol(&argv[ParamCount][2], NULL, 0);
         }
@@ -83,14 +657,178 @@ int main(int argc, char **argv)
         }
         if (StatsType == 0xa)
             pc.CollectFullExpressions = true;
+        if (StatsType == 0xf)
+            pc.CollectExpressionNgrams = true;
         ParamCount++;
+    } else if (strncmp(argv[ParamCount], "-j", 2) == 0) {
+#ifdef NO_STATS
+        fprintf(stderr, "this picoc was built with NO_STATS, so it can't collect stats\n");
+        PicocCleanup(&pc);
+        return 1;
+#endif
+        if (argc < ParamCount + 3) {
+            fprintf(stderr, "-j needs a file to write the stats to and a program\n");
+            PicocCleanup(&pc);
+            return 1;
+        }
+        if (strlen(argv[ParamCount]) > 2) {
+            char *Type = &argv[ParamCount][2];
+
+            /* a comma-separated list of -d types */
+            StatsReports = 0;
+            while (*Type != '\0') {
+                StatsType = strtol(Type, &Type, 0);
+                if (StatsType < 0 || StatsType > 0xf || (*Type != ',' && *Type != '\0')) {
+                    fprintf(stderr, "-j takes a list of stats types from 0x0 to 0xf\n");
+                    PicocCleanup(&pc);
+                    return 1;
+                }
+                StatsReports |= STATS_REPORT(StatsType);
+                if (*Type == ',')
+                    Type++;
+            }
+        }
+        pc.CollectStats = true;
+        if (StatsReports & STATS_REPORT(0xa))
+            pc.CollectFullExpressions = true;
+        if (StatsReports & STATS_REPORT(0xf))
+            pc.CollectExpressionNgrams = true;
+        StatsFile = argv[ParamCount+1];
+        ParamCount += 2;
+    } else if (strncmp(argv[ParamCount], "-p", 2) == 0) {
+        int Rate = PROFILE_RATE;
+
+        if (strlen(argv[ParamCount]) > 2)
+            Rate = atoi(&argv[ParamCount][2]);
+
+        if (argc < ParamCount + 3) {
+            fprintf(stderr, "-p needs a file to write the samples to and a program\n");
+            PicocCleanup(&pc);
+            return 1;
+        }
+        if (!PicocProfileStart(&pc, Rate)) {
+            fprintf(stderr, "can't profile at %d samples a second\n", Rate);
+            PicocCleanup(&pc);
+            return 1;
+        }
+        ProfileFile = argv[ParamCount+1];
+        ParamCount += 2;
+    } else if (strcmp(argv[ParamCount], "-P") == 0) {
+        if (argc < ParamCount + 3) {
+            fprintf(stderr, "-P needs a file to write the costs to and a program\n");
+            PicocCleanup(&pc);
+            return 1;
+        }
+        if (!PicocProfileCosts(&pc)) {
+            fprintf(stderr, "this picoc was built with NO_STATS, so it can't count costs\n");
+            PicocCleanup(&pc);
+            return 1;
+        }
+        CostsFile = argv[ParamCount+1];
+        ParamCount += 2;
+    } else if (strcmp(argv[ParamCount], "-T") == 0) {
+        if (argc < ParamCount + 3) {
+            fprintf(stderr, "-T needs a file to write the trace to and a program\n");
+            PicocCleanup(&pc);
+            return 1;
+        }
+        TraceOut = fopen(argv[ParamCount+1], "w");
+        if (TraceOut == NULL) {
+            fprintf(stderr, "can't write the trace to %s\n", argv[ParamCount+1]);
+            PicocCleanup(&pc);
+            return 1;
+        }
+        if (!PicocProfileTrace(&pc, TraceOut)) {
+            fprintf(stderr, "this picoc was built with NO_STATS, so it can't trace\n");
+            fclose(TraceOut);
+            PicocCleanup(&pc);
+            return 1;
+        }
+        TraceFile = argv[ParamCount+1];
+        ParamCount += 2;
+    } else if (strcmp(argv[ParamCount], "-m") == 0) {
+#ifdef NO_STATS
+        fprintf(stderr, "this picoc was built with NO_STATS, so it can't collect stats\n");
+        PicocCleanup(&pc);
+        return 1;
+#endif
+        pc.CollectStats = true;
+        pc.ReportHeapLeaks = true;
+        ParamCount++;
+    } else if (strncmp(argv[ParamCount], "-g", 2) == 0) {
+#ifdef NO_STATS
+        fprintf(stderr, "this picoc was built with NO_STATS, so it can't collect stats\n");
+        PicocCleanup(&pc);
+        return 1;
+#endif
+        if (strlen(argv[ParamCount]) > 2)
+            NgramsTop = atoi(&argv[ParamCount][2]);
+
+        if (argc < ParamCount + 3 || NgramsTop <= 0) {
+            fprintf(stderr, "-g needs a file to write the n-grams to and a program\n");
+            PicocCleanup(&pc);
+            return 1;
+        }
+        pc.CollectStats = true;
+        pc.CollectExpressionNgrams = true;
+        NgramsFile = argv[ParamCount+1];
+        ParamCount += 2;
+    } else if (strcmp(argv[ParamCount], "-x") == 0) {
+#ifdef NO_STATS
+        fprintf(stderr, "this picoc was built with NO_STATS, so it can't collect stats\n");
+        PicocCleanup(&pc);
+        return 1;
+#endif
+        if (argc < ParamCount + 3) {
+            fprintf(stderr, "-x needs a file to stream the expression chains to and a program\n");
+            PicocCleanup(&pc);
+            return 1;
+        }
+        if (!stats_stream_expression_chains(&pc, argv[ParamCount+1])) {
+            fprintf(stderr, "can't write expression chains to %s\n", argv[ParamCount+1]);
+            PicocCleanup(&pc);
+            return 1;
+        }
+        pc.CollectStats = true;
+        ChainsFile = argv[ParamCount+1];
+        ParamCount += 2;
+    } else if (strcmp(argv[ParamCount], "-f") == 0) {
+        if (argc < ParamCount + 3) {
+            fprintf(stderr, "-f needs a file of n-grams and a program\n");
+            PicocCleanup(&pc);
+            return 1;
+        }
+        if (PicocLoadExpressionFusions(&pc, argv[ParamCount+1]) < 0) {
+            fprintf(stderr, "can't read n-grams from %s\n", argv[ParamCount+1]);
+            PicocCleanup(&pc);
+            return 1;
+        }
+        ParamCount += 2;
     }
 
+    FirstFile = ParamCount;
+    for (NumFiles = 0; FirstFile + NumFiles < argc &&
+            strcmp(argv[FirstFile + NumFiles], "-") != 0; NumFiles++)
+        ;
+
     if (argc > ParamCount && strcmp(argv[ParamCount], "-i") == 0) {
         PicocIncludeAllSystemHeaders(&pc);
         PicocParseInteractive(&pc);
     } else {
         if (PicocPlatformSetExitPoint(&pc)) {
+            /* the stats are still wanted when the program calls exit() */
+            if (StatsFile != NULL)
+                WriteStats(&pc, StatsFile, StatsReports, &argv[FirstFile], NumFiles);
+            if (ProfileFile != NULL)
+                WriteProfile(&pc, ProfileFile);
+            if (CostsFile != NULL)
+                WriteCosts(&pc, CostsFile, &argv[FirstFile], NumFiles);
+            if (NgramsFile != NULL)
+                WriteExpressionNgrams(&pc, NgramsFile, NgramsTop);
+            if (ChainsFile != NULL && !stats_close_expression_chains(&pc))
+                fprintf(stderr, "can't write expression chains to %s\n", ChainsFile);
+            if (TraceFile != NULL)
+                WriteTrace(&pc, TraceOut, TraceFile);
             PicocCleanup(&pc);
             return pc.PicocExitValue;
         }
@@ -102,8 +840,6 @@ int main(int argc, char **argv)
             PicocCallMain(&pc, argc - ParamCount, &argv[ParamCount]);
     }
 
-    PicocCleanup(&pc);
-
     /* Stats types:
      * 0x0: Print tokens that have been seen for each run mode
      * 0x1: Print all tokens for each run mode
@@ -117,9 +853,10 @@ int main(int argc, char **argv)
      * 0x9: Print summary of expressions encountered during execution and their counts
      * 0xa: Print full list of expressions encountered during execution
      * 0xb: Print summary information about expression chains
-     * 0xc: Print memory information about stack depths, frame sizes, and global variable allocations
+     * 0xc: Print memory information about stack depths, frame sizes by function, global variable allocations and the program's heap use
      * 0xd: Print memory information about stack depths, frame sizes, and global variable allocations, in CSV format
      * 0xe: Print summary of expressions encountered during execution and their counts, in CSV format
+     * 0xf: Print the most common runs of 2 to 4 expressions evaluated one after another, as picoc -g writes them
      *
      * Add 0x0010 to each type to also print token information to stderr in real-time as they are parsed.
      * Add 0x0100 to each type to also print expressions information to stderr in real-time as they are executed.
@@ -129,55 +866,86 @@ int main(int argc, char **argv)
     if (CollectStats) {
         switch (StatsType) {
             case 0x00:
-                stats_print_tokens(false);
+                stats_print_tokens(&pc, false);
                 break;
             case 0x01:
-                stats_print_tokens(true);
+                stats_print_tokens(&pc, true);
                 break;
             case 0x02:
-                stats_print_tokens_csv();
+                stats_print_tokens_csv(&pc);
                 break;
             case 0x03:
-                stats_print_tokens_csv_runmode(RunModeRun);
+                stats_print_tokens_csv_runmode(&pc, RunModeRun);
                 break;
             case 0x04:
-                stats_print_function_parameter_counts(false);
+                stats_print_function_parameter_counts(&pc, false);
                 break;
             case 0x05:
-                stats_print_function_parameter_counts(true);
+                stats_print_function_parameter_counts(&pc, true);
                 break;
             case 0x06:
-                stats_print_max_depths();
+                stats_print_max_depths(&pc);
                 break;
             case 0x07:
-                stats_print_assignments();
+                stats_print_assignments(&pc);
                 break;
             case 0x08:
-                stats_print_assignments_csv();
+                stats_print_assignments_csv(&pc);
                 break;
             case 0x09:
-                stats_print_expressions_summary();
+                stats_print_expressions_summary(&pc);
                 break;
             case 0x0a:
-                stats_print_expression_chains();
+                stats_print_expression_chains(&pc);
                 break;
             case 0x0b:
-                stats_print_expression_chains_summary();
+                stats_print_expression_chains_summary(&pc);
                 break;
             case 0x0c:
-                stats_print_memory_info();
+                stats_print_memory_info(&pc);
                 break;
             case 0x0d:
-                stats_print_memory_info_csv();
+                stats_print_memory_info_csv(&pc);
                 break;
             case 0x0e:
-                stats_print_expressions_summary_csv();
+                stats_print_expressions_summary_csv(&pc);
+                break;
+            case 0x0f:
+                stats_print_expression_ngrams(&pc);
                 break;
             default:
                 break;
         }
     }
 
+    if (StatsFile != NULL && !WriteStats(&pc, StatsFile, StatsReports,
+            &argv[FirstFile], NumFiles) && pc.PicocExitValue == 0)
+        pc.PicocExitValue = 1;
+
+    if (ProfileFile != NULL && !WriteProfile(&pc, ProfileFile) &&
+            pc.PicocExitValue == 0)
+        pc.PicocExitValue = 1;
+
+    if (CostsFile != NULL && !WriteCosts(&pc, CostsFile, &argv[FirstFile],
+            NumFiles) && pc.PicocExitValue == 0)
+        pc.PicocExitValue = 1;
+
+    if (NgramsFile != NULL && !WriteExpressionNgrams(&pc, NgramsFile,
+            NgramsTop) && pc.PicocExitValue == 0)
+        pc.PicocExitValue = 1;
+
+    if (TraceFile != NULL && !WriteTrace(&pc, TraceOut, TraceFile) &&
+            pc.PicocExitValue == 0)
+        pc.PicocExitValue = 1;
+
+    if (ChainsFile != NULL && !stats_close_expression_chains(&pc)) {
+        fprintf(stderr, "can't write expression chains to %s\n", ChainsFile);
+        if (pc.PicocExitValue == 0)
+            pc.PicocExitValue = 1;
+    }
+
+    PicocCleanup(&pc);
+
     return pc.PicocExitValue;
 }
 #endif
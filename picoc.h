@@ -18,19 +18,72 @@
 	the stack being corrupt */
 #define PicocPlatformSetExitPoint(pc) setjmp((pc)->PicocExitBuf)
 
+/* a function in the program, found once with PicocGetFunction() and then
+	called from the host with PicocCallFunction() */
+struct PicocFunction {
+	const char *Name;
+	struct FuncDef *Def;
+};
+
+/* an argument to or result of a function called from the host. the member
+	used is the one which suits the type the function declares */
+union PicocValue {
+	long long Integer;
+	double FP;
+	void *Pointer;
+};
+
 
 /* parse.c */
 extern void PicocParse(Picoc *pc, const char *FileName, const char *Source,
 	int SourceLen, int RunIt, int CleanupNow, int CleanupSource, int EnableDebugger);
 extern void PicocParseInteractive(Picoc *pc);
 
+/* expression.c */
+extern int PicocLoadExpressionFusions(Picoc *pc, const char *FileName);
+
 /* platform.c */
 extern void PicocCallMain(Picoc *pc, int argc, char **argv);
+extern int PicocGetFunction(Picoc *pc, const char *Name,
+	struct PicocFunction *Func);
+extern void PicocCallFunction(Picoc *pc, struct PicocFunction *Func,
+	union PicocValue *Args, int NumArgs, union PicocValue *Result);
+extern void PicocCallVarArgs(Picoc *pc, struct PicocFunction *Func,
+	union PicocValue *Args, struct ValueType **ArgTypes, int NumArgs,
+	union PicocValue *Result);
+extern struct ValueType *PicocGetType(Picoc *pc, const char *TypeName);
+extern void PicocBind(Picoc *pc, const char *Name, void *Data,
+	struct ValueType *Typ, int Length, int IsWritable);
 extern void PicocInitialize(Picoc *pc, int StackSize);
+extern void PicocInitializeForImage(Picoc *pc, int StackSize);
+extern void PicocSetOutput(Picoc *pc, FILE *Stream);
 extern void PicocCleanup(Picoc *pc);
 extern void PicocPlatformScanFile(Picoc *pc, const char *FileName);
 
 /* include.c */
 extern void PicocIncludeAllSystemHeaders(Picoc *pc);
 
+/* image.c */
+extern void PicocSaveImage(Picoc *pc, const char *FileName);
+extern int PicocLoadImage(Picoc *pc, const char *FileName);
+extern void PicocSetResetPoint(Picoc *pc);
+extern void PicocReset(Picoc *pc);
+
+/* profile.c */
+extern int PicocProfileStart(Picoc *pc, int Rate);
+extern void PicocProfileStop(Picoc *pc);
+extern long PicocProfileWrite(Picoc *pc, FILE *Out);
+extern int PicocProfileCosts(Picoc *pc);
+extern void PicocProfileWriteCosts(Picoc *pc, FILE *Table, FILE *Callgrind,
+    const char *Command);
+extern int PicocProfileTrace(Picoc *pc, FILE *Out);
+extern int PicocProfileTraceStop(Picoc *pc);
+
+/* task.c */
+extern int PicocTaskStart(Picoc *pc, void (*Body)(Picoc *pc, void *Arg),
+	void *Arg, int StackSize);
+extern int PicocTaskRun(Picoc *pc, long Statements, long Microseconds);
+extern void PicocTaskYield(Picoc *pc);
+extern void PicocTaskEnd(Picoc *pc);
+
 #endif /* PICOC_H */
@@ -3,6 +3,7 @@
 
 #include "picoc.h"
 #include "interpreter.h"
+#include "stats.h"
 
 
 static void PrintSourceTextErrorLine(IOFILE *Stream, const char *FileName,
@@ -16,9 +17,11 @@ static int gEnableDebugger = false;
 
 
 /* initialize everything */
-void PicocInitialize(Picoc *pc, int StackSize)
+static void PicocInitializeHeap(Picoc *pc, int StackSize, int PrivateHeap)
 {
     memset(pc, '\0', sizeof(*pc));
+    pc->PrivateHeap = PrivateHeap;
+    pc->RandSeed = 1;
     PlatformInit(pc);
     BasicIOInit(pc);
     HeapInit(pc, StackSize);
@@ -34,13 +37,40 @@ void PicocInitialize(Picoc *pc, int StackSize)
 #endif
 }
 
+void PicocInitialize(Picoc *pc, int StackSize)
+{
+    PicocInitializeHeap(pc, StackSize, false);
+}
+
+/* initialize with everything allocated inside the stack area, so the
+    instance can be saved with PicocSaveImage() or put back to how it was
+    with PicocReset() */
+void PicocInitializeForImage(Picoc *pc, int StackSize)
+{
+    PicocInitializeHeap(pc, StackSize, true);
+    PicocSetResetPoint(pc);
+}
+
+/* send the program's standard output and any error messages to Stream
+    rather than stdout. PicocReset() and PicocLoadImage() put it back */
+void PicocSetOutput(Picoc *pc, FILE *Stream)
+{
+    pc->CStdOut = Stream;
+    pc->StdoutValue = Stream;
+}
+
 /* free memory */
 void PicocCleanup(Picoc *pc)
 {
+    PicocTaskEnd(pc);
+    ThreadCleanup(pc);
+    StdlibReleaseResources(pc, true);
+    ProfileCleanup(pc);
 #ifdef DEBUGGER
     DebugCleanup(pc);
 #endif
     IncludeCleanup(pc);
+    StdioCleanup(pc);
     ParseCleanup(pc);
     LexCleanup(pc);
     VariableCleanup(pc);
@@ -48,6 +78,9 @@ void PicocCleanup(Picoc *pc)
     TableStrFree(pc);
     HeapCleanup(pc);
     PlatformCleanup(pc);
+    stats_cleanup(pc);
+    free(pc->ExpressionFusions);
+    pc->ExpressionFusions = NULL;
 }
 
 /* platform-dependent code for running programs */
@@ -100,9 +133,247 @@ void PicocCallMain(Picoc *pc, int argc, char **argv)
                 strlen(CALL_MAIN_WITH_ARGS_RETURN_INT), true, true, false,
                 gEnableDebugger);
     }
+
+    /* returning from main() ends any threads it left running */
+    ThreadStopAll(pc);
 }
 #endif
 
+/* can a value of this type go between the host and a guest function */
+static int PicocHostType(struct ValueType *Typ)
+{
+    return (Typ->Base >= TypeInt && Typ->Base <= TypeDouble) ||
+        Typ->Base == TypePointer;
+}
+
+/* look up a function in the program so the host can call it with
+    PicocCallFunction() as often as it likes. returns false if there's no
+    such function, it isn't defined yet or it takes or returns something
+    other than numbers and pointers */
+int PicocGetFunction(Picoc *pc, const char *Name, struct PicocFunction *Func)
+{
+    struct Value *FuncValue = NULL;
+    struct FuncDef *Def;
+    const char *RegisteredName = TableStrRegister(pc, Name);
+    int Count;
+
+    if (!VariableDefined(pc, RegisteredName))
+        return false;
+
+    VariableGet(pc, NULL, RegisteredName, &FuncValue);
+    if (FuncValue->Typ->Base != TypeFunction)
+        return false;
+
+    Def = &FuncValue->Val->FuncDef;
+    if (Def->Intrinsic == NULL && Def->Native == NULL && Def->Body.Pos == NULL)
+        return false;
+
+    if (Def->ReturnType != &pc->VoidType &&
+            !PicocHostType(Def->ReturnType))
+        return false;
+
+    for (Count = 0; Count < Def->NumParams; Count++) {
+        if (!PicocHostType(Def->ParamType[Count]))
+            return false;
+    }
+
+    Func->Name = RegisteredName;
+    Func->Def = Def;
+    return true;
+}
+
+/* call Func with NumArgs arguments. the types of any after its fixed
+    parameters are in ArgTypes, see PicocCallVarArgs() */
+static void PicocCall(Picoc *pc, struct PicocFunction *Func,
+    union PicocValue *Args, struct ValueType **ArgTypes, int NumArgs,
+    union PicocValue *Result)
+{
+    struct FuncDef *Def = Func->Def;
+    struct ParseState Parser;
+    struct Value *ReturnValue;
+    struct Value **ParamArray;
+    int Count;
+
+    if (NumArgs != Def->NumParams && !(Def->VarArgs && NumArgs > Def->NumParams))
+        ProgramFailNoParser(pc, "%s() takes %d arguments, not %d", Func->Name,
+            Def->NumParams, NumArgs);
+
+    for (Count = Def->NumParams; Count < NumArgs; Count++) {
+        if (ArgTypes == NULL)
+            ProgramFailNoParser(pc, "%s() takes extra arguments - "
+                "use PicocCallVarArgs() to give their types", Func->Name);
+
+        if (ArgTypes[Count] == NULL || !PicocHostType(ArgTypes[Count]))
+            ProgramFailNoParser(pc, "argument %d to %s() should be a number "
+                "or a pointer", Count+1, Func->Name);
+    }
+
+    /* threads the program starts unwind their own stacks */
+    if (ThreadCurrent == NULL && pc->HostCalls++ == 0) {
+        pc->HostCallTopStackFrame = pc->MainThread.TopStackFrame;
+        pc->HostCallStackFrame = pc->MainThread.StackFrame;
+        pc->HostCallHeapStackTop = pc->MainThread.HeapStackTop;
+    }
+
+    if (Def->Intrinsic == NULL && Def->Native == NULL)
+        ParserCopy(&Parser, &Def->Body);
+    else {
+        memset(&Parser, '\0', sizeof(Parser));
+        Parser.pc = pc;
+        Parser.FileName = (char*)Func->Name;
+    }
+    Parser.Mode = RunModeRun;
+    stats_log_function_entry(&Parser, Func->Name, NumArgs);
+
+    ReturnValue = VariableAllocValueFromType(pc, &Parser, Def->ReturnType,
+        false, NULL, false);
+    HeapPushStackFrame(pc);
+    ParamArray = HeapAllocStack(pc, sizeof(struct Value*) * NumArgs);
+    if (ParamArray == NULL)
+        ProgramFail(&Parser, "(PicocCallFunction) out of memory");
+
+    for (Count = 0; Count < NumArgs; Count++) {
+        ParamArray[Count] = VariableAllocValueFromType(pc, &Parser,
+            Count < Def->NumParams ? Def->ParamType[Count] : ArgTypes[Count],
+            true, NULL, false);
+        if (ParamArray[Count]->Typ->Base == TypePointer)
+            ParamArray[Count]->Val->Pointer = Args[Count].Pointer;
+        else if (IS_FP(ParamArray[Count]))
+            ExpressionAssignFP(&Parser, ParamArray[Count], Args[Count].FP);
+        else
+            ExpressionAssignInt(&Parser, ParamArray[Count], Args[Count].Integer,
+                false);
+    }
+
+    if (Def->Native != NULL)
+        LibraryCallNative(&Parser, Def, ReturnValue, ParamArray, NumArgs);
+    else if (Def->Intrinsic != NULL)
+        Def->Intrinsic(&Parser, ReturnValue, ParamArray, NumArgs);
+    else {
+        ExpressionCallFrameAdd(&Parser, Func->Name, Def, ParamArray, NumArgs,
+            ReturnValue, NULL);
+        ExpressionCallBody(Def);
+        VariableStackFramePop(&Parser);
+    }
+
+    HeapPopStackFrame(pc);
+    stats_log_function_exit(&Parser);
+
+    if (Result != NULL && Def->ReturnType != &pc->VoidType) {
+        if (ReturnValue->Typ->Base == TypePointer)
+            Result->Pointer = ReturnValue->Val->Pointer;
+        else if (IS_FP(ReturnValue))
+            Result->FP = ExpressionCoerceFP(ReturnValue);
+        else
+            Result->Integer = ExpressionCoerceInteger(ReturnValue);
+    }
+
+    VariableStackPop(&Parser, ReturnValue);
+    if (ThreadCurrent == NULL)
+        pc->HostCalls--;
+}
+
+/* call a function found by PicocGetFunction() with NumArgs arguments,
+    each taken from whichever member of Args suits the type of the
+    parameter it's for. the result is stored in *Result if it isn't NULL.
+    errors and exit() jump to the exit point, as for PicocCallMain() */
+void PicocCallFunction(Picoc *pc, struct PicocFunction *Func,
+    union PicocValue *Args, int NumArgs, union PicocValue *Result)
+{
+    PicocCall(pc, Func, Args, NULL, NumArgs, Result);
+}
+
+/* call a function which takes a variable number of arguments, as
+    PicocCallFunction() does. ArgTypes gives the type of each argument
+    after the fixed parameters, which has to be a number or a pointer, from
+    PicocGetType(). the entries for the fixed parameters aren't used */
+void PicocCallVarArgs(Picoc *pc, struct PicocFunction *Func,
+    union PicocValue *Args, struct ValueType **ArgTypes, int NumArgs,
+    union PicocValue *Result)
+{
+    PicocCall(pc, Func, Args, ArgTypes, NumArgs, Result);
+}
+
+/* an error or exit() ends any calls from the host, so whatever they left
+    on the stack goes. called by PlatformExit() */
+void PlatformEndHostCalls(Picoc *pc)
+{
+    if (pc->HostCalls == 0)
+        return;
+
+    pc->MainThread.TopStackFrame = pc->HostCallTopStackFrame;
+    pc->MainThread.StackFrame = pc->HostCallStackFrame;
+    pc->MainThread.HeapStackTop = pc->HostCallHeapStackTop;
+    pc->HostCalls = 0;
+}
+
+/* get a type from its name, as it would be written in a declaration - "int",
+    "unsigned char *" or "struct Record" for instance. the struct has to
+    have been defined already, by the program or a PicocParse(). returns
+    NULL if the name isn't a type */
+struct ValueType *PicocGetType(Picoc *pc, const char *TypeName)
+{
+    struct ParseState Parser;
+    struct ValueType *BasicType;
+    struct ValueType *Typ = NULL;
+    struct Value *LexerValue;
+    struct Value *VarValue;
+    char *Identifier;
+    char *FileName = TableStrRegister(pc, "host type");
+    void *Tokens;
+
+    Tokens = LexAnalyse(pc, FileName, TypeName, strlen(TypeName), NULL);
+    LexInitParser(&Parser, pc, TypeName, Tokens, FileName, true, false);
+
+    /* an identifier's only a type if it's been typedefed */
+    if (LexGetToken(&Parser, &LexerValue, false) == TokenIdentifier &&
+            (!VariableDefined(pc, LexerValue->Val->Identifier) ||
+            (VariableGet(pc, &Parser, LexerValue->Val->Identifier, &VarValue),
+            VarValue->Typ->Base != Type_Type))) {
+        HeapFreeMem(pc, Tokens);
+        return NULL;
+    }
+
+    if (TypeParseFront(&Parser, &BasicType, NULL, NULL, NULL))
+        TypeParseIdentPart(&Parser, BasicType, &Typ, &Identifier);
+
+    HeapFreeMem(pc, Tokens);
+    return Typ;
+}
+
+/* make the host's memory at Data a global variable called Name, without
+    copying it. it's an array of Length elements of type Typ, or just one
+    Typ - a struct for instance - if Length is 0. the program can't assign
+    to it unless IsWritable is true. binding a name again points it at new
+    memory, which is cheap enough to do for every record in a stream */
+void PicocBind(Picoc *pc, const char *Name, void *Data, struct ValueType *Typ,
+    int Length, int IsWritable)
+{
+    struct Value *Existing;
+    char *RegisteredName = TableStrRegister(pc, Name);
+
+    if (Length > 0)
+        Typ = TypeGetMatching(pc, NULL, Typ, TypeArray, Length, pc->StrEmpty,
+            true);
+
+    if (TypeIsForwardDeclared(NULL, Typ) || Typ->Base == TypeVoid ||
+            Typ->Base == TypeFunction || Typ->Base == TypeMacro)
+        ProgramFailNoParser(pc, "can't bind '%s' to a %t", Name, Typ);
+
+    if (TableGet(&pc->GlobalTable, RegisteredName, &Existing, NULL, NULL,
+            NULL)) {
+        if (Existing->Typ != Typ)
+            ProgramFailNoParser(pc, "'%s' is already defined as a %t", Name,
+                Existing->Typ);
+
+        Existing->Val = Data;
+        Existing->IsLValue = IsWritable;
+        return;
+    }
+
+    VariableDefinePlatformVar(pc, NULL, RegisteredName, Typ, Data, IsWritable);
+}
+
 void PrintSourceTextErrorLine(IOFILE *Stream, const char *FileName,
     const char *SourceText, int Line, int CharacterPos)
 {
@@ -254,7 +525,7 @@ void PlatformVPrintf(IOFILE *Stream, const char *Format, va_list Args)
     }
 }
 
-/* make a new temporary name. takes a static buffer of char [7] as a parameter.
+/* make a new temporary name. takes a buffer of char [7] as a parameter.
  * should be initialized to "XX0000"
  * where XX can be any characters */
 char *PlatformMakeTempName(Picoc *pc, char *TempNameBuffer)
@@ -10,9 +10,12 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <setjmp.h>
+#include <signal.h>
 #include <math.h>
 #include <stdbool.h>
+#include <time.h>
 
 /* host platform includes */
 #ifdef UNIX_HOST
@@ -29,6 +32,7 @@
  #define UNIX_HOST
  #define DEBUGGER
  #define USE_READLINE (defined by default for UNIX_HOST)
+ #define NO_STATS (leave the -d stats hooks out for production builds)
  */
 #define USE_READLINE
 
@@ -45,6 +49,13 @@
 #undef DEBUG_VAR_SCOPE
 
 
+/* a variable each host thread has its own copy of */
+#if defined(WIN32)
+#define PLATFORM_THREAD_LOCAL __declspec(thread)
+#else
+#define PLATFORM_THREAD_LOCAL __thread
+#endif
+
 #if defined(__hppa__) || defined(__sparc__)
 /* the default data type to use for alignment */
 #define ALIGN_TYPE double
@@ -57,8 +68,14 @@
 #define STRING_TABLE_SIZE (97)                /* shared string table size */
 #define STRING_LITERAL_TABLE_SIZE (97)        /* string literal table size */
 #define RESERVED_WORD_TABLE_SIZE (97)         /* reserved word table size */
+#define CONSTANT_TABLE_SIZE (97)              /* library constant table size */
+#define PRINTF_FORMAT_TABLE_SIZE (97)         /* compiled printf() format table size */
 #define PARAMETER_MAX (32)                    /* maximum number of parameters to a function */
+#define NATIVE_INT_ARGS (6)                   /* most integer and pointer parameters to a dlbind() function */
+#define NATIVE_FP_ARGS (8)                    /* most floating point parameters to a dlbind() function */
 #define LINEBUFFER_MAX (256)                  /* maximum number of characters on a line */
+#define THREAD_STACK_SIZE (4*1024*1024)       /* stack for each thread a program starts */
+#define PROFILE_RATE (99)                     /* picoc -p samples a second by default */
 #define LOCAL_TABLE_SIZE (11)                 /* size of local variable table (can expand) */
 #define STRUCT_TABLE_SIZE (11)                /* size of struct/union member table (can expand) */
 
@@ -66,6 +83,4 @@
 #define INTERACTIVE_PROMPT_STATEMENT "picoc> "
 #define INTERACTIVE_PROMPT_LINE "     > "
 
-extern jmp_buf ExitBuf;
-
 #endif /* PLATFORM_H */
@@ -18,7 +18,7 @@ void CLineNo (struct ParseState *Parser, struct Value *ReturnValue,
 }
 
 /* list of all library functions and their prototypes */
-struct LibraryFunction MsvcFunctions[] =
+const struct LibraryFunction MsvcFunctions[] =
 {
     {CTest, "void Test(int);"},
     {CLineNo, "int LineNo();"},
@@ -27,6 +27,7 @@ struct LibraryFunction MsvcFunctions[] =
 
 void PlatformLibraryInit(Picoc *pc)
 {
-    IncludeRegister(pc, "picoc_msvc.h", &MsvcSetupFunc, &MsvcFunctions[0], NULL);
+    IncludeRegister(pc, "picoc_msvc.h", &MsvcSetupFunc, &MsvcFunctions[0],
+        NULL, NULL);
 }
 
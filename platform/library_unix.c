@@ -18,7 +18,7 @@ void Clineno (struct ParseState *Parser, struct Value *ReturnValue,
 }
 
 /* list of all library functions and their prototypes */
-struct LibraryFunction UnixFunctions[] =
+const struct LibraryFunction UnixFunctions[] =
 {
     {Ctest, "void test(int);"},
     {Clineno, "int lineno();"},
@@ -27,5 +27,6 @@ struct LibraryFunction UnixFunctions[] =
 
 void PlatformLibraryInit(Picoc *pc)
 {
-    IncludeRegister(pc, "picoc_unix.h", &UnixSetupFunc, &UnixFunctions[0], NULL);
+    IncludeRegister(pc, "picoc_unix.h", &UnixSetupFunc, &UnixFunctions[0],
+        NULL, NULL);
 }
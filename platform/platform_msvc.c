@@ -7,13 +7,17 @@ static int gEnableDebugger = true;
 static int gEnableDebugger = false;
 #endif
 
-/* mark where to end the program for platforms which require this */
-jmp_buf PicocExitBuf;
-
 void PlatformInit(Picoc *pc)
 {
 }
 
+#ifdef DEBUGGER
+int PlatformBreakPending(Picoc *pc)
+{
+    return false;
+}
+#endif
+
 void PlatformCleanup(Picoc *pc)
 {
 }
@@ -53,7 +57,7 @@ char *PlatformReadFile(Picoc *pc, const char *FileName)
     if (stat(FileName, &FileInfo))
         ProgramFailNoParser(pc, "can't read file %s\n", FileName);
 
-    ReadText = malloc(FileInfo.st_size + 1);
+    ReadText = HeapAllocMem(pc, FileInfo.st_size + 1);
     if (ReadText == NULL)
         ProgramFailNoParser(pc, "out of memory\n");
 
@@ -89,5 +93,50 @@ void PicocPlatformScanFile(Picoc *pc, const char *FileName)
 void PlatformExit(Picoc *pc, int RetVal)
 {
     pc->PicocExitValue = RetVal;
+    ThreadExit(pc);
+    PlatformEndHostCalls(pc);
     longjmp(pc->PicocExitBuf, 1);
 }
+
+/* images aren't supported on this platform */
+int PlatformImageRange(void *Addr, unsigned long *Base, unsigned long *Size)
+{
+    return false;
+}
+
+int PlatformHostHeapRange(unsigned long *Base, unsigned long *Size)
+{
+    return false;
+}
+
+void *PlatformMapImage(const char *FileName, void *Hint, size_t Size)
+{
+    return NULL;
+}
+
+void PlatformUnmapImage(void *Mapping, size_t Size)
+{
+}
+
+/* tasks aren't supported here, so PicocTaskStart() always fails */
+void *PlatformTaskCreate(Picoc *pc, void (*Entry)(Picoc *pc), int StackSize)
+{
+    return NULL;
+}
+
+void PlatformTaskEnter(void *Context)
+{
+}
+
+void PlatformTaskLeave(void *Context)
+{
+}
+
+void PlatformTaskFree(void *Context)
+{
+}
+
+unsigned long PlatformMicroseconds(void)
+{
+    return (unsigned long)((double)clock() * 1000000 / CLOCKS_PER_SEC);
+}
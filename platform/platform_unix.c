@@ -1,6 +1,12 @@
+#define _GNU_SOURCE     /* for dl_iterate_phdr() */
 #include "../picoc.h"
 #include "../interpreter.h"
 
+#include <fcntl.h>
+#include <link.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+
 #ifdef USE_READLINE
 #include <readline/readline.h>
 #include <readline/history.h>
@@ -12,25 +18,36 @@ static int gEnableDebugger = true;
 static int gEnableDebugger = false;
 #endif
 
-/* mark where to end the program for platforms which require this */
-jmp_buf PicocExitBuf;
-
 #ifdef DEBUGGER
 #include <signal.h>
 
-Picoc *break_pc = NULL;
+/* the number of break signals so far. every instance notices a break
+    the next time it checks, whichever thread it's running on */
+static volatile sig_atomic_t BreakCount = 0;
 
 static void BreakHandler(int Signal)
 {
-    break_pc->DebugManualBreak = true;
+    BreakCount++;
 }
 
 void PlatformInit(Picoc *pc)
 {
     /* capture the break signal and pass it to the debugger */
-    break_pc = pc;
+    pc->DebugBreakCount = BreakCount;
     signal(SIGINT, BreakHandler);
 }
+
+/* check for a break signal this instance hasn't handled yet */
+int PlatformBreakPending(Picoc *pc)
+{
+    int Count = BreakCount;
+
+    if (Count == pc->DebugBreakCount)
+        return false;
+
+    pc->DebugBreakCount = Count;
+    return true;
+}
 #else
 void PlatformInit(Picoc *pc) { }
 #endif
@@ -91,7 +108,7 @@ char *PlatformReadFile(Picoc *pc, const char *FileName)
     if (stat(FileName, &FileInfo))
         ProgramFailNoParser(pc, "can't read file %s\n", FileName);
 
-    ReadText = malloc(FileInfo.st_size + 1);
+    ReadText = HeapAllocMem(pc, FileInfo.st_size + 1);
     if (ReadText == NULL)
         ProgramFailNoParser(pc, "out of memory\n");
 
@@ -134,6 +151,185 @@ void PicocPlatformScanFile(Picoc *pc, const char *FileName)
 void PlatformExit(Picoc *pc, int RetVal)
 {
     pc->PicocExitValue = RetVal;
+    ThreadExit(pc);
+    PlatformEndHostCalls(pc);
     longjmp(pc->PicocExitBuf, 1);
 }
 
+/* find the loaded object containing an address */
+struct ImageRangeSearch {
+    unsigned long Addr;
+    unsigned long Base;
+    unsigned long Size;
+};
+
+static int PlatformImageRangeCallback(struct dl_phdr_info *Info, size_t InfoSize,
+    void *Data)
+{
+    struct ImageRangeSearch *Search = Data;
+    unsigned long Low = (unsigned long)-1;
+    unsigned long High = 0;
+    int Count;
+
+    for (Count = 0; Count < Info->dlpi_phnum; Count++) {
+        const ElfW(Phdr) *Phdr = &Info->dlpi_phdr[Count];
+        if (Phdr->p_type != PT_LOAD)
+            continue;
+
+        if (Info->dlpi_addr + Phdr->p_vaddr < Low)
+            Low = Info->dlpi_addr + Phdr->p_vaddr;
+        if (Info->dlpi_addr + Phdr->p_vaddr + Phdr->p_memsz > High)
+            High = Info->dlpi_addr + Phdr->p_vaddr + Phdr->p_memsz;
+    }
+
+    if (Search->Addr < Low || Search->Addr >= High)
+        return 0;
+
+    Search->Base = Low;
+    Search->Size = High - Low;
+    return 1;
+}
+
+/* get the extent of the executable or shared object picoc is loaded in, so
+    pointers to its code and static data can be relocated in an image */
+int PlatformImageRange(void *Addr, unsigned long *Base, unsigned long *Size)
+{
+    struct ImageRangeSearch Search;
+
+    Search.Addr = (unsigned long)Addr;
+    if (!dl_iterate_phdr(&PlatformImageRangeCallback, &Search))
+        return false;
+
+    *Base = Search.Base;
+    *Size = Search.Size;
+    return true;
+}
+
+/* get the extent of the heap malloc() uses for small blocks, so an image
+    isn't saved with pointers into it. returns false if it can't be found */
+int PlatformHostHeapRange(unsigned long *Base, unsigned long *Size)
+{
+    FILE *Maps = fopen("/proc/self/maps", "r");
+    char Line[1024];
+    unsigned long Low;
+    unsigned long High;
+    int Found = false;
+
+    if (Maps == NULL)
+        return false;
+
+    while (!Found && fgets(Line, sizeof(Line), Maps) != NULL) {
+        if (strstr(Line, "[heap]") != NULL &&
+                sscanf(Line, "%lx-%lx", &Low, &High) == 2)
+            Found = true;
+    }
+
+    fclose(Maps);
+    if (Found) {
+        *Base = Low;
+        *Size = High - Low;
+    }
+
+    return Found;
+}
+
+/* map an image file copy-on-write, at the address it was saved from if
+    possible. returns NULL if it can't be mapped */
+void *PlatformMapImage(const char *FileName, void *Hint, size_t Size)
+{
+    void *Mapping;
+    int FileNo = open(FileName, O_RDONLY);
+
+    if (FileNo < 0)
+        return NULL;
+
+    Mapping = mmap(Hint, Size, PROT_READ | PROT_WRITE, MAP_PRIVATE, FileNo, 0);
+    close(FileNo);
+    if (Mapping == MAP_FAILED)
+        return NULL;
+
+    return Mapping;
+}
+
+void PlatformUnmapImage(void *Mapping, size_t Size)
+{
+    munmap(Mapping, Size);
+}
+
+/* a task's stack and the contexts to switch between */
+struct PlatformTask {
+    ucontext_t Host;
+    ucontext_t Task;
+    void (*Entry)(Picoc *pc);
+    Picoc *pc;
+    char *Stack;
+};
+
+/* makecontext() only passes ints, so the task arrives in two halves */
+static void PlatformTaskStart(unsigned int Low, unsigned int High)
+{
+    struct PlatformTask *Task =
+        (struct PlatformTask *)(((uintptr_t)High << 16 << 16) | Low);
+
+    Task->Entry(Task->pc);
+}
+
+/* make a stack for Entry(pc) to run on. it mustn't return */
+void *PlatformTaskCreate(Picoc *pc, void (*Entry)(Picoc *pc), int StackSize)
+{
+    struct PlatformTask *Task = malloc(sizeof(struct PlatformTask));
+
+    if (Task == NULL)
+        return NULL;
+
+    Task->Stack = malloc(StackSize);
+    if (Task->Stack == NULL || getcontext(&Task->Task) != 0) {
+        free(Task->Stack);
+        free(Task);
+        return NULL;
+    }
+
+    Task->Entry = Entry;
+    Task->pc = pc;
+    Task->Task.uc_stack.ss_sp = Task->Stack;
+    Task->Task.uc_stack.ss_size = StackSize;
+    Task->Task.uc_link = NULL;
+    makecontext(&Task->Task, (void (*)(void))PlatformTaskStart, 2,
+        (unsigned int)(uintptr_t)Task,
+        (unsigned int)((uintptr_t)Task >> 16 >> 16));
+
+    return Task;
+}
+
+/* switch from the host to the task, returning when it leaves */
+void PlatformTaskEnter(void *Context)
+{
+    struct PlatformTask *Task = Context;
+
+    swapcontext(&Task->Host, &Task->Task);
+}
+
+/* switch from the task back to the host, returning when it's entered again */
+void PlatformTaskLeave(void *Context)
+{
+    struct PlatformTask *Task = Context;
+
+    swapcontext(&Task->Task, &Task->Host);
+}
+
+void PlatformTaskFree(void *Context)
+{
+    struct PlatformTask *Task = Context;
+
+    free(Task->Stack);
+    free(Task);
+}
+
+/* a clock for timing slices, which only has to go forwards */
+unsigned long PlatformMicroseconds(void)
+{
+    struct timespec Now;
+
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return (unsigned long)Now.tv_sec * 1000000 + Now.tv_nsec / 1000;
+}
@@ -0,0 +1,1112 @@
+/* picoc profilers.
+ *
+ * the sampling profiler: a SIGPROF timer says a sample is due and the next
+ * statement the program runs records where it is: the functions on its
+ * stack and the line each of them is at. the signal handler only sets a
+ * flag, so all the program pays between samples is testing it. the
+ * samples are written as folded stacks - one line for each different
+ * stack, root first with the functions separated by ';', followed by how
+ * many samples found it - which flamegraph.pl and similar tools read.
+ *
+ * the cost profile: exact counts of the work the interpreter does -
+ * statements, tokens, operators and stack bytes - for each function and
+ * line, from the hooks in stats.h. tokens read while skipping code, or
+ * searching for a case or goto label, are also counted by run mode against
+ * the statement which started it, so the if, switch and goto statements
+ * which waste the most re-parsing can be found. the same program gives the
+ * same counts every time, so they can be compared from one version to the
+ * next. they are written as a table and in callgrind's format, for
+ * kcachegrind and other callgrind viewers.
+ *
+ * the trace: when each call of a function and each loop began and ended,
+ * from the same hooks, as Chrome trace events for chrome://tracing and
+ * Perfetto to show on a timeline */
+#include "picoc.h"
+#include "interpreter.h"
+
+#ifdef UNIX_HOST
+#include <sys/time.h>
+#endif
+
+#define PROFILE_TABLE_SIZE (1021)   /* different stacks hash table size */
+#define PROFILE_STACK_MAX (256)     /* the most frames recorded in a sample */
+#define PROFILE_FOLDED_MAX (8192)   /* the longest folded stack */
+#define COST_FUNCTION_TABLE_SIZE (97)   /* functions hash table size */
+#define COST_LINE_TABLE_SIZE (31)       /* each function's lines hash table size */
+#define COST_STRING_TABLE_SIZE (97)     /* names hash table size */
+#define COST_TOP_LEVEL "(top level)"    /* what code outside functions is called */
+#define TRACE_BUFFER_SIZE (1024*1024)   /* trace events kept until they're written */
+#define TRACE_EVENT_MAX (1024)          /* the longest trace event */
+#define TRACE_STRING_MAX (400)          /* the longest name in one */
+
+/* a stack that's been sampled and how often */
+struct ProfileStack {
+    struct ProfileStack *Next;
+    unsigned long Hash;
+    long Count;
+    char Folded[];
+};
+
+struct ProfileState {
+    int Rate;                   /* samples a second */
+    int Running;
+    long Samples;
+    struct ProfileStack *Stacks[PROFILE_TABLE_SIZE];
+#ifdef UNIX_HOST
+    struct sigaction OldAction;
+#endif
+};
+
+/* the costs keep their own copies of names, since the registered strings
+    can go when the instance is reset */
+struct CostString {
+    struct CostString *Next;
+    char Name[];
+};
+
+/* what one line of a function cost */
+struct CostLine {
+    struct CostLine *Next;
+    const char *FileName;       /* a CostString's, NULL for the function's entry */
+    int Line;
+    unsigned long long Cost[CostKinds];
+};
+
+/* the calls from one line of a function to another function */
+struct CostCall {
+    struct CostCall *Next;
+    struct CostFunction *Callee;
+    struct CostLine *From;
+    unsigned long long Calls;
+    unsigned long long Inclusive[CostKinds];
+};
+
+struct CostFunction {
+    struct CostFunction *Next;
+    const char *Name;           /* a CostString's */
+    const char *FileName;       /* where its first statement is */
+    int Line;
+    int Active;                 /* calls of it under way */
+    unsigned long long Calls;
+    unsigned long long Self[CostKinds];
+    unsigned long long Inclusive[CostKinds];
+    struct CostLine *Lines[COST_LINE_TABLE_SIZE];
+    struct CostCall *CallList;
+};
+
+/* a call under way */
+struct CostFrame {
+    struct CostFunction *Caller;
+    struct CostLine *CallerLine;
+    unsigned long long Start[CostKinds];
+};
+
+struct CostState {
+    unsigned long long Total[CostKinds];
+    struct CostString *Strings[COST_STRING_TABLE_SIZE];
+    struct CostFunction *Functions[COST_FUNCTION_TABLE_SIZE];
+    int NumFunctions;
+    int NumLines;
+    struct CostFunction *TopLevel;
+    struct CostFunction *Current;
+    struct CostLine *CurrentLine;
+    const char *FileRegistered; /* the file statements were last in */
+    const char *FileName;       /* and our copy of its name */
+    struct CostFrame *Frames;
+    int NumFrames;
+    int MaxFrames;
+};
+
+/* a trace being written */
+struct TraceState {
+    FILE *Out;
+    char *Buffer;
+    size_t Used;
+    int Failed;                 /* a write went wrong */
+    int NumEvents;
+    int Depth;                  /* begin events without an end yet */
+    unsigned long long Start;   /* nanoseconds */
+};
+
+static void TraceEndAll(struct TraceState *Trace);
+
+static const char *CostNames[CostKinds] = {
+    "statements", "tokens", "expressions", "stack_bytes", "skip", "return",
+    "case_search", "break", "continue", "goto"
+};
+
+static const char *CostEvents[CostKinds] = {
+    "Statements", "Tokens", "Expressions", "StackBytes", "SkipTokens",
+    "ReturnTokens", "CaseSearchTokens", "BreakTokens", "ContinueTokens",
+    "GotoTokens"
+};
+
+/* set by the timer when a sample's due. the timer's for the whole process
+    so only one instance can be profiled at a time */
+volatile sig_atomic_t ProfileDue = false;
+static Picoc *ProfileOwner = NULL;
+
+
+#ifdef UNIX_HOST
+static void ProfileSignal(int Signal)
+{
+    ProfileDue = true;
+}
+#endif
+
+/* start sampling the program Rate times a second of the CPU time it uses.
+    samples add to any already taken. returns false if another instance is
+    being profiled or there's no timer on this platform */
+int PicocProfileStart(Picoc *pc, int Rate)
+{
+#ifdef UNIX_HOST
+    struct ProfileState *Profile = pc->Profile;
+    struct sigaction Action;
+    struct itimerval Timer;
+    long Interval;
+
+    if (Rate <= 0 || Rate > 1000000 ||
+            (ProfileOwner != NULL && ProfileOwner != pc))
+        return false;
+
+    if (Profile == NULL) {
+        Profile = calloc(1, sizeof(struct ProfileState));
+        if (Profile == NULL)
+            return false;
+
+        pc->Profile = Profile;
+    }
+
+    if (Profile->Running)
+        PicocProfileStop(pc);
+
+    memset(&Action, '\0', sizeof(Action));
+    Action.sa_handler = ProfileSignal;
+    Action.sa_flags = SA_RESTART;
+    sigemptyset(&Action.sa_mask);
+    if (sigaction(SIGPROF, &Action, &Profile->OldAction) != 0)
+        return false;
+
+    /* setitimer() wants tv_usec below a second, so a rate of 1 is 1s 0us */
+    Interval = 1000000 / Rate;
+    Timer.it_interval.tv_sec = Interval / 1000000;
+    Timer.it_interval.tv_usec = Interval % 1000000;
+    Timer.it_value = Timer.it_interval;
+    if (setitimer(ITIMER_PROF, &Timer, NULL) != 0) {
+        sigaction(SIGPROF, &Profile->OldAction, NULL);
+        return false;
+    }
+
+    Profile->Rate = Rate;
+    Profile->Running = true;
+    ProfileOwner = pc;
+    return true;
+#else
+    return false;
+#endif
+}
+
+/* stop sampling, keeping the samples taken so far */
+void PicocProfileStop(Picoc *pc)
+{
+#ifdef UNIX_HOST
+    struct ProfileState *Profile = pc->Profile;
+    struct itimerval Timer;
+
+    if (Profile == NULL || !Profile->Running)
+        return;
+
+    memset(&Timer, '\0', sizeof(Timer));
+    setitimer(ITIMER_PROF, &Timer, NULL);
+    sigaction(SIGPROF, &Profile->OldAction, NULL);
+    Profile->Running = false;
+    ProfileOwner = NULL;
+    ProfileDue = false;
+#endif
+}
+
+/* add a frame's name and line to a folded stack being built */
+static int ProfileAddFrame(char *Folded, int Len, const char *Name, int Line)
+{
+    int Added;
+
+    if (Len >= PROFILE_FOLDED_MAX)
+        return Len;
+
+    Added = snprintf(&Folded[Len], PROFILE_FOLDED_MAX - Len, "%s%s:%d",
+        Len > 0 ? ";" : "", Name, Line);
+    return Len + Added;
+}
+
+/* record where the program is. called by ParseStatement() when a sample's
+    due. the functions called from a library function, like a qsort()
+    comparison, appear as if their caller had called them */
+void ProfileSample(struct ParseState *Parser)
+{
+    Picoc *pc = Parser->pc;
+    struct ProfileState *Profile = pc->Profile;
+    struct StackFrame *Frames[PROFILE_STACK_MAX];
+    struct StackFrame *Frame;
+    struct ProfileStack *Stack;
+    char Folded[PROFILE_FOLDED_MAX];
+    unsigned long Hash = 2166136261UL;
+    int NumFrames = 0;
+    int Truncated = false;
+    int Len = 0;
+    int Count;
+
+    /* it's another instance's sample */
+    if (Profile == NULL || !Profile->Running)
+        return;
+
+    ProfileDue = false;
+
+    for (Frame = THREAD(pc)->TopStackFrame; Frame != NULL;
+            Frame = Frame->PreviousStackFrame) {
+        if (NumFrames == PROFILE_STACK_MAX) {
+            Truncated = true;
+            break;
+        }
+        Frames[NumFrames++] = Frame;
+    }
+
+    /* the root is the outermost function, or the file for code outside
+        any function. each function's line is where it called the next one */
+    if (Truncated)
+        Len = snprintf(Folded, PROFILE_FOLDED_MAX, "...");
+    else if (NumFrames == 0)
+        Len = ProfileAddFrame(Folded, Len, Parser->FileName, Parser->Line);
+
+    for (Count = NumFrames - 1; Count >= 0; Count--)
+        Len = ProfileAddFrame(Folded, Len, Frames[Count]->FuncName,
+            Count > 0 ? Frames[Count-1]->ReturnParser.Line : Parser->Line);
+
+    if (Len >= PROFILE_FOLDED_MAX)
+        Len = PROFILE_FOLDED_MAX - 1;
+
+    for (Count = 0; Count < Len; Count++)
+        Hash = (Hash ^ (unsigned char)Folded[Count]) * 16777619UL;
+
+    /* threads the program starts take samples too */
+    ThreadLock(pc);
+    Profile->Samples++;
+    for (Stack = Profile->Stacks[Hash % PROFILE_TABLE_SIZE]; Stack != NULL;
+            Stack = Stack->Next) {
+        if (Stack->Hash == Hash && strncmp(Stack->Folded, Folded, Len) == 0 &&
+                Stack->Folded[Len] == '\0')
+            break;
+    }
+
+    if (Stack == NULL) {
+        Stack = malloc(sizeof(struct ProfileStack) + Len + 1);
+        if (Stack != NULL) {
+            Stack->Hash = Hash;
+            Stack->Count = 0;
+            memcpy(Stack->Folded, Folded, Len);
+            Stack->Folded[Len] = '\0';
+            Stack->Next = Profile->Stacks[Hash % PROFILE_TABLE_SIZE];
+            Profile->Stacks[Hash % PROFILE_TABLE_SIZE] = Stack;
+        }
+    }
+
+    if (Stack != NULL)
+        Stack->Count++;
+    ThreadUnlock(pc);
+}
+
+/* write the samples as folded stacks. returns how many samples there are */
+long PicocProfileWrite(Picoc *pc, FILE *Out)
+{
+    struct ProfileState *Profile = pc->Profile;
+    struct ProfileStack *Stack;
+    int Count;
+
+    if (Profile == NULL)
+        return 0;
+
+    for (Count = 0; Count < PROFILE_TABLE_SIZE; Count++) {
+        for (Stack = Profile->Stacks[Count]; Stack != NULL;
+                Stack = Stack->Next)
+            fprintf(Out, "%s %ld\n", Stack->Folded, Stack->Count);
+    }
+
+    return Profile->Samples;
+}
+
+/* free the cost profile */
+static void CostCleanup(Picoc *pc)
+{
+    struct CostState *Costs = pc->Costs;
+    struct CostFunction *Func;
+    struct CostFunction *NextFunc;
+    struct CostLine *Line;
+    struct CostLine *NextLine;
+    struct CostCall *Call;
+    struct CostCall *NextCall;
+    struct CostString *String;
+    struct CostString *NextString;
+    int Count;
+    int Bucket;
+
+    if (Costs == NULL)
+        return;
+
+    for (Count = 0; Count < COST_STRING_TABLE_SIZE; Count++) {
+        for (String = Costs->Strings[Count]; String != NULL; String = NextString) {
+            NextString = String->Next;
+            free(String);
+        }
+    }
+
+    for (Count = 0; Count < COST_FUNCTION_TABLE_SIZE; Count++) {
+        for (Func = Costs->Functions[Count]; Func != NULL; Func = NextFunc) {
+            NextFunc = Func->Next;
+            for (Bucket = 0; Bucket < COST_LINE_TABLE_SIZE; Bucket++) {
+                for (Line = Func->Lines[Bucket]; Line != NULL; Line = NextLine) {
+                    NextLine = Line->Next;
+                    free(Line);
+                }
+            }
+            for (Call = Func->CallList; Call != NULL; Call = NextCall) {
+                NextCall = Call->Next;
+                free(Call);
+            }
+            free(Func);
+        }
+    }
+
+    free(Costs->Frames);
+    free(Costs);
+    pc->Costs = NULL;
+}
+
+/* stop sampling and free the samples */
+void ProfileCleanup(Picoc *pc)
+{
+    struct ProfileState *Profile = pc->Profile;
+    struct ProfileStack *Stack;
+    struct ProfileStack *Next;
+    int Count;
+
+    CostCleanup(pc);
+    if (pc->Trace != NULL) {
+        /* whoever started the trace should have stopped it */
+        free(pc->Trace->Buffer);
+        free(pc->Trace);
+        pc->Trace = NULL;
+    }
+
+    if (Profile == NULL)
+        return;
+
+    PicocProfileStop(pc);
+    for (Count = 0; Count < PROFILE_TABLE_SIZE; Count++) {
+        for (Stack = Profile->Stacks[Count]; Stack != NULL; Stack = Next) {
+            Next = Stack->Next;
+            free(Stack);
+        }
+    }
+
+    free(Profile);
+    pc->Profile = NULL;
+}
+
+
+static void *CostAlloc(size_t Size)
+{
+    void *Mem = calloc(1, Size);
+
+    if (Mem == NULL) {
+        fprintf(stderr, "Error allocating memory for the cost profile\n");
+        exit(1);
+    }
+
+    return Mem;
+}
+
+/* our copy of a registered string */
+static const char *CostGetString(struct CostState *Costs,
+    const char *Registered)
+{
+    unsigned long Hash = 2166136261UL;
+    struct CostString *String;
+    const char *Pos;
+
+    for (Pos = Registered; *Pos != '\0'; Pos++)
+        Hash = (Hash ^ (unsigned char)*Pos) * 16777619UL;
+    Hash %= COST_STRING_TABLE_SIZE;
+
+    for (String = Costs->Strings[Hash]; String != NULL; String = String->Next) {
+        if (strcmp(String->Name, Registered) == 0)
+            return String->Name;
+    }
+
+    String = CostAlloc(sizeof(struct CostString) + strlen(Registered) + 1);
+    strcpy(String->Name, Registered);
+    String->Next = Costs->Strings[Hash];
+    Costs->Strings[Hash] = String;
+    return String->Name;
+}
+
+/* find a function's costs, adding it the first time it's called */
+static struct CostFunction *CostGetFunction(struct CostState *Costs,
+    const char *Name)
+{
+    unsigned long Hash = ((unsigned long)Name >> 3) % COST_FUNCTION_TABLE_SIZE;
+    struct CostFunction *Func;
+
+    for (Func = Costs->Functions[Hash]; Func != NULL; Func = Func->Next) {
+        if (Func->Name == Name)
+            return Func;
+    }
+
+    Func = CostAlloc(sizeof(struct CostFunction));
+    Func->Name = Name;
+    Func->Next = Costs->Functions[Hash];
+    Costs->Functions[Hash] = Func;
+    Costs->NumFunctions++;
+    return Func;
+}
+
+/* find the costs of a line of the current function */
+static struct CostLine *CostGetLine(struct CostState *Costs,
+    const char *FileName, int Line)
+{
+    struct CostFunction *Func = Costs->Current;
+    unsigned long Hash = (((unsigned long)FileName >> 3) ^ Line) %
+        COST_LINE_TABLE_SIZE;
+    struct CostLine *CostLine;
+
+    for (CostLine = Func->Lines[Hash]; CostLine != NULL;
+            CostLine = CostLine->Next) {
+        if (CostLine->FileName == FileName && CostLine->Line == Line)
+            return CostLine;
+    }
+
+    CostLine = CostAlloc(sizeof(struct CostLine));
+    CostLine->FileName = FileName;
+    CostLine->Line = Line;
+    CostLine->Next = Func->Lines[Hash];
+    Func->Lines[Hash] = CostLine;
+    Costs->NumLines++;
+    return CostLine;
+}
+
+/* start counting costs. only code parsed from now on is counted, so this
+    has to be called before the program's read in. returns false if picoc
+    was built without the stats hooks */
+int PicocProfileCosts(Picoc *pc)
+{
+#ifdef NO_STATS
+    return false;
+#else
+    struct CostState *Costs;
+
+    if (pc->Costs != NULL)
+        return true;
+
+    Costs = CostAlloc(sizeof(struct CostState));
+    pc->Costs = Costs;
+    Costs->TopLevel = CostGetFunction(Costs, CostGetString(Costs, COST_TOP_LEVEL));
+    Costs->TopLevel->Calls = 1;
+    Costs->TopLevel->Active = 1;
+    Costs->Current = Costs->TopLevel;
+    return true;
+#endif
+}
+
+/* charge something to the current line and function. like the stats,
+    costs are only counted on the main thread */
+void ProfileCostAdd(struct ParseState *Parser, enum ProfileCost Cost,
+    int Amount)
+{
+    struct CostState *Costs = Parser->pc->Costs;
+
+    if (Costs == NULL || ThreadCurrent != NULL)
+        return;
+
+    if (Costs->CurrentLine == NULL)
+        Costs->CurrentLine = CostGetLine(Costs, NULL, 0);
+
+    Costs->Total[Cost] += Amount;
+    Costs->Current->Self[Cost] += Amount;
+    Costs->CurrentLine->Cost[Cost] += Amount;
+}
+
+/* a token's been fetched. it's wasted if it isn't being run */
+void ProfileCostToken(struct ParseState *Parser)
+{
+    ProfileCostAdd(Parser, CostTokens, 1);
+    if (Parser->Mode != RunModeRun)
+        ProfileCostAdd(Parser, (enum ProfileCost)(CostSkipTokens +
+            Parser->Mode - RunModeSkip), 1);
+}
+
+/* a statement's starting - it's the line costs go to until the next one.
+    statements which aren't being run leave it at the one which started
+    skipping them */
+void ProfileCostStatement(struct ParseState *Parser)
+{
+    struct CostState *Costs = Parser->pc->Costs;
+    struct CostLine *Line = Costs != NULL ? Costs->CurrentLine : NULL;
+
+    if (Costs == NULL || ThreadCurrent != NULL || Parser->Mode != RunModeRun)
+        return;
+
+    if (Costs->FileRegistered != Parser->FileName) {
+        Costs->FileName = CostGetString(Costs, Parser->FileName);
+        Costs->FileRegistered = Parser->FileName;
+    }
+
+    if (Line == NULL || Line->FileName != Costs->FileName ||
+            Line->Line != Parser->Line) {
+        if (Costs->Current->FileName == NULL) {
+            Costs->Current->FileName = Costs->FileName;
+            Costs->Current->Line = Parser->Line;
+        }
+        Costs->CurrentLine = CostGetLine(Costs, Costs->FileName,
+            Parser->Line);
+    }
+
+    ProfileCostAdd(Parser, CostStatements, 1);
+}
+
+/* a function's being called from the current line */
+void ProfileCostEntry(struct ParseState *Parser, const char *FuncName)
+{
+    struct CostState *Costs = Parser->pc->Costs;
+    struct CostFrame *Frame;
+
+    if (Costs == NULL || ThreadCurrent != NULL)
+        return;
+
+    if (Costs->CurrentLine == NULL)
+        Costs->CurrentLine = CostGetLine(Costs, NULL, 0);
+
+    if (Costs->NumFrames == Costs->MaxFrames) {
+        Costs->MaxFrames = Costs->MaxFrames * 2 + 16;
+        Costs->Frames = realloc(Costs->Frames,
+            sizeof(struct CostFrame) * Costs->MaxFrames);
+        if (Costs->Frames == NULL) {
+            fprintf(stderr, "Error allocating memory for the cost profile\n");
+            exit(1);
+        }
+    }
+
+    Frame = &Costs->Frames[Costs->NumFrames++];
+    Frame->Caller = Costs->Current;
+    Frame->CallerLine = Costs->CurrentLine;
+    memcpy(Frame->Start, Costs->Total, sizeof(Frame->Start));
+
+    Costs->Current = CostGetFunction(Costs, CostGetString(Costs, FuncName));
+    Costs->Current->Calls++;
+    Costs->Current->Active++;
+    Costs->CurrentLine = NULL;
+}
+
+/* the function called last has returned. what it cost, including what it
+    called, goes to the call and, unless it's a recursive call, to the
+    function */
+static void CostReturn(struct CostState *Costs)
+{
+    struct CostFrame *Frame = &Costs->Frames[--Costs->NumFrames];
+    struct CostFunction *Callee = Costs->Current;
+    struct CostCall *Call;
+    int Count;
+
+    for (Call = Frame->Caller->CallList; Call != NULL; Call = Call->Next) {
+        if (Call->Callee == Callee && Call->From == Frame->CallerLine)
+            break;
+    }
+
+    if (Call == NULL) {
+        Call = CostAlloc(sizeof(struct CostCall));
+        Call->Callee = Callee;
+        Call->From = Frame->CallerLine;
+        Call->Next = Frame->Caller->CallList;
+        Frame->Caller->CallList = Call;
+    }
+
+    Call->Calls++;
+    for (Count = 0; Count < CostKinds; Count++) {
+        unsigned long long Cost = Costs->Total[Count] - Frame->Start[Count];
+
+        Call->Inclusive[Count] += Cost;
+        if (Callee->Active == 1)
+            Callee->Inclusive[Count] += Cost;
+    }
+
+    Callee->Active--;
+    Costs->Current = Frame->Caller;
+    Costs->CurrentLine = Frame->CallerLine;
+}
+
+void ProfileCostExit(struct ParseState *Parser)
+{
+    struct CostState *Costs = Parser->pc->Costs;
+
+    if (Costs == NULL || ThreadCurrent != NULL || Costs->NumFrames == 0)
+        return;
+
+    CostReturn(Costs);
+}
+
+/* the instance is being reset. finish any calls and loops an error or
+    exit() left under way and forget the registered strings */
+void ProfileReset(Picoc *pc)
+{
+    struct CostState *Costs = pc->Costs;
+
+    if (pc->Trace != NULL)
+        TraceEndAll(pc->Trace);
+
+    if (Costs == NULL)
+        return;
+
+    while (Costs->NumFrames > 0)
+        CostReturn(Costs);
+
+    Costs->CurrentLine = NULL;
+    Costs->FileRegistered = NULL;
+}
+
+static int CostCompareFunctions(const void *A, const void *B)
+{
+    const struct CostFunction *FuncA = *(const struct CostFunction **)A;
+    const struct CostFunction *FuncB = *(const struct CostFunction **)B;
+
+    if (FuncA->Inclusive[CostTokens] != FuncB->Inclusive[CostTokens])
+        return FuncA->Inclusive[CostTokens] < FuncB->Inclusive[CostTokens] ? 1 : -1;
+
+    return strcmp(FuncA->Name, FuncB->Name);
+}
+
+/* the tokens read without running them */
+static unsigned long long CostWasted(const unsigned long long *Cost)
+{
+    unsigned long long Wasted = 0;
+    int Kind;
+
+    for (Kind = CostSkipTokens; Kind < CostKinds; Kind++)
+        Wasted += Cost[Kind];
+
+    return Wasted;
+}
+
+static int CostCompareWastedFunctions(const void *A, const void *B)
+{
+    const struct CostFunction *FuncA = *(const struct CostFunction **)A;
+    const struct CostFunction *FuncB = *(const struct CostFunction **)B;
+    unsigned long long WastedA = CostWasted(FuncA->Self);
+    unsigned long long WastedB = CostWasted(FuncB->Self);
+
+    if (WastedA != WastedB)
+        return WastedA < WastedB ? 1 : -1;
+
+    return strcmp(FuncA->Name, FuncB->Name);
+}
+
+/* lines are kept with the function they're in while they're sorted */
+struct CostLineEntry {
+    struct CostFunction *Func;
+    struct CostLine *Line;
+};
+
+static int CostCompareLinePlaces(const struct CostLineEntry *LineA,
+    const struct CostLineEntry *LineB)
+{
+    int Order = strcmp(LineA->Func->Name, LineB->Func->Name);
+
+    if (Order == 0)
+        Order = LineA->Line->Line - LineB->Line->Line;
+
+    return Order;
+}
+
+static int CostCompareLines(const void *A, const void *B)
+{
+    const struct CostLineEntry *LineA = A;
+    const struct CostLineEntry *LineB = B;
+
+    if (LineA->Line->Cost[CostTokens] != LineB->Line->Cost[CostTokens])
+        return LineA->Line->Cost[CostTokens] < LineB->Line->Cost[CostTokens] ? 1 : -1;
+
+    return CostCompareLinePlaces(LineA, LineB);
+}
+
+static int CostCompareWastedLines(const void *A, const void *B)
+{
+    const struct CostLineEntry *LineA = A;
+    const struct CostLineEntry *LineB = B;
+    unsigned long long WastedA = CostWasted(LineA->Line->Cost);
+    unsigned long long WastedB = CostWasted(LineB->Line->Cost);
+
+    if (WastedA != WastedB)
+        return WastedA < WastedB ? 1 : -1;
+
+    return CostCompareLinePlaces(LineA, LineB);
+}
+
+static void CostWriteLine(FILE *Out, struct CostLine *Line,
+    unsigned long long *Cost)
+{
+    int Count;
+
+    fprintf(Out, "%d", Line->Line);
+    for (Count = 0; Count < CostKinds; Count++)
+        fprintf(Out, " %llu", Cost[Count]);
+    fprintf(Out, "\n");
+}
+
+/* costs for the callgrind format, with the file they're in if it changes */
+static void CostWriteCallgrindLine(FILE *Out, struct CostLine *Line,
+    unsigned long long *Cost, const char **FileName)
+{
+    if (Line->FileName != NULL && Line->FileName != *FileName) {
+        fprintf(Out, "fi=%s\n", Line->FileName);
+        *FileName = Line->FileName;
+    }
+
+    CostWriteLine(Out, Line, Cost);
+}
+
+static void CostWriteCallgrind(Picoc *pc, FILE *Out, const char *Command,
+    struct CostFunction **Functions, int NumFunctions)
+{
+    struct CostState *Costs = pc->Costs;
+    struct CostFunction *Func;
+    struct CostCall *Call;
+    struct CostLine *Line;
+    const char *FileName;
+    int Count;
+    int Bucket;
+
+    fprintf(Out, "# callgrind format\nversion: 1\ncreator: picoc %s\n",
+        PICOC_VERSION);
+    if (Command != NULL)
+        fprintf(Out, "cmd: %s\n", Command);
+    fprintf(Out, "positions: line\nevents:");
+    for (Count = 0; Count < CostKinds; Count++)
+        fprintf(Out, " %s", CostEvents[Count]);
+    fprintf(Out, "\nsummary:");
+    for (Count = 0; Count < CostKinds; Count++)
+        fprintf(Out, " %llu", Costs->Total[Count]);
+    fprintf(Out, "\n");
+
+    for (Count = 0; Count < NumFunctions; Count++) {
+        Func = Functions[Count];
+        FileName = Func->FileName != NULL ? Func->FileName : "(library)";
+        fprintf(Out, "\nfl=%s\nfn=%s\n", FileName, Func->Name);
+
+        for (Bucket = 0; Bucket < COST_LINE_TABLE_SIZE; Bucket++) {
+            for (Line = Func->Lines[Bucket]; Line != NULL; Line = Line->Next)
+                CostWriteCallgrindLine(Out, Line, Line->Cost, &FileName);
+        }
+
+        for (Call = Func->CallList; Call != NULL; Call = Call->Next) {
+            fprintf(Out, "cfl=%s\ncfn=%s\ncalls=%llu %d\n",
+                Call->Callee->FileName != NULL ? Call->Callee->FileName :
+                "(library)", Call->Callee->Name, Call->Calls,
+                Call->Callee->Line);
+            CostWriteCallgrindLine(Out, Call->From, Call->Inclusive, &FileName);
+        }
+    }
+}
+
+/* a line of the table, with the costs from First to Last */
+static void CostWriteTableLine(FILE *Out, struct CostLineEntry *Entry,
+    int First, int Last)
+{
+    int Kind;
+
+    fprintf(Out, " ");
+    for (Kind = First; Kind < Last; Kind++)
+        fprintf(Out, " %12llu", Entry->Line->Cost[Kind]);
+    if (Entry->Line->FileName != NULL)
+        fprintf(Out, "  %s:%d %s\n", Entry->Line->FileName,
+            Entry->Line->Line, Entry->Func->Name);
+    else
+        fprintf(Out, "  (entry) %s\n", Entry->Func->Name);
+}
+
+static void CostWriteTable(Picoc *pc, FILE *Out,
+    struct CostFunction **Functions, int NumFunctions)
+{
+    struct CostState *Costs = pc->Costs;
+    struct CostLineEntry *Lines;
+    struct CostLine *Line;
+    int NumLines = 0;
+    int Count;
+    int Kind;
+    int Bucket;
+
+    fprintf(Out, "# costs:");
+    for (Kind = 0; Kind < CostSkipTokens; Kind++)
+        fprintf(Out, " %llu %s", Costs->Total[Kind], CostNames[Kind]);
+    fprintf(Out, ", %llu tokens not run\n", CostWasted(Costs->Total));
+    fprintf(Out, "# functions, by tokens including the functions they call\n");
+    fprintf(Out, "# %10s", "calls");
+    for (Kind = 0; Kind < CostSkipTokens; Kind++)
+        fprintf(Out, " %12s", CostNames[Kind]);
+    for (Kind = 0; Kind < CostSkipTokens; Kind++)
+        fprintf(Out, " %12s", "incl");
+    fprintf(Out, "  function\n");
+
+    for (Count = 0; Count < NumFunctions; Count++) {
+        fprintf(Out, "  %10llu", Functions[Count]->Calls);
+        for (Kind = 0; Kind < CostSkipTokens; Kind++)
+            fprintf(Out, " %12llu", Functions[Count]->Self[Kind]);
+        for (Kind = 0; Kind < CostSkipTokens; Kind++)
+            fprintf(Out, " %12llu", Functions[Count]->Inclusive[Kind]);
+        fprintf(Out, "  %s\n", Functions[Count]->Name);
+    }
+
+    Lines = CostAlloc(sizeof(struct CostLineEntry) * (Costs->NumLines + 1));
+    for (Count = 0; Count < NumFunctions; Count++) {
+        for (Bucket = 0; Bucket < COST_LINE_TABLE_SIZE; Bucket++) {
+            for (Line = Functions[Count]->Lines[Bucket]; Line != NULL;
+                    Line = Line->Next) {
+                Lines[NumLines].Func = Functions[Count];
+                Lines[NumLines++].Line = Line;
+            }
+        }
+    }
+    qsort(Lines, NumLines, sizeof(struct CostLineEntry), CostCompareLines);
+
+    fprintf(Out, "# lines, by tokens\n#");
+    for (Kind = 0; Kind < CostSkipTokens; Kind++)
+        fprintf(Out, " %12s", CostNames[Kind]);
+    fprintf(Out, "  line\n");
+
+    for (Count = 0; Count < NumLines; Count++)
+        CostWriteTableLine(Out, &Lines[Count], 0, CostSkipTokens);
+
+    /* the tokens read without running them, by the run mode they were
+        read in. only functions and lines which wasted any are listed */
+    qsort(Functions, NumFunctions, sizeof(struct CostFunction*),
+        CostCompareWastedFunctions);
+    fprintf(Out, "# functions, by tokens not run\n#");
+    for (Kind = CostSkipTokens; Kind < CostKinds; Kind++)
+        fprintf(Out, " %12s", CostNames[Kind]);
+    fprintf(Out, "  function\n");
+
+    for (Count = 0; Count < NumFunctions &&
+            CostWasted(Functions[Count]->Self) > 0; Count++) {
+        fprintf(Out, " ");
+        for (Kind = CostSkipTokens; Kind < CostKinds; Kind++)
+            fprintf(Out, " %12llu", Functions[Count]->Self[Kind]);
+        fprintf(Out, "  %s\n", Functions[Count]->Name);
+    }
+
+    qsort(Lines, NumLines, sizeof(struct CostLineEntry),
+        CostCompareWastedLines);
+    fprintf(Out, "# lines, by tokens not run\n#");
+    for (Kind = CostSkipTokens; Kind < CostKinds; Kind++)
+        fprintf(Out, " %12s", CostNames[Kind]);
+    fprintf(Out, "  line\n");
+
+    for (Count = 0; Count < NumLines &&
+            CostWasted(Lines[Count].Line->Cost) > 0; Count++)
+        CostWriteTableLine(Out, &Lines[Count], CostSkipTokens, CostKinds);
+
+    free(Lines);
+}
+
+/* write the costs as a table, sorted by tokens, and in callgrind's
+    format. either can be NULL. Command is what ran, for callgrind */
+void PicocProfileWriteCosts(Picoc *pc, FILE *Table, FILE *Callgrind,
+    const char *Command)
+{
+    struct CostState *Costs = pc->Costs;
+    struct CostFunction **Functions;
+    struct CostFunction *Func;
+    int NumFunctions = 0;
+    int Count;
+
+    if (Costs == NULL)
+        return;
+
+    /* finish any calls an error or exit() left under way */
+    while (Costs->NumFrames > 0)
+        CostReturn(Costs);
+    memcpy(Costs->TopLevel->Inclusive, Costs->Total, sizeof(Costs->Total));
+
+    Functions = CostAlloc(sizeof(struct CostFunction*) * Costs->NumFunctions);
+    for (Count = 0; Count < COST_FUNCTION_TABLE_SIZE; Count++) {
+        for (Func = Costs->Functions[Count]; Func != NULL; Func = Func->Next)
+            Functions[NumFunctions++] = Func;
+    }
+    qsort(Functions, NumFunctions, sizeof(struct CostFunction*),
+        CostCompareFunctions);
+
+    if (Table != NULL)
+        CostWriteTable(pc, Table, Functions, NumFunctions);
+    if (Callgrind != NULL)
+        CostWriteCallgrind(pc, Callgrind, Command, Functions, NumFunctions);
+
+    free(Functions);
+}
+
+/* the trace's events are collected in a buffer which is written out when
+    it fills, so the file gets a few large writes */
+
+/* nanoseconds from some fixed point */
+static unsigned long long TraceNow(void)
+{
+#ifdef UNIX_HOST
+    struct timespec Now;
+
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return (unsigned long long)Now.tv_sec * 1000000000 + Now.tv_nsec;
+#else
+    return (unsigned long long)clock() * (1000000000 / CLOCKS_PER_SEC);
+#endif
+}
+
+static void TraceFlush(struct TraceState *Trace)
+{
+    if (Trace->Used > 0 &&
+            fwrite(Trace->Buffer, 1, Trace->Used, Trace->Out) != Trace->Used)
+        Trace->Failed = true;
+
+    Trace->Used = 0;
+}
+
+/* copy a name into an event as a JSON string, cutting it short if it
+    won't fit */
+static int TraceString(char *Event, int Len, const char *Name)
+{
+    int Start = ++Len;
+
+    Event[Start - 1] = '"';
+    for (; *Name != '\0' && Len - Start < TRACE_STRING_MAX; Name++) {
+        if (*Name == '"' || *Name == '\\')
+            Event[Len++] = '\\';
+        if ((unsigned char)*Name >= ' ')
+            Event[Len++] = *Name;
+    }
+    Event[Len++] = '"';
+    return Len;
+}
+
+/* add an event, with its timestamp in microseconds. Name is NULL for an
+    end event */
+static void TraceEvent(struct TraceState *Trace, const char *Name,
+    const char *Category, const char *FileName, int Line)
+{
+    unsigned long long Time = TraceNow() - Trace->Start;
+    char Event[TRACE_EVENT_MAX];
+    int Len;
+
+    Len = sprintf(Event, "%s\n{\"ph\":\"%c\",\"ts\":%llu.%03u,\"pid\":1,\"tid\":1",
+        Trace->NumEvents > 0 ? "," : "", Name != NULL ? 'B' : 'E',
+        Time / 1000, (unsigned)(Time % 1000));
+
+    if (Name != NULL) {
+        strcpy(&Event[Len], ",\"name\":");
+        Len = TraceString(Event, Len + 8, Name);
+        Len += sprintf(&Event[Len], ",\"cat\":\"%s\",\"args\":{\"file\":",
+            Category);
+        Len = TraceString(Event, Len, FileName != NULL ? FileName : "");
+        Len += sprintf(&Event[Len], ",\"line\":%d}", Line);
+    }
+
+    Event[Len++] = '}';
+
+    if (Trace->Used + Len > TRACE_BUFFER_SIZE)
+        TraceFlush(Trace);
+
+    memcpy(&Trace->Buffer[Trace->Used], Event, Len);
+    Trace->Used += Len;
+    Trace->NumEvents++;
+}
+
+/* start writing a trace to Out. only code parsed from now on is traced,
+    so this has to be called before the program's read in. returns false
+    if picoc was built without the stats hooks or it's already tracing */
+int PicocProfileTrace(Picoc *pc, FILE *Out)
+{
+#ifdef NO_STATS
+    return false;
+#else
+    struct TraceState *Trace;
+
+    if (pc->Trace != NULL)
+        return false;
+
+    Trace = CostAlloc(sizeof(struct TraceState));
+    Trace->Buffer = CostAlloc(TRACE_BUFFER_SIZE);
+    Trace->Out = Out;
+    Trace->Start = TraceNow();
+    pc->Trace = Trace;
+
+    fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", Out);
+    return true;
+#endif
+}
+
+/* a function's being called from the current line. like the costs, only
+    the main thread is traced */
+void ProfileTraceCall(struct ParseState *Parser, const char *FuncName)
+{
+    struct TraceState *Trace = Parser->pc->Trace;
+
+    if (Trace == NULL || ThreadCurrent != NULL)
+        return;
+
+    TraceEvent(Trace, FuncName, "function", Parser->FileName, Parser->Line);
+    Trace->Depth++;
+}
+
+/* a loop's starting. Kind is "for", "while" or "do" */
+void ProfileTraceLoop(struct ParseState *Parser, const char *Kind,
+    int Line)
+{
+    struct TraceState *Trace = Parser->pc->Trace;
+
+    if (Trace == NULL || ThreadCurrent != NULL)
+        return;
+
+    TraceEvent(Trace, Kind, "loop", Parser->FileName, Line);
+    Trace->Depth++;
+}
+
+/* the call or loop started last has finished */
+void ProfileTraceEnd(struct ParseState *Parser)
+{
+    struct TraceState *Trace = Parser->pc->Trace;
+
+    if (Trace == NULL || ThreadCurrent != NULL || Trace->Depth == 0)
+        return;
+
+    TraceEvent(Trace, NULL, NULL, NULL, 0);
+    Trace->Depth--;
+}
+
+/* end the events an error or exit() left without one */
+static void TraceEndAll(struct TraceState *Trace)
+{
+    for (; Trace->Depth > 0; Trace->Depth--)
+        TraceEvent(Trace, NULL, NULL, NULL, 0);
+}
+
+/* finish the trace and stop tracing. the file it's written to is left
+    open. returns false if any of it couldn't be written */
+int PicocProfileTraceStop(Picoc *pc)
+{
+    struct TraceState *Trace = pc->Trace;
+    int Written;
+
+    if (Trace == NULL)
+        return true;
+
+    TraceEndAll(Trace);
+    TraceFlush(Trace);
+    fputs("\n]}\n", Trace->Out);
+    Written = !Trace->Failed && !ferror(Trace->Out);
+
+    free(Trace->Buffer);
+    free(Trace);
+    pc->Trace = NULL;
+    return Written;
+}
@@ -2,6 +2,7 @@
 // Created by Russell Joyce on 12/05/2020.
 //
 
+#include "picoc.h"
 #include "stats.h"
 #include "interpreter.h"
 
@@ -11,21 +12,38 @@
 #define NUM_BASE_TYPES 22
 #define NUM_OPERATORS 45
 #define NUM_EXPRESSION_TYPES 4
-#define EXPRESSION_CHAIN_STACK_SIZE 100
-#define MAX_STACK_FRAMES 100
+#define EXPRESSION_CHAIN_STACK_MIN_SIZE 64
+#define STACK_FRAME_STATS_MIN_SIZE 64
+#define STACK_DEPTH_BUCKETS 32          /* each power of two, from 1 */
+#define FRAME_FUNCTION_TABLE_SIZE 251
+#define FRAME_FUNCTIONS_PRINTED 10
+#define NGRAM_TABLE_SIZE 4093
+#define NAME_TABLE_SIZE 61
+#define BRANCH_TABLE_MIN_SIZE 1024     /* a power of two */
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define HEAP_BLOCK_TABLE_MIN_SIZE 256   /* a power of two */
+#define HEAP_SITE_TABLE_SIZE 251
+#define HEAP_SIZE_BUCKETS 33            /* 0 bytes, then each power of two */
+#define HEAP_SITES_PRINTED 10
 
 struct LexTokenStat {
     const char* name;
-    int count[NUM_RUN_MODES];
 };
 
 struct TypeStat {
     const char* name;
-    int assignments;
+};
+
+/* a file or function name the stats keep, once for however many times
+ * it's used */
+struct StatsName {
+    struct StatsName *Next;
+    unsigned int StreamIndex;   /* its number in a chains stream, from 1 */
+    char Name[];
 };
 
 struct FileCoordinate {
-    char* FileName;
+    const char *FileName;
     int Line;
     int Column;
 };
@@ -48,22 +66,66 @@ struct ExpressionChainListNode {
     struct ExpressionChainListNode *Next;
 };
 
-union ExpressionHash {
-    uint32_t Hash;
-    struct {
-        uint8_t Type;
-        uint8_t Op;
-        uint8_t TopType;
-        uint8_t BottomType;
-    } Components;
+/* a run of expressions evaluated one after another in a chain, and where
+ * it was first seen */
+struct ExpressionNgram {
+    struct ExpressionNgram *Next;
+    unsigned int Count;
+    unsigned int Length;
+    union ExpressionHash Hashes[STATS_NGRAM_MAX];
+    struct FileCoordinate Coordinate;
 };
 
+/* a node of the expression chains tree. its branches are a list, in the
+ * order they were first seen, and are found by their parent and hash in
+ * one hash table for the whole tree */
 struct ExpressionChainItem {
     union ExpressionHash Hash;
     unsigned int LeafCount;
-    unsigned int BranchCount;
-    unsigned int BranchListSize;
+    struct ExpressionChainItem *Parent;
     struct ExpressionChainItem *Branches;
+    struct ExpressionChainItem *LastBranch;
+    struct ExpressionChainItem *NextBranch;
+    struct ExpressionChainItem *NextInTable;
+    unsigned int StreamIndex;   /* its number in a chains stream, from 1 */
+};
+
+/* where a program allocates memory on the heap, and what it's allocated */
+struct HeapSite {
+    struct HeapSite *Next;
+    const char *FileName;       /* a StatsName's, as is FuncName */
+    int Line;
+    const char *FuncName;
+    unsigned long long Allocations;
+    unsigned long long Bytes;
+    unsigned long long LiveBytes;
+    unsigned long long PeakLiveBytes;
+    unsigned int LiveBlocks;
+};
+
+/* the stack frames made for one function of the program */
+struct FrameFunction {
+    struct FrameFunction *Next;
+    const char *FuncName;       /* a StatsName's */
+    unsigned long long Frames;
+    unsigned int PeakFrameSize;
+};
+
+/* a block the program has allocated and not yet freed */
+struct HeapBlock {
+    struct HeapBlock *Next;
+    void *Pointer;
+    size_t Size;
+    struct HeapSite *Site;
+};
+
+/* the stats' nodes are allocated from blocks which are only freed with the
+ * stats, since none of them is freed before that */
+struct StatsArenaBlock {
+    struct StatsArenaBlock *Next;
+    size_t Used;
+    size_t Size;
+    char Data[];
 };
 
 const char *RunModeNames[NUM_RUN_MODES] = {
@@ -76,7 +138,7 @@ const char *RunModeNames[NUM_RUN_MODES] = {
         "RunModeGoto"
 };
 
-struct LexTokenStat LexTokenStats[NUM_TOKENS] = {
+const struct LexTokenStat LexTokenStats[NUM_TOKENS] = {
         {"TokenNone"},
         {"TokenComma"},
         {"TokenAssign"},
@@ -186,7 +248,7 @@ struct LexTokenStat LexTokenStats[NUM_TOKENS] = {
         {"TokenConstType"}
 };
 
-struct TypeStat TypeStats[NUM_TYPES] = {
+const struct TypeStat TypeStats[NUM_TYPES] = {
         {"Char"},
         {"UnsignedChar"},
         {"Short"},
@@ -278,70 +340,592 @@ const char *OperatorSymbols[NUM_OPERATORS] = {
 struct StackFrameStats {
     unsigned int TotalAllocation;
     unsigned int CumulativeTotalAllocation;
+    struct FrameFunction *Function;     /* NULL at the top level */
 };
 
+/* the hooks in stats.h have already checked the parser's flags. stats are
+    only collected on the main thread - threads the program starts itself
+    would race each other for them */
+#define STATS_COLLECTING(parser) (ThreadCurrent == NULL)
+
 
 void stats_print_expression(enum ExpressionType Type, enum LexToken Op, enum BaseType TopType, enum BaseType BottomType);
-void stats_traverse_expressions_tree(struct ExpressionChainItem *Node);
-
-
-unsigned int FunctionParameterCounts[PARAMETER_MAX + 1] = {0};
-unsigned int FunctionParameterDynamicCounts[PARAMETER_MAX + 1] = {0};
-unsigned int FunctionCallDepth = 0;
-unsigned int FunctionCallMaxDepth = 0;
-unsigned int LoopDepth = 0;
-unsigned int LoopMaxDepth = 0;
-unsigned int ConditionalDepth = 0;
-unsigned int ConditionalMaxDepth = 0;
-unsigned int ExpressionDepth = 0;
-unsigned int ExpressionMaxDepth = 0;
-unsigned int StackFramesDepth = 0;
-unsigned int StackFramesMaxDepth = 0;
-unsigned int ExpressionCounts[NUM_EXPRESSION_TYPES][NUM_OPERATORS][NUM_BASE_TYPES][NUM_BASE_TYPES] = {{{{0}}}};
-struct ExpressionChainListNode *ExpressionChainListHead = NULL;
-struct ExpressionChainListNode *ExpressionChainListTail = NULL;
-struct ExpressionChainNode *CurrentExpression = NULL;
-struct ExpressionChainItem ExpressionChainsRoot = {{0}};
-struct ExpressionChainItem *ExpressionChainTreePosition = NULL;
-union ExpressionHash ExpressionChainStack[EXPRESSION_CHAIN_STACK_SIZE];
-unsigned int ExpressionChainStackTop = 0;
-unsigned int TotalExpressions = 0;
-unsigned int TotalExpressionChains = 0;
-struct StackFrameStats StackFrameAllocations[MAX_STACK_FRAMES] = {{0}};
-unsigned int MaxStackFrameTotalAllocation = 0;
-unsigned int MaxCumulativeTotalAllocation = 0;
-unsigned int GlobalsCount = 0;
-unsigned int GlobalsSize = 0;
-
-
-void stats_log_statement(enum LexToken token, struct ParseState *parser)
-{
-    if (parser->pc->CollectStats) {
+void stats_traverse_expressions_tree(struct StatsState *stats, struct ExpressionChainItem *Node);
+
+
+/* everything collected for one instance, allocated when it first collects
+ * something so that instances on different threads don't share counts */
+struct StatsState {
+    int TokenCounts[NUM_TOKENS][NUM_RUN_MODES];
+    int TypeAssignments[NUM_TYPES];
+    unsigned int FunctionParameterCounts[PARAMETER_MAX + 1];
+    unsigned int FunctionParameterDynamicCounts[PARAMETER_MAX + 1];
+    unsigned int FunctionCallDepth;
+    unsigned int FunctionCallMaxDepth;
+    unsigned int LoopDepth;
+    unsigned int LoopMaxDepth;
+    unsigned int ConditionalDepth;
+    unsigned int ConditionalMaxDepth;
+    unsigned int ExpressionDepth;
+    unsigned int ExpressionMaxDepth;
+    unsigned int StackFramesDepth;
+    unsigned int StackFramesMaxDepth;
+    unsigned int ExpressionCounts[NUM_EXPRESSION_TYPES][NUM_OPERATORS][NUM_BASE_TYPES][NUM_BASE_TYPES];
+    struct ExpressionChainListNode *ExpressionChainListHead;
+    struct ExpressionChainListNode *ExpressionChainListTail;
+    struct ExpressionChainNode *CurrentExpression;
+    struct ExpressionChainItem ExpressionChainsRoot;
+    struct ExpressionChainItem *ExpressionChainTreePosition;
+    struct ExpressionChainItem **BranchTable;
+    unsigned int BranchTableSize;
+    unsigned int NumBranches;
+    union ExpressionHash *ExpressionChainStack;
+    unsigned int ExpressionChainStackSize;
+    unsigned int ExpressionChainStackTop;
+    unsigned int TotalExpressions;
+    unsigned int TotalExpressionChains;
+    union ExpressionHash NgramWindow[STATS_NGRAM_MAX];
+    unsigned int NgramWindowLength;
+    struct ExpressionNgram *Ngrams[NGRAM_TABLE_SIZE];
+    unsigned int NumNgrams;
+    struct StatsArenaBlock *Arena;
+    struct StatsName *Names[NAME_TABLE_SIZE];
+    const char *LastName;
+    struct StatsName *LastStatsName;
+    FILE *ChainsStream;
+    struct StatsName *StreamFileName;
+    int StreamLine;
+    int StreamColumn;
+    int StreamLastLine;
+    unsigned int NumStreamFileNames;
+    unsigned int NumStreamNodes;
+    struct StackFrameStats *StackFrameAllocations;     /* indexed by depth */
+    unsigned int StackFrameAllocationsSize;
+    unsigned long long StackFrameDepths[STACK_DEPTH_BUCKETS];
+    struct FrameFunction *FrameFunctions[FRAME_FUNCTION_TABLE_SIZE];
+    unsigned int NumFrameFunctions;
+    unsigned int MaxStackFrameTotalAllocation;
+    unsigned int MaxCumulativeTotalAllocation;
+    unsigned int GlobalsCount;
+    unsigned int GlobalsSize;
+    struct HeapBlock **HeapBlocks;
+    unsigned int HeapBlocksSize;
+    struct HeapBlock *FreeHeapBlocks;
+    struct HeapSite *HeapSites[HEAP_SITE_TABLE_SIZE];
+    unsigned int NumHeapSites;
+    unsigned long long HeapAllocations;
+    unsigned long long HeapReallocations;
+    unsigned long long HeapFrees;
+    unsigned long long HeapFailures;
+    unsigned long long HeapBytes;
+    unsigned long long HeapLiveBytes;
+    unsigned long long HeapPeakLiveBytes;
+    unsigned int HeapLiveBlocks;
+    unsigned long long HeapSizes[HEAP_SIZE_BUCKETS];
+};
+
+
+/* get an instance's stats, allocating them the first time */
+static struct StatsState *stats_get(Picoc *pc)
+{
+    if (pc->Stats == NULL) {
+        pc->Stats = calloc(1, sizeof(struct StatsState));
+        if (pc->Stats == NULL) {
+            fprintf(stderr, "Error allocating memory for stats\n");
+            exit(1);
+        }
+    }
+    return pc->Stats;
+}
+
+
+/* allocate zeroed memory from the stats' arena */
+static void *stats_arena_alloc(struct StatsState *stats, size_t Size)
+{
+    struct StatsArenaBlock *Block = stats->Arena;
+    void *Allocated;
+
+    Size = (Size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    if (Block == NULL || Block->Size - Block->Used < Size) {
+        size_t BlockSize = Size > ARENA_BLOCK_SIZE ? Size : ARENA_BLOCK_SIZE;
+
+        Block = calloc(1, sizeof(struct StatsArenaBlock) + BlockSize);
+        if (Block == NULL) {
+            fprintf(stderr, "Error allocating memory for stats\n");
+            exit(1);
+        }
+        Block->Size = BlockSize;
+        Block->Next = stats->Arena;
+        stats->Arena = Block;
+    }
+
+    Allocated = &Block->Data[Block->Used];
+    Block->Used += Size;
+    return Allocated;
+}
+
+
+/* keep a name once, however many coordinates use it. parsers' file names
+ * are usually the same string each time, so the last one is remembered */
+static struct StatsName *stats_name(struct StatsState *stats, const char *String)
+{
+    struct StatsName *Name;
+    uint32_t Key = 2166136261u;
+
+    if (String == NULL)
+        String = "";
+
+    if (String == stats->LastName)
+        return stats->LastStatsName;
+
+    for (const char *Pos = String; *Pos != '\0'; Pos++) {
+        Key = (Key ^ (unsigned char)*Pos) * 16777619u;
+    }
+
+    for (Name = stats->Names[Key % NAME_TABLE_SIZE]; Name != NULL; Name = Name->Next) {
+        if (strcmp(Name->Name, String) == 0)
+            break;
+    }
+
+    if (Name == NULL) {
+        Name = stats_arena_alloc(stats, sizeof(struct StatsName) + strlen(String) + 1);
+        strcpy(Name->Name, String);
+        Name->Next = stats->Names[Key % NAME_TABLE_SIZE];
+        stats->Names[Key % NAME_TABLE_SIZE] = Name;
+    }
+
+    stats->LastName = String;
+    stats->LastStatsName = Name;
+    return Name;
+}
+
+
+static unsigned int stats_branch_key(struct ExpressionChainItem *Parent, union ExpressionHash Hash)
+{
+    uintptr_t Key = (uintptr_t)Parent / sizeof(void *);
+
+    return (unsigned int)((Key * 2654435761u) ^ (Hash.Hash * 2246822519u));
+}
+
+
+/* find a node's branch for an expression, adding it if it's new */
+static struct ExpressionChainItem *stats_expression_branch(struct StatsState *stats,
+        struct ExpressionChainItem *Parent, union ExpressionHash Hash)
+{
+    struct ExpressionChainItem *Branch;
+    unsigned int Key = stats_branch_key(Parent, Hash);
+
+    if (stats->BranchTable != NULL) {
+        for (Branch = stats->BranchTable[Key & (stats->BranchTableSize - 1)]; Branch != NULL;
+                Branch = Branch->NextInTable) {
+            if (Branch->Parent == Parent && Branch->Hash.Hash == Hash.Hash)
+                return Branch;
+        }
+    }
+
+    /* keep the table no more than full, doubling it when it would be */
+    if (stats->NumBranches >= stats->BranchTableSize) {
+        unsigned int NewSize = stats->BranchTableSize == 0 ? BRANCH_TABLE_MIN_SIZE : stats->BranchTableSize * 2;
+        struct ExpressionChainItem **NewTable = calloc(NewSize, sizeof(struct ExpressionChainItem *));
+
+        if (NewTable == NULL) {
+            fprintf(stderr, "Error allocating memory for %u expression chain branches\n", NewSize);
+            exit(1);
+        }
+
+        for (unsigned int i = 0; i < stats->BranchTableSize; i++) {
+            while (stats->BranchTable[i] != NULL) {
+                Branch = stats->BranchTable[i];
+                stats->BranchTable[i] = Branch->NextInTable;
+                Branch->NextInTable = NewTable[stats_branch_key(Branch->Parent, Branch->Hash) & (NewSize - 1)];
+                NewTable[stats_branch_key(Branch->Parent, Branch->Hash) & (NewSize - 1)] = Branch;
+            }
+        }
+
+        free(stats->BranchTable);
+        stats->BranchTable = NewTable;
+        stats->BranchTableSize = NewSize;
+    }
+
+    Branch = stats_arena_alloc(stats, sizeof(struct ExpressionChainItem));
+    Branch->Hash = Hash;
+    Branch->Parent = Parent;
+    Branch->NextInTable = stats->BranchTable[Key & (stats->BranchTableSize - 1)];
+    stats->BranchTable[Key & (stats->BranchTableSize - 1)] = Branch;
+    stats->NumBranches++;
+
+    if (Parent->LastBranch == NULL)
+        Parent->Branches = Branch;
+    else
+        Parent->LastBranch->NextBranch = Branch;
+    Parent->LastBranch = Branch;
+
+    return Branch;
+}
+
+
+/* a chains stream is a line saying what it is and then records, each a
+ * letter and some numbers. numbers are 7 bits to a byte, least significant
+ * first, with the top bit set on all but the last byte:
+ *
+ *   f <length> <name>                      the next file name
+ *   n <parent> <hash>                      the next node of the chains tree
+ *   c <file> <line change> <column> <node> a chain, which is the expressions
+ *                                          from the root to the node
+ *
+ * names and nodes are numbered from 1 in the order they're written, and
+ * node 0 is the root. a line change is zig-zag encoded, so small changes
+ * either way are one byte. a chain is often just 5 or 6 bytes however long
+ * it is, so streams from long runs don't get too big */
+static void stats_stream_number(FILE *Out, unsigned int Number)
+{
+    while (Number >= 0x80) {
+        putc((Number & 0x7f) | 0x80, Out);
+        Number >>= 7;
+    }
+    putc(Number, Out);
+}
+
+
+/* a node's number in the stream, writing it and its parents if they're new */
+static unsigned int stats_stream_node(struct StatsState *stats, struct ExpressionChainItem *Node)
+{
+    if (Node == &stats->ExpressionChainsRoot)
+        return 0;
+
+    if (Node->StreamIndex == 0) {
+        unsigned int Parent = stats_stream_node(stats, Node->Parent);
+
+        putc('n', stats->ChainsStream);
+        stats_stream_number(stats->ChainsStream, Parent);
+        stats_stream_number(stats->ChainsStream, Node->Hash.Hash);
+        Node->StreamIndex = ++stats->NumStreamNodes;
+    }
+
+    return Node->StreamIndex;
+}
+
+
+/* write the chain that's just ended, if there's anything in it */
+static void stats_stream_chain(struct StatsState *stats)
+{
+    struct ExpressionChainItem *End = stats->ExpressionChainTreePosition;
+    struct StatsName *Name = stats->StreamFileName;
+    int LineChange = stats->StreamLine - stats->StreamLastLine;
+    unsigned int Node;
+
+    stats->StreamFileName = NULL;
+    if (Name == NULL || End == NULL || End == &stats->ExpressionChainsRoot)
+        return;
+
+    Node = stats_stream_node(stats, End);
+    if (Name->StreamIndex == 0) {
+        putc('f', stats->ChainsStream);
+        stats_stream_number(stats->ChainsStream, strlen(Name->Name));
+        fputs(Name->Name, stats->ChainsStream);
+        Name->StreamIndex = ++stats->NumStreamFileNames;
+    }
+
+    putc('c', stats->ChainsStream);
+    stats_stream_number(stats->ChainsStream, Name->StreamIndex);
+    stats_stream_number(stats->ChainsStream, ((unsigned int)LineChange << 1) ^ (unsigned int)(LineChange >> 31));
+    stats_stream_number(stats->ChainsStream, stats->StreamColumn);
+    stats_stream_number(stats->ChainsStream, Node);
+    stats->StreamLastLine = stats->StreamLine;
+}
+
+
+/* write every full expression chain to a file as it's evaluated instead of
+ * keeping them, for runs too long to keep them all. returns false if the
+ * file can't be written or chains are already being streamed */
+int stats_stream_expression_chains(Picoc *pc, const char *FileName)
+{
+    struct StatsState *stats = stats_get(pc);
+
+    if (stats->ChainsStream != NULL)
+        return false;
+
+    stats->ChainsStream = fopen(FileName, "wb");
+    if (stats->ChainsStream == NULL)
+        return false;
+
+    /* anything from an earlier stream is numbered afresh */
+    for (int i = 0; i < NAME_TABLE_SIZE; i++) {
+        for (struct StatsName *Name = stats->Names[i]; Name != NULL; Name = Name->Next) {
+            Name->StreamIndex = 0;
+        }
+    }
+    for (unsigned int i = 0; i < stats->BranchTableSize; i++) {
+        for (struct ExpressionChainItem *Branch = stats->BranchTable[i]; Branch != NULL; Branch = Branch->NextInTable) {
+            Branch->StreamIndex = 0;
+        }
+    }
+    stats->NumStreamFileNames = 0;
+    stats->NumStreamNodes = 0;
+    stats->StreamFileName = NULL;
+    stats->StreamLastLine = 0;
+
+    fprintf(stats->ChainsStream, "picoc expression chains %d\n", STATS_CHAINS_VERSION);
+    pc->CollectFullExpressions = true;
+    return true;
+}
+
+
+/* finish a stream of expression chains. returns false if it couldn't all
+ * be written */
+int stats_close_expression_chains(Picoc *pc)
+{
+    struct StatsState *stats = pc->Stats;
+    int Written;
+
+    if (stats == NULL || stats->ChainsStream == NULL)
+        return true;
+
+    stats_stream_chain(stats);
+    Written = !ferror(stats->ChainsStream);
+    if (fclose(stats->ChainsStream) != 0)
+        Written = false;
+    stats->ChainsStream = NULL;
+    return Written;
+}
+
+
+static int stats_read_number(FILE *In, unsigned int *Number)
+{
+    int Byte;
+    int Shift = 0;
+
+    *Number = 0;
+    do {
+        Byte = getc(In);
+        if (Byte == EOF || Shift > 28)
+            return false;
+        *Number |= (unsigned int)(Byte & 0x7f) << Shift;
+        Shift += 7;
+    } while (Byte & 0x80);
+
+    return true;
+}
+
+
+/* print a stream of expression chains the way the 0xa report prints them.
+ * returns false if it can't be read */
+int stats_print_expression_chains_file(const char *FileName)
+{
+    FILE *In = fopen(FileName, "rb");
+    char **Names = NULL;
+    unsigned int NumNames = 0;
+    struct {
+        unsigned int Parent;
+        union ExpressionHash Hash;
+    } *Nodes = NULL;
+    unsigned int NumNodes = 0;
+    union ExpressionHash *Chain = NULL;
+    unsigned int ChainSize = 0;
+    unsigned int Length;
+    int Line = 0;
+    int Version;
+    int Record;
+    int Read = true;
+
+    if (In == NULL)
+        return false;
+
+    if (fscanf(In, "picoc expression chains %d", &Version) != 1 || Version != STATS_CHAINS_VERSION ||
+            getc(In) != '\n') {
+        fclose(In);
+        return false;
+    }
+
+    while (Read && (Record = getc(In)) != EOF) {
+        unsigned int Numbers[4];
+
+        switch (Record) {
+        case 'f':
+            if (!stats_read_number(In, &Numbers[0])) {
+                Read = false;
+                break;
+            }
+            if (NumNames % 16 == 0)
+                Names = realloc(Names, sizeof(char *) * (NumNames + 16));
+            if (Names == NULL || (Names[NumNames] = calloc(1, Numbers[0] + 1)) == NULL) {
+                fprintf(stderr, "Error allocating memory for expression chains\n");
+                exit(1);
+            }
+            Read = fread(Names[NumNames++], 1, Numbers[0], In) == Numbers[0];
+            break;
+
+        case 'n':
+            if (!stats_read_number(In, &Numbers[0]) || !stats_read_number(In, &Numbers[1]) ||
+                    Numbers[0] > NumNodes) {
+                Read = false;
+                break;
+            }
+            if (NumNodes % 256 == 0) {
+                Nodes = realloc(Nodes, sizeof(*Nodes) * (NumNodes + 256));
+                if (Nodes == NULL) {
+                    fprintf(stderr, "Error allocating memory for expression chains\n");
+                    exit(1);
+                }
+            }
+            Nodes[NumNodes].Parent = Numbers[0];
+            Nodes[NumNodes].Hash.Hash = Numbers[1];
+            NumNodes++;
+            break;
+
+        case 'c':
+            for (int i = 0; i < 4 && Read; i++) {
+                Read = stats_read_number(In, &Numbers[i]);
+            }
+            if (!Read || Numbers[0] < 1 || Numbers[0] > NumNames || Numbers[3] < 1 || Numbers[3] > NumNodes) {
+                Read = false;
+                break;
+            }
+
+            Line += (int)(Numbers[1] >> 1) ^ -(int)(Numbers[1] & 1);
+            printf("\n%s:%d:%u   ", Names[Numbers[0] - 1], Line, Numbers[2]);
+
+            /* the expressions are found from the end of the chain back */
+            Length = 0;
+            for (unsigned int Node = Numbers[3]; Node != 0; Node = Nodes[Node - 1].Parent) {
+                if (Length == ChainSize) {
+                    ChainSize = ChainSize == 0 ? 16 : ChainSize * 2;
+                    Chain = realloc(Chain, sizeof(union ExpressionHash) * ChainSize);
+                    if (Chain == NULL) {
+                        fprintf(stderr, "Error allocating memory for expression chains\n");
+                        exit(1);
+                    }
+                }
+                Chain[Length++] = Nodes[Node - 1].Hash;
+            }
+
+            while (Length > 0) {
+                union ExpressionHash Hash = Chain[--Length];
+
+                stats_print_expression(Hash.Components.Type, Hash.Components.Op,
+                                       Hash.Components.TopType, Hash.Components.BottomType);
+                if (Length > 0)
+                    printf("  ->  ");
+            }
+            break;
+
+        default:
+            Read = false;
+            break;
+        }
+    }
+
+    printf("\n");
+
+    for (unsigned int i = 0; i < NumNames; i++) {
+        free(Names[i]);
+    }
+    free(Names);
+    free(Nodes);
+    free(Chain);
+    fclose(In);
+    return Read;
+}
+
+
+/* the instance is being reset, so the registered strings the parsers'
+ * file names and functions' names are can be different strings at the
+ * same addresses */
+void stats_reset(Picoc *pc)
+{
+    struct StatsState *stats = pc->Stats;
+
+    if (stats == NULL)
+        return;
+
+    stats->LastName = NULL;
+    stats->LastStatsName = NULL;
+
+    /* the program's stack frames went with the reset, popped or not */
+    stats->StackFramesDepth = 0;
+}
+
+
+void stats_cleanup(Picoc *pc)
+{
+    struct StatsState *stats = pc->Stats;
+
+    if (stats == NULL)
+        return;
+
+    stats_close_expression_chains(pc);
+    if (pc->ReportHeapLeaks) {
+        /* after everything the program printed */
+        fflush(stdout);
+        stats_print_heap_leaks(pc, stderr);
+    }
+
+    /* the tree, chains and n-grams are all in the arena */
+    while (stats->Arena != NULL) {
+        struct StatsArenaBlock *Block = stats->Arena;
+
+        stats->Arena = Block->Next;
+        free(Block);
+    }
+
+    free(stats->BranchTable);
+    free(stats->HeapBlocks);
+    free(stats->StackFrameAllocations);
+    free(stats->ExpressionChainStack);
+    free(stats);
+    pc->Stats = NULL;
+}
+
+
+/* the flags a new parser gets - see STATS_PARSER_ANY */
+int stats_parser_flags(Picoc *pc, const char *FileName)
+{
+#ifdef NO_STATS
+    return 0;
+#else
+    int Flags = pc->Costs != NULL || pc->Trace != NULL ? STATS_PARSER_PROFILE : 0;
+
+    if (!pc->CollectStats)
+        return Flags;
+
+    if (strcmp(FileName, "startup") == 0)
+        return Flags | STATS_PARSER_ANY;
+
+    return Flags | STATS_PARSER_ANY | STATS_PARSER_PROGRAM;
+#endif
+}
+
+void stats_record_statement(enum LexToken token, struct ParseState *parser)
+{
+    if (STATS_COLLECTING(parser)) {
+        struct StatsState *stats = stats_get(parser->pc);
         if (parser->pc->PrintStats) {
             fprintf(stderr, "Parsing Statement %s (%d) in %s (%d) at %s:%d:%d\n", LexTokenStats[token].name, token,
                     RunModeNames[parser->Mode], parser->Mode, parser->FileName, parser->Line, parser->CharacterPos);
         }
-        LexTokenStats[token].count[parser->Mode]++;
+        stats->TokenCounts[token][parser->Mode]++;
     }
 }
 
 
-void stats_log_expression_token_parse(enum LexToken token, struct ParseState *parser)
+void stats_record_expression_token_parse(enum LexToken token, struct ParseState *parser)
 {
-    if (parser->pc->CollectStats) {
+    if (STATS_COLLECTING(parser)) {
+        struct StatsState *stats = stats_get(parser->pc);
         if (parser->pc->PrintStats) {
             fprintf(stderr, "Parsing Expression Token %s (%d) in %s (%d) at %s:%d:%d\n", LexTokenStats[token].name, token,
                     RunModeNames[parser->Mode], parser->Mode, parser->FileName, parser->Line, parser->CharacterPos);
         }
-        LexTokenStats[token].count[parser->Mode]++;
+        stats->TokenCounts[token][parser->Mode]++;
     }
 }
 
 
-void stats_log_function_definition(int parameterCount, struct ParseState *parser)
+void stats_record_function_definition(int parameterCount, struct ParseState *parser)
 {
-    if (parser->pc->CollectStats) {
-        FunctionParameterCounts[parameterCount]++;
+    if (STATS_COLLECTING(parser)) {
+        struct StatsState *stats = stats_get(parser->pc);
+        stats->FunctionParameterCounts[parameterCount]++;
         if (parser->pc->PrintStats) {
             fprintf(stderr, "Parsing function definition with %d parameters at %s:%d:%d\n",
                     parameterCount, parser->FileName, parser->Line, parser->CharacterPos);
@@ -350,91 +934,98 @@ void stats_log_function_definition(int parameterCount, struct ParseState *parser
 }
 
 
-void stats_log_function_entry(struct ParseState *parser, int argCount)
+void stats_record_function_entry(struct ParseState *parser, int argCount)
 {
-    if (parser->pc->CollectStats) {
-        FunctionParameterDynamicCounts[argCount]++;
-        FunctionCallDepth++;
-        if (FunctionCallDepth > FunctionCallMaxDepth) {
-            FunctionCallMaxDepth = FunctionCallDepth;
+    if (STATS_COLLECTING(parser)) {
+        struct StatsState *stats = stats_get(parser->pc);
+        stats->FunctionParameterDynamicCounts[argCount]++;
+        stats->FunctionCallDepth++;
+        if (stats->FunctionCallDepth > stats->FunctionCallMaxDepth) {
+            stats->FunctionCallMaxDepth = stats->FunctionCallDepth;
         }
         if (parser->pc->PrintStats) {
             fprintf(stderr, "Entering function (current call depth %u, max %u) at %s:%d:%d\n",
-                    FunctionCallDepth, FunctionCallMaxDepth, parser->FileName, parser->Line, parser->CharacterPos);
+                    stats->FunctionCallDepth, stats->FunctionCallMaxDepth, parser->FileName, parser->Line, parser->CharacterPos);
         }
     }
 }
 
 
-void stats_log_function_exit(struct ParseState *parser)
+void stats_record_function_exit(struct ParseState *parser)
 {
-    if (parser->pc->CollectStats) {
-        FunctionCallDepth--;
+    if (STATS_COLLECTING(parser)) {
+        struct StatsState *stats = stats_get(parser->pc);
+        stats->FunctionCallDepth--;
         if (parser->pc->PrintStats) {
             fprintf(stderr, "Leaving function (current call depth %u, max %u) at %s:%d:%d\n",
-                    FunctionCallDepth, FunctionCallMaxDepth, parser->FileName, parser->Line, parser->CharacterPos);
+                    stats->FunctionCallDepth, stats->FunctionCallMaxDepth, parser->FileName, parser->Line, parser->CharacterPos);
         }
     }
 }
 
 
-void stats_log_loop_entry(struct ParseState *parser)
+void stats_record_loop_entry(struct ParseState *parser)
 {
-    if (parser->pc->CollectStats) {
-        LoopDepth++;
-        if (LoopDepth > LoopMaxDepth) {
-            LoopMaxDepth = LoopDepth;
+    if (STATS_COLLECTING(parser)) {
+        struct StatsState *stats = stats_get(parser->pc);
+        stats->LoopDepth++;
+        if (stats->LoopDepth > stats->LoopMaxDepth) {
+            stats->LoopMaxDepth = stats->LoopDepth;
         }
         if (parser->pc->PrintStats) {
             fprintf(stderr, "Entering loop (current nesting depth %u, max %u) at %s:%d:%d\n",
-                    LoopDepth, LoopMaxDepth, parser->FileName, parser->Line, parser->CharacterPos);
+                    stats->LoopDepth, stats->LoopMaxDepth, parser->FileName, parser->Line, parser->CharacterPos);
         }
     }
 }
 
 
-void stats_log_loop_exit(struct ParseState *parser)
+void stats_record_loop_exit(struct ParseState *parser)
 {
-    if (parser->pc->CollectStats) {
-        LoopDepth--;
+    if (STATS_COLLECTING(parser)) {
+        struct StatsState *stats = stats_get(parser->pc);
+        stats->LoopDepth--;
         if (parser->pc->PrintStats) {
             fprintf(stderr, "Leaving loop (current nesting depth %u, max %u) at %s:%d:%d\n",
-                    LoopDepth, LoopMaxDepth, parser->FileName, parser->Line, parser->CharacterPos);
+                    stats->LoopDepth, stats->LoopMaxDepth, parser->FileName, parser->Line, parser->CharacterPos);
         }
     }
 }
 
 
-void stats_log_conditional_entry(struct ParseState *parser, int condition)
+void stats_record_conditional_entry(struct ParseState *parser, int condition)
 {
-    if (parser->pc->CollectStats && condition) {
-        ConditionalDepth++;
-        if (ConditionalDepth > ConditionalMaxDepth) {
-            ConditionalMaxDepth = ConditionalDepth;
+    if (STATS_COLLECTING(parser) && condition) {
+        struct StatsState *stats = stats_get(parser->pc);
+        stats->ConditionalDepth++;
+        if (stats->ConditionalDepth > stats->ConditionalMaxDepth) {
+            stats->ConditionalMaxDepth = stats->ConditionalDepth;
         }
         if (parser->pc->PrintStats) {
             fprintf(stderr, "Entering conditional (current nesting depth %u, max %u) at %s:%d:%d\n",
-                    ConditionalDepth, ConditionalMaxDepth, parser->FileName, parser->Line, parser->CharacterPos);
+                    stats->ConditionalDepth, stats->ConditionalMaxDepth, parser->FileName, parser->Line, parser->CharacterPos);
         }
     }
 }
 
 
-void stats_log_conditional_exit(struct ParseState *parser, int condition)
+void stats_record_conditional_exit(struct ParseState *parser, int condition)
 {
-    if (parser->pc->CollectStats && condition) {
-        ConditionalDepth--;
+    if (STATS_COLLECTING(parser) && condition) {
+        struct StatsState *stats = stats_get(parser->pc);
+        stats->ConditionalDepth--;
         if (parser->pc->PrintStats) {
             fprintf(stderr, "Leaving conditional (current nesting depth %u, max %u) at %s:%d:%d\n",
-                    ConditionalDepth, ConditionalMaxDepth, parser->FileName, parser->Line, parser->CharacterPos);
+                    stats->ConditionalDepth, stats->ConditionalMaxDepth, parser->FileName, parser->Line, parser->CharacterPos);
         }
     }
 }
 
 
-void stats_log_assignment(struct ParseState *parser, int type) {
-    if (parser->pc->CollectStats && (strcmp(parser->FileName, "startup") != 0)) {
-        TypeStats[type].assignments++;
+void stats_record_assignment(struct ParseState *parser, int type) {
+    if (STATS_COLLECTING(parser)) {
+        struct StatsState *stats = stats_get(parser->pc);
+        stats->TypeAssignments[type]++;
         if (parser->pc->PrintStats) {
             fprintf(stderr, "Assignment of type %s at %s:%d:%d\n",
                     TypeStats[type].name, parser->FileName, parser->Line, parser->CharacterPos);
@@ -443,58 +1034,60 @@ void stats_log_assignment(struct ParseState *parser, int type) {
 }
 
 
-void stats_log_expression_parse(struct ParseState *Parser)
+void stats_record_expression_parse(struct ParseState *Parser)
 {
-    if (Parser->pc->CollectStats && (Parser->Mode == RunModeRun) && (strcmp(Parser->FileName, "startup") != 0)) {
-
-        ExpressionDepth = 0;
-
-        ExpressionChainTreePosition = &ExpressionChainsRoot;
-        ExpressionChainTreePosition->LeafCount++;
-        TotalExpressionChains++;
-
-        /* temporarily move the parser to the next token to get more accurate file coordinates */
-        struct ParseState PreState;
-        ParserCopy(&PreState, Parser);
-        LexGetToken(Parser, NULL, true);
-
-        if (Parser->pc->CollectFullExpressions) {
-            if (ExpressionChainListHead == NULL) {
-                ExpressionChainListHead = malloc(sizeof(struct ExpressionChainListNode));
-                if (ExpressionChainListHead == NULL) {
-                    fprintf(stderr, "Error allocating memory for expression chain stats\n");
-                    exit(1);
-                }
-                ExpressionChainListTail = ExpressionChainListHead;
-            } else {
-                struct ExpressionChainListNode *NewNode = malloc(sizeof(struct ExpressionChainListNode));
-                if (NewNode == NULL) {
-                    fprintf(stderr, "Error allocating memory for expression chain stats\n");
-                    exit(1);
-                }
-                ExpressionChainListTail->Next = NewNode;
-                ExpressionChainListTail = NewNode;
-            }
-            ExpressionChainListTail->ExpressionChainHead = NULL;
-            ExpressionChainListTail->Next = NULL;
-            CurrentExpression = NULL;
-            ExpressionChainListTail->Coordinate.FileName = strdup(Parser->FileName);
-            ExpressionChainListTail->Coordinate.Line = Parser->Line;
-            ExpressionChainListTail->Coordinate.Column = Parser->CharacterPos;
+    if (STATS_COLLECTING(Parser)) {
+        struct StatsState *stats = stats_get(Parser->pc);
+
+        stats->ExpressionDepth = 0;
+
+        /* the chain that's ending is written out when they're streamed */
+        if (stats->ChainsStream != NULL)
+            stats_stream_chain(stats);
+
+        stats->ExpressionChainTreePosition = &stats->ExpressionChainsRoot;
+        stats->ExpressionChainTreePosition->LeafCount++;
+        stats->TotalExpressionChains++;
+        stats->NgramWindowLength = 0;
+
+        if (!Parser->pc->CollectFullExpressions && !Parser->pc->PrintExpressions)
+            return;
+
+        /* the next token's file coordinates are more accurate, so look
+            ahead with a copy of the parser when they're wanted */
+        struct ParseState NextState;
+        ParserCopy(&NextState, Parser);
+        LexGetToken(&NextState, NULL, true);
+        Parser = &NextState;
+
+        if (Parser->pc->CollectFullExpressions && stats->ChainsStream != NULL) {
+            stats->StreamFileName = stats_name(stats, Parser->FileName);
+            stats->StreamLine = Parser->Line;
+            stats->StreamColumn = Parser->CharacterPos;
+        } else if (Parser->pc->CollectFullExpressions) {
+            struct ExpressionChainListNode *NewNode = stats_arena_alloc(stats, sizeof(struct ExpressionChainListNode));
+
+            if (stats->ExpressionChainListHead == NULL)
+                stats->ExpressionChainListHead = NewNode;
+            else
+                stats->ExpressionChainListTail->Next = NewNode;
+            stats->ExpressionChainListTail = NewNode;
+            stats->CurrentExpression = NULL;
+            NewNode->Coordinate.FileName = stats_name(stats, Parser->FileName)->Name;
+            NewNode->Coordinate.Line = Parser->Line;
+            NewNode->Coordinate.Column = Parser->CharacterPos;
         }
 
         if (Parser->pc->PrintExpressions) {
             fprintf(stderr, "\n---\nParsing expression at %s:%d:%d\n", Parser->FileName, Parser->Line, Parser->CharacterPos);
         }
-
-        ParserCopy(Parser, &PreState);
     }
 }
 
 
-void stats_log_expression_stack_collapse(struct ParseState *parser)
+void stats_record_expression_stack_collapse(struct ParseState *parser)
 {
-    if (parser->pc->CollectStats && (parser->Mode == RunModeRun) && (strcmp(parser->FileName, "startup") != 0)) {
+    if (STATS_COLLECTING(parser)) {
         if (parser->pc->PrintExpressions) {
 //            fprintf(stderr, "Collapsing expression stack at %s:%d:%d\n", parser->FileName, parser->Line, parser->CharacterPos);
         }
@@ -502,104 +1095,95 @@ void stats_log_expression_stack_collapse(struct ParseState *parser)
 }
 
 
-void stats_log_expression_evaluation(struct ParseState *parser, enum ExpressionType Type, enum LexToken Op, struct Value *BottomValue, struct Value *TopValue)
+/* count the n-grams which end with an expression that's just been
+    evaluated. the window holds the chain's last few expressions */
+static void stats_record_expression_ngrams(struct StatsState *stats, struct ParseState *parser, union ExpressionHash Hash)
+{
+    if (stats->NgramWindowLength == STATS_NGRAM_MAX) {
+        memmove(&stats->NgramWindow[0], &stats->NgramWindow[1], sizeof(union ExpressionHash) * (STATS_NGRAM_MAX - 1));
+        stats->NgramWindowLength--;
+    }
+    stats->NgramWindow[stats->NgramWindowLength++] = Hash;
+
+    for (unsigned int Length = STATS_NGRAM_MIN; Length <= stats->NgramWindowLength; Length++) {
+        union ExpressionHash *Hashes = &stats->NgramWindow[stats->NgramWindowLength - Length];
+        uint32_t Key = 2166136261u ^ Length;
+        struct ExpressionNgram *Ngram;
+
+        for (unsigned int i = 0; i < Length; i++) {
+            Key = (Key ^ Hashes[i].Hash) * 16777619u;
+        }
+
+        for (Ngram = stats->Ngrams[Key % NGRAM_TABLE_SIZE]; Ngram != NULL; Ngram = Ngram->Next) {
+            if (Ngram->Length == Length && memcmp(Ngram->Hashes, Hashes, sizeof(union ExpressionHash) * Length) == 0)
+                break;
+        }
+
+        if (Ngram == NULL) {
+            Ngram = stats_arena_alloc(stats, sizeof(struct ExpressionNgram));
+            Ngram->Length = Length;
+            memcpy(Ngram->Hashes, Hashes, sizeof(union ExpressionHash) * Length);
+            Ngram->Coordinate.FileName = stats_name(stats, parser->FileName)->Name;
+            Ngram->Coordinate.Line = parser->Line;
+            Ngram->Coordinate.Column = parser->CharacterPos;
+            Ngram->Next = stats->Ngrams[Key % NGRAM_TABLE_SIZE];
+            stats->Ngrams[Key % NGRAM_TABLE_SIZE] = Ngram;
+            stats->NumNgrams++;
+        }
+
+        Ngram->Count++;
+    }
+}
+
+
+void stats_record_expression_evaluation(struct ParseState *parser, enum ExpressionType Type, enum LexToken Op, struct Value *BottomValue, struct Value *TopValue)
 {
-    if (parser->pc->CollectStats && (parser->Mode == RunModeRun) && (strcmp(parser->FileName, "startup") != 0)) {
+    if (STATS_COLLECTING(parser)) {
+        struct StatsState *stats = stats_get(parser->pc);
         enum BaseType TopType = TopValue ? TopValue->Typ->Base : 0;
         enum BaseType BottomType = BottomValue ? BottomValue->Typ->Base : 0;
 
-        ExpressionDepth++;
-        if (ExpressionDepth > ExpressionMaxDepth) {
-            ExpressionMaxDepth = ExpressionDepth;
+        stats->ExpressionDepth++;
+        if (stats->ExpressionDepth > stats->ExpressionMaxDepth) {
+            stats->ExpressionMaxDepth = stats->ExpressionDepth;
         }
 
         if (Type == ExpressionInfix && Op == TokenLeftSquareBracket && BottomValue && BottomType == TypeArray) {
             BottomType = BottomValue->Typ->FromType->Base;
         }
 
-        ExpressionCounts[Type][Op][TopType][BottomType]++;
-        TotalExpressions++;
+        stats->ExpressionCounts[Type][Op][TopType][BottomType]++;
+        stats->TotalExpressions++;
 
-        if (ExpressionChainTreePosition) {
+        if (parser->pc->CollectExpressionNgrams) {
             union ExpressionHash Hash = {.Components = {Type, Op, TopType, BottomType}};
+            stats_record_expression_ngrams(stats, parser, Hash);
+        }
 
-            /* reduce count of current leaf because it will be added to the new leaf instead */
-            ExpressionChainTreePosition->LeafCount--;
-            TotalExpressionChains--;
-
-            /* if the node has no branches, initialise its branch array */
-            if (ExpressionChainTreePosition->Branches == NULL) {
-                ExpressionChainTreePosition->Branches = malloc(sizeof(struct ExpressionChainItem) * 2);
-                if (ExpressionChainTreePosition->Branches == NULL) {
-                    fprintf(stderr, "Error allocating memory for expression chain branches\n");
-                    exit(1);
-                }
-                ExpressionChainTreePosition->BranchListSize = 2;
-            }
-
-            /* search for an existing branch with the current expression hash */
-            struct ExpressionChainItem *MatchedBranch = NULL;
-            for (int i = 0; i < ExpressionChainTreePosition->BranchCount; i++) {
-                if (ExpressionChainTreePosition->Branches[i].Hash.Hash == Hash.Hash) {
-                    MatchedBranch = &ExpressionChainTreePosition->Branches[i];
-                    /* increment the leaf count of the matched (or new) branch */
-                    MatchedBranch->LeafCount++;
-                    TotalExpressionChains++;
-                    break;
-                }
-            }
-
-            /* if there's not a matching branch, create a new branch for this hash */
-            if (MatchedBranch == NULL) {
-                /* create more branch storage on this node if it's needed */
-                if (ExpressionChainTreePosition->BranchCount == ExpressionChainTreePosition->BranchListSize) {
-                    ExpressionChainTreePosition->BranchListSize *= 2;
-                    ExpressionChainTreePosition->Branches = realloc(ExpressionChainTreePosition->Branches,
-                                                                    sizeof(struct ExpressionChainItem) *
-                                                                    ExpressionChainTreePosition->BranchListSize);
-                    if (ExpressionChainTreePosition->Branches == NULL) {
-                        fprintf(stderr, "Error reallocating memory for %d expression chain branches\n",
-                                ExpressionChainTreePosition->BranchListSize);
-                        exit(1);
-                    }
-                }
-
-                /* set up the new branch for the current expression */
-                MatchedBranch = &ExpressionChainTreePosition->Branches[ExpressionChainTreePosition->BranchCount];
-                MatchedBranch->Hash = Hash;
-                MatchedBranch->LeafCount = 1;
-                TotalExpressionChains++;
-                MatchedBranch->BranchCount = 0;
-                MatchedBranch->BranchListSize = 0;
-                MatchedBranch->Branches = NULL;
-                ExpressionChainTreePosition->BranchCount++;
-            }
+        if (stats->ExpressionChainTreePosition) {
+            union ExpressionHash Hash = {.Components = {Type, Op, TopType, BottomType}};
 
-            /* set the new position in the tree to be the matched (or new) branch */
-            ExpressionChainTreePosition = MatchedBranch;
+            /* the chain so far now ends with this expression's branch instead */
+            stats->ExpressionChainTreePosition->LeafCount--;
+            stats->ExpressionChainTreePosition = stats_expression_branch(stats, stats->ExpressionChainTreePosition, Hash);
+            stats->ExpressionChainTreePosition->LeafCount++;
         }
 
-        if (parser->pc->CollectFullExpressions) {
-            if (ExpressionChainListTail != NULL) {
-                struct ExpressionChainNode *NewNode = malloc(sizeof(struct ExpressionChainNode));
-                if (NewNode == NULL) {
-                    fprintf(stderr, "Error allocating memory for expression chain stats\n");
-                    exit(1);
-                }
-                NewNode->Next = NULL;
+        if (parser->pc->CollectFullExpressions && stats->ChainsStream == NULL &&
+                stats->ExpressionChainListTail != NULL) {
+            struct ExpressionChainNode *NewNode = stats_arena_alloc(stats, sizeof(struct ExpressionChainNode));
 
-                if (ExpressionChainListTail->ExpressionChainHead == NULL) {
-                    ExpressionChainListTail->ExpressionChainHead = NewNode;
-                } else {
-                    CurrentExpression->Next = NewNode;
-                }
-                CurrentExpression = NewNode;
+            if (stats->ExpressionChainListTail->ExpressionChainHead == NULL) {
+                stats->ExpressionChainListTail->ExpressionChainHead = NewNode;
+            } else {
+                stats->CurrentExpression->Next = NewNode;
             }
+            stats->CurrentExpression = NewNode;
 
-            CurrentExpression->Expression.Type = Type;
-            CurrentExpression->Expression.Op = Op;
-            CurrentExpression->Expression.BottomType = BottomType;
-            CurrentExpression->Expression.TopType = TopType;
+            NewNode->Expression.Type = Type;
+            NewNode->Expression.Op = Op;
+            NewNode->Expression.BottomType = BottomType;
+            NewNode->Expression.TopType = TopType;
         }
 
         if (parser->pc->PrintExpressions) {
@@ -638,41 +1222,100 @@ void stats_log_expression_evaluation(struct ParseState *parser, enum ExpressionT
 }
 
 
-void stats_log_stack_frame_add(struct ParseState *parser, const char *funcName)
+/* the stats for the stack frame at a depth, growing the list of them to
+ * reach it */
+static struct StackFrameStats *stats_stack_frame(struct StatsState *stats, unsigned int Depth)
+{
+    if (Depth >= stats->StackFrameAllocationsSize) {
+        unsigned int OldSize = stats->StackFrameAllocationsSize;
+        unsigned int NewSize = OldSize == 0 ? STACK_FRAME_STATS_MIN_SIZE : OldSize * 2;
+        struct StackFrameStats *Frames;
+
+        while (NewSize <= Depth)
+            NewSize *= 2;
+
+        Frames = realloc(stats->StackFrameAllocations, sizeof(struct StackFrameStats) * NewSize);
+        if (Frames == NULL) {
+            fprintf(stderr, "Error allocating memory for %u stack frames\n", NewSize);
+            exit(1);
+        }
+        memset(&Frames[OldSize], 0, sizeof(struct StackFrameStats) * (NewSize - OldSize));
+        stats->StackFrameAllocations = Frames;
+        stats->StackFrameAllocationsSize = NewSize;
+    }
+
+    return &stats->StackFrameAllocations[Depth];
+}
+
+
+static struct FrameFunction *stats_frame_function(struct StatsState *stats, const char *funcName)
+{
+    const char *FuncName = stats_name(stats, funcName)->Name;
+    unsigned int Key = (unsigned int)((uintptr_t)FuncName / sizeof(void *)) % FRAME_FUNCTION_TABLE_SIZE;
+    struct FrameFunction *Function;
+
+    for (Function = stats->FrameFunctions[Key]; Function != NULL; Function = Function->Next) {
+        if (Function->FuncName == FuncName)
+            return Function;
+    }
+
+    Function = stats_arena_alloc(stats, sizeof(struct FrameFunction));
+    Function->FuncName = FuncName;
+    Function->Next = stats->FrameFunctions[Key];
+    stats->FrameFunctions[Key] = Function;
+    stats->NumFrameFunctions++;
+    return Function;
+}
+
+
+void stats_record_stack_frame_add(struct ParseState *parser, const char *funcName)
 {
-    if (parser->pc->CollectStats) {
-        StackFramesDepth++;
-        if (StackFramesDepth > StackFramesMaxDepth) {
-            StackFramesMaxDepth = StackFramesDepth;
+    if (STATS_COLLECTING(parser)) {
+        struct StatsState *stats = stats_get(parser->pc);
+        struct StackFrameStats *Frame;
+        unsigned int Bucket = 0;
+
+        stats->StackFramesDepth++;
+        if (stats->StackFramesDepth > stats->StackFramesMaxDepth) {
+            stats->StackFramesMaxDepth = stats->StackFramesDepth;
         }
 
-        StackFrameAllocations[StackFramesDepth].TotalAllocation = 0;
-        StackFrameAllocations[StackFramesDepth].CumulativeTotalAllocation = StackFrameAllocations[StackFramesDepth - 1].CumulativeTotalAllocation;
+        /* bucket n has the depths from 2^n to 2^(n+1) - 1 */
+        for (unsigned int Depth = stats->StackFramesDepth; Depth > 1 && Bucket < STACK_DEPTH_BUCKETS - 1; Depth >>= 1)
+            Bucket++;
+        stats->StackFrameDepths[Bucket]++;
+
+        Frame = stats_stack_frame(stats, stats->StackFramesDepth);
+        Frame->TotalAllocation = 0;
+        Frame->CumulativeTotalAllocation = stats_stack_frame(stats, stats->StackFramesDepth - 1)->CumulativeTotalAllocation;
+        Frame->Function = stats_frame_function(stats, funcName);
+        Frame->Function->Frames++;
 
         if (parser->pc->PrintStats || parser->pc->PrintMemory) {
             fprintf(stderr, "\n");
-            for (int i = 0; i < StackFramesDepth - 1; i++)
+            for (int i = 0; i < stats->StackFramesDepth - 1; i++)
                 fprintf(stderr, "  ");
             fprintf(stderr, "***\n");
-            for (int i = 0; i < StackFramesDepth - 1; i++)
+            for (int i = 0; i < stats->StackFramesDepth - 1; i++)
                 fprintf(stderr, "  ");
             fprintf(stderr, "Adding stack frame for '%s()' (new depth %u, max depth %u) at %s:%d:%d\n",
-                    funcName, StackFramesDepth, StackFramesMaxDepth, parser->FileName, parser->Line, parser->CharacterPos);
+                    funcName, stats->StackFramesDepth, stats->StackFramesMaxDepth, parser->FileName, parser->Line, parser->CharacterPos);
         }
     }
 }
 
 
-void stats_log_stack_frame_pop(struct ParseState *parser)
+void stats_record_stack_frame_pop(struct ParseState *parser)
 {
-    if (parser->pc->CollectStats) {
-        StackFramesDepth--;
+    if (STATS_COLLECTING(parser)) {
+        struct StatsState *stats = stats_get(parser->pc);
+        stats->StackFramesDepth--;
         if (parser->pc->PrintStats || parser->pc->PrintMemory) {
-            for (int i = 0; i < StackFramesDepth; i++)
+            for (int i = 0; i < stats->StackFramesDepth; i++)
                 fprintf(stderr, "  ");
             fprintf(stderr, "Popping stack frame (new depth %u, max depth %u) at %s:%d:%d\n",
-                    StackFramesDepth, StackFramesMaxDepth, parser->FileName, parser->Line, parser->CharacterPos);
-            for (int i = 0; i < StackFramesDepth; i++)
+                    stats->StackFramesDepth, stats->StackFramesMaxDepth, parser->FileName, parser->Line, parser->CharacterPos);
+            for (int i = 0; i < stats->StackFramesDepth; i++)
                 fprintf(stderr, "  ");
             fprintf(stderr, "***\n\n");
         }
@@ -680,58 +1323,262 @@ void stats_log_stack_frame_pop(struct ParseState *parser)
 }
 
 
-void stats_log_stack_allocation(struct ParseState *parser, int Size)
+void stats_record_stack_allocation(struct ParseState *parser, int Size)
 {
-    if (parser->pc->CollectStats && (parser->Mode == RunModeRun) && (strcmp(parser->FileName, "startup") != 0)) {
+    if (STATS_COLLECTING(parser)) {
+        struct StatsState *stats = stats_get(parser->pc);
+        struct StackFrameStats *Frame = stats_stack_frame(stats, stats->StackFramesDepth);
 
-        StackFrameAllocations[StackFramesDepth].TotalAllocation += Size;
-        if (StackFrameAllocations[StackFramesDepth].TotalAllocation > MaxStackFrameTotalAllocation)
-            MaxStackFrameTotalAllocation = StackFrameAllocations[StackFramesDepth].TotalAllocation;
+        Frame->TotalAllocation += Size;
+        if (Frame->TotalAllocation > stats->MaxStackFrameTotalAllocation)
+            stats->MaxStackFrameTotalAllocation = Frame->TotalAllocation;
+        if (Frame->Function != NULL && Frame->TotalAllocation > Frame->Function->PeakFrameSize)
+            Frame->Function->PeakFrameSize = Frame->TotalAllocation;
 
-        StackFrameAllocations[StackFramesDepth].CumulativeTotalAllocation += Size;
-        if (StackFrameAllocations[StackFramesDepth].CumulativeTotalAllocation > MaxCumulativeTotalAllocation)
-            MaxCumulativeTotalAllocation = StackFrameAllocations[StackFramesDepth].CumulativeTotalAllocation;
+        Frame->CumulativeTotalAllocation += Size;
+        if (Frame->CumulativeTotalAllocation > stats->MaxCumulativeTotalAllocation)
+            stats->MaxCumulativeTotalAllocation = Frame->CumulativeTotalAllocation;
 
         if (parser->pc->PrintMemory) {
-            for (int i = 0; i < StackFramesDepth; i++)
+            for (int i = 0; i < stats->StackFramesDepth; i++)
                 fprintf(stderr, "  ");
             fprintf(stderr, "%s:%d:%d  Allocated %d bytes on stack (total %d/%d)\n",
                     parser->FileName, parser->Line, parser->CharacterPos, Size,
-                    StackFrameAllocations[StackFramesDepth].TotalAllocation,
-                    StackFrameAllocations[StackFramesDepth].CumulativeTotalAllocation);
+                    Frame->TotalAllocation, Frame->CumulativeTotalAllocation);
         }
     }
 }
 
 
-void stats_log_stack_pop(struct ParseState *parser, struct Value *Var)
+void stats_record_stack_pop(struct ParseState *parser, struct Value *Var)
 {
-    if (parser->pc->CollectStats && (parser->Mode == RunModeRun) && (strcmp(parser->FileName, "startup") != 0)) {
+    if (STATS_COLLECTING(parser)) {
+        struct StatsState *stats = stats_get(parser->pc);
         int Size = Var->Typ->Sizeof;
         if (parser->pc->PrintMemory) {
-            for (int i = 0; i < StackFramesDepth; i++)
+            struct StackFrameStats *Frame = stats_stack_frame(stats, stats->StackFramesDepth);
+
+            for (int i = 0; i < stats->StackFramesDepth; i++)
                 fprintf(stderr, "  ");
             fprintf(stderr, "%s:%d:%d  Popped %d bytes off stack (total %d/%d)\n",
                     parser->FileName, parser->Line, parser->CharacterPos, Size,
-                    StackFrameAllocations[StackFramesDepth].TotalAllocation,
-                    StackFrameAllocations[StackFramesDepth].CumulativeTotalAllocation);
+                    Frame->TotalAllocation, Frame->CumulativeTotalAllocation);
+        }
+    }
+}
+
+
+/* the site a heap allocation's being made from: the line and the program
+ * function it's in */
+static struct HeapSite *stats_heap_site(struct StatsState *stats, struct ParseState *parser)
+{
+    struct StackFrame *Frame = THREAD(parser->pc)->TopStackFrame;
+    const char *FileName = stats_name(stats, parser->FileName)->Name;
+    const char *FuncName = stats_name(stats, Frame != NULL ? Frame->FuncName : "(top level)")->Name;
+    unsigned int Key = (unsigned int)(((uintptr_t)FileName ^ (uintptr_t)FuncName * 31) / sizeof(void *) +
+                                      parser->Line) % HEAP_SITE_TABLE_SIZE;
+    struct HeapSite *Site;
+
+    for (Site = stats->HeapSites[Key]; Site != NULL; Site = Site->Next) {
+        if (Site->FileName == FileName && Site->Line == parser->Line && Site->FuncName == FuncName)
+            return Site;
+    }
+
+    Site = stats_arena_alloc(stats, sizeof(struct HeapSite));
+    Site->FileName = FileName;
+    Site->Line = parser->Line;
+    Site->FuncName = FuncName;
+    Site->Next = stats->HeapSites[Key];
+    stats->HeapSites[Key] = Site;
+    stats->NumHeapSites++;
+    return Site;
+}
+
+
+static unsigned int stats_heap_key(struct StatsState *stats, void *Pointer)
+{
+    return (unsigned int)(((uintptr_t)Pointer / 16) * 2654435761u) & (stats->HeapBlocksSize - 1);
+}
+
+
+/* forget a block that's been freed or reallocated, returning false if the
+ * program didn't allocate it */
+static int stats_heap_remove(struct StatsState *stats, void *Pointer)
+{
+    struct HeapBlock **Link;
+    struct HeapBlock *Block;
+
+    if (stats->HeapBlocks == NULL)
+        return false;
+
+    for (Link = &stats->HeapBlocks[stats_heap_key(stats, Pointer)]; *Link != NULL; Link = &(*Link)->Next) {
+        if ((*Link)->Pointer == Pointer)
+            break;
+    }
+
+    Block = *Link;
+    if (Block == NULL)
+        return false;
+
+    *Link = Block->Next;
+    Block->Site->LiveBytes -= Block->Size;
+    Block->Site->LiveBlocks--;
+    stats->HeapLiveBytes -= Block->Size;
+    stats->HeapLiveBlocks--;
+
+    Block->Next = stats->FreeHeapBlocks;
+    stats->FreeHeapBlocks = Block;
+    return true;
+}
+
+
+static void stats_heap_add(struct StatsState *stats, struct ParseState *parser, void *Pointer, size_t Size)
+{
+    struct HeapSite *Site = stats_heap_site(stats, parser);
+    struct HeapBlock *Block;
+    unsigned int Bucket = 0;
+
+    /* keep the table no more than full, doubling it when it would be */
+    if (stats->HeapLiveBlocks >= stats->HeapBlocksSize) {
+        struct HeapBlock **OldBlocks = stats->HeapBlocks;
+        unsigned int OldSize = stats->HeapBlocksSize;
+
+        stats->HeapBlocksSize = OldSize == 0 ? HEAP_BLOCK_TABLE_MIN_SIZE : OldSize * 2;
+        stats->HeapBlocks = calloc(stats->HeapBlocksSize, sizeof(struct HeapBlock *));
+        if (stats->HeapBlocks == NULL) {
+            fprintf(stderr, "Error allocating memory for %u heap blocks\n", stats->HeapBlocksSize);
+            exit(1);
+        }
+
+        for (unsigned int i = 0; i < OldSize; i++) {
+            while (OldBlocks[i] != NULL) {
+                Block = OldBlocks[i];
+                OldBlocks[i] = Block->Next;
+                Block->Next = stats->HeapBlocks[stats_heap_key(stats, Block->Pointer)];
+                stats->HeapBlocks[stats_heap_key(stats, Block->Pointer)] = Block;
+            }
         }
+        free(OldBlocks);
+    }
+
+    if (stats->FreeHeapBlocks != NULL) {
+        Block = stats->FreeHeapBlocks;
+        stats->FreeHeapBlocks = Block->Next;
+    } else {
+        Block = stats_arena_alloc(stats, sizeof(struct HeapBlock));
     }
+
+    Block->Pointer = Pointer;
+    Block->Size = Size;
+    Block->Site = Site;
+    Block->Next = stats->HeapBlocks[stats_heap_key(stats, Pointer)];
+    stats->HeapBlocks[stats_heap_key(stats, Pointer)] = Block;
+
+    Site->Allocations++;
+    Site->Bytes += Size;
+    Site->LiveBytes += Size;
+    Site->LiveBlocks++;
+    if (Site->LiveBytes > Site->PeakLiveBytes)
+        Site->PeakLiveBytes = Site->LiveBytes;
+
+    stats->HeapAllocations++;
+    stats->HeapBytes += Size;
+    stats->HeapLiveBytes += Size;
+    stats->HeapLiveBlocks++;
+    if (stats->HeapLiveBytes > stats->HeapPeakLiveBytes)
+        stats->HeapPeakLiveBytes = stats->HeapLiveBytes;
+
+    /* bucket n has the sizes from 2^(n-1) to 2^n - 1 */
+    for (size_t Remaining = Size; Remaining != 0 && Bucket < HEAP_SIZE_BUCKETS - 1; Remaining >>= 1)
+        Bucket++;
+    stats->HeapSizes[Bucket]++;
 }
 
 
-void stats_log_variable_definition(struct ParseState *parser, char *Ident, struct ValueType *Typ, int IsGlobal)
+/* the program's called malloc(), calloc() or realloc(). Old is what's being
+ * reallocated, or NULL, and New is what was returned for Size bytes.
+ * only the main thread's allocations are counted, but the heap blocks are
+ * shared with the threads the program starts, which can reallocate or free
+ * them, so the blocks are only changed with the shared lock held */
+void stats_record_heap_allocation(struct ParseState *parser, void *Old, void *New, size_t Size)
 {
-    if (parser && parser->pc->CollectStats && Typ) {
+    Picoc *pc = parser->pc;
+
+    if (STATS_COLLECTING(parser)) {
+        struct StatsState *stats = stats_get(pc);
+
+        ThreadLock(pc);
+        if (New == NULL && Size != 0) {
+            /* nothing's changed, even for realloc() */
+            stats->HeapFailures++;
+        } else {
+            if (Old != NULL) {
+                stats_heap_remove(stats, Old);
+                stats->HeapReallocations++;
+            }
+            if (New != NULL)
+                stats_heap_add(stats, parser, New, Size);
+        }
+        ThreadUnlock(pc);
+
+        if (pc->PrintMemory) {
+            fprintf(stderr, "%s:%d:%d  Allocated %lu bytes on heap at %p%s (%llu bytes in %u blocks live)\n",
+                    parser->FileName, parser->Line, parser->CharacterPos, (unsigned long)Size, New,
+                    Old != NULL ? " by reallocating" : "", stats->HeapLiveBytes, stats->HeapLiveBlocks);
+        }
+    } else if (pc->Stats != NULL && Old != NULL && (New != NULL || Size == 0)) {
+        /* another thread's moved a block out of what's counted */
+        ThreadLock(pc);
+        stats_heap_remove(pc->Stats, Old);
+        ThreadUnlock(pc);
+    }
+}
+
+
+/* the program's called free(), on any thread */
+void stats_record_heap_free(struct ParseState *parser, void *Pointer)
+{
+    Picoc *pc = parser->pc;
+    struct StatsState *stats = pc->Stats;
+    int Removed;
+
+    if (stats == NULL || Pointer == NULL)
+        return;
+
+    ThreadLock(pc);
+    Removed = stats_heap_remove(stats, Pointer);
+    if (Removed)
+        stats->HeapFrees++;
+    ThreadUnlock(pc);
+
+    if (STATS_COLLECTING(parser) && pc->PrintMemory) {
+        fprintf(stderr, "%s:%d:%d  Freed heap at %p (%llu bytes in %u blocks live)\n",
+                parser->FileName, parser->Line, parser->CharacterPos, Pointer,
+                stats->HeapLiveBytes, stats->HeapLiveBlocks);
+    }
+}
+
+
+/* PicocReset() has freed a block the program left allocated */
+void stats_record_heap_release(Picoc *pc, void *Pointer)
+{
+    stats_heap_remove(pc->Stats, Pointer);
+}
+
+
+void stats_record_variable_definition(struct ParseState *parser, char *Ident, struct ValueType *Typ, int IsGlobal)
+{
+    if (STATS_COLLECTING(parser) && Typ) {
+        struct StatsState *stats = stats_get(parser->pc);
         int Size = Typ->Sizeof;
 
         if (IsGlobal) {
-            GlobalsCount++;
-            GlobalsSize += Size;
+            stats->GlobalsCount++;
+            stats->GlobalsSize += Size;
         }
 
         if (parser->pc->PrintMemory) {
-            for (int i = 0; i < StackFramesDepth; i++)
+            for (int i = 0; i < stats->StackFramesDepth; i++)
                 fprintf(stderr, "  ");
             fprintf(stderr, "%s:%d:%d  Defining%s variable '%s' of size %d bytes...\n",
                     parser->FileName, parser->Line, parser->CharacterPos, IsGlobal ? " global" : "", Ident, Size);
@@ -740,15 +1587,17 @@ void stats_log_variable_definition(struct ParseState *parser, char *Ident, struc
 }
 
 
-void stats_print_tokens(int all)
+void stats_print_tokens(Picoc *pc, int all)
 {
+    struct StatsState *stats = stats_get(pc);
+
     printf("\n*********\nToken stats:\n");
     for (int i = 0; i < NUM_RUN_MODES; i++) {
         printf("***\n");
         printf("%s\n", RunModeNames[i]);
         for (int j = 0; j < NUM_TOKENS; j++) {
-            if (all || LexTokenStats[j].count[i] > 0) {
-                printf("%5d %s\n", LexTokenStats[j].count[i], LexTokenStats[j].name);
+            if (all || stats->TokenCounts[j][i] > 0) {
+                printf("%5d %s\n", stats->TokenCounts[j][i], LexTokenStats[j].name);
             }
         }
     }
@@ -756,8 +1605,10 @@ void stats_print_tokens(int all)
 }
 
 
-void stats_print_tokens_csv()
+void stats_print_tokens_csv(Picoc *pc)
 {
+    struct StatsState *stats = stats_get(pc);
+
     printf("RunMode");
     for (int j = 0; j < NUM_TOKENS; j++) {
         printf(",%s", LexTokenStats[j].name);
@@ -765,19 +1616,21 @@ void stats_print_tokens_csv()
     for (int i = 0; i < NUM_RUN_MODES; i++) {
         printf("\n%s", RunModeNames[i]);
         for (int j = 0; j < NUM_TOKENS; j++) {
-            printf(",%d", LexTokenStats[j].count[i]);
+            printf(",%d", stats->TokenCounts[j][i]);
         }
     }
     printf("\n");
 }
 
 
-void stats_print_tokens_csv_runmode(enum RunMode runMode)
+void stats_print_tokens_csv_runmode(Picoc *pc, enum RunMode runMode)
 {
+    struct StatsState *stats = stats_get(pc);
+
     for (int i = 0; i < NUM_TOKENS - 1; i++) {
-        printf("%d,", LexTokenStats[i].count[runMode]);
+        printf("%d,", stats->TokenCounts[i][runMode]);
     }
-    printf("%d\n", LexTokenStats[NUM_TOKENS - 1].count[runMode]);
+    printf("%d\n", stats->TokenCounts[NUM_TOKENS - 1][runMode]);
 }
 
 
@@ -799,24 +1652,28 @@ void stats_print_token_list(void)
 }
 
 
-void stats_print_function_parameter_counts(bool dynamic)
+void stats_print_function_parameter_counts(Picoc *pc, bool dynamic)
 {
+    struct StatsState *stats = stats_get(pc);
+
     for (int i = 0; i < PARAMETER_MAX; i++) {
         if (dynamic)
-            printf("%u,", FunctionParameterDynamicCounts[i]);
+            printf("%u,", stats->FunctionParameterDynamicCounts[i]);
         else
-            printf("%u,", FunctionParameterCounts[i]);
+            printf("%u,", stats->FunctionParameterCounts[i]);
     }
     if (dynamic)
-        printf("%u\n", FunctionParameterDynamicCounts[PARAMETER_MAX]);
+        printf("%u\n", stats->FunctionParameterDynamicCounts[PARAMETER_MAX]);
     else
-        printf("%u\n", FunctionParameterCounts[PARAMETER_MAX]);
+        printf("%u\n", stats->FunctionParameterCounts[PARAMETER_MAX]);
 }
 
 
-void stats_print_max_depths(void)
+void stats_print_max_depths(Picoc *pc)
 {
-    printf("%u,%u,%u,%u,%u\n", FunctionCallMaxDepth, LoopMaxDepth, ConditionalMaxDepth, ExpressionMaxDepth, StackFramesMaxDepth);
+    struct StatsState *stats = stats_get(pc);
+
+    printf("%u,%u,%u,%u,%u\n", stats->FunctionCallMaxDepth, stats->LoopMaxDepth, stats->ConditionalMaxDepth, stats->ExpressionMaxDepth, stats->StackFramesMaxDepth);
 }
 
 
@@ -829,31 +1686,37 @@ void stats_print_types_list(void)
 }
 
 
-void stats_print_assignments(void)
+void stats_print_assignments(Picoc *pc)
 {
+    struct StatsState *stats = stats_get(pc);
+
     for (int i = 0; i < NUM_TYPES; i++) {
-        printf("%s: %d\n", TypeStats[i].name, TypeStats[i].assignments);
+        printf("%s: %d\n", TypeStats[i].name, stats->TypeAssignments[i]);
     }
 }
 
 
-void stats_print_assignments_csv(void)
+void stats_print_assignments_csv(Picoc *pc)
 {
+    struct StatsState *stats = stats_get(pc);
+
     for (int i = 0; i < NUM_TYPES - 1; i++) {
-        printf("%d,", TypeStats[i].assignments);
+        printf("%d,", stats->TypeAssignments[i]);
     }
-    printf("%d\n", TypeStats[NUM_TYPES - 1].assignments);
+    printf("%d\n", stats->TypeAssignments[NUM_TYPES - 1]);
 }
 
 
-void stats_print_expressions_summary(void)
+void stats_print_expressions_summary(Picoc *pc)
 {
+    struct StatsState *stats = stats_get(pc);
+
     for (int Type = 0; Type < NUM_EXPRESSION_TYPES; Type++) {
         for (int Op = 0; Op < NUM_OPERATORS; Op++) {
             for (int TopType = 0; TopType < NUM_BASE_TYPES; TopType++) {
                 for (int BottomType = 0; BottomType < NUM_BASE_TYPES; BottomType++) {
-                    unsigned int count = ExpressionCounts[Type][Op][TopType][BottomType];
-                    double percentage = (count * 100.0) / TotalExpressions;
+                    unsigned int count = stats->ExpressionCounts[Type][Op][TopType][BottomType];
+                    double percentage = (count * 100.0) / stats->TotalExpressions;
                     if (count > 0) {
                         const char *TopTypeName = BaseTypeNames[TopType];
                         const char *BottomTypeName = BaseTypeNames[BottomType];
@@ -888,18 +1751,20 @@ void stats_print_expressions_summary(void)
         }
     }
 
-    printf("\nTotal expressions: %d\n", TotalExpressions);
-    printf("Maximum expression chain depth: %d\n", ExpressionMaxDepth);
+    printf("\nTotal expressions: %d\n", stats->TotalExpressions);
+    printf("Maximum expression chain depth: %d\n", stats->ExpressionMaxDepth);
 }
 
 
-void stats_print_expressions_summary_csv(void)
+void stats_print_expressions_summary_csv(Picoc *pc)
 {
+    struct StatsState *stats = stats_get(pc);
+
     for (int Type = 0; Type < NUM_EXPRESSION_TYPES; Type++) {
         for (int Op = 0; Op < NUM_OPERATORS; Op++) {
             for (int TopType = 0; TopType < NUM_BASE_TYPES; TopType++) {
                 for (int BottomType = 0; BottomType < NUM_BASE_TYPES; BottomType++) {
-                    unsigned int count = ExpressionCounts[Type][Op][TopType][BottomType];
+                    unsigned int count = stats->ExpressionCounts[Type][Op][TopType][BottomType];
                     if (count > 0) {
                         const char *TopTypeName = BaseTypeNames[TopType];
                         const char *BottomTypeName = BaseTypeNames[BottomType];
@@ -980,56 +1845,76 @@ void stats_print_expression(enum ExpressionType Type, enum LexToken Op, enum Bas
 }
 
 
-void stats_traverse_expressions_tree(struct ExpressionChainItem *Node)
+/* push an expression on to the chain being printed, growing the stack of
+ * them if it's full */
+static void stats_push_chain_expression(struct StatsState *stats, union ExpressionHash Hash)
 {
-    if (ExpressionChainStackTop == EXPRESSION_CHAIN_STACK_SIZE) {
-        fprintf(stderr, "Stats printing expression chain stack overflow");
-        exit(1);
+    if (stats->ExpressionChainStackTop == stats->ExpressionChainStackSize) {
+        unsigned int NewSize = stats->ExpressionChainStackSize == 0 ?
+            EXPRESSION_CHAIN_STACK_MIN_SIZE : stats->ExpressionChainStackSize * 2;
+        union ExpressionHash *Stack = realloc(stats->ExpressionChainStack, sizeof(union ExpressionHash) * NewSize);
+
+        if (Stack == NULL) {
+            fprintf(stderr, "Error allocating memory for an expression chain of %u expressions\n", NewSize);
+            exit(1);
+        }
+        stats->ExpressionChainStack = Stack;
+        stats->ExpressionChainStackSize = NewSize;
     }
 
-    union ExpressionHash Hash = Node->Hash;
-    ExpressionChainStack[ExpressionChainStackTop++] = Hash;
+    stats->ExpressionChainStack[stats->ExpressionChainStackTop++] = Hash;
+}
+
+
+void stats_traverse_expressions_tree(struct StatsState *stats, struct ExpressionChainItem *Node)
+{
+    stats_push_chain_expression(stats, Node->Hash);
 
     /* print out expressions chain stack up to this point, if a chain ended here */
     if (Node->LeafCount > 0) {
-        double percentage = (Node->LeafCount * 100.0) / TotalExpressionChains;
+        double percentage = (Node->LeafCount * 100.0) / stats->TotalExpressionChains;
         printf("%5.1f%% %8d    ", percentage, Node->LeafCount);
-        for (int i = 0; i < ExpressionChainStackTop; i++) {
-            stats_print_expression(ExpressionChainStack[i].Components.Type,
-                                   ExpressionChainStack[i].Components.Op,
-                                   ExpressionChainStack[i].Components.TopType,
-                                   ExpressionChainStack[i].Components.BottomType);
-            if (i < ExpressionChainStackTop - 1)
+        for (int i = 0; i < stats->ExpressionChainStackTop; i++) {
+            stats_print_expression(stats->ExpressionChainStack[i].Components.Type,
+                                   stats->ExpressionChainStack[i].Components.Op,
+                                   stats->ExpressionChainStack[i].Components.TopType,
+                                   stats->ExpressionChainStack[i].Components.BottomType);
+            if (i < stats->ExpressionChainStackTop - 1)
                 printf("  ->  ");
         }
         printf("\n");
     }
 
-    for (int i = 0; i < Node->BranchCount; i++) {
-        stats_traverse_expressions_tree(&Node->Branches[i]);
+    for (struct ExpressionChainItem *Branch = Node->Branches; Branch != NULL; Branch = Branch->NextBranch) {
+        stats_traverse_expressions_tree(stats, Branch);
     }
 
-    ExpressionChainStackTop--;
+    stats->ExpressionChainStackTop--;
 }
 
 
-void stats_print_expression_chains_summary(void)
+void stats_print_expression_chains_summary(Picoc *pc)
 {
+    struct StatsState *stats = stats_get(pc);
+
     /* depth-first traverse the expressions tree to find the chain counts */
-    ExpressionChainStackTop = 0;
-    for (int i = 0; i < ExpressionChainsRoot.BranchCount; i++) {
-        stats_traverse_expressions_tree(&ExpressionChainsRoot.Branches[i]);
+    stats->ExpressionChainStackTop = 0;
+    for (struct ExpressionChainItem *Branch = stats->ExpressionChainsRoot.Branches; Branch != NULL;
+            Branch = Branch->NextBranch) {
+        stats_traverse_expressions_tree(stats, Branch);
     }
 
-    printf("\nTotal expressions: %d\n", TotalExpressions);
-    printf("Total expression chains: %d\n", TotalExpressionChains);
-    printf("Maximum expression chain depth: %d\n", ExpressionMaxDepth);
+    printf("\nTotal expressions: %d\n", stats->TotalExpressions);
+    printf("Total expression chains: %d\n", stats->TotalExpressionChains);
+    printf("Maximum expression chain depth: %d\n", stats->ExpressionMaxDepth);
 }
 
 
-void stats_print_expression_chains(void)
+void stats_print_expression_chains(Picoc *pc)
 {
-    struct ExpressionChainListNode *ExpressionChain = ExpressionChainListHead;
+    struct StatsState *stats = stats_get(pc);
+
+    struct ExpressionChainListNode *ExpressionChain = stats->ExpressionChainListHead;
 
     while (ExpressionChain != NULL) {
         struct ExpressionChainNode *ExpressionNode = ExpressionChain->ExpressionChainHead;
@@ -1057,21 +1942,582 @@ void stats_print_expression_chains(void)
 }
 
 
-void stats_print_memory_info(void)
+static int stats_compare_heap_sites(const void *A, const void *B)
+{
+    const struct HeapSite *SiteA = *(const struct HeapSite **)A;
+    const struct HeapSite *SiteB = *(const struct HeapSite **)B;
+    int Compare;
+
+    if (SiteA->PeakLiveBytes != SiteB->PeakLiveBytes)
+        return SiteA->PeakLiveBytes < SiteB->PeakLiveBytes ? 1 : -1;
+    if (SiteA->Bytes != SiteB->Bytes)
+        return SiteA->Bytes < SiteB->Bytes ? 1 : -1;
+
+    Compare = strcmp(SiteA->FileName, SiteB->FileName);
+    return Compare != 0 ? Compare : SiteA->Line - SiteB->Line;
+}
+
+
+static int stats_compare_heap_leaks(const void *A, const void *B)
 {
-    printf("Maximum stack frame depth: %d\n", StackFramesMaxDepth);
-    printf("Maximum individual stack frame size: %d bytes\n", MaxStackFrameTotalAllocation);
-    printf("Maximum cumulative stack frame size: %d bytes\n", MaxCumulativeTotalAllocation);
-    printf("%d global variables, with total size %d bytes\n", GlobalsCount, GlobalsSize);
+    const struct HeapSite *SiteA = *(const struct HeapSite **)A;
+    const struct HeapSite *SiteB = *(const struct HeapSite **)B;
+
+    if (SiteA->LiveBytes != SiteB->LiveBytes)
+        return SiteA->LiveBytes < SiteB->LiveBytes ? 1 : -1;
+
+    return stats_compare_heap_sites(A, B);
 }
 
 
-void stats_print_memory_info_csv(void)
+/* the heap sites, sorted with Compare. free() the list */
+static struct HeapSite **stats_heap_sites(struct StatsState *stats, int (*Compare)(const void *, const void *))
 {
+    struct HeapSite **Sites = malloc(sizeof(struct HeapSite *) * (stats->NumHeapSites + 1));
+    unsigned int NumSites = 0;
+
+    if (Sites == NULL) {
+        fprintf(stderr, "Error allocating memory for heap stats\n");
+        exit(1);
+    }
+
+    for (int i = 0; i < HEAP_SITE_TABLE_SIZE; i++) {
+        for (struct HeapSite *Site = stats->HeapSites[i]; Site != NULL; Site = Site->Next) {
+            Sites[NumSites++] = Site;
+        }
+    }
+
+    qsort(Sites, NumSites, sizeof(struct HeapSite *), Compare);
+    return Sites;
+}
+
+
+static int stats_compare_frame_functions(const void *A, const void *B)
+{
+    const struct FrameFunction *FunctionA = *(const struct FrameFunction **)A;
+    const struct FrameFunction *FunctionB = *(const struct FrameFunction **)B;
+
+    if (FunctionA->PeakFrameSize != FunctionB->PeakFrameSize)
+        return FunctionA->PeakFrameSize < FunctionB->PeakFrameSize ? 1 : -1;
+    if (FunctionA->Frames != FunctionB->Frames)
+        return FunctionA->Frames < FunctionB->Frames ? 1 : -1;
+
+    return strcmp(FunctionA->FuncName, FunctionB->FuncName);
+}
+
+
+/* the functions stack frames were made for, largest frame first. free()
+ * the list */
+static struct FrameFunction **stats_frame_functions(struct StatsState *stats)
+{
+    struct FrameFunction **Functions = malloc(sizeof(struct FrameFunction *) * (stats->NumFrameFunctions + 1));
+    unsigned int NumFunctions = 0;
+
+    if (Functions == NULL) {
+        fprintf(stderr, "Error allocating memory for stack frame stats\n");
+        exit(1);
+    }
+
+    for (int i = 0; i < FRAME_FUNCTION_TABLE_SIZE; i++) {
+        for (struct FrameFunction *Function = stats->FrameFunctions[i]; Function != NULL; Function = Function->Next) {
+            Functions[NumFunctions++] = Function;
+        }
+    }
+
+    qsort(Functions, NumFunctions, sizeof(struct FrameFunction *), stats_compare_frame_functions);
+    return Functions;
+}
+
+
+/* the smallest size in a bucket of the heap allocation sizes */
+static unsigned long long stats_heap_bucket_size(int Bucket)
+{
+    return Bucket == 0 ? 0 : 1ULL << (Bucket - 1);
+}
+
+
+void stats_print_memory_info(Picoc *pc)
+{
+    struct StatsState *stats = stats_get(pc);
+    struct HeapSite **Sites;
+
+    printf("Maximum stack frame depth: %d\n", stats->StackFramesMaxDepth);
+    printf("Maximum individual stack frame size: %d bytes\n", stats->MaxStackFrameTotalAllocation);
+    printf("Maximum cumulative stack frame size: %d bytes\n", stats->MaxCumulativeTotalAllocation);
+    printf("%d global variables, with total size %d bytes\n", stats->GlobalsCount, stats->GlobalsSize);
+
+    if (stats->NumFrameFunctions > 0) {
+        struct FrameFunction **Functions = stats_frame_functions(stats);
+
+        printf("\nStack frame depths:\n");
+        for (int i = 0; i < STACK_DEPTH_BUCKETS; i++) {
+            if (stats->StackFrameDepths[i] > 0)
+                printf("%12u+ deep %10llu\n", 1U << i, stats->StackFrameDepths[i]);
+        }
+
+        printf("\nStack frames, by largest frame:\n");
+        printf("%12s %14s  %s\n", "frames", "largest", "function");
+        for (unsigned int i = 0; i < stats->NumFrameFunctions && i < FRAME_FUNCTIONS_PRINTED; i++) {
+            printf("%12llu %14u  %s\n", Functions[i]->Frames, Functions[i]->PeakFrameSize, Functions[i]->FuncName);
+        }
+        free(Functions);
+    }
+
+    printf("\nHeap: %llu allocations (%llu by realloc), %llu frees, %llu failed\n", stats->HeapAllocations,
+           stats->HeapReallocations, stats->HeapFrees, stats->HeapFailures);
+    printf("Heap: %llu bytes allocated, at most %llu bytes live, %llu bytes in %u blocks still live\n",
+           stats->HeapBytes, stats->HeapPeakLiveBytes, stats->HeapLiveBytes, stats->HeapLiveBlocks);
+    if (stats->HeapAllocations == 0)
+        return;
+
+    printf("\nHeap allocation sizes:\n");
+    for (int i = 0; i < HEAP_SIZE_BUCKETS; i++) {
+        if (stats->HeapSizes[i] > 0)
+            printf("%12llu+ bytes %10llu\n", stats_heap_bucket_size(i), stats->HeapSizes[i]);
+    }
+
+    printf("\nHeap allocation sites, by peak bytes live:\n");
+    printf("%12s %14s %14s %14s  %s\n", "allocations", "bytes", "peak live", "live", "site");
+    Sites = stats_heap_sites(stats, stats_compare_heap_sites);
+    for (unsigned int i = 0; i < stats->NumHeapSites && i < HEAP_SITES_PRINTED; i++) {
+        printf("%12llu %14llu %14llu %14llu  %s:%d %s\n", Sites[i]->Allocations, Sites[i]->Bytes,
+               Sites[i]->PeakLiveBytes, Sites[i]->LiveBytes, Sites[i]->FileName, Sites[i]->Line, Sites[i]->FuncName);
+    }
+    free(Sites);
+}
+
+
+/* report the heap blocks the program allocated and never freed, if there
+ * are any, by where they were allocated */
+void stats_print_heap_leaks(Picoc *pc, FILE *Out)
+{
+    struct StatsState *stats = pc->Stats;
+    struct HeapSite **Sites;
+
+    if (stats == NULL || stats->HeapLiveBlocks == 0)
+        return;
+
+    fprintf(Out, "picoc: %llu bytes in %u blocks allocated by the program were never freed:\n",
+            stats->HeapLiveBytes, stats->HeapLiveBlocks);
+    Sites = stats_heap_sites(stats, stats_compare_heap_leaks);
+    for (unsigned int i = 0; i < stats->NumHeapSites && Sites[i]->LiveBlocks > 0; i++) {
+        fprintf(Out, "  %llu bytes in %u blocks from %s:%d in %s\n", Sites[i]->LiveBytes, Sites[i]->LiveBlocks,
+                Sites[i]->FileName, Sites[i]->Line, Sites[i]->FuncName);
+    }
+    free(Sites);
+}
+
+
+void stats_print_memory_info_csv(Picoc *pc)
+{
+    struct StatsState *stats = stats_get(pc);
+
     printf("%d,%d,%d,%d,%d\n",
-           StackFramesMaxDepth,
-           MaxStackFrameTotalAllocation,
-           MaxCumulativeTotalAllocation,
-           GlobalsCount,
-           GlobalsSize);
+           stats->StackFramesMaxDepth,
+           stats->MaxStackFrameTotalAllocation,
+           stats->MaxCumulativeTotalAllocation,
+           stats->GlobalsCount,
+           stats->GlobalsSize);
+}
+
+
+/* the text of an expression, as the summaries print it */
+static void stats_expression_text(char *Text, size_t Size, union ExpressionHash Hash)
+{
+    const char *TopTypeName = BaseTypeNames[Hash.Components.TopType];
+    const char *BottomTypeName = BaseTypeNames[Hash.Components.BottomType];
+    const char *OpSymbol = OperatorSymbols[Hash.Components.Op];
+
+    switch (Hash.Components.Type) {
+        case ExpressionInfix:
+            if (Hash.Components.Op == TokenAssign) {
+                snprintf(Text, Size, "var<%s> = %s", BottomTypeName, TopTypeName);
+            } else if (Hash.Components.Op == TokenLeftSquareBracket) {
+                snprintf(Text, Size, "arr<%s>[%s]", BottomTypeName, TopTypeName);
+            } else {
+                snprintf(Text, Size, "%s %s %s", BottomTypeName, OpSymbol, TopTypeName);
+            }
+            break;
+        case ExpressionPrefix:
+            snprintf(Text, Size, "%s%s", OpSymbol, TopTypeName);
+            break;
+        case ExpressionPostfix:
+            snprintf(Text, Size, "%s%s", TopTypeName, OpSymbol);
+            break;
+        case ExpressionReturn:
+            snprintf(Text, Size, "ret<%s> = %s", BottomTypeName, TopTypeName);
+            break;
+        default:
+            snprintf(Text, Size, "invalid");
+            break;
+    }
+}
+
+
+/* write a string as a JSON string */
+static void stats_json_string(FILE *Out, const char *Str)
+{
+    fputc('"', Out);
+    for (; *Str != '\0'; Str++) {
+        if (*Str == '"' || *Str == '\\')
+            fprintf(Out, "\\%c", *Str);
+        else if ((unsigned char)*Str < ' ')
+            fprintf(Out, "\\u%04x", *Str);
+        else
+            fputc(*Str, Out);
+    }
+    fputc('"', Out);
+}
+
+
+static void stats_json_expression(FILE *Out, union ExpressionHash Hash)
+{
+    char Text[64];
+
+    stats_expression_text(Text, sizeof(Text), Hash);
+    stats_json_string(Out, Text);
+}
+
+
+/* write each chain ending at or below a node of the expression chains tree */
+static void stats_json_chains(FILE *Out, struct StatsState *stats, struct ExpressionChainItem *Node, int *First)
+{
+    stats_push_chain_expression(stats, Node->Hash);
+
+    if (Node->LeafCount > 0) {
+        fprintf(Out, "%s\n        {\"count\": %u, \"expressions\": [", *First ? "" : ",", Node->LeafCount);
+        for (int i = 0; i < stats->ExpressionChainStackTop; i++) {
+            if (i > 0)
+                fprintf(Out, ", ");
+            stats_json_expression(Out, stats->ExpressionChainStack[i]);
+        }
+        fprintf(Out, "]}");
+        *First = false;
+    }
+
+    for (struct ExpressionChainItem *Branch = Node->Branches; Branch != NULL; Branch = Branch->NextBranch) {
+        stats_json_chains(Out, stats, Branch, First);
+    }
+
+    stats->ExpressionChainStackTop--;
+}
+
+
+static void stats_json_counts(FILE *Out, unsigned int *Counts, int NumCounts)
+{
+    fputc('[', Out);
+    for (int i = 0; i < NumCounts; i++) {
+        fprintf(Out, "%s%u", i > 0 ? ", " : "", Counts[i]);
+    }
+    fputc(']', Out);
+}
+
+
+static int stats_compare_ngrams(const void *A, const void *B)
+{
+    const struct ExpressionNgram *NgramA = *(const struct ExpressionNgram **)A;
+    const struct ExpressionNgram *NgramB = *(const struct ExpressionNgram **)B;
+
+    if (NgramA->Length != NgramB->Length)
+        return NgramA->Length < NgramB->Length ? -1 : 1;
+
+    if (NgramA->Count != NgramB->Count)
+        return NgramA->Count > NgramB->Count ? -1 : 1;
+
+    for (unsigned int i = 0; i < NgramA->Length; i++) {
+        if (NgramA->Hashes[i].Hash != NgramB->Hashes[i].Hash)
+            return NgramA->Hashes[i].Hash < NgramB->Hashes[i].Hash ? -1 : 1;
+    }
+
+    return 0;
+}
+
+
+/* the Top most common n-grams of each length, shortest first and then the
+ * most common first. the array has to be freed */
+static struct ExpressionNgram **stats_top_ngrams(struct StatsState *stats, int Top, int *NumNgrams)
+{
+    struct ExpressionNgram **Ngrams = malloc(sizeof(struct ExpressionNgram *) * (stats->NumNgrams + 1));
+    int Count = 0;
+    int Kept = 0;
+
+    if (Ngrams == NULL) {
+        fprintf(stderr, "Error allocating memory for expression n-grams\n");
+        exit(1);
+    }
+
+    for (int i = 0; i < NGRAM_TABLE_SIZE; i++) {
+        for (struct ExpressionNgram *Ngram = stats->Ngrams[i]; Ngram != NULL; Ngram = Ngram->Next) {
+            Ngrams[Count++] = Ngram;
+        }
+    }
+    qsort(Ngrams, Count, sizeof(struct ExpressionNgram *), stats_compare_ngrams);
+
+    for (int i = 0, OfLength = 0; i < Count; i++) {
+        OfLength = (i > 0 && Ngrams[i]->Length == Ngrams[i-1]->Length) ? OfLength + 1 : 0;
+        if (OfLength < Top)
+            Ngrams[Kept++] = Ngrams[i];
+    }
+
+    *NumNgrams = Kept;
+    return Ngrams;
+}
+
+
+/* write the Top most common n-grams of each length, a line each with its
+ * count, length, the hashes of its expressions as in the 0xe report, where
+ * it was first seen and its expressions. lines starting with '#' are
+ * comments */
+void stats_write_expression_ngrams(Picoc *pc, FILE *Out, int Top)
+{
+    struct StatsState *stats = stats_get(pc);
+    int NumNgrams;
+    struct ExpressionNgram **Ngrams = stats_top_ngrams(stats, Top, &NumNgrams);
+    char Text[64];
+
+    fprintf(Out, "# picoc expression n-grams %d\n", STATS_NGRAMS_VERSION);
+    fprintf(Out, "# count\tlength\thashes\tfirst seen\texpressions\n");
+    for (int i = 0; i < NumNgrams; i++) {
+        struct ExpressionNgram *Ngram = Ngrams[i];
+
+        fprintf(Out, "%u\t%u\t", Ngram->Count, Ngram->Length);
+        for (unsigned int j = 0; j < Ngram->Length; j++) {
+            fprintf(Out, "%s%u", j > 0 ? "," : "", Ngram->Hashes[j].Hash);
+        }
+        fprintf(Out, "\t%s:%d\t", Ngram->Coordinate.FileName, Ngram->Coordinate.Line);
+        for (unsigned int j = 0; j < Ngram->Length; j++) {
+            stats_expression_text(Text, sizeof(Text), Ngram->Hashes[j]);
+            fprintf(Out, "%s%s", j > 0 ? "  ->  " : "", Text);
+        }
+        fprintf(Out, "\n");
+    }
+
+    free(Ngrams);
+}
+
+
+void stats_print_expression_ngrams(Picoc *pc)
+{
+    stats_write_expression_ngrams(pc, stdout, STATS_NGRAMS_TOP);
+}
+
+
+/* write the reports picked by Reports, a bit for each -d type, as one JSON
+ * object - see README.md for its layout. each report holds the same
+ * numbers as the -d type's CSV output, or its text output if it has no CSV
+ * form. Files are the program's source files and ExitValue is what it
+ * exited with */
+void stats_write_json(Picoc *pc, FILE *Out, int Reports, char **Files, int NumFiles, int ExitValue)
+{
+    struct StatsState *stats = stats_get(pc);
+    const char *Separator = "";
+
+    fprintf(Out, "{\n  \"schema\": \"picoc-stats\",\n  \"version\": %d,\n  \"picoc\": ", STATS_JSON_VERSION);
+    stats_json_string(Out, PICOC_VERSION);
+    fprintf(Out, ",\n  \"files\": [");
+    for (int i = 0; i < NumFiles; i++) {
+        if (i > 0)
+            fprintf(Out, ", ");
+        stats_json_string(Out, Files[i]);
+    }
+    fprintf(Out, "],\n  \"exit_value\": %d,\n  \"reports\": {", ExitValue);
+
+    /* 0x0-0x3 */
+    if (Reports & (STATS_REPORT(0x0) | STATS_REPORT(0x1) | STATS_REPORT(0x2) | STATS_REPORT(0x3))) {
+        fprintf(Out, "%s\n    \"tokens\": {", Separator);
+        for (int i = 0; i < NUM_RUN_MODES; i++) {
+            fprintf(Out, "%s\n      \"%s\": {", i > 0 ? "," : "", RunModeNames[i]);
+            for (int j = 0; j < NUM_TOKENS; j++) {
+                fprintf(Out, "%s\"%s\": %d", j > 0 ? ", " : "", LexTokenStats[j].name, stats->TokenCounts[j][i]);
+            }
+            fputc('}', Out);
+        }
+        fprintf(Out, "\n    }");
+        Separator = ",";
+    }
+
+    /* 0x4 */
+    if (Reports & STATS_REPORT(0x4)) {
+        fprintf(Out, "%s\n    \"function_parameter_counts\": ", Separator);
+        stats_json_counts(Out, stats->FunctionParameterCounts, PARAMETER_MAX + 1);
+        Separator = ",";
+    }
+
+    /* 0x5 */
+    if (Reports & STATS_REPORT(0x5)) {
+        fprintf(Out, "%s\n    \"function_call_parameter_counts\": ", Separator);
+        stats_json_counts(Out, stats->FunctionParameterDynamicCounts, PARAMETER_MAX + 1);
+        Separator = ",";
+    }
+
+    /* 0x6 */
+    if (Reports & STATS_REPORT(0x6)) {
+        fprintf(Out, "%s\n    \"max_depths\": {\"function_call\": %u, \"loop\": %u, \"conditional\": %u, "
+                "\"expression\": %u, \"stack_frames\": %u}", Separator, stats->FunctionCallMaxDepth,
+                stats->LoopMaxDepth, stats->ConditionalMaxDepth, stats->ExpressionMaxDepth, stats->StackFramesMaxDepth);
+        Separator = ",";
+    }
+
+    /* 0x7 and 0x8 */
+    if (Reports & (STATS_REPORT(0x7) | STATS_REPORT(0x8))) {
+        fprintf(Out, "%s\n    \"assignments\": {", Separator);
+        for (int i = 0; i < NUM_TYPES; i++) {
+            fprintf(Out, "%s\"%s\": %d", i > 0 ? ", " : "", TypeStats[i].name, stats->TypeAssignments[i]);
+        }
+        fputc('}', Out);
+        Separator = ",";
+    }
+
+    /* 0x9 and 0xe */
+    if (Reports & (STATS_REPORT(0x9) | STATS_REPORT(0xe))) {
+        int First = true;
+
+        fprintf(Out, "%s\n    \"expressions\": {\n      \"total\": %u,\n      \"max_depth\": %u,\n      \"counts\": [",
+                Separator, stats->TotalExpressions, stats->ExpressionMaxDepth);
+        for (int Type = 0; Type < NUM_EXPRESSION_TYPES; Type++) {
+            for (int Op = 0; Op < NUM_OPERATORS; Op++) {
+                for (int TopType = 0; TopType < NUM_BASE_TYPES; TopType++) {
+                    for (int BottomType = 0; BottomType < NUM_BASE_TYPES; BottomType++) {
+                        unsigned int count = stats->ExpressionCounts[Type][Op][TopType][BottomType];
+                        union ExpressionHash Hash = {.Components = {Type, Op, TopType, BottomType}};
+
+                        if (count == 0)
+                            continue;
+
+                        fprintf(Out, "%s\n        {\"hash\": %u, \"count\": %u, \"expression\": ",
+                                First ? "" : ",", Hash.Hash, count);
+                        stats_json_expression(Out, Hash);
+                        fputc('}', Out);
+                        First = false;
+                    }
+                }
+            }
+        }
+        fprintf(Out, "\n      ]\n    }");
+        Separator = ",";
+    }
+
+    /* 0xa */
+    if (Reports & STATS_REPORT(0xa)) {
+        int First = true;
+
+        fprintf(Out, "%s\n    \"expression_list\": [", Separator);
+        for (struct ExpressionChainListNode *Chain = stats->ExpressionChainListHead; Chain != NULL; Chain = Chain->Next) {
+            if (Chain->ExpressionChainHead == NULL)
+                continue;
+
+            fprintf(Out, "%s\n      {\"file\": ", First ? "" : ",");
+            stats_json_string(Out, Chain->Coordinate.FileName);
+            fprintf(Out, ", \"line\": %d, \"column\": %d, \"expressions\": [", Chain->Coordinate.Line, Chain->Coordinate.Column);
+            for (struct ExpressionChainNode *Node = Chain->ExpressionChainHead; Node != NULL; Node = Node->Next) {
+                union ExpressionHash Hash = {.Components = {Node->Expression.Type, Node->Expression.Op,
+                                                            Node->Expression.TopType, Node->Expression.BottomType}};
+                if (Node != Chain->ExpressionChainHead)
+                    fprintf(Out, ", ");
+                stats_json_expression(Out, Hash);
+            }
+            fprintf(Out, "]}");
+            First = false;
+        }
+        fprintf(Out, "\n    ]");
+        Separator = ",";
+    }
+
+    /* 0xb */
+    if (Reports & STATS_REPORT(0xb)) {
+        int First = true;
+
+        fprintf(Out, "%s\n    \"expression_chains\": {\n      \"total_expressions\": %u,\n      \"total_chains\": %u,\n"
+                "      \"max_depth\": %u,\n      \"chains\": [", Separator, stats->TotalExpressions,
+                stats->TotalExpressionChains, stats->ExpressionMaxDepth);
+        stats->ExpressionChainStackTop = 0;
+        for (struct ExpressionChainItem *Branch = stats->ExpressionChainsRoot.Branches; Branch != NULL;
+                Branch = Branch->NextBranch) {
+            stats_json_chains(Out, stats, Branch, &First);
+        }
+        fprintf(Out, "\n      ]\n    }");
+        Separator = ",";
+    }
+
+    /* 0xc and 0xd */
+    if (Reports & (STATS_REPORT(0xc) | STATS_REPORT(0xd))) {
+        struct HeapSite **Sites = stats_heap_sites(stats, stats_compare_heap_sites);
+        struct FrameFunction **Functions = stats_frame_functions(stats);
+        int NumSizes = HEAP_SIZE_BUCKETS;
+        int NumDepths = STACK_DEPTH_BUCKETS;
+
+        fprintf(Out, "%s\n    \"memory\": {\"max_stack_frames\": %u, \"max_stack_frame_size\": %u, "
+                "\"max_cumulative_stack_frame_size\": %u, \"globals\": %u, \"globals_size\": %u,", Separator,
+                stats->StackFramesMaxDepth, stats->MaxStackFrameTotalAllocation,
+                stats->MaxCumulativeTotalAllocation, stats->GlobalsCount, stats->GlobalsSize);
+
+        /* the depths are counts for 1 and then each power of two after it */
+        while (NumDepths > 1 && stats->StackFrameDepths[NumDepths - 1] == 0)
+            NumDepths--;
+        fprintf(Out, "\n      \"stack_frame_depths\": [");
+        for (int i = 0; i < NumDepths; i++) {
+            fprintf(Out, "%s%llu", i > 0 ? ", " : "", stats->StackFrameDepths[i]);
+        }
+        fprintf(Out, "],\n      \"stack_frames\": [");
+        for (unsigned int i = 0; i < stats->NumFrameFunctions; i++) {
+            fprintf(Out, "%s\n        {\"function\": ", i > 0 ? "," : "");
+            stats_json_string(Out, Functions[i]->FuncName);
+            fprintf(Out, ", \"frames\": %llu, \"largest_frame_size\": %u}", Functions[i]->Frames,
+                    Functions[i]->PeakFrameSize);
+        }
+        fprintf(Out, "%s],", stats->NumFrameFunctions > 0 ? "\n      " : "");
+        free(Functions);
+
+        /* the sizes are counts for 0 bytes and then each power of two */
+        while (NumSizes > 1 && stats->HeapSizes[NumSizes - 1] == 0)
+            NumSizes--;
+        fprintf(Out, "\n      \"heap\": {\"allocations\": %llu, \"reallocations\": %llu, \"frees\": %llu, "
+                "\"failures\": %llu, \"bytes\": %llu, \"peak_live_bytes\": %llu, \"live_bytes\": %llu, "
+                "\"live_blocks\": %u, \"sizes\": [", stats->HeapAllocations, stats->HeapReallocations,
+                stats->HeapFrees, stats->HeapFailures, stats->HeapBytes, stats->HeapPeakLiveBytes,
+                stats->HeapLiveBytes, stats->HeapLiveBlocks);
+        for (int i = 0; i < NumSizes; i++) {
+            fprintf(Out, "%s%llu", i > 0 ? ", " : "", stats->HeapSizes[i]);
+        }
+        fprintf(Out, "], \"sites\": [");
+        for (unsigned int i = 0; i < stats->NumHeapSites; i++) {
+            fprintf(Out, "%s\n        {\"file\": ", i > 0 ? "," : "");
+            stats_json_string(Out, Sites[i]->FileName);
+            fprintf(Out, ", \"line\": %d, \"function\": ", Sites[i]->Line);
+            stats_json_string(Out, Sites[i]->FuncName);
+            fprintf(Out, ", \"allocations\": %llu, \"bytes\": %llu, \"peak_live_bytes\": %llu, "
+                    "\"live_bytes\": %llu, \"live_blocks\": %u}", Sites[i]->Allocations, Sites[i]->Bytes,
+                    Sites[i]->PeakLiveBytes, Sites[i]->LiveBytes, Sites[i]->LiveBlocks);
+        }
+        fprintf(Out, "%s]}}", stats->NumHeapSites > 0 ? "\n      " : "");
+        free(Sites);
+        Separator = ",";
+    }
+
+    /* 0xf */
+    if (Reports & STATS_REPORT(0xf)) {
+        int NumNgrams;
+        struct ExpressionNgram **Ngrams = stats_top_ngrams(stats, STATS_NGRAMS_TOP, &NumNgrams);
+
+        fprintf(Out, "%s\n    \"expression_ngrams\": [", Separator);
+        for (int i = 0; i < NumNgrams; i++) {
+            fprintf(Out, "%s\n      {\"count\": %u, \"hashes\": [", i > 0 ? "," : "", Ngrams[i]->Count);
+            for (unsigned int j = 0; j < Ngrams[i]->Length; j++) {
+                fprintf(Out, "%s%u", j > 0 ? ", " : "", Ngrams[i]->Hashes[j].Hash);
+            }
+            fprintf(Out, "], \"expressions\": [");
+            for (unsigned int j = 0; j < Ngrams[i]->Length; j++) {
+                if (j > 0)
+                    fprintf(Out, ", ");
+                stats_json_expression(Out, Ngrams[i]->Hashes[j]);
+            }
+            fprintf(Out, "], \"file\": ");
+            stats_json_string(Out, Ngrams[i]->Coordinate.FileName);
+            fprintf(Out, ", \"line\": %d}", Ngrams[i]->Coordinate.Line);
+        }
+        fprintf(Out, "\n    ]");
+        free(Ngrams);
+    }
+
+    fprintf(Out, "\n  }\n}\n");
 }
@@ -28,39 +28,170 @@ enum ExpressionType {
     ExpressionReturn
 };
 
-void stats_log_statement(enum LexToken token, struct ParseState *parser);
-void stats_log_expression_token_parse(enum LexToken token, struct ParseState *parser);
-void stats_log_function_definition(int parameterCount, struct ParseState *parser);
-void stats_log_function_entry(struct ParseState *parser, int argCount);
-void stats_log_function_exit(struct ParseState *parser);
-void stats_log_loop_entry(struct ParseState *parser);
-void stats_log_loop_exit(struct ParseState *parser);
-void stats_log_conditional_entry(struct ParseState *parser, int condition);
-void stats_log_conditional_exit(struct ParseState *parser, int condition);
-void stats_log_assignment(struct ParseState *parser, int type);
-void stats_log_expression_parse(struct ParseState *Parser);
-void stats_log_expression_stack_collapse(struct ParseState *parser);
-void stats_log_expression_evaluation(struct ParseState *parser, enum ExpressionType Type, enum LexToken Op, struct Value *BottomValue, struct Value *TopValue);
-void stats_log_stack_frame_add(struct ParseState *parser, const char *funcName);
-void stats_log_stack_frame_pop(struct ParseState *parser);
-void stats_log_stack_allocation(struct ParseState *parser, int Size);
-void stats_log_stack_pop(struct ParseState *parser, struct Value *Var);
-void stats_log_variable_definition(struct ParseState *parser, char *Ident, struct ValueType *Typ, int IsGlobal);
-void stats_print_tokens(int all);
-void stats_print_tokens_csv(void);
-void stats_print_tokens_csv_runmode(enum RunMode runMode);
+/* an expression's type, operator and operand types packed into a number,
+    as the expression reports and n-gram files have them */
+union ExpressionHash {
+    uint32_t Hash;
+    struct {
+        uint8_t Type;
+        uint8_t Op;
+        uint8_t TopType;
+        uint8_t BottomType;
+    } Components;
+};
+
+/* what a parser collects stats for, worked out once when it's set up so the
+    hooks below are a test of a flag. the "startup" code that calls main()
+    only counts towards the structural stats, not the ones about the
+    program's expressions and memory. the cost profile and the trace in
+    profile.c use some of the same hooks */
+#define STATS_PARSER_ANY 0x1
+#define STATS_PARSER_PROGRAM 0x2
+#define STATS_PARSER_PROFILE 0x4
+
+#define STATS_ANY(parser) ((parser)->Stats & STATS_PARSER_ANY)
+#define STATS_PROGRAM(parser) ((parser)->Stats & STATS_PARSER_PROGRAM)
+#define STATS_RUNNING(parser) (STATS_PROGRAM(parser) && (parser)->Mode == RunModeRun)
+#define STATS_PROFILE(parser) ((parser)->Stats & STATS_PARSER_PROFILE)
+
+#ifdef NO_STATS
+#define STATS_HOOK(test, call) do { } while (0)
+#define STATS_PROFILE_HOOK(test, call, parser, profile) do { } while (0)
+#else
+#define STATS_HOOK(test, call) do { if (test) call; } while (0)
+#define STATS_PROFILE_HOOK(test, call, parser, profile) \
+    do { \
+        if ((parser)->Stats != 0) { \
+            if (test) \
+                call; \
+            if (STATS_PROFILE(parser)) \
+                profile; \
+        } \
+    } while (0)
+#endif
+
+#define stats_log_statement(token, parser) \
+    STATS_PROFILE_HOOK(STATS_ANY(parser), stats_record_statement(token, parser), \
+        parser, ProfileCostStatement(parser))
+#define stats_log_token_fetch(parser) \
+    STATS_HOOK(STATS_PROFILE(parser), ProfileCostToken(parser))
+#define stats_log_expression_token_parse(token, parser) \
+    STATS_HOOK(STATS_ANY(parser), stats_record_expression_token_parse(token, parser))
+#define stats_log_function_definition(parameterCount, parser) \
+    STATS_HOOK(STATS_ANY(parser), stats_record_function_definition(parameterCount, parser))
+#define stats_log_function_entry(parser, funcName, argCount) \
+    STATS_PROFILE_HOOK(STATS_ANY(parser), stats_record_function_entry(parser, argCount), \
+        parser, (ProfileCostEntry(parser, funcName), ProfileTraceCall(parser, funcName)))
+#define stats_log_function_exit(parser) \
+    STATS_PROFILE_HOOK(STATS_ANY(parser), stats_record_function_exit(parser), \
+        parser, (ProfileCostExit(parser), ProfileTraceEnd(parser)))
+#define stats_log_loop_entry(parser) \
+    STATS_HOOK(STATS_ANY(parser), stats_record_loop_entry(parser))
+#define stats_log_loop_exit(parser) \
+    STATS_HOOK(STATS_ANY(parser), stats_record_loop_exit(parser))
+#define stats_log_loop_begin(parser, kind, line) \
+    STATS_HOOK(STATS_PROFILE(parser), ProfileTraceLoop(parser, kind, line))
+#define stats_log_loop_end(parser) \
+    STATS_HOOK(STATS_PROFILE(parser), ProfileTraceEnd(parser))
+#define stats_log_conditional_entry(parser, condition) \
+    STATS_HOOK(STATS_ANY(parser), stats_record_conditional_entry(parser, condition))
+#define stats_log_conditional_exit(parser, condition) \
+    STATS_HOOK(STATS_ANY(parser), stats_record_conditional_exit(parser, condition))
+#define stats_log_assignment(parser, type) \
+    STATS_HOOK(STATS_PROGRAM(parser), stats_record_assignment(parser, type))
+#define stats_log_expression_parse(parser) \
+    STATS_HOOK(STATS_RUNNING(parser), stats_record_expression_parse(parser))
+#define stats_log_expression_stack_collapse(parser) \
+    STATS_HOOK(STATS_RUNNING(parser), stats_record_expression_stack_collapse(parser))
+#define stats_log_expression_evaluation(parser, Type, Op, BottomValue, TopValue) \
+    STATS_PROFILE_HOOK(STATS_RUNNING(parser), stats_record_expression_evaluation(parser, Type, Op, BottomValue, TopValue), \
+        parser, (parser)->Mode == RunModeRun ? ProfileCostAdd(parser, CostExpressions, 1) : (void)0)
+#define stats_log_stack_frame_add(parser, funcName) \
+    STATS_HOOK(STATS_ANY(parser), stats_record_stack_frame_add(parser, funcName))
+#define stats_log_stack_frame_pop(parser) \
+    STATS_HOOK(STATS_ANY(parser), stats_record_stack_frame_pop(parser))
+#define stats_log_stack_allocation(parser, Size) \
+    STATS_PROFILE_HOOK(STATS_RUNNING(parser), stats_record_stack_allocation(parser, Size), \
+        parser, (parser)->Mode == RunModeRun ? ProfileCostAdd(parser, CostStackBytes, Size) : (void)0)
+#define stats_log_stack_pop(parser, Var) \
+    STATS_HOOK(STATS_RUNNING(parser), stats_record_stack_pop(parser, Var))
+#define stats_log_heap_allocation(parser, Old, New, Size) \
+    STATS_HOOK(STATS_PROGRAM(parser), stats_record_heap_allocation(parser, Old, New, Size))
+#define stats_log_heap_free(parser, Pointer) \
+    STATS_HOOK(STATS_PROGRAM(parser), stats_record_heap_free(parser, Pointer))
+#define stats_log_heap_release(pc, Pointer) \
+    STATS_HOOK((pc)->Stats != NULL, stats_record_heap_release(pc, Pointer))
+#define stats_log_variable_definition(parser, Ident, Typ, IsGlobal) \
+    STATS_HOOK((parser) != NULL && STATS_ANY(parser), stats_record_variable_definition(parser, Ident, Typ, IsGlobal))
+
+int stats_parser_flags(Picoc *pc, const char *FileName);
+void stats_record_statement(enum LexToken token, struct ParseState *parser);
+void stats_record_expression_token_parse(enum LexToken token, struct ParseState *parser);
+void stats_record_function_definition(int parameterCount, struct ParseState *parser);
+void stats_record_function_entry(struct ParseState *parser, int argCount);
+void stats_record_function_exit(struct ParseState *parser);
+void stats_record_loop_entry(struct ParseState *parser);
+void stats_record_loop_exit(struct ParseState *parser);
+void stats_record_conditional_entry(struct ParseState *parser, int condition);
+void stats_record_conditional_exit(struct ParseState *parser, int condition);
+void stats_record_assignment(struct ParseState *parser, int type);
+void stats_record_expression_parse(struct ParseState *Parser);
+void stats_record_expression_stack_collapse(struct ParseState *parser);
+void stats_record_expression_evaluation(struct ParseState *parser, enum ExpressionType Type, enum LexToken Op, struct Value *BottomValue, struct Value *TopValue);
+void stats_record_stack_frame_add(struct ParseState *parser, const char *funcName);
+void stats_record_stack_frame_pop(struct ParseState *parser);
+void stats_record_stack_allocation(struct ParseState *parser, int Size);
+void stats_record_stack_pop(struct ParseState *parser, struct Value *Var);
+void stats_record_variable_definition(struct ParseState *parser, char *Ident, struct ValueType *Typ, int IsGlobal);
+void stats_record_heap_allocation(struct ParseState *parser, void *Old, void *New, size_t Size);
+void stats_record_heap_free(struct ParseState *parser, void *Pointer);
+void stats_record_heap_release(Picoc *pc, void *Pointer);
+void stats_print_tokens(Picoc *pc, int all);
+void stats_print_tokens_csv(Picoc *pc);
+void stats_print_tokens_csv_runmode(Picoc *pc, enum RunMode runMode);
 void stats_print_runmode_list(void);
 void stats_print_token_list(void);
-void stats_print_function_parameter_counts(bool dynamic);
-void stats_print_max_depths(void);
+void stats_print_function_parameter_counts(Picoc *pc, bool dynamic);
+void stats_print_max_depths(Picoc *pc);
 void stats_print_types_list(void);
-void stats_print_assignments(void);
-void stats_print_assignments_csv(void);
-void stats_print_expressions_summary(void);
-void stats_print_expressions_summary_csv(void);
-void stats_print_expression_chains_summary(void);
-void stats_print_expression_chains(void);
-void stats_print_memory_info(void);
-void stats_print_memory_info_csv(void);
+void stats_print_assignments(Picoc *pc);
+void stats_print_assignments_csv(Picoc *pc);
+void stats_print_expressions_summary(Picoc *pc);
+void stats_print_expressions_summary_csv(Picoc *pc);
+void stats_print_expression_chains_summary(Picoc *pc);
+void stats_print_expression_chains(Picoc *pc);
+void stats_print_memory_info(Picoc *pc);
+void stats_print_memory_info_csv(Picoc *pc);
+void stats_print_heap_leaks(Picoc *pc, FILE *Out);
+void stats_print_expression_ngrams(Picoc *pc);
+void stats_reset(Picoc *pc);
+void stats_cleanup(Picoc *pc);
+
+/* picoc -g writes the most common runs of 2 to 4 expressions evaluated one
+    after another to a file which PicocLoadExpressionFusions() reads. the
+    version goes up whenever the file's layout changes */
+#define STATS_NGRAMS_VERSION 1
+#define STATS_NGRAM_MIN 2
+#define STATS_NGRAM_MAX 4
+#define STATS_NGRAMS_TOP 32     /* how many of each length are written */
+
+void stats_write_expression_ngrams(Picoc *pc, FILE *Out, int Top);
+
+/* picoc -x streams the full expression chains to a file as they're
+    evaluated, and picoc -X prints one. the version goes up whenever the
+    file's layout changes */
+#define STATS_CHAINS_VERSION 1
+
+int stats_stream_expression_chains(Picoc *pc, const char *FileName);
+int stats_close_expression_chains(Picoc *pc);
+int stats_print_expression_chains_file(const char *FileName);
+
+/* picoc -j writes the reports for a set of -d types to one JSON file. the
+    version goes up whenever the file's layout changes */
+#define STATS_JSON_VERSION 1
+#define STATS_REPORT(type) (1 << (type))
+#define STATS_REPORTS_DEFAULT (0xffff & ~STATS_REPORT(0xa))
+
+void stats_write_json(Picoc *pc, FILE *Out, int Reports, char **Files, int NumFiles, int ExitValue);
 
 #endif //PICOC_STATS_H
@@ -129,6 +129,33 @@ struct Value *TableDelete(Picoc *pc, struct Table *Tbl, const char *Key)
     return NULL;
 }
 
+/* re-hash a table of values after its keys have moved, eg. when an
+    image is loaded at a different address */
+void TableRehash(struct Table *Tbl)
+{
+    int Count;
+    int HashValue;
+    struct TableEntry *Entry;
+    struct TableEntry *NextEntry;
+    struct TableEntry *AllEntries = NULL;
+
+    for (Count = 0; Count < Tbl->Size; Count++) {
+        for (Entry = Tbl->HashTable[Count]; Entry != NULL; Entry = NextEntry) {
+            NextEntry = Entry->Next;
+            Entry->Next = AllEntries;
+            AllEntries = Entry;
+        }
+        Tbl->HashTable[Count] = NULL;
+    }
+
+    for (Entry = AllEntries; Entry != NULL; Entry = NextEntry) {
+        NextEntry = Entry->Next;
+        HashValue = ((unsigned long)Entry->p.v.Key) % Tbl->Size;
+        Entry->Next = Tbl->HashTable[HashValue];
+        Tbl->HashTable[HashValue] = Entry;
+    }
+}
+
 /* check a hash table entry for an identifier */
 struct TableEntry *TableSearchIdentifier(struct Table *Tbl,
     const char *Key, int Len, int *AddAt)
@@ -176,7 +203,12 @@ char *TableSetIdentifier(Picoc *pc, struct Table *Tbl, const char *Ident,
 /* register a string in the shared string store */
 char *TableStrRegister2(Picoc *pc, const char *Str, int Len)
 {
-    return TableSetIdentifier(pc, &pc->StringTable, Str, Len);
+    char *Registered;
+
+    ThreadLock(pc);
+    Registered = TableSetIdentifier(pc, &pc->StringTable, Str, Len);
+    ThreadUnlock(pc);
+    return Registered;
 }
 
 char *TableStrRegister(Picoc *pc, const char *Str)
@@ -0,0 +1,169 @@
+/* picoc tasks - running a program a slice at a time. the program runs on a
+ * stack of its own, provided by the platform, so when its slice is up it
+ * can hand back to the host in the middle of whatever it's doing and carry
+ * on from there the next time it's run. a slice is a number of statements,
+ * a length of time or both, so a host can share a few threads fairly
+ * between lots of long-running programs or stop a runaway one.
+ *
+ * each instance can have one task at a time. its exit point is separate
+ * from the host's, so errors and exit() in the program end the task rather
+ * than jumping back into the host */
+#include "picoc.h"
+#include "interpreter.h"
+
+#define TASK_CLOCK_STATEMENTS (1000)    /* how often to look at the clock */
+
+struct PicocTask {
+    void *Context;              /* the platform's stack and saved registers */
+    void (*Body)(Picoc *pc, void *Arg);
+    void *Arg;
+    int Started;
+    int Running;
+    int Finished;
+    long StatementsLeft;        /* in this slice, or 0 for no limit */
+    long Countdown;             /* what the countdown was last set to */
+    unsigned long SliceStart;   /* in microseconds */
+    unsigned long SliceTime;    /* in microseconds, or 0 for no limit */
+    jmp_buf HostExitBuf;
+    jmp_buf TaskExitBuf;
+};
+
+
+/* count down to the end of the slice, or to the next look at the clock */
+static void TaskSetCountdown(Picoc *pc, struct PicocTask *Task)
+{
+    long Countdown = Task->StatementsLeft;
+
+    if (Task->SliceTime != 0 &&
+            (Countdown == 0 || Countdown > TASK_CLOCK_STATEMENTS))
+        Countdown = TASK_CLOCK_STATEMENTS;
+
+    Task->Countdown = Countdown;
+    pc->MainThread.TaskCountdown = Countdown;
+}
+
+/* the task's stack starts here. it never returns, since there's nothing
+    to return to - it just hands back to the host for the last time */
+static void TaskMain(Picoc *pc)
+{
+    struct PicocTask *Task = pc->Task;
+
+    if (PicocPlatformSetExitPoint(pc) == 0)
+        Task->Body(pc, Task->Arg);
+
+    Task->Finished = true;
+    PicocTaskYield(pc);
+}
+
+/* set up a task which will run Body(pc, Arg) on a stack of StackSize
+    bytes. nothing runs until PicocTaskRun(). returns false if the instance
+    already has a task or there's no memory for the stack */
+int PicocTaskStart(Picoc *pc, void (*Body)(Picoc *pc, void *Arg), void *Arg,
+    int StackSize)
+{
+    struct PicocTask *Task;
+
+    if (pc->Task != NULL)
+        return false;
+
+    Task = calloc(1, sizeof(struct PicocTask));
+    if (Task == NULL)
+        return false;
+
+    Task->Context = PlatformTaskCreate(pc, TaskMain, StackSize);
+    if (Task->Context == NULL) {
+        free(Task);
+        return false;
+    }
+
+    Task->Body = Body;
+    Task->Arg = Arg;
+    pc->Task = Task;
+    return true;
+}
+
+/* run the task until it finishes, it's run Statements statements or it's
+    run for Microseconds, whichever comes first. 0 means no limit. returns
+    true once the task has finished, false if there's more to run */
+int PicocTaskRun(Picoc *pc, long Statements, long Microseconds)
+{
+    struct PicocTask *Task = pc->Task;
+
+    if (Task == NULL || Task->Finished)
+        return true;
+
+    Task->StatementsLeft = Statements > 0 ? Statements : 0;
+    Task->SliceTime = Microseconds > 0 ? Microseconds : 0;
+    if (Task->SliceTime != 0)
+        Task->SliceStart = PlatformMicroseconds();
+
+    TaskSetCountdown(pc, Task);
+
+    /* swap the host's exit point for the task's while it runs */
+    memcpy(Task->HostExitBuf, pc->PicocExitBuf, sizeof(jmp_buf));
+    if (Task->Started)
+        memcpy(pc->PicocExitBuf, Task->TaskExitBuf, sizeof(jmp_buf));
+
+    Task->Started = true;
+    Task->Running = true;
+    PlatformTaskEnter(Task->Context);
+    Task->Running = false;
+
+    memcpy(Task->TaskExitBuf, pc->PicocExitBuf, sizeof(jmp_buf));
+    memcpy(pc->PicocExitBuf, Task->HostExitBuf, sizeof(jmp_buf));
+    pc->MainThread.TaskCountdown = 0;
+
+    return Task->Finished;
+}
+
+/* hand back to the host from inside the task, carrying on from here the
+    next time it's run. native library functions can call this while
+    they're waiting for something. it does nothing outside a task */
+void PicocTaskYield(Picoc *pc)
+{
+    struct PicocTask *Task = pc->Task;
+
+    if (Task == NULL || !Task->Running)
+        return;
+
+    pc->MainThread.TaskCountdown = 0;
+    PlatformTaskLeave(Task->Context);
+}
+
+/* throw the task away, whether or not it's finished. an unfinished task
+    leaves the instance part way through running something, so it has to
+    be reset or cleaned up before it's used again */
+void PicocTaskEnd(Picoc *pc)
+{
+    struct PicocTask *Task = pc->Task;
+
+    if (Task == NULL)
+        return;
+
+    PlatformTaskFree(Task->Context);
+    free(Task);
+    pc->Task = NULL;
+    pc->MainThread.TaskCountdown = 0;
+}
+
+/* called by ParseStatement() when pc->TaskCountdown runs out */
+void TaskCountdownExpired(Picoc *pc)
+{
+    struct PicocTask *Task = pc->Task;
+
+    if (Task->StatementsLeft != 0) {
+        Task->StatementsLeft -= Task->Countdown;
+        if (Task->StatementsLeft == 0) {
+            PicocTaskYield(pc);
+            return;
+        }
+    }
+
+    if (Task->SliceTime != 0 &&
+            PlatformMicroseconds() - Task->SliceStart >= Task->SliceTime) {
+        PicocTaskYield(pc);
+        return;
+    }
+
+    TaskSetCountdown(pc, Task);
+}
@@ -0,0 +1,52 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <math.h>
+#if 0
+#include <time.h>
+#endif
+
+#define MY_EOF EOF
+#define BUFSIZ 42
+
+int main()
+{
+    int Count;
+    int Total = 0;
+    bool Done = false;
+    int CLOCKS_PER_SEC = 7;     /* time.h wasn't included */
+
+    printf("%d %d\n", EOF, MY_EOF);
+    printf("%d %d %d\n", SEEK_SET, SEEK_CUR, SEEK_END);
+    printf("%d %d\n", true, false);
+    printf("%d\n", NULL == 0);
+    printf("%d\n", ERANGE > 0);
+    printf("%.5f\n", M_PI);
+    printf("%d\n", sizeof(EOF) == sizeof(int));
+    printf("%d\n", BUFSIZ);
+
+#ifdef EOF
+    printf("EOF is defined\n");
+#endif
+#ifndef SEEK_SET
+    printf("SEEK_SET isn't defined\n");
+#endif
+#ifdef CLOCKS_PER_SEC
+    printf("CLOCKS_PER_SEC is defined\n");
+#endif
+    printf("%d\n", CLOCKS_PER_SEC);
+
+    for (Count = 0; !Done; Count++) {
+        switch (Count == 10 ? EOF : Count) {
+        case EOF:
+            Done = true;
+            break;
+        default:
+            Total += Count;
+            break;
+        }
+    }
+    printf("%d\n", Total);
+
+    return 0;
+}
@@ -0,0 +1,49 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+/* this is saved to an image with picoc -w and then run with picoc -l, so
+    everything set up here has to survive being reloaded */
+struct Point
+{
+    int x;
+    int y;
+};
+
+struct Point Origin;
+char *Greeting = "hello";
+char Buffer[32];
+int Table[4] = { 1, 2, 3, 4 };
+int *TablePtr = &Table[2];
+struct Point *OriginPtr = &Origin;
+
+void setup()
+{
+    Origin.x = 3;
+    Origin.y = 4;
+    strcpy(Buffer, Greeting);
+}
+
+setup();
+
+int scale(int a)
+{
+    return a * OriginPtr->x + *TablePtr;
+}
+
+int main()
+{
+    struct Point p;
+
+    p.x = Origin.y;
+    p.y = scale(2);
+    printf("%s %s\n", Greeting, Buffer);
+    printf("%d %d\n", p.x, p.y);
+    printf("%d\n", Table[3] + TablePtr[-2]);
+
+    errno = 0;
+    printf("%d\n", errno);
+    strcat(Buffer, " again");
+    printf("%s\n", Buffer);
+    return 0;
+}
@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <pthread.h>
+
+#define NUM_THREADS 4
+#define PER_THREAD 2500
+
+int Numbers[NUM_THREADS * PER_THREAD];
+int Partial[NUM_THREADS];
+int Starts[NUM_THREADS];
+int Total = 0;
+int Counted = 0;
+pthread_mutex_t Lock;
+
+void *SumPart(void *Arg)
+{
+    int Start = *(int *)Arg;
+    int Count;
+    int Sum = 0;
+
+    for (Count = Start; Count < Start + PER_THREAD; Count++)
+    {
+        Sum += Numbers[Count];
+        __sync_fetch_and_add(&Counted, 1);
+    }
+
+    Partial[Start / PER_THREAD] = Sum;
+
+    pthread_mutex_lock(&Lock);
+    Total += Sum;
+    pthread_mutex_unlock(&Lock);
+
+    return Arg;
+}
+
+int main()
+{
+    pthread_t Threads[NUM_THREADS];
+    void *Result;
+    int Count;
+    int Expected = 0;
+
+    for (Count = 0; Count < NUM_THREADS * PER_THREAD; Count++)
+    {
+        Numbers[Count] = Count;
+        Expected += Count;
+    }
+
+    pthread_mutex_init(&Lock, NULL);
+
+    for (Count = 0; Count < NUM_THREADS; Count++)
+    {
+        Starts[Count] = Count * PER_THREAD;
+        if (pthread_create(&Threads[Count], NULL, SumPart, &Starts[Count]) != 0)
+            printf("can't start thread %d\n", Count);
+    }
+
+    for (Count = 0; Count < NUM_THREADS; Count++)
+    {
+        pthread_join(Threads[Count], &Result);
+        printf("thread %d summed from %d: %d\n", Count, *(int *)Result, Partial[Count]);
+    }
+
+    printf("total %d, expected %d\n", Total, Expected);
+    printf("counted %d\n", Counted);
+    printf("main thread %d\n", pthread_self());
+    printf("join again %d\n", pthread_join(Threads[0], NULL) == ESRCH);
+
+    pthread_mutex_destroy(&Lock);
+
+    return 0;
+}
@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <pthread.h>
+
+#define QUEUE_SIZE 4
+#define NUM_ITEMS 200
+#define NUM_CONSUMERS 3
+
+struct Queue
+{
+    int Items[QUEUE_SIZE];
+    int Head;
+    int Tail;
+    int Count;
+    pthread_mutex_t Lock;
+    pthread_cond_t NotEmpty;
+    pthread_cond_t NotFull;
+};
+
+struct Queue Q;
+int Consumed[NUM_CONSUMERS];
+int Ids[NUM_CONSUMERS];
+
+void Put(int Item)
+{
+    pthread_mutex_lock(&Q.Lock);
+    while (Q.Count == QUEUE_SIZE)
+        pthread_cond_wait(&Q.NotFull, &Q.Lock);
+
+    Q.Items[Q.Tail] = Item;
+    Q.Tail = (Q.Tail + 1) % QUEUE_SIZE;
+    Q.Count++;
+    pthread_cond_signal(&Q.NotEmpty);
+    pthread_mutex_unlock(&Q.Lock);
+}
+
+int Get()
+{
+    int Item;
+
+    pthread_mutex_lock(&Q.Lock);
+    while (Q.Count == 0)
+        pthread_cond_wait(&Q.NotEmpty, &Q.Lock);
+
+    Item = Q.Items[Q.Head];
+    Q.Head = (Q.Head + 1) % QUEUE_SIZE;
+    Q.Count--;
+    pthread_cond_signal(&Q.NotFull);
+    pthread_mutex_unlock(&Q.Lock);
+
+    return Item;
+}
+
+void *Producer(void *Arg)
+{
+    int Count;
+
+    for (Count = 1; Count <= NUM_ITEMS; Count++)
+        Put(Count);
+
+    /* one stop marker for each consumer */
+    for (Count = 0; Count < NUM_CONSUMERS; Count++)
+        Put(0);
+
+    return NULL;
+}
+
+void *Consumer(void *Arg)
+{
+    int Id = *(int *)Arg;
+    int Item;
+
+    while ((Item = Get()) != 0)
+        Consumed[Id] += Item;
+
+    pthread_exit(Arg);
+    printf("not reached\n");
+    return NULL;
+}
+
+int main()
+{
+    pthread_t ProducerThread;
+    pthread_t ConsumerThreads[NUM_CONSUMERS];
+    void *Result;
+    int Count;
+    int Total = 0;
+
+    for (Count = 0; Count < NUM_CONSUMERS; Count++)
+    {
+        Ids[Count] = Count;
+        pthread_create(&ConsumerThreads[Count], NULL, Consumer, &Ids[Count]);
+    }
+
+    pthread_create(&ProducerThread, NULL, Producer, NULL);
+    pthread_join(ProducerThread, &Result);
+    printf("producer returned %d\n", Result == NULL);
+
+    for (Count = 0; Count < NUM_CONSUMERS; Count++)
+    {
+        pthread_join(ConsumerThreads[Count], &Result);
+        printf("consumer %d finished %d\n", Count, *(int *)Result == Count);
+        Total += Consumed[Count];
+    }
+
+    printf("consumed %d, queue has %d\n", Total, Q.Count);
+
+    return 0;
+}
@@ -0,0 +1,44 @@
+#include <stdio.h>
+
+int Squares[100];
+
+int main()
+{
+    int i;
+    int Sum = 0;
+    double Total = 0.5;
+    int Scale = 3;
+
+#pragma picoc parallel for num_threads(4) reduction(+:Sum, Total)
+    for (i = 0; i < 100; i++)
+    {
+        int Square = i * i;
+
+        Squares[i] = Square * Scale;
+        Sum += i;
+        Total += 0.25;
+        if (i % 2)
+            continue;
+        Sum += 1000;
+    }
+
+    printf("i = %d\n", i);
+    printf("Sum = %d\n", Sum);
+    printf("Total = %f\n", Total);
+    printf("Squares[7] = %d, Squares[99] = %d\n", Squares[7], Squares[99]);
+
+#pragma picoc parallel for reduction(+:Sum)
+    for (i = 5; i <= 10; ++i)
+        Sum += i;
+
+    printf("i = %d\n", i);
+    printf("Sum = %d\n", Sum);
+
+#pragma picoc parallel for
+    for (i = 3; i < 3; i += 1)
+        printf("never\n");
+
+    printf("i = %d\n", i);
+
+    return 0;
+}
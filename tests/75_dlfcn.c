@@ -0,0 +1,50 @@
+#include <stdio.h>
+#include <dlfcn.h>
+
+struct Point
+{
+    double x;
+    double y;
+    int Weight;
+};
+
+int Count(char *s, char c);
+
+int main()
+{
+    void *Lib = dlopen("./dlfcn/libkernel.so", RTLD_NOW);
+    double a[4] = { 1.0, 2.0, 3.0, 4.0 };
+    double b[4] = { 0.5, 0.5, 2.0, 1.0 };
+    struct Point p;
+
+    if (Lib == NULL)
+    {
+        printf("can't open the library: %s\n", dlerror());
+        return 1;
+    }
+
+    dlbind(Lib, "double Dot(double *a, double *b, int n)");
+    dlbind(Lib, "long Mix(char c, double x, int i, float f, unsigned long u, double y);");
+    dlbind(Lib, "float Half(float f)");
+    dlbind(Lib, "void Scale(struct Point *p, double By)");
+    dlbind(Lib, "char *Name()");
+    dlbind(Lib, "unsigned char Low(unsigned int x)");
+    dlbind(Lib, "int Count(char *s, char c)");
+    printf("missing: %d\n", dlbind(Lib, "int NoSuchFunction(int)"));
+
+    printf("Dot = %f\n", Dot(a, b, 4));
+    printf("Mix = %d\n", (int)Mix(3, 4.5, 5, 0.25, 6, 7.0));
+    printf("Half = %f\n", Half(5.0));
+    p.x = 1.5;
+    p.y = -2.0;
+    p.Weight = 7;
+    Scale(&p, 2.0);
+    printf("Scale = %f, %f, %d\n", p.x, p.y, p.Weight);
+    printf("Name = %s\n", Name());
+    printf("Low = %d\n", Low(0x1234));
+    printf("Count = %d\n", Count("hello world", 'o'));
+    printf("dlsym = %d\n", dlsym(Lib, "Dot") != NULL);
+
+    dlclose(Lib);
+    return 0;
+}
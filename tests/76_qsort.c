@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct Person
+{
+    char Name[8];
+    int Age;
+};
+
+int Compares;
+
+int CompareInt(void *a, void *b)
+{
+    Compares++;
+    return *(int *)a - *(int *)b;
+}
+
+int CompareDown(void *a, void *b)
+{
+    return *(int *)b - *(int *)a;
+}
+
+int CompareCounted(void *a, void *b)
+{
+    static int Calls = 0;
+
+    Calls++;
+    Compares = Calls;
+    return *(int *)a - *(int *)b;
+}
+
+int CompareAge(void *a, void *b)
+{
+    struct Person *x = a;
+    struct Person *y = b;
+    return x->Age - y->Age;
+}
+
+int CompareName(void *a, void *b)
+{
+    struct Person *x = a;
+    struct Person *y = b;
+    return strcmp(x->Name, y->Name);
+}
+
+int Numbers[10] = { 62, 83, 4, 89, 36, 21, 74, 37, 65, 33 };
+struct Person People[4];
+
+void main()
+{
+    int i;
+    int Key;
+    int *Found;
+    struct Person Who;
+    struct Person *Person;
+
+    qsort(Numbers, 10, sizeof(int), CompareInt);
+    for (i = 0; i < 10; i++)
+        printf("%d ", Numbers[i]);
+    printf("\n");
+    printf("%d\n", Compares > 0);
+
+    qsort(Numbers, 10, sizeof(int), CompareDown);
+    for (i = 0; i < 10; i++)
+        printf("%d ", Numbers[i]);
+    printf("\n");
+
+    strcpy(People[0].Name, "fred");
+    People[0].Age = 42;
+    strcpy(People[1].Name, "joe");
+    People[1].Age = 7;
+    strcpy(People[2].Name, "anne");
+    People[2].Age = 25;
+    strcpy(People[3].Name, "mary");
+    People[3].Age = 13;
+
+    qsort(People, 4, sizeof(struct Person), CompareAge);
+    for (i = 0; i < 4; i++)
+        printf("%s %d\n", People[i].Name, People[i].Age);
+
+    qsort(People, 4, sizeof(struct Person), CompareName);
+    strcpy(Who.Name, "joe");
+    Person = bsearch(&Who, People, 4, sizeof(struct Person), CompareName);
+    if (Person != NULL)
+        printf("%s is %d\n", Person->Name, Person->Age);
+
+    strcpy(Who.Name, "bob");
+    Person = bsearch(&Who, People, 4, sizeof(struct Person), CompareName);
+    if (Person == NULL)
+        printf("no bob\n");
+
+    qsort(Numbers, 10, sizeof(int), CompareInt);
+    for (i = 0; i < 10; i++)
+    {
+        Key = Numbers[i];
+        Found = bsearch(&Key, Numbers, 10, sizeof(int), CompareInt);
+        if (Found != &Numbers[i])
+            printf("%d not found\n", Key);
+    }
+
+    Key = 50;
+    Found = bsearch(&Key, Numbers, 10, sizeof(int), CompareInt);
+    if (Found == NULL)
+        printf("no 50\n");
+
+    /* an empty array is fine */
+    Found = bsearch(&Key, Numbers, 0, sizeof(int), CompareInt);
+    if (Found == NULL)
+        printf("empty\n");
+    qsort(Numbers, 0, sizeof(int), CompareInt);
+
+    /* a comparison function's static locals last from one call to the
+        next, whether it's called directly or by qsort() */
+    Key = 50;
+    printf("%d\n", CompareCounted(&Key, &Numbers[0]) > 0);
+    printf("%d\n", Compares);
+    qsort(Numbers, 10, sizeof(int), CompareCounted);
+    printf("%d\n", Compares > 1);
+    CompareCounted(&Key, &Key);
+    qsort(Numbers, 10, sizeof(int), CompareCounted);
+    printf("%d %d\n", Numbers[0], Numbers[9]);
+}
@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <string.h>
+
+char Format[100];
+char Long[200];
+
+void Show(char *Format, int Value)
+{
+    printf(Format, Value);
+}
+
+void main()
+{
+    int i;
+    char Buf[40];
+    long Big = 1234567890123;
+
+    /* the same literal format over and over */
+    for (i = 0; i < 3; i++)
+        printf("%d: %5.2f %s %c%%\n", i, i * 1.5, "text", 'a' + i);
+
+    /* the same literal passed around as a pointer */
+    Show("value %d\n", 1);
+    Show("value %d\n", 2);
+
+    /* a format which changes between calls */
+    strcpy(Format, "first %d\n");
+    for (i = 0; i < 2; i++)
+    {
+        printf(Format, i);
+        strcpy(Format, "second [%3d]\n");
+    }
+
+    /* longs, including ones given an int */
+    printf("%ld %ld %lx %lld\n", Big, -5, 255, Big);
+
+    /* more conversions than fit in a format compiled on the stack */
+    strcpy(Long, "");
+    for (i = 0; i < 30; i++)
+        strcat(Long, "%d,");
+    strcat(Long, "\n");
+    printf(Long, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16,
+        17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29);
+
+    /* missing arguments */
+    printf("%d %d\n", 1);
+
+    /* formatted into strings */
+    for (i = 0; i < 2; i++)
+    {
+        sprintf(Buf, "<%03d|%-4s>", i * 7, "ab");
+        printf("%s %d\n", Buf, snprintf(Buf, 6, "%d%d%d", 123, 456, 789));
+        printf("%s\n", Buf);
+    }
+
+    /* snprintf() returns the length it would have written if it had room */
+    i = snprintf(Buf, 8, "hello %d world", 12345);
+    printf("%d %s\n", i, Buf);
+    i = snprintf(Buf, 4, "abcdefgh");
+    printf("%d %s\n", i, Buf);
+    i = snprintf(Buf, 3, "%c%c%c%c", 'w', 'x', 'y', 'z');
+    printf("%d %s\n", i, Buf);
+}
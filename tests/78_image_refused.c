@@ -0,0 +1,14 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+/* saving this to an image with picoc -w has to fail, since P points to
+    memory from malloc() which a process loading the image won't have */
+int *P = malloc(16);
+*P = 42;
+
+int main()
+{
+    printf("%d\n", *P);
+    free(P);
+    return 0;
+}
@@ -0,0 +1,19 @@
+/* output benchmark - prints lines of a report, 64 bytes each, until there's
+    the given number of megabytes. usage: picoc bench/output.c - [megabytes] */
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(int argc, char **argv)
+{
+    int Lines = 100 * 1024 * 1024 / 64;
+    int i;
+
+    if (argc > 1)
+        Lines = atoi(argv[1]) * 1024 * 1024 / 64;
+
+    for (i = 0; i < Lines; i++)
+        printf("line %11d of the report: value %12.3f, name %s\n", i,
+            i * 0.25, "output");
+
+    return 0;
+}
@@ -0,0 +1,89 @@
+/* sort benchmark - sorts the same pseudo-random ints with qsort() and a
+    comparison function in the program, or with a quicksort written in the
+    program. usage: picoc bench/sort.c - qsort|quicksort [count] */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int *Array;
+
+int Compare(void *a, void *b)
+{
+    return *(int *)a - *(int *)b;
+}
+
+void Swap(int a, int b)
+{
+    int Tmp = Array[a];
+    Array[a] = Array[b];
+    Array[b] = Tmp;
+}
+
+void QuickSort(int Left, int Right)
+{
+    int Index;
+    int Pivot;
+    int i;
+
+    while (Left < Right)
+    {
+        Swap((Left + Right) / 2, Right);
+        Pivot = Array[Right];
+        Index = Left;
+        for (i = Left; i < Right; i++)
+        {
+            if (Array[i] < Pivot)
+            {
+                Swap(i, Index);
+                Index++;
+            }
+        }
+        Swap(Right, Index);
+
+        /* recurse on the smaller half so the stack stays shallow */
+        if (Index - Left < Right - Index)
+        {
+            QuickSort(Left, Index - 1);
+            Left = Index + 1;
+        }
+        else
+        {
+            QuickSort(Index + 1, Right);
+            Right = Index - 1;
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int Count = 1000000;
+    unsigned int Seed = 1;
+    int i;
+
+    if (argc > 2)
+        Count = atoi(argv[2]);
+
+    Array = malloc(Count * sizeof(int));
+    for (i = 0; i < Count; i++)
+    {
+        Seed = Seed * 1103515245 + 12345;
+        Array[i] = (Seed >> 8) % 1000000;
+    }
+
+    if (argc > 1 && strcmp(argv[1], "quicksort") == 0)
+        QuickSort(0, Count - 1);
+    else
+        qsort(Array, Count, sizeof(int), Compare);
+
+    for (i = 1; i < Count; i++)
+    {
+        if (Array[i-1] > Array[i])
+        {
+            printf("not sorted at %d\n", i);
+            return 1;
+        }
+    }
+
+    free(Array);
+    return 0;
+}
@@ -0,0 +1,3 @@
+/* startup benchmark - every system header is included by -s and then
+    nothing else happens, so the run time is all interpreter startup */
+int Startup = 1;
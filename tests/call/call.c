@@ -0,0 +1,485 @@
+/* calls functions in a program from the host with PicocCallFunction() and
+ * checks what comes back, including from a library function, a variadic one
+ * and after an error, and checks that host memory bound with PicocBind() is seen and
+ * changed in place, and that a profile of a call finds the function and a
+ * cost profile counts its calls. then it times lots of calls from the host
+ * against the same calls made by a loop in the program.
+ *
+ * usage: call [calls] */
+#include <time.h>
+#include "../../picoc.h"
+
+#define CALL_HEAP_SIZE (4*1024*1024)
+#define CALL_TIMED 1000000
+
+static const char CallProgram[] = "\
+int Calls; \
+int Add(int a, int b) { Calls++; return a + b; } \
+double Scale(double x, float f) { return x * f; } \
+char *Pick(char **Names, int n) { return Names[n]; } \
+long long Fib(int n) { if (n < 2) return n; return Fib(n-1) + Fib(n-2); } \
+unsigned char Low(unsigned int x) { return x; } \
+void Count() { Calls++; } \
+int GetCalls() { return Calls; } \
+struct Record { int Id; double Weight; char Tag[4]; }; \
+double Total() { int i; double t = 0; for (i = 0; i < 1000; i++) t += Records[i].Weight; return t; } \
+void Mark() { Records[Record.Id].Tag[0] = 'x'; } \
+void SetId() { Record.Id = 1; } \
+";
+
+/* the same as struct Record in the program */
+struct CallRecord {
+    int Id;
+    double Weight;
+    char Tag[4];
+};
+
+static double CallNow(void)
+{
+    struct timespec Now;
+
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return Now.tv_sec + Now.tv_nsec / 1e9;
+}
+
+/* look up a function, failing the test if it isn't there */
+static int CallGet(Picoc *pc, const char *Name, struct PicocFunction *Func)
+{
+    if (PicocGetFunction(pc, Name, Func))
+        return true;
+
+    fprintf(stderr, "can't find %s()\n", Name);
+    return false;
+}
+
+/* check the results of calls with each kind of argument and result */
+static int CallCheck(Picoc *pc)
+{
+    struct PicocFunction Func;
+    union PicocValue Args[2];
+    union PicocValue Result;
+    char *Names[] = { "zero", "one", "two" };
+    int Failures = 0;
+
+    Args[0].Integer = 40;
+    Args[1].Integer = 2;
+    if (!CallGet(pc, "Add", &Func))
+        return 1;
+    PicocCallFunction(pc, &Func, Args, 2, &Result);
+    Failures += Result.Integer != 42;
+
+    Args[0].FP = 1.5;
+    Args[1].FP = 4.0;
+    if (!CallGet(pc, "Scale", &Func))
+        return 1;
+    PicocCallFunction(pc, &Func, Args, 2, &Result);
+    Failures += Result.FP != 6.0;
+
+    Args[0].Pointer = Names;
+    Args[1].Integer = 2;
+    if (!CallGet(pc, "Pick", &Func))
+        return 1;
+    PicocCallFunction(pc, &Func, Args, 2, &Result);
+    Failures += Result.Pointer != Names[2];
+
+    Args[0].Integer = 30;
+    if (!CallGet(pc, "Fib", &Func))
+        return 1;
+    PicocCallFunction(pc, &Func, Args, 1, &Result);
+    Failures += Result.Integer != 832040;
+
+    Args[0].Integer = 0x1234;
+    if (!CallGet(pc, "Low", &Func))
+        return 1;
+    PicocCallFunction(pc, &Func, Args, 1, &Result);
+    Failures += Result.Integer != 0x34;
+
+    if (!CallGet(pc, "Count", &Func))
+        return 1;
+    PicocCallFunction(pc, &Func, NULL, 0, NULL);
+    if (!CallGet(pc, "GetCalls", &Func))
+        return 1;
+    PicocCallFunction(pc, &Func, NULL, 0, &Result);
+    Failures += Result.Integer != 2;
+
+    Args[0].Integer = -7;
+    if (!CallGet(pc, "abs", &Func))
+        return 1;
+    PicocCallFunction(pc, &Func, Args, 1, &Result);
+    Failures += Result.Integer != 7;
+
+    /* things which can't be called from the host */
+    Failures += PicocGetFunction(pc, "Calls", &Func);
+    Failures += PicocGetFunction(pc, "NoSuchFunction", &Func);
+
+    if (Failures > 0)
+        fprintf(stderr, "%d calls returned the wrong thing\n", Failures);
+
+    return Failures;
+}
+
+/* bind an array of records and one record and check the program uses them
+    where they are */
+static int CallBind(Picoc *pc)
+{
+    static struct CallRecord Records[1000];
+    struct PicocFunction Total;
+    struct PicocFunction Mark;
+    struct PicocFunction SetId;
+    struct ValueType *RecordType;
+    union PicocValue Result;
+    int Failures = 0;
+    int Count;
+
+    for (Count = 0; Count < 1000; Count++) {
+        Records[Count].Id = Count;
+        Records[Count].Weight = 0.5;
+    }
+
+    RecordType = PicocGetType(pc, "struct Record");
+    if (RecordType == NULL || PicocGetType(pc, "NotAType") != NULL ||
+            RecordType->Sizeof != sizeof(struct CallRecord)) {
+        fprintf(stderr, "struct Record isn't the right type\n");
+        return 1;
+    }
+
+    if (!CallGet(pc, "Total", &Total) || !CallGet(pc, "Mark", &Mark) ||
+            !CallGet(pc, "SetId", &SetId))
+        return 1;
+
+    if (PicocPlatformSetExitPoint(pc)) {
+        fprintf(stderr, "error using bound records\n");
+        return 1;
+    }
+
+    PicocBind(pc, "Records", Records, RecordType, 1000, true);
+    PicocCallFunction(pc, &Total, NULL, 0, &Result);
+    Failures += Result.FP != 500.0;
+
+    Records[999].Weight = 100.5;
+    PicocCallFunction(pc, &Total, NULL, 0, &Result);
+    Failures += Result.FP != 600.0;
+
+    /* stream through the records, binding each in turn */
+    for (Count = 0; Count < 1000; Count += 3) {
+        PicocBind(pc, "Record", &Records[Count], RecordType, 0, false);
+        PicocCallFunction(pc, &Mark, NULL, 0, NULL);
+    }
+
+    for (Count = 0; Count < 1000; Count++)
+        Failures += (Records[Count].Tag[0] == 'x') != (Count % 3 == 0);
+
+    /* a read-only record can't be assigned to, and the failed call
+        doesn't leave its stack frame behind */
+    if (PicocPlatformSetExitPoint(pc) == 0) {
+        PicocCallFunction(pc, &SetId, NULL, 0, NULL);
+        Failures++;
+    }
+    Failures += Records[999].Id != 999;
+    Failures += pc->MainThread.TopStackFrame != NULL;
+
+    if (Failures > 0)
+        fprintf(stderr, "%d things were wrong with bound records\n", Failures);
+
+    return Failures;
+}
+
+/* a call with the wrong number of arguments jumps to the exit point, and
+    the instance can still be called afterwards */
+static int CallError(Picoc *pc)
+{
+    struct PicocFunction Func;
+    union PicocValue Args[2];
+    union PicocValue Result;
+
+    if (!CallGet(pc, "Add", &Func))
+        return 1;
+
+    Args[0].Integer = 1;
+    if (PicocPlatformSetExitPoint(pc) == 0) {
+        PicocCallFunction(pc, &Func, Args, 1, &Result);
+        fprintf(stderr, "a bad call didn't fail\n");
+        return 1;
+    }
+
+    Args[1].Integer = 2;
+    if (PicocPlatformSetExitPoint(pc) == 0) {
+        PicocCallFunction(pc, &Func, Args, 2, &Result);
+        if (Result.Integer == 3)
+            return 0;
+    }
+
+    fprintf(stderr, "a call after a bad call failed\n");
+    return 1;
+}
+
+/* call snprintf() with extra arguments of each kind. they can only be
+    given with PicocCallVarArgs(), which knows their types */
+static int CallVarArgs(Picoc *pc)
+{
+    struct PicocFunction Func;
+    union PicocValue Args[6];
+    struct ValueType *ArgTypes[6];
+    union PicocValue Result;
+    char Buffer[32];
+
+    if (!CallGet(pc, "snprintf", &Func))
+        return 1;
+
+    Args[0].Pointer = Buffer;
+    Args[1].Integer = sizeof(Buffer);
+    Args[2].Pointer = "%s %g %d";
+    Args[3].Pointer = "pi";
+    Args[4].FP = 3.25;
+    Args[5].Integer = 7;
+    ArgTypes[3] = PicocGetType(pc, "char *");
+    ArgTypes[4] = PicocGetType(pc, "double");
+    ArgTypes[5] = PicocGetType(pc, "int");
+    if (PicocPlatformSetExitPoint(pc) == 0) {
+        PicocCallFunction(pc, &Func, Args, 6, &Result);
+        fprintf(stderr, "extra arguments without their types didn't fail\n");
+        return 1;
+    }
+
+    if (PicocPlatformSetExitPoint(pc) == 0) {
+        PicocCallVarArgs(pc, &Func, Args, ArgTypes, 6, &Result);
+        if (Result.Integer == 9 && strcmp(Buffer, "pi 3.25 7") == 0)
+            return 0;
+    }
+
+    fprintf(stderr, "snprintf() from the host gave \"%s\"\n", Buffer);
+    return 1;
+}
+
+/* profile a call to Fib() and check the samples are in it */
+static int CallProfile(Picoc *pc)
+{
+    struct PicocFunction Func;
+    union PicocValue Args[1];
+    union PicocValue Result;
+    FILE *Folded;
+    char *Samples = NULL;
+    size_t SamplesSize;
+    long NumSamples;
+    int Failures = 0;
+
+    if (!CallGet(pc, "Fib", &Func))
+        return 1;
+
+    /* the slowest rate is an interval of a whole second */
+    if (!PicocProfileStart(pc, 1)) {
+        fprintf(stderr, "can't profile at 1 sample a second\n");
+        return 1;
+    }
+    PicocProfileStop(pc);
+
+    if (!PicocProfileStart(pc, 1000)) {
+        fprintf(stderr, "can't start profiling\n");
+        return 1;
+    }
+
+    Args[0].Integer = 24;
+    PicocCallFunction(pc, &Func, Args, 1, &Result);
+    PicocProfileStop(pc);
+
+    Folded = open_memstream(&Samples, &SamplesSize);
+    NumSamples = PicocProfileWrite(pc, Folded);
+    fclose(Folded);
+
+    Failures += NumSamples == 0;
+    Failures += strncmp(Samples, "Fib:", 4) != 0;
+    if (Failures > 0)
+        fprintf(stderr, "profiling found %ld samples:\n%s", NumSamples, Samples);
+
+    free(Samples);
+    return Failures;
+}
+
+/* count the costs of a call to Fib() in an instance of its own, since
+    costs are only counted for code parsed after they're asked for */
+static int CallCosts(void)
+{
+    Picoc pc;
+    struct PicocFunction Func;
+    union PicocValue Args[1];
+    union PicocValue Result;
+    FILE *Callgrind;
+    char *Costs = NULL;
+    size_t CostsSize;
+    int Failures = 0;
+
+    PicocInitialize(&pc, CALL_HEAP_SIZE);
+    if (PicocPlatformSetExitPoint(&pc)) {
+        fprintf(stderr, "error counting costs\n");
+        PicocCleanup(&pc);
+        return 1;
+    }
+
+    if (!PicocProfileCosts(&pc)) {
+        PicocCleanup(&pc);
+        return 0;
+    }
+
+    PicocParse(&pc, "call", CallProgram, strlen(CallProgram), true, false,
+        false, false);
+    if (!CallGet(&pc, "Fib", &Func)) {
+        PicocCleanup(&pc);
+        return 1;
+    }
+
+    Args[0].Integer = 10;
+    PicocCallFunction(&pc, &Func, Args, 1, &Result);
+
+    Callgrind = open_memstream(&Costs, &CostsSize);
+    PicocProfileWriteCosts(&pc, NULL, Callgrind, "call");
+    fclose(Callgrind);
+
+    /* the first call's from the host, which has no caller to count it */
+    Failures += strstr(Costs, "\nfn=Fib\n") == NULL;
+    Failures += strstr(Costs, "\ncfn=Fib\ncalls=176 ") == NULL;
+    if (Failures > 0)
+        fprintf(stderr, "the costs of Fib(10) were:\n%s", Costs);
+
+    free(Costs);
+    PicocCleanup(&pc);
+    return Failures;
+}
+
+/* trace a call of Fib(10) from the host, which has each of its calls begin
+    and end */
+static int CallTrace(void)
+{
+    Picoc pc;
+    struct PicocFunction Func;
+    union PicocValue Args[1];
+    union PicocValue Result;
+    FILE *Out;
+    char *Trace = NULL;
+    size_t TraceSize;
+    char *Pos;
+    int Begins = 0;
+    int Ends = 0;
+    int Failures = 0;
+
+    PicocInitialize(&pc, CALL_HEAP_SIZE);
+    if (PicocPlatformSetExitPoint(&pc)) {
+        fprintf(stderr, "error tracing\n");
+        PicocCleanup(&pc);
+        return 1;
+    }
+
+    Out = open_memstream(&Trace, &TraceSize);
+    if (!PicocProfileTrace(&pc, Out)) {
+        fclose(Out);
+        free(Trace);
+        PicocCleanup(&pc);
+        return 0;
+    }
+
+    PicocParse(&pc, "call", CallProgram, strlen(CallProgram), true, false,
+        false, false);
+    if (!CallGet(&pc, "Fib", &Func)) {
+        PicocProfileTraceStop(&pc);
+        fclose(Out);
+        free(Trace);
+        PicocCleanup(&pc);
+        return 1;
+    }
+
+    Args[0].Integer = 10;
+    PicocCallFunction(&pc, &Func, Args, 1, &Result);
+    Failures += !PicocProfileTraceStop(&pc);
+    fclose(Out);
+
+    for (Pos = Trace; (Pos = strstr(Pos, "\"name\":\"Fib\"")) != NULL; Pos++)
+        Begins++;
+    for (Pos = Trace; (Pos = strstr(Pos, "\"ph\":\"E\"")) != NULL; Pos++)
+        Ends++;
+
+    Failures += Begins != 177 || Ends != 177;
+    if (Failures > 0)
+        fprintf(stderr, "the trace of Fib(10) had %d begins and %d ends\n",
+            Begins, Ends);
+
+    free(Trace);
+    PicocCleanup(&pc);
+    return Failures;
+}
+
+/* time calls to Add() from the host and from a loop in the program */
+static void CallTime(Picoc *pc, long Calls)
+{
+    char Loop[200];
+    struct PicocFunction Func;
+    union PicocValue Args[2];
+    union PicocValue Result;
+    double Start;
+    double HostTime;
+    double ProgramTime;
+    long Count;
+
+    CallGet(pc, "Add", &Func);
+    Result.Integer = 0;
+    Start = CallNow();
+    for (Count = 0; Count < Calls; Count++) {
+        Args[0].Integer = Result.Integer;
+        Args[1].Integer = 1;
+        PicocCallFunction(pc, &Func, Args, 2, &Result);
+    }
+    HostTime = CallNow() - Start;
+
+    snprintf(Loop, sizeof(Loop),
+        "{ int i; int Sum = 0; for (i = 0; i < %ld; i++) Sum = Add(Sum, 1); }",
+        Calls);
+    Start = CallNow();
+    PicocParse(pc, "loop", Loop, strlen(Loop), true, true, false, false);
+    ProgramTime = CallNow() - Start;
+
+    printf("    %ld calls: %.0f/sec from the host, %.0f/sec from the program\n",
+        Calls, Calls / HostTime, Calls / ProgramTime);
+}
+
+int main(int argc, char **argv)
+{
+    Picoc pc;
+    FILE *Output;
+    char *Errors = NULL;
+    size_t ErrorsSize;
+    long Calls = argc > 1 ? atol(argv[1]) : CALL_TIMED;
+    int Failures = 0;
+
+    /* error messages are expected, so they're kept out of the way */
+    Output = open_memstream(&Errors, &ErrorsSize);
+    PicocInitialize(&pc, CALL_HEAP_SIZE);
+    PicocSetOutput(&pc, Output);
+    if (PicocPlatformSetExitPoint(&pc)) {
+        fflush(Output);
+        fprintf(stderr, "error setting up the test: %s\n", Errors);
+        return 1;
+    }
+
+    PicocIncludeAllSystemHeaders(&pc);
+    PicocParse(&pc, "call", CallProgram, strlen(CallProgram), true, false,
+        false, false);
+
+    Failures += CallCheck(&pc);
+    Failures += CallError(&pc);
+    Failures += CallVarArgs(&pc);
+    Failures += CallBind(&pc);
+    Failures += CallProfile(&pc);
+    Failures += CallCosts();
+    Failures += CallTrace();
+    if (Failures == 0) {
+        if (PicocPlatformSetExitPoint(&pc) == 0)
+            CallTime(&pc, Calls);
+        else {
+            fprintf(stderr, "error timing calls\n");
+            Failures++;
+        }
+    }
+
+    PicocCleanup(&pc);
+    fclose(Output);
+    free(Errors);
+    return Failures != 0;
+}
@@ -0,0 +1,60 @@
+/* a shared library for 75_dlfcn to call with dlbind(). it's built by
+ * tests/Makefile with the system compiler */
+#include <string.h>
+
+struct Point {
+    double x;
+    double y;
+    int Weight;
+};
+
+double Dot(double *a, double *b, int n)
+{
+    double Sum = 0;
+    int i;
+
+    for (i = 0; i < n; i++)
+        Sum += a[i] * b[i];
+
+    return Sum;
+}
+
+/* integers and floating point mixed up, to check each gets to the right
+    place */
+long Mix(char c, double x, int i, float f, unsigned long u, double y)
+{
+    return c + (long)x * 10 + i * 100 + (long)(f * 1000) + u * 10000 +
+        (long)y * 100000;
+}
+
+float Half(float f)
+{
+    return f / 2;
+}
+
+void Scale(struct Point *p, double By)
+{
+    p->x *= By;
+    p->y *= By;
+    p->Weight++;
+}
+
+const char *Name(void)
+{
+    return "kernel";
+}
+
+unsigned char Low(unsigned int x)
+{
+    return x & 0xff;
+}
+
+int Count(const char *s, char c)
+{
+    int n = 0;
+
+    for (; *s != '\0'; s++)
+        n += *s == c;
+
+    return n;
+}
@@ -0,0 +1,130 @@
+/* runs a program which allocates memory and opens files without freeing or
+ * closing them, over and over in one instance put back to its reset point
+ * with PicocReset() between runs, the way picoc -b does. it checks the
+ * memory the process has and the file descriptors it has open don't grow
+ * from run to run, and that a block allocated before the reset point is
+ * kept.
+ *
+ * usage: reset [runs] */
+#include <sys/resource.h>
+#include "../../picoc.h"
+
+#define RESET_STACK_SIZE (256*1024)
+#define RESET_RUNS 1000
+#define RESET_WARM_RUNS 50
+#define RESET_GROWTH_KB (16*1024)
+
+/* run before the reset point, so Kept has to survive every reset */
+static const char ResetSetup[] = "\
+char *Kept = malloc(8); \
+strcpy(Kept, \"kept\"); \
+";
+
+/* leaks 128k, then 256k after it's grown, a string and two files */
+static const char ResetProgram[] = "\
+int main() \
+{ \
+    char *Block = malloc(128 * 1024); \
+    FILE *Source = fopen(\"reset/reset.c\", \"r\"); \
+    FILE *Temporary = tmpfile(); \
+    char *Copy = strdup(Kept); \
+    if (Block == NULL || Source == NULL || Temporary == NULL || Copy == NULL) \
+        return 1; \
+    memset(Block, 1, 128 * 1024); \
+    Block = realloc(Block, 256 * 1024); \
+    if (Block == NULL) \
+        return 1; \
+    memset(Block, 2, 256 * 1024); \
+    return strcmp(Copy, \"kept\") != 0; \
+} \
+";
+
+/* the lowest file descriptor that isn't open */
+static int ResetLowestFree(void)
+{
+    int Descriptor = dup(0);
+
+    close(Descriptor);
+    return Descriptor;
+}
+
+/* the most memory the process has had, in kilobytes */
+static long ResetMaxResident(void)
+{
+    struct rusage Usage;
+
+    getrusage(RUSAGE_SELF, &Usage);
+    return Usage.ru_maxrss;
+}
+
+/* run the program once from the reset point, returning its exit value */
+static int ResetRun(Picoc *pc)
+{
+    PicocReset(pc);
+    if (PicocPlatformSetExitPoint(pc) == 0) {
+        PicocParse(pc, "reset", ResetProgram, strlen(ResetProgram), true,
+            false, false, false);
+        PicocCallMain(pc, 0, NULL);
+    }
+
+    return pc->PicocExitValue;
+}
+
+int main(int argc, char **argv)
+{
+    Picoc pc;
+    int Runs = argc > 1 ? atoi(argv[1]) : RESET_RUNS;
+    int Run;
+    int LowestFree;
+    long WarmResident;
+    long Growth;
+
+    PicocInitializeForImage(&pc, RESET_STACK_SIZE);
+    if (PicocPlatformSetExitPoint(&pc)) {
+        fprintf(stderr, "error setting up the reset point\n");
+        PicocCleanup(&pc);
+        return 1;
+    }
+
+    PicocIncludeAllSystemHeaders(&pc);
+    PicocParse(&pc, "setup", ResetSetup, strlen(ResetSetup), true, false,
+        false, false);
+    PicocSetResetPoint(&pc);
+
+    for (Run = 0; Run < RESET_WARM_RUNS; Run++) {
+        if (ResetRun(&pc) != 0) {
+            fprintf(stderr, "warm up run %d failed\n", Run);
+            PicocCleanup(&pc);
+            return 1;
+        }
+    }
+
+    LowestFree = ResetLowestFree();
+    WarmResident = ResetMaxResident();
+    for (Run = 0; Run < Runs; Run++) {
+        if (ResetRun(&pc) != 0) {
+            fprintf(stderr, "run %d failed\n", Run);
+            PicocCleanup(&pc);
+            return 1;
+        }
+    }
+
+    if (ResetLowestFree() != LowestFree) {
+        fprintf(stderr, "files left open after %d runs: the lowest free "
+            "descriptor went from %d to %d\n", Runs, LowestFree,
+            ResetLowestFree());
+        PicocCleanup(&pc);
+        return 1;
+    }
+
+    Growth = ResetMaxResident() - WarmResident;
+    if (Growth > RESET_GROWTH_KB) {
+        fprintf(stderr, "memory grew by %ldk over %d runs\n", Growth, Runs);
+        PicocCleanup(&pc);
+        return 1;
+    }
+
+    PicocCleanup(&pc);
+    printf("%d runs, memory grew by %ldk\n", Runs, Growth);
+    return 0;
+}
@@ -0,0 +1,35 @@
+#include <stdio.h>
+
+/* a tower of disks like 30_hanoi.c, only ever moved one way so that it
+    recurses once for each of 150 disks, deeper than the 100 stack frames
+    the stats once had room for */
+int Move(int Disks)
+{
+    int Below;
+
+    if (Disks == 0)
+        return 0;
+
+    Below = Move(Disks - 1);
+    return Below + 1;
+}
+
+/* a chain of 120 expressions, longer than the 100 the stats could print */
+int Sum(int n)
+{
+    return n + n + n + n + n + n + n + n + n + n + n + n + n + n + n + n + n
+        + n + n + n + n + n + n + n + n + n + n + n + n + n + n + n + n + n
+        + n + n + n + n + n + n + n + n + n + n + n + n + n + n + n + n + n
+        + n + n + n + n + n + n + n + n + n + n + n + n + n + n + n + n + n
+        + n + n + n + n + n + n + n + n + n + n + n + n + n + n + n + n + n
+        + n + n + n + n + n + n + n + n + n + n + n + n + n + n + n + n + n
+        + n + n + n + n + n + n + n + n + n + n + n + n + n + n + n + n + n
+        + n;
+}
+
+int main()
+{
+    printf("%d\n", Move(150));
+    printf("%d\n", Sum(1));
+    return 0;
+}
@@ -0,0 +1,41 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+/* grows a buffer a block at a time, leaving the last one allocated */
+char *Grow(char *Buffer, int Size)
+{
+    return realloc(Buffer, Size);
+}
+
+/* frees a block the main thread allocated */
+void *Release(void *Block)
+{
+    free(Block);
+    return NULL;
+}
+
+int main()
+{
+    int Count;
+    char *Kept;
+    char *Buffer = NULL;
+    int *Numbers = malloc(10 * sizeof(int));
+    char *Zeroes = calloc(3, 100);
+    pthread_t Thread;
+
+    for (Count = 1; Count <= 5; Count++)
+        Buffer = Grow(Buffer, Count * 64);
+
+    free(Numbers);
+    free(Zeroes);
+    Kept = malloc(33);
+    for (Count = 0; Count < 4; Count++)
+        free(malloc(1000));
+
+    pthread_create(&Thread, NULL, Release, malloc(500));
+    pthread_join(Thread, NULL);
+
+    printf("leaking %d blocks\n", Buffer != NULL && Kept != NULL ? 2 : 0);
+    return 0;
+}
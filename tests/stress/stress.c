@@ -0,0 +1,189 @@
+/* runs the test programs in lots of picoc instances at once, one thread per
+ * core, and checks each run's output matches a run on its own. This is
+ * built against the interpreter's object files rather than run through the
+ * picoc binary so that all the instances share one process.
+ *
+ * usage: stress [-j threads] [-n rounds] test.c ...
+ *
+ * tests are run the way tests/Makefile runs them - a name containing "args"
+ * gets arguments and one containing "script" is run with picoc -s */
+#include <pthread.h>
+
+#include "../../picoc.h"
+
+#define STRESS_STACK_SIZE (1024*1024)
+#define STRESS_ROUNDS 4
+#define STRESS_MIN_THREADS 4    /* so instances still interleave on one core */
+
+
+/* one test program and what it printed when run by itself */
+struct StressTest {
+    const char *FileName;
+    char *Expected;
+    size_t ExpectedSize;
+};
+
+/* the work shared by all the threads */
+struct StressRun {
+    struct StressTest *Tests;
+    int NumTests;
+    int Rounds;
+    pthread_mutex_t Lock;
+    int Runs;
+    int Failures;
+};
+
+struct StressThread {
+    pthread_t Thread;
+    struct StressRun *Run;
+    int Index;
+};
+
+static char *StressArgs[] = { "-", "arg1", "arg2", "arg3", "arg4" };
+
+
+/* run a test in a new instance, returning everything it printed followed
+    by its exit value */
+static char *StressRunTest(const char *FileName, size_t *Size)
+{
+    Picoc *pc = malloc(sizeof(Picoc));
+    char *Output = NULL;
+    FILE *Stream;
+
+    if (pc == NULL)
+        return NULL;
+
+    Stream = open_memstream(&Output, Size);
+    if (Stream == NULL) {
+        free(pc);
+        return NULL;
+    }
+
+    PicocInitialize(pc, STRESS_STACK_SIZE);
+    PicocSetOutput(pc, Stream);
+    if (PicocPlatformSetExitPoint(pc) == 0) {
+        if (strstr(FileName, "script") != NULL) {
+            PicocIncludeAllSystemHeaders(pc);
+            PicocPlatformScanFile(pc, FileName);
+        } else {
+            PicocPlatformScanFile(pc, FileName);
+            if (strstr(FileName, "args") != NULL)
+                PicocCallMain(pc, sizeof(StressArgs) / sizeof(char*),
+                    StressArgs);
+            else
+                PicocCallMain(pc, 0, NULL);
+        }
+    }
+
+    fprintf(Stream, "exit %d\n", pc->PicocExitValue);
+    PicocCleanup(pc);
+    fclose(Stream);
+    free(pc);
+
+    return Output;
+}
+
+/* run every test a number of times, each thread starting at a different
+    test so that different programs overlap */
+static void *StressThreadMain(void *Arg)
+{
+    struct StressThread *This = Arg;
+    struct StressRun *Run = This->Run;
+    int Round;
+    int Count;
+
+    for (Round = 0; Round < Run->Rounds; Round++) {
+        for (Count = 0; Count < Run->NumTests; Count++) {
+            struct StressTest *Test =
+                &Run->Tests[(Count + This->Index) % Run->NumTests];
+            size_t Size;
+            char *Output = StressRunTest(Test->FileName, &Size);
+            int Failed = Output == NULL || Size != Test->ExpectedSize ||
+                memcmp(Output, Test->Expected, Size) != 0;
+
+            pthread_mutex_lock(&Run->Lock);
+            Run->Runs++;
+            if (Failed) {
+                Run->Failures++;
+                fprintf(stderr, "error in test %s on thread %d\n",
+                    Test->FileName, This->Index);
+            }
+            pthread_mutex_unlock(&Run->Lock);
+
+            free(Output);
+        }
+    }
+
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    struct StressRun Run;
+    struct StressThread *Threads;
+    int NumThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    int ParamCount = 1;
+    int Count;
+
+    Run.Rounds = STRESS_ROUNDS;
+    for (; ParamCount < argc - 1 && argv[ParamCount][0] == '-'; ParamCount += 2) {
+        if (strcmp(argv[ParamCount], "-j") == 0)
+            NumThreads = atoi(argv[ParamCount+1]);
+        else if (strcmp(argv[ParamCount], "-n") == 0)
+            Run.Rounds = atoi(argv[ParamCount+1]);
+        else
+            break;
+    }
+
+    if (NumThreads < STRESS_MIN_THREADS)
+        NumThreads = STRESS_MIN_THREADS;
+
+    if (ParamCount >= argc) {
+        fprintf(stderr, "usage: stress [-j threads] [-n rounds] test.c ...\n");
+        return 1;
+    }
+
+    /* the expected output comes from running each test on its own */
+    Run.NumTests = argc - ParamCount;
+    Run.Tests = calloc(Run.NumTests, sizeof(struct StressTest));
+    for (Count = 0; Count < Run.NumTests; Count++) {
+        struct StressTest *Test = &Run.Tests[Count];
+
+        Test->FileName = argv[ParamCount + Count];
+        Test->Expected = StressRunTest(Test->FileName, &Test->ExpectedSize);
+        if (Test->Expected == NULL) {
+            fprintf(stderr, "can't run test %s\n", Test->FileName);
+            return 1;
+        }
+    }
+
+    pthread_mutex_init(&Run.Lock, NULL);
+    Run.Runs = 0;
+    Run.Failures = 0;
+
+    Threads = calloc(NumThreads, sizeof(struct StressThread));
+    for (Count = 0; Count < NumThreads; Count++) {
+        Threads[Count].Run = &Run;
+        Threads[Count].Index = Count;
+        if (pthread_create(&Threads[Count].Thread, NULL, StressThreadMain,
+                &Threads[Count]) != 0) {
+            fprintf(stderr, "can't create thread %d\n", Count);
+            return 1;
+        }
+    }
+
+    for (Count = 0; Count < NumThreads; Count++)
+        pthread_join(Threads[Count].Thread, NULL);
+
+    printf("%d runs of %d tests on %d threads, %d failed\n", Run.Runs,
+        Run.NumTests, NumThreads, Run.Failures);
+
+    for (Count = 0; Count < Run.NumTests; Count++)
+        free(Run.Tests[Count].Expected);
+
+    free(Run.Tests);
+    free(Threads);
+    pthread_mutex_destroy(&Run.Lock);
+
+    return Run.Failures != 0;
+}
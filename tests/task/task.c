@@ -0,0 +1,203 @@
+/* runs the test programs as tasks, all at once on one thread a slice at a
+ * time, and checks each one prints what it does when run straight through.
+ * some tasks get slices of a few statements and some get slices of time,
+ * so they're stopped and resumed all over the place. it also checks that
+ * a program which never stops can be held to its slices.
+ *
+ * usage: task [-n copies] [-s statements] test.c ...
+ *
+ * tests are run the way tests/Makefile runs them - a name containing "args"
+ * gets arguments and one containing "script" is run with picoc -s */
+#include "../../picoc.h"
+
+#define TASK_HEAP_SIZE (1024*1024)
+#define TASK_STACK_SIZE (256*1024)
+#define TASK_COPIES 2
+#define TASK_STATEMENTS 7
+#define TASK_MICROSECONDS 20
+
+
+/* one run of a test program */
+struct TaskTest {
+    const char *FileName;
+    Picoc pc;
+    FILE *Stream;
+    char *Output;
+    size_t OutputSize;
+    int Finished;
+};
+
+static char *TaskArgs[] = { "-", "arg1", "arg2", "arg3", "arg4" };
+
+
+/* run a test program in the instance it's been given */
+static void TaskBody(Picoc *pc, void *Arg)
+{
+    struct TaskTest *Test = Arg;
+
+    if (strstr(Test->FileName, "script") != NULL) {
+        PicocIncludeAllSystemHeaders(pc);
+        PicocPlatformScanFile(pc, Test->FileName);
+    } else {
+        PicocPlatformScanFile(pc, Test->FileName);
+        if (strstr(Test->FileName, "args") != NULL)
+            PicocCallMain(pc, sizeof(TaskArgs) / sizeof(char*), TaskArgs);
+        else
+            PicocCallMain(pc, 0, NULL);
+    }
+}
+
+/* set up a test to run, returning false if it can't be */
+static int TaskTestStart(struct TaskTest *Test, const char *FileName)
+{
+    Test->FileName = FileName;
+    Test->Output = NULL;
+    Test->Finished = false;
+    Test->Stream = open_memstream(&Test->Output, &Test->OutputSize);
+    if (Test->Stream == NULL)
+        return false;
+
+    PicocInitialize(&Test->pc, TASK_HEAP_SIZE);
+    PicocSetOutput(&Test->pc, Test->Stream);
+    return PicocTaskStart(&Test->pc, TaskBody, Test, TASK_STACK_SIZE);
+}
+
+/* tidy up after a test which has finished, leaving its output */
+static void TaskTestFinish(struct TaskTest *Test)
+{
+    fprintf(Test->Stream, "exit %d\n", Test->pc.PicocExitValue);
+    PicocCleanup(&Test->pc);
+    fclose(Test->Stream);
+    Test->Finished = true;
+}
+
+/* a program that never stops has to come back after every slice */
+static void TaskRunawayBody(Picoc *pc, void *Arg)
+{
+    const char *Source = Arg;
+
+    PicocParse(pc, "runaway", Source, strlen(Source), true, true, false,
+        false);
+}
+
+static int TaskRunaway(void)
+{
+    static const char Source[] = "int i; for (;;) i++;";
+    Picoc pc;
+    int Slice;
+    int Failed = false;
+
+    PicocInitialize(&pc, TASK_HEAP_SIZE);
+    if (!PicocTaskStart(&pc, TaskRunawayBody, (void *)Source, TASK_STACK_SIZE))
+        return false;
+
+    for (Slice = 0; Slice < 100; Slice++) {
+        if (PicocTaskRun(&pc, 1000, 0))
+            Failed = true;
+    }
+
+    if (PicocTaskRun(&pc, 0, 2000))
+        Failed = true;
+
+    PicocCleanup(&pc);
+    return !Failed;
+}
+
+int main(int argc, char **argv)
+{
+    struct TaskTest *Tests;
+    int Copies = TASK_COPIES;
+    long Statements = TASK_STATEMENTS;
+    int ParamCount = 1;
+    int NumFiles;
+    int NumTests;
+    int Running;
+    int Slices = 0;
+    int Failures = 0;
+    int Count;
+
+    for (; ParamCount < argc - 1 && argv[ParamCount][0] == '-'; ParamCount += 2) {
+        if (strcmp(argv[ParamCount], "-n") == 0)
+            Copies = atoi(argv[ParamCount+1]);
+        else if (strcmp(argv[ParamCount], "-s") == 0)
+            Statements = atol(argv[ParamCount+1]);
+        else
+            break;
+    }
+
+    if (ParamCount >= argc || Copies < 1) {
+        fprintf(stderr, "usage: task [-n copies] [-s statements] test.c ...\n");
+        return 1;
+    }
+
+    /* the expected output comes from running each test in one slice */
+    NumFiles = argc - ParamCount;
+    NumTests = NumFiles * (Copies + 1);
+    Tests = calloc(NumTests, sizeof(struct TaskTest));
+    for (Count = 0; Count < NumFiles; Count++) {
+        struct TaskTest *Test = &Tests[Count];
+
+        if (!TaskTestStart(Test, argv[ParamCount + Count])) {
+            fprintf(stderr, "can't run test %s\n", Test->FileName);
+            return 1;
+        }
+
+        PicocTaskRun(&Test->pc, 0, 0);
+        TaskTestFinish(Test);
+    }
+
+    /* then all the copies take turns */
+    for (Count = NumFiles; Count < NumTests; Count++) {
+        if (!TaskTestStart(&Tests[Count], Tests[Count % NumFiles].FileName)) {
+            fprintf(stderr, "can't start test %s\n", Tests[Count].FileName);
+            return 1;
+        }
+    }
+
+    do {
+        Running = 0;
+        for (Count = NumFiles; Count < NumTests; Count++) {
+            struct TaskTest *Test = &Tests[Count];
+            int Finished;
+
+            if (Test->Finished)
+                continue;
+
+            if (Count % 2)
+                Finished = PicocTaskRun(&Test->pc, 0, TASK_MICROSECONDS);
+            else
+                Finished = PicocTaskRun(&Test->pc, Statements, 0);
+
+            Slices++;
+            if (Finished)
+                TaskTestFinish(Test);
+            else
+                Running++;
+        }
+    } while (Running > 0);
+
+    for (Count = NumFiles; Count < NumTests; Count++) {
+        struct TaskTest *Test = &Tests[Count];
+        struct TaskTest *Expected = &Tests[Count % NumFiles];
+
+        if (Test->OutputSize != Expected->OutputSize ||
+                memcmp(Test->Output, Expected->Output, Test->OutputSize) != 0) {
+            fprintf(stderr, "error in test %s\n", Test->FileName);
+            Failures++;
+        }
+    }
+
+    if (!TaskRunaway()) {
+        fprintf(stderr, "error in runaway test\n");
+        Failures++;
+    }
+
+    printf("%d tasks of %d tests in %d slices, %d failed\n",
+        NumTests - NumFiles, NumFiles, Slices, Failures);
+
+    for (Count = 0; Count < NumTests; Count++)
+        free(Tests[Count].Output);
+
+    free(Tests);
+    return Failures != 0;
+}
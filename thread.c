@@ -0,0 +1,975 @@
+/* picoc threads - running several of a program's functions at once, each on
+ * a host thread of its own. a thread has its own stack, stack frames and
+ * lexer value (see struct ThreadState) and shares everything else - globals,
+ * types, the heap and the string table - with the rest of the program.
+ *
+ * the shared lock is only made when the first thread starts, so programs
+ * which don't use threads don't pay for it. it's taken while changing
+ * anything shared which the interpreter changes as it goes along, which is
+ * the private heap, the string table, the type tree and static variables.
+ * the program's own globals are up to the program to look after.
+ *
+ * when the program ends - main() returns, something calls exit() or there's
+ * an error on any thread - the other threads stop at their next statement
+ * and the main thread waits for them before going on.
+ *
+ * "#pragma picoc parallel for" loops are run by a pool of worker threads
+ * along with the thread which gets to the loop. each starts with an equal
+ * share of the iterations, taking a piece of what it has left at a time,
+ * and when it runs out it steals half of whatever share has most left */
+#include "picoc.h"
+#include "interpreter.h"
+
+#ifdef UNIX_HOST
+#include <pthread.h>
+#include <errno.h>
+#include <unistd.h>
+#endif
+
+#define THREAD_WAIT_MS (10)     /* how often a waiting thread looks to see
+                                    if the program's ending */
+#define PARALLEL_MAX_THREADS (64)
+#define PARALLEL_GRAIN (8)      /* take an eighth of what's left at a time */
+
+/* the iterations one thread of a parallel for has left */
+struct ParallelRange {
+    long long Next;
+    long long End;
+};
+
+/* a parallel for which is running */
+struct ParallelJob {
+    struct ParallelLoop Loop;
+    int NumWorkers;             /* threads from the pool helping out */
+    int Finished;               /* how many of them have finished */
+    int NumRanges;
+    long long IntSum[PARALLEL_MAX_REDUCTIONS];
+    double FPSum[PARALLEL_MAX_REDUCTIONS];
+    struct ParallelRange Range[];   /* the caller's first, then the workers' */
+};
+
+static void ParallelLock(Picoc *pc);
+static void ParallelUnlock(Picoc *pc);
+
+/* the thread this host thread is running, or NULL for the main thread */
+PLATFORM_THREAD_LOCAL struct ThreadState *ThreadCurrent = NULL;
+
+/* share the iterations of a loop out equally between NumThreads threads */
+static struct ParallelJob *ParallelJobMake(struct ParseState *Parser,
+    struct ParallelLoop *Loop, int NumThreads, int *Size)
+{
+    struct ParallelJob *Job;
+    long long Iterations = Loop->End - Loop->Start;
+    int Count;
+
+    *Size = sizeof(struct ParallelJob) + sizeof(struct ParallelRange) * NumThreads;
+    Job = VariableAlloc(Parser->pc, Parser, *Size, false);
+    memcpy(&Job->Loop, Loop, sizeof(struct ParallelLoop));
+    Job->NumWorkers = NumThreads - 1;
+    Job->NumRanges = NumThreads;
+    for (Count = 0; Count < NumThreads; Count++) {
+        Job->Range[Count].Next = Loop->Start + Iterations * Count / NumThreads;
+        Job->Range[Count].End = Loop->Start + Iterations * (Count+1) / NumThreads;
+    }
+
+    return Job;
+}
+
+/* get the next iterations for thread Index to run - a piece of its own
+    share or, once that's gone, half of the share with most left */
+static int ParallelTake(Picoc *pc, struct ParallelJob *Job, int Index,
+    long long *From, long long *To)
+{
+    struct ParallelRange *Own = &Job->Range[Index];
+    struct ParallelRange *Victim = NULL;
+    long long Most = 0;
+    long long Grain;
+    int Count;
+
+    ParallelLock(pc);
+    if (Own->Next >= Own->End) {
+        for (Count = 0; Count < Job->NumRanges; Count++) {
+            if (Job->Range[Count].End - Job->Range[Count].Next > Most) {
+                Victim = &Job->Range[Count];
+                Most = Victim->End - Victim->Next;
+            }
+        }
+
+        if (Victim == NULL) {
+            ParallelUnlock(pc);
+            return false;
+        }
+
+        Own->End = Victim->End;
+        Victim->End -= (Most + 1) / 2;
+        Own->Next = Victim->End;
+    }
+
+    Grain = (Own->End - Own->Next) / PARALLEL_GRAIN;
+    if (Grain < 1)
+        Grain = 1;
+
+    *From = Own->Next;
+    *To = Own->Next + Grain;
+    Own->Next = *To;
+    ParallelUnlock(pc);
+
+    return true;
+}
+
+/* let a thread see the locals of the function the loop's in. they're the
+    same variables, not copies, except for the loop variable and the
+    reductions which each thread has its own of */
+static void ParallelShareLocals(Picoc *pc, struct ParallelLoop *Loop)
+{
+    struct Table *Locals = &THREAD(pc)->TopStackFrame->LocalTable;
+    struct TableEntry *Entry;
+    int Count;
+    int Reduction;
+
+    for (Count = 0; Count < Loop->Locals->Size; Count++) {
+        for (Entry = Loop->Locals->HashTable[Count]; Entry != NULL;
+                Entry = Entry->Next) {
+            if (Entry->p.v.Val->OutOfScope || Entry->p.v.Key == Loop->Ident)
+                continue;
+
+            for (Reduction = 0; Reduction < Loop->NumReductions &&
+                    Entry->p.v.Key != Loop->Reduction[Reduction]; Reduction++) {
+            }
+
+            if (Reduction == Loop->NumReductions)
+                TableSet(pc, Locals, Entry->p.v.Key, Entry->p.v.Val,
+                    Entry->DeclFileName, Entry->DeclLine, Entry->DeclColumn);
+        }
+    }
+}
+
+/* run thread Index's part of a parallel for, in a stack frame of its own */
+static void ParallelRun(Picoc *pc, struct ParallelJob *Job, int Index)
+{
+    struct ParallelLoop *Loop = &Job->Loop;
+    struct ParseState Parser;
+    struct Value *Ident;
+    struct Value *Reduction[PARALLEL_MAX_REDUCTIONS];
+    long long Iteration;
+    long long Last;
+    int Count;
+    int WasPreprocessor;
+
+    ParserCopy(&Parser, &Loop->Body);
+    VariableStackFrameAdd(&Parser, Loop->FuncName, 0);
+    THREAD(pc)->TopStackFrame->ReturnValue = VariableAllocValueFromType(pc,
+        &Parser, &pc->VoidType, false, NULL, false);
+
+    if (Loop->Locals != NULL)
+        ParallelShareLocals(pc, Loop);
+
+    Parser.ScopeID = -1;
+    Ident = VariableDefine(pc, &Parser, Loop->Ident, NULL, Loop->IdentType,
+        true);
+    for (Count = 0; Count < Loop->NumReductions; Count++)
+        Reduction[Count] = VariableDefine(pc, &Parser, Loop->Reduction[Count],
+            NULL, Loop->ReductionValue[Count]->Typ, true);
+
+    Parser.ScopeID = Loop->Body.ScopeID;
+    while (ParallelTake(pc, Job, Index, &Iteration, &Last)) {
+        for (; Iteration < Last; Iteration++) {
+            ExpressionAssignInt(&Parser, Ident, Iteration, false);
+            ParserCopyPos(&Parser, &Loop->Body);
+            do {
+                ParseStatement(&Parser, true, false, &WasPreprocessor);
+            } while (WasPreprocessor);
+
+            if (Parser.Mode == RunModeContinue)
+                Parser.Mode = RunModeRun;
+            else if (Parser.Mode != RunModeRun)
+                ProgramFail(&Parser, "can't break, return or goto out of a parallel for");
+        }
+    }
+
+    ParallelLock(pc);
+    for (Count = 0; Count < Loop->NumReductions; Count++) {
+        if (IS_FP(Reduction[Count]))
+            Job->FPSum[Count] += ExpressionCoerceFP(Reduction[Count]);
+        else
+            Job->IntSum[Count] += ExpressionCoerceInteger(Reduction[Count]);
+    }
+    ParallelUnlock(pc);
+
+    VariableStackFramePop(&Parser);
+}
+
+/* add each thread's reductions to the variables they're for */
+static void ParallelReduce(struct ParseState *Parser, struct ParallelJob *Job)
+{
+    struct Value *Value;
+    int Count;
+
+    for (Count = 0; Count < Job->Loop.NumReductions; Count++) {
+        Value = Job->Loop.ReductionValue[Count];
+        if (IS_FP(Value))
+            ExpressionAssignFP(Parser, Value,
+                ExpressionCoerceFP(Value) + Job->FPSum[Count]);
+        else
+            ExpressionAssignInt(Parser, Value,
+                ExpressionCoerceInteger(Value) + Job->IntSum[Count], false);
+    }
+}
+
+#ifdef UNIX_HOST
+
+/* the threads which help run parallel for loops. they're started as
+    they're needed and wait for more loops until the instance is cleaned up */
+struct ParallelPool {
+    pthread_mutex_t Lock;       /* held while changing any of this or a job */
+    pthread_cond_t Work;        /* signalled when there's a new job */
+    pthread_cond_t Done;        /* signalled when a worker finishes a job */
+    struct ProgramThread *Workers[PARALLEL_MAX_THREADS];
+    int NumWorkers;
+    struct ParallelJob *Job;    /* what they're running, or NULL */
+    int Generation;             /* counts the jobs */
+    int Stopping;
+};
+
+/* a thread the program has started */
+struct ProgramThread {
+    struct ThreadState State;   /* must come first - see ThreadSelf() */
+    pthread_t Handle;
+    Picoc *pc;
+    int ID;
+    struct FuncDef *Func;
+    const char *FuncName;
+    void *Arg;
+    void *Result;
+    int Finished;
+    int Joining;
+    int Index;                  /* a parallel for worker's place in the pool */
+    int Seen;                   /* the last parallel for it looked at */
+    char *Stack;
+    struct ProgramThread *Next;
+};
+
+
+/* the thread we're running on, or NULL if it's the main thread */
+static struct ProgramThread *ThreadSelf(void)
+{
+    return (struct ProgramThread*)ThreadCurrent;
+}
+
+/* lock everything the threads share. it's recursive, so the interpreter
+    can take it again while it's held */
+void ThreadLock(Picoc *pc)
+{
+    if (pc->SharedLock != NULL)
+        pthread_mutex_lock(pc->SharedLock);
+}
+
+void ThreadUnlock(Picoc *pc)
+{
+    if (pc->SharedLock != NULL)
+        pthread_mutex_unlock(pc->SharedLock);
+}
+
+/* make the shared lock and the condition threads signal when they finish */
+static int ThreadMakeLock(Picoc *pc)
+{
+    pthread_mutexattr_t Attr;
+    pthread_mutex_t *Lock = malloc(sizeof(pthread_mutex_t));
+    pthread_cond_t *Finished = malloc(sizeof(pthread_cond_t));
+
+    if (Lock == NULL || Finished == NULL) {
+        free(Lock);
+        free(Finished);
+        return false;
+    }
+
+    pthread_mutexattr_init(&Attr);
+    pthread_mutexattr_settype(&Attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(Lock, &Attr);
+    pthread_mutexattr_destroy(&Attr);
+    pthread_cond_init(Finished, NULL);
+
+    pc->SharedLock = Lock;
+    pc->ThreadFinished = Finished;
+    return true;
+}
+
+/* the time a wait should give up at to look at pc->ThreadsExiting */
+static void ThreadDeadline(struct timespec *Deadline)
+{
+    clock_gettime(CLOCK_REALTIME, Deadline);
+    Deadline->tv_nsec += THREAD_WAIT_MS * 1000000L;
+    if (Deadline->tv_nsec >= 1000000000L) {
+        Deadline->tv_sec++;
+        Deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+/* call the thread's function, the same way ExpressionParseFunctionCall()
+    would but with nothing to return to */
+static void ThreadRun(struct ProgramThread *Thread)
+{
+    Picoc *pc = Thread->pc;
+    struct FuncDef *Func = Thread->Func;
+    struct ParseState Parser;
+    struct Value *ReturnValue;
+    struct Value *Param = NULL;
+
+    ParserCopy(&Parser, &Func->Body);
+    Parser.Mode = RunModeRun;
+    ReturnValue = VariableAllocValueFromType(pc, &Parser, Func->ReturnType,
+        false, NULL, false);
+
+    HeapPushStackFrame(pc);
+    if (Func->NumParams > 0) {
+        Param = VariableAllocValueFromType(pc, &Parser, Func->ParamType[0],
+            false, NULL, false);
+        Param->Val->Pointer = Thread->Arg;
+    }
+
+    ExpressionCallFrameAdd(&Parser, Thread->FuncName, Func, &Param,
+        Func->NumParams, ReturnValue, NULL);
+    ExpressionCallBody(Func);
+
+    if (Func->ReturnType->Base == TypePointer)
+        Thread->Result = ReturnValue->Val->Pointer;
+
+    VariableStackFramePop(&Parser);
+    HeapPopStackFrame(pc);
+}
+
+/* a host thread's starting point. errors, exit() and pthread_exit() all
+    jump back here to finish the thread */
+static void *ThreadMain(void *Arg)
+{
+    struct ProgramThread *Thread = Arg;
+    Picoc *pc = Thread->pc;
+
+    ThreadCurrent = &Thread->State;
+    if (setjmp(Thread->State.ExitBuf) == 0)
+        ThreadRun(Thread);
+
+    ThreadLock(pc);
+    Thread->Finished = true;
+    pthread_cond_broadcast(pc->ThreadFinished);
+    ThreadUnlock(pc);
+
+    return NULL;
+}
+
+static void ThreadFree(struct ProgramThread *Thread)
+{
+    free(Thread->Stack);
+    free(Thread);
+}
+
+/* start a thread running the function in FuncValue with Arg as its
+    parameter. returns 0 and sets *ID, or an errno value if there aren't
+    the resources for another thread */
+int ThreadStart(struct ParseState *Parser, struct Value *FuncValue, void *Arg,
+    int *ID)
+{
+    Picoc *pc = Parser->pc;
+    struct FuncDef *Func;
+    struct ProgramThread *Thread;
+    char *StackStart;
+
+    if (FuncValue->Typ->Base != TypeFunction)
+        ProgramFail(Parser, "a thread has to run a function, not %t",
+            FuncValue->Typ);
+
+    Func = &FuncValue->Val->FuncDef;
+    if (Func->Intrinsic != NULL || Func->Native != NULL)
+        ProgramFail(Parser, "a thread can't run a library function");
+
+    if (Func->Body.Pos == NULL)
+        ProgramFail(Parser, "the thread's function isn't defined");
+
+    if (Func->NumParams > 1 ||
+            (Func->NumParams == 1 && Func->ParamType[0]->Base != TypePointer))
+        ProgramFail(Parser, "a thread's function should take one pointer");
+
+    /* only the main thread can get here without the lock, so there's no
+        race making it */
+    if (pc->SharedLock == NULL && !ThreadMakeLock(pc))
+        return EAGAIN;
+
+    Thread = calloc(1, sizeof(struct ProgramThread));
+    if (Thread == NULL)
+        return EAGAIN;
+
+    Thread->Stack = malloc(THREAD_STACK_SIZE);
+    if (Thread->Stack == NULL) {
+        free(Thread);
+        return EAGAIN;
+    }
+
+    StackStart = Thread->Stack;
+    while (((unsigned long)StackStart & (sizeof(ALIGN_TYPE)-1)) != 0)
+        StackStart++;
+
+    HeapInitStack(&Thread->State, StackStart,
+        Thread->Stack + THREAD_STACK_SIZE - sizeof(ALIGN_TYPE));
+    LexInitValue(&Thread->State);
+    Thread->pc = pc;
+    Thread->Func = Func;
+    Thread->FuncName = VariableFuncName(pc, FuncValue, "thread");
+    Thread->Arg = Arg;
+
+    /* it's started while the lock's held so that ThreadStopAll() never
+        sees a thread on the list which isn't running yet */
+    ThreadLock(pc);
+    if (pc->ThreadsExiting) {
+        ThreadUnlock(pc);
+        ThreadFree(Thread);
+        ThreadCheck(pc);
+        return EAGAIN;
+    }
+
+    if (pthread_create(&Thread->Handle, NULL, ThreadMain, Thread) != 0) {
+        ThreadUnlock(pc);
+        ThreadFree(Thread);
+        return EAGAIN;
+    }
+
+    Thread->ID = ++pc->NextThreadID;
+    Thread->Next = pc->Threads;
+    pc->Threads = Thread;
+    *ID = Thread->ID;
+    ThreadUnlock(pc);
+
+    return 0;
+}
+
+/* wait for a thread to finish and get the pointer its function returned.
+    returns 0, or an errno value if there's no such thread or it can't be
+    waited for */
+int ThreadJoin(struct ParseState *Parser, int ID, void **Result)
+{
+    Picoc *pc = Parser->pc;
+    struct ProgramThread **Link;
+    struct ProgramThread *Thread;
+    struct timespec Deadline;
+
+    if (ID == ThreadID(pc))
+        return EDEADLK;
+
+    ThreadLock(pc);
+    for (Link = &pc->Threads; *Link != NULL && (*Link)->ID != ID;
+            Link = &(*Link)->Next) {
+    }
+
+    Thread = *Link;
+    if (Thread == NULL || Thread->Joining) {
+        ThreadUnlock(pc);
+        return Thread == NULL ? ESRCH : EINVAL;
+    }
+
+    Thread->Joining = true;
+    while (!Thread->Finished) {
+        ThreadDeadline(&Deadline);
+        pthread_cond_timedwait(pc->ThreadFinished, pc->SharedLock, &Deadline);
+        if (pc->ThreadsExiting) {
+            ThreadUnlock(pc);
+            ThreadCheck(pc);
+        }
+    }
+
+    /* the list may have changed while we were waiting */
+    for (Link = &pc->Threads; *Link != Thread; Link = &(*Link)->Next) {
+    }
+
+    *Link = Thread->Next;
+    ThreadUnlock(pc);
+
+    pthread_join(Thread->Handle, NULL);
+    if (Result != NULL)
+        *Result = Thread->Result;
+
+    ThreadFree(Thread);
+    return 0;
+}
+
+/* the current thread's ID - 0 for the main thread */
+int ThreadID(Picoc *pc)
+{
+    struct ProgramThread *Self = ThreadSelf();
+
+    return Self != NULL ? Self->ID : 0;
+}
+
+/* end the current thread as if its function had returned Result. the main
+    thread waits for all the others and then ends the program */
+void ThreadFinish(Picoc *pc, void *Result)
+{
+    struct ProgramThread *Self = ThreadSelf();
+    struct ProgramThread *Thread;
+    struct timespec Deadline;
+
+    if (Self != NULL) {
+        Self->Result = Result;
+        longjmp(Self->State.ExitBuf, 1);
+    }
+
+    ThreadLock(pc);
+    for (;;) {
+        for (Thread = pc->Threads; Thread != NULL && Thread->Finished;
+                Thread = Thread->Next) {
+        }
+
+        if (Thread == NULL || pc->ThreadsExiting)
+            break;
+
+        ThreadDeadline(&Deadline);
+        pthread_cond_timedwait(pc->ThreadFinished, pc->SharedLock, &Deadline);
+    }
+    ThreadUnlock(pc);
+
+    ThreadCheck(pc);
+    PlatformExit(pc, 0);
+}
+
+/* wait on one of the program's condition variables, giving up now and
+    then to see if the program's ending. it can return early, like
+    pthread_cond_wait() can */
+int ThreadWait(Picoc *pc, void *Cond, void *Mutex)
+{
+    struct timespec Deadline;
+    int Result;
+
+    ThreadDeadline(&Deadline);
+    Result = pthread_cond_timedwait(Cond, Mutex, &Deadline);
+    if (pc->ThreadsExiting)
+        ThreadCheck(pc);
+
+    return Result == ETIMEDOUT ? 0 : Result;
+}
+
+/* lock one of the program's mutexes, giving up now and then to see if the
+    program's ending */
+int ThreadWaitLock(Picoc *pc, void *Mutex)
+{
+    struct timespec Deadline;
+    int Result;
+
+    do {
+        if (pc->ThreadsExiting)
+            ThreadCheck(pc);
+
+        ThreadDeadline(&Deadline);
+        Result = pthread_mutex_timedlock(Mutex, &Deadline);
+    } while (Result == ETIMEDOUT);
+
+    return Result;
+}
+
+/* stop here if the program's ending. a thread the program started just
+    finishes, the main thread ends the program */
+void ThreadCheck(Picoc *pc)
+{
+    struct ProgramThread *Self = ThreadSelf();
+
+    if (!pc->ThreadsExiting)
+        return;
+
+    if (Self != NULL)
+        longjmp(Self->State.ExitBuf, 1);
+
+    PlatformExit(pc, pc->PicocExitValue);
+}
+
+/* called by PlatformExit(). on a thread the program started that means
+    telling the others the program's ending and finishing this one. on the
+    main thread it means waiting for the others to stop */
+void ThreadExit(Picoc *pc)
+{
+    struct ProgramThread *Self = ThreadSelf();
+
+    if (Self != NULL) {
+        pc->ThreadsExiting = true;
+        longjmp(Self->State.ExitBuf, 1);
+    }
+
+    ThreadStopAll(pc);
+}
+
+static void ParallelLock(Picoc *pc)
+{
+    if (pc->Parallel != NULL)
+        pthread_mutex_lock(&pc->Parallel->Lock);
+}
+
+static void ParallelUnlock(Picoc *pc)
+{
+    if (pc->Parallel != NULL)
+        pthread_mutex_unlock(&pc->Parallel->Lock);
+}
+
+/* how many threads to run a loop on if it doesn't say */
+static int ParallelNumThreads(void)
+{
+    long Cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return Cores > 0 ? (int)Cores : 1;
+}
+
+/* a pool thread's starting point. it runs its part of each new job, and
+    errors and exit() jump back here to finish it */
+static void *ParallelWorkerMain(void *Arg)
+{
+    struct ProgramThread *Worker = Arg;
+    Picoc *pc = Worker->pc;
+    struct ParallelPool *Pool = pc->Parallel;
+    struct ParallelJob *Job;
+
+    ThreadCurrent = &Worker->State;
+    pthread_mutex_lock(&Pool->Lock);
+    for (;;) {
+        while (!Pool->Stopping &&
+                (Pool->Job == NULL || Pool->Generation == Worker->Seen))
+            pthread_cond_wait(&Pool->Work, &Pool->Lock);
+
+        if (Pool->Stopping)
+            break;
+
+        Worker->Seen = Pool->Generation;
+        Job = Pool->Job;
+        if (Worker->Index > Job->NumWorkers)
+            continue;
+
+        pthread_mutex_unlock(&Pool->Lock);
+        HeapInitStack(&Worker->State, Worker->State.StackStart,
+            Worker->State.StackEnd);
+        Worker->State.TopStackFrame = NULL;
+        if (setjmp(Worker->State.ExitBuf) == 0)
+            ParallelRun(pc, Job, Worker->Index);
+
+        pthread_mutex_lock(&Pool->Lock);
+        Job->Finished++;
+        pthread_cond_broadcast(&Pool->Done);
+    }
+    pthread_mutex_unlock(&Pool->Lock);
+
+    return NULL;
+}
+
+/* make the pool, with no threads in it yet */
+static int ParallelPoolMake(Picoc *pc)
+{
+    struct ParallelPool *Pool;
+
+    if (pc->SharedLock == NULL && !ThreadMakeLock(pc))
+        return false;
+
+    ThreadLock(pc);
+    if (pc->Parallel == NULL) {
+        Pool = calloc(1, sizeof(struct ParallelPool));
+        if (Pool != NULL) {
+            pthread_mutex_init(&Pool->Lock, NULL);
+            pthread_cond_init(&Pool->Work, NULL);
+            pthread_cond_init(&Pool->Done, NULL);
+            pc->Parallel = Pool;
+        }
+    }
+    ThreadUnlock(pc);
+
+    return pc->Parallel != NULL;
+}
+
+/* add a thread to the pool. the pool's lock must be held */
+static int ParallelWorkerAdd(Picoc *pc, struct ParallelPool *Pool)
+{
+    struct ProgramThread *Worker;
+    char *StackStart;
+
+    Worker = calloc(1, sizeof(struct ProgramThread));
+    if (Worker == NULL)
+        return false;
+
+    Worker->Stack = malloc(THREAD_STACK_SIZE);
+    if (Worker->Stack == NULL) {
+        free(Worker);
+        return false;
+    }
+
+    StackStart = Worker->Stack;
+    while (((unsigned long)StackStart & (sizeof(ALIGN_TYPE)-1)) != 0)
+        StackStart++;
+
+    HeapInitStack(&Worker->State, StackStart,
+        Worker->Stack + THREAD_STACK_SIZE - sizeof(ALIGN_TYPE));
+    LexInitValue(&Worker->State);
+    Worker->pc = pc;
+    Worker->FuncName = "parallel for";
+    Worker->Index = Pool->NumWorkers + 1;
+    Worker->Seen = Pool->Generation;
+
+    if (pthread_create(&Worker->Handle, NULL, ParallelWorkerMain,
+            Worker) != 0) {
+        ThreadFree(Worker);
+        return false;
+    }
+
+    ThreadLock(pc);
+    Worker->ID = ++pc->NextThreadID;
+    ThreadUnlock(pc);
+
+    Pool->Workers[Pool->NumWorkers++] = Worker;
+    return true;
+}
+
+/* hand a job to the pool, starting more threads if it needs them. returns
+    false if the pool's already busy with the loop this one's nested in, in
+    which case the caller runs it by itself */
+static int ParallelStart(Picoc *pc, struct ParallelJob *Job)
+{
+    struct ParallelPool *Pool;
+
+    if (pc->Parallel == NULL && !ParallelPoolMake(pc))
+        return false;
+
+    Pool = pc->Parallel;
+    pthread_mutex_lock(&Pool->Lock);
+    if (Pool->Job != NULL || pc->ThreadsExiting) {
+        pthread_mutex_unlock(&Pool->Lock);
+        return false;
+    }
+
+    while (Pool->NumWorkers < Job->NumWorkers && ParallelWorkerAdd(pc, Pool)) {
+    }
+
+    /* any shares without a thread get stolen by the others */
+    if (Job->NumWorkers > Pool->NumWorkers)
+        Job->NumWorkers = Pool->NumWorkers;
+
+    if (Job->NumWorkers == 0) {
+        pthread_mutex_unlock(&Pool->Lock);
+        return false;
+    }
+
+    Pool->Job = Job;
+    Pool->Generation++;
+    pthread_cond_broadcast(&Pool->Work);
+    pthread_mutex_unlock(&Pool->Lock);
+
+    return true;
+}
+
+/* wait for the pool to finish a job. returns false if ThreadStopAll() took
+    it away because the program's ending */
+static int ParallelFinish(Picoc *pc, struct ParallelJob *Job)
+{
+    struct ParallelPool *Pool = pc->Parallel;
+    int Released = false;
+
+    pthread_mutex_lock(&Pool->Lock);
+    while (Pool->Job == Job && Job->Finished < Job->NumWorkers)
+        pthread_cond_wait(&Pool->Done, &Pool->Lock);
+
+    if (Pool->Job == Job) {
+        Pool->Job = NULL;
+        Released = true;
+    }
+    pthread_mutex_unlock(&Pool->Lock);
+
+    return Released;
+}
+
+/* run a parallel for with the iterations from Loop->Start up to Loop->End */
+void ThreadParallelFor(struct ParseState *Parser, struct ParallelLoop *Loop)
+{
+    Picoc *pc = Parser->pc;
+    struct ParallelJob *Job;
+    long long Iterations = Loop->End - Loop->Start;
+    int NumThreads = Loop->NumThreads > 0 ? Loop->NumThreads :
+        ParallelNumThreads();
+    int Size;
+    int Shared;
+
+    if (NumThreads > PARALLEL_MAX_THREADS)
+        NumThreads = PARALLEL_MAX_THREADS;
+
+    if (NumThreads > Iterations)
+        NumThreads = (int)Iterations;
+
+    Job = ParallelJobMake(Parser, Loop, NumThreads, &Size);
+    Shared = Job->NumWorkers > 0 && ParallelStart(pc, Job);
+    if (!Shared)
+        Job->NumWorkers = 0;
+
+    ParallelRun(pc, Job, 0);
+    if (Shared && !ParallelFinish(pc, Job))
+        ThreadCheck(pc);
+
+    if (pc->ThreadsExiting)
+        ThreadCheck(pc);
+
+    ParallelReduce(Parser, Job);
+    HeapPopStack(pc, Job, Size);
+}
+
+/* wait for the pool to finish whatever it's running and take the job off
+    it, so the thread it belongs to can stop */
+static void ParallelStopJob(Picoc *pc)
+{
+    struct ParallelPool *Pool = pc->Parallel;
+
+    if (Pool == NULL)
+        return;
+
+    pthread_mutex_lock(&Pool->Lock);
+    while (Pool->Job != NULL && Pool->Job->Finished < Pool->Job->NumWorkers)
+        pthread_cond_wait(&Pool->Done, &Pool->Lock);
+
+    Pool->Job = NULL;
+    pthread_cond_broadcast(&Pool->Done);
+    pthread_mutex_unlock(&Pool->Lock);
+}
+
+/* stop the pool's threads and free it */
+static void ParallelPoolFree(Picoc *pc)
+{
+    struct ParallelPool *Pool = pc->Parallel;
+    int Count;
+
+    if (Pool == NULL)
+        return;
+
+    pthread_mutex_lock(&Pool->Lock);
+    Pool->Stopping = true;
+    pthread_cond_broadcast(&Pool->Work);
+    pthread_mutex_unlock(&Pool->Lock);
+
+    for (Count = 0; Count < Pool->NumWorkers; Count++) {
+        pthread_join(Pool->Workers[Count]->Handle, NULL);
+        ThreadFree(Pool->Workers[Count]);
+    }
+
+    pthread_mutex_destroy(&Pool->Lock);
+    pthread_cond_destroy(&Pool->Work);
+    pthread_cond_destroy(&Pool->Done);
+    free(Pool);
+    pc->Parallel = NULL;
+}
+
+/* stop every thread the program started and wait for them. only the main
+    thread calls this */
+void ThreadStopAll(Picoc *pc)
+{
+    struct ProgramThread *Thread;
+
+    if (pc->Threads == NULL &&
+            (pc->Parallel == NULL || pc->Parallel->Job == NULL))
+        return;
+
+    ThreadLock(pc);
+    pc->ThreadsExiting = true;
+    pthread_cond_broadcast(pc->ThreadFinished);
+    ThreadUnlock(pc);
+
+    ParallelStopJob(pc);
+
+    for (;;) {
+        ThreadLock(pc);
+        Thread = pc->Threads;
+        if (Thread != NULL)
+            pc->Threads = Thread->Next;
+        ThreadUnlock(pc);
+
+        if (Thread == NULL)
+            break;
+
+        pthread_join(Thread->Handle, NULL);
+        ThreadFree(Thread);
+    }
+
+    pc->ThreadsExiting = false;
+}
+
+/* stop the threads, the parallel for pool too, and free the shared lock */
+void ThreadCleanup(Picoc *pc)
+{
+    ThreadStopAll(pc);
+    ParallelPoolFree(pc);
+
+    if (pc->SharedLock != NULL) {
+        pthread_mutex_destroy(pc->SharedLock);
+        pthread_cond_destroy(pc->ThreadFinished);
+        free(pc->SharedLock);
+        free(pc->ThreadFinished);
+        pc->SharedLock = NULL;
+        pc->ThreadFinished = NULL;
+    }
+}
+
+#else
+
+/* there's only ever the main thread on other platforms */
+void ThreadLock(Picoc *pc)
+{
+}
+
+void ThreadUnlock(Picoc *pc)
+{
+}
+
+int ThreadStart(struct ParseState *Parser, struct Value *FuncValue, void *Arg,
+    int *ID)
+{
+    ProgramFail(Parser, "threads aren't supported on this platform");
+    return 0;
+}
+
+int ThreadJoin(struct ParseState *Parser, int ID, void **Result)
+{
+    ProgramFail(Parser, "threads aren't supported on this platform");
+    return 0;
+}
+
+int ThreadID(Picoc *pc)
+{
+    return 0;
+}
+
+void ThreadFinish(Picoc *pc, void *Result)
+{
+    PlatformExit(pc, 0);
+}
+
+void ThreadCheck(Picoc *pc)
+{
+}
+
+void ThreadExit(Picoc *pc)
+{
+}
+
+void ThreadStopAll(Picoc *pc)
+{
+}
+
+void ThreadCleanup(Picoc *pc)
+{
+}
+
+static void ParallelLock(Picoc *pc)
+{
+}
+
+static void ParallelUnlock(Picoc *pc)
+{
+}
+
+/* with no threads the loop just runs all its iterations itself */
+void ThreadParallelFor(struct ParseState *Parser, struct ParallelLoop *Loop)
+{
+    struct ParallelJob *Job;
+    int Size;
+
+    Job = ParallelJobMake(Parser, Loop, 1, &Size);
+    ParallelRun(Parser->pc, Job, 0);
+    ParallelReduce(Parser, Job);
+    HeapPopStack(Parser->pc, Job, Size);
+}
+
+#endif
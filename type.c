@@ -7,6 +7,8 @@
 static struct ValueType *TypeAdd(Picoc *pc, struct ParseState *Parser,
     struct ValueType *ParentType, enum BaseType Base, int ArraySize,
     const char *Identifier, int Sizeof, int AlignBytes);
+static struct ValueType *TypeFind(struct ValueType *ParentType,
+    enum BaseType Base, int ArraySize, const char *Identifier);
 static void TypeAddBaseType(Picoc *pc, struct ValueType *TypeNode,
     enum BaseType Base, int Sizeof, int AlignBytes);
 static void TypeCleanupNode(Picoc *pc, struct ValueType *Typ);
@@ -18,11 +20,6 @@ static struct ValueType *TypeParseBack(struct ParseState *Parser,
 
 
 
-/* some basic types */
-static int PointerAlignBytes;
-static int IntAlignBytes;
-
-
 /* add a new type to the set of types we know about */
 struct ValueType *TypeAdd(Picoc *pc, struct ParseState *Parser,
     struct ValueType *ParentType, enum BaseType Base, int ArraySize,
@@ -45,6 +42,18 @@ struct ValueType *TypeAdd(Picoc *pc, struct ParseState *Parser,
     return NewType;
 }
 
+/* look for a derived type which has already been made */
+struct ValueType *TypeFind(struct ValueType *ParentType, enum BaseType Base,
+    int ArraySize, const char *Identifier)
+{
+    struct ValueType *ThisType = ParentType->DerivedTypeList;
+    while (ThisType != NULL && (ThisType->Base != Base ||
+            ThisType->ArraySize != ArraySize || ThisType->Identifier != Identifier))
+        ThisType = ThisType->Next;
+
+    return ThisType;
+}
+
 /* given a parent type, get a matching derived type and make one if necessary.
  * Identifier should be registered with the shared string table. */
 struct ValueType *TypeGetMatching(Picoc *pc, struct ParseState *Parser,
@@ -53,39 +62,48 @@ struct ValueType *TypeGetMatching(Picoc *pc, struct ParseState *Parser,
 {
     int Sizeof;
     int AlignBytes;
-    struct ValueType *ThisType = ParentType->DerivedTypeList;
-    while (ThisType != NULL && (ThisType->Base != Base ||
-            ThisType->ArraySize != ArraySize || ThisType->Identifier != Identifier))
-        ThisType = ThisType->Next;
+    struct ValueType *ThisType = TypeFind(ParentType, Base, ArraySize,
+        Identifier);
+
+    if (ThisType == NULL) {
+        /* another thread might be making the same type - look again while
+            no-one else can */
+        ThreadLock(pc);
+        ThisType = TypeFind(ParentType, Base, ArraySize, Identifier);
+        if (ThisType == NULL) {
+            switch (Base) {
+            case TypePointer:
+                Sizeof = sizeof(void*);
+                AlignBytes = pc->CharPtrType->AlignBytes;
+                break;
+            case TypeArray:
+                Sizeof = ArraySize * ParentType->Sizeof;
+                AlignBytes = ParentType->AlignBytes;
+                break;
+            case TypeEnum:
+                Sizeof = sizeof(int);
+                AlignBytes = pc->IntType.AlignBytes;
+                break;
+            default:
+                Sizeof = 0; AlignBytes = 0;
+                break;  /* structs and unions will get bigger
+                            when we add members to them */
+            }
 
-    if (ThisType != NULL) {
-        if (AllowDuplicates)
+            ThisType = TypeAdd(pc, Parser, ParentType, Base, ArraySize,
+                Identifier, Sizeof, AlignBytes);
+            ThreadUnlock(pc);
             return ThisType;
-        else
-            ProgramFail(Parser, "data type '%s' is already defined", Identifier);
+        }
+        ThreadUnlock(pc);
     }
 
-    switch (Base) {
-    case TypePointer:
-        Sizeof = sizeof(void*);
-        AlignBytes = PointerAlignBytes;
-        break;
-    case TypeArray:
-        Sizeof = ArraySize * ParentType->Sizeof;
-        AlignBytes = ParentType->AlignBytes;
-        break;
-    case TypeEnum:
-        Sizeof = sizeof(int);
-        AlignBytes = IntAlignBytes;
-        break;
-    default:
-        Sizeof = 0; AlignBytes = 0;
-        break;  /* structs and unions will get bigger
-                    when we add members to them */
-    }
+    if (AllowDuplicates)
+        return ThisType;
+    else
+        ProgramFail(Parser, "data type '%s' is already defined", Identifier);
 
-    return TypeAdd(pc, Parser, ParentType, Base, ArraySize, Identifier, Sizeof,
-        AlignBytes);
+    return NULL;
 }
 
 /* stack space used by a value */
@@ -147,9 +165,8 @@ void TypeInit(Picoc *pc)
     struct FloatAlign {char x; float y;} fa;
     struct DoubleAlign {char x; double y;} da;
     struct PointerAlign {char x; void *y;} pa;
-
-    IntAlignBytes = (char*)&ia.y - &ia.x;
-    PointerAlignBytes = (char*)&pa.y - &pa.x;
+    int IntAlignBytes = (char*)&ia.y - &ia.x;
+    int PointerAlignBytes = (char*)&pa.y - &pa.x;
 
     pc->UberType.DerivedTypeList = NULL;
     TypeAddBaseType(pc, &pc->IntType, TypeInt, sizeof(int), IntAlignBytes);
@@ -190,6 +207,9 @@ void TypeInit(Picoc *pc)
         pc->StrEmpty, sizeof(void*), PointerAlignBytes);
     pc->VoidPtrType = TypeAdd(pc, NULL, &pc->VoidType, TypePointer, 0,
         pc->StrEmpty, sizeof(void*), PointerAlignBytes);
+
+    strcpy(pc->StructTempName, "^s0000");
+    strcpy(pc->EnumTempName, "^e0000");
 }
 
 /* deallocate heap-allocated types */
@@ -239,10 +259,8 @@ void TypeParseStruct(struct ParseState *Parser, struct ValueType **Typ,
         LexGetToken(Parser, &LexValue, true);
         StructIdentifier = LexValue->Val->Identifier;
         Token = LexGetToken(Parser, NULL, false);
-    } else {
-        static char TempNameBuf[7] = "^s0000";
-        StructIdentifier = PlatformMakeTempName(pc, TempNameBuf);
-    }
+    } else
+        StructIdentifier = PlatformMakeTempName(pc, pc->StructTempName);
 
     *Typ = TypeGetMatching(pc, Parser, &Parser->pc->UberType,
         IsStruct ? TypeStruct : TypeUnion, 0, StructIdentifier, true);
@@ -260,7 +278,7 @@ void TypeParseStruct(struct ParseState *Parser, struct ValueType **Typ,
         return;
     }
 
-    if (pc->TopStackFrame != NULL)
+    if (THREAD(pc)->TopStackFrame != NULL)
         ProgramFail(Parser, "struct/union definitions can only be globals");
 
     LexGetToken(Parser, NULL, true);
@@ -324,7 +342,10 @@ struct ValueType *TypeCreateOpaqueStruct(Picoc *pc, struct ParseState *Parser,
     const char *StructName, int Size)
 {
     struct ValueType *Typ = TypeGetMatching(pc, Parser, &pc->UberType,
-        TypeStruct, 0, StructName, false);
+        TypeStruct, 0, StructName, pc->ImageRebind);
+
+    if (Typ->Members != NULL)
+        return Typ;     /* already made in a loaded image */
 
     /* create the (empty) table */
     Typ->Members = VariableAlloc(pc,
@@ -355,10 +376,8 @@ void TypeParseEnum(struct ParseState *Parser, struct ValueType **Typ)
         LexGetToken(Parser, &LexValue, true);
         EnumIdentifier = LexValue->Val->Identifier;
         Token = LexGetToken(Parser, NULL, false);
-    } else {
-        static char TempNameBuf[7] = "^e0000";
-        EnumIdentifier = PlatformMakeTempName(pc, TempNameBuf);
-    }
+    } else
+        EnumIdentifier = PlatformMakeTempName(pc, pc->EnumTempName);
 
     TypeGetMatching(pc, Parser, &pc->UberType, TypeEnum, 0, EnumIdentifier,
         Token != TokenLeftBrace);
@@ -371,7 +390,7 @@ void TypeParseEnum(struct ParseState *Parser, struct ValueType **Typ)
         return;
     }
 
-    if (pc->TopStackFrame != NULL)
+    if (THREAD(pc)->TopStackFrame != NULL)
         ProgramFail(Parser, "enum definitions can only be globals");
 
     LexGetToken(Parser, NULL, true);
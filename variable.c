@@ -15,7 +15,7 @@ void VariableInit(Picoc *pc)
         GLOBAL_TABLE_SIZE, true);
     TableInitTable(&pc->StringLiteralTable, &pc->StringLiteralHashTable[0],
         STRING_LITERAL_TABLE_SIZE, true);
-    pc->TopStackFrame = NULL;
+    pc->MainThread.TopStackFrame = NULL;
 }
 
 /* deallocate the contents of a variable */
@@ -104,8 +104,9 @@ struct Value *VariableAllocValueAndData(Picoc *pc, struct ParseState *Parser,
     NewValue->ValOnStack = !OnHeap;
     NewValue->IsLValue = IsLValue;
     NewValue->LValueFrom = LValueFrom;
-    if (Parser)
-        NewValue->ScopeID = Parser->ScopeID;
+    /* values made without a parser, like library functions, aren't in any
+        scope. 0 isn't safe as VariableScopeBegin()'s hash can produce it */
+    NewValue->ScopeID = Parser ? Parser->ScopeID : -1;
 
     NewValue->OutOfScope = false;
 
@@ -193,6 +194,7 @@ void VariableRealloc(struct ParseState *Parser, struct Value *FromValue,
 int VariableScopeBegin(struct ParseState *Parser, int* OldScopeID)
 {
     int Count;
+    uintptr_t Hash;
     struct TableEntry *Entry;
     struct TableEntry *NextEntry;
 #ifdef DEBUG_VAR_SCOPE
@@ -202,13 +204,18 @@ int VariableScopeBegin(struct ParseState *Parser, int* OldScopeID)
     if (Parser->ScopeID == -1)
         return -1;
 
-    struct Table *HashTable = (Parser->pc->TopStackFrame == NULL) ?
-        &(Parser->pc->GlobalTable) : &(Parser->pc->TopStackFrame)->LocalTable;
+    struct Table *HashTable = (THREAD(Parser->pc)->TopStackFrame == NULL) ?
+        &(Parser->pc->GlobalTable) : &(THREAD(Parser->pc)->TopStackFrame)->LocalTable;
 
-    /* XXX dumb hash, let's hope for no collisions... */
+    /* XXX dumb hash, let's hope for no collisions... all of both pointers
+        are used since a heap, eg. a thread's, can start on a 4GB boundary,
+        leaving nothing in the low bits of SourceText */
     *OldScopeID = Parser->ScopeID;
-    Parser->ScopeID = (int)(intptr_t)(Parser->SourceText) *
-        ((int)(intptr_t)(Parser->Pos) / sizeof(char*));
+    Hash = (uintptr_t)Parser->SourceText * 31 +
+        (uintptr_t)Parser->Pos / sizeof(char*);
+    Parser->ScopeID = (int)(Hash ^ (Hash >> 16 >> 16));
+    if (Parser->ScopeID == -1)
+        Parser->ScopeID = 0;
     /* or maybe a more human-readable hash for debugging? */
     /* Parser->ScopeID = Parser->Line * 0x10000 + Parser->CharacterPos; */
 
@@ -245,8 +252,8 @@ void VariableScopeEnd(struct ParseState *Parser, int ScopeID, int PrevScopeID)
     if (ScopeID == -1)
         return;
 
-    struct Table *HashTable = (Parser->pc->TopStackFrame == NULL) ?
-        &(Parser->pc->GlobalTable) : &(Parser->pc->TopStackFrame)->LocalTable;
+    struct Table *HashTable = (THREAD(Parser->pc)->TopStackFrame == NULL) ?
+        &(Parser->pc->GlobalTable) : &(THREAD(Parser->pc)->TopStackFrame)->LocalTable;
 
     for (Count = 0; Count < HashTable->Size; Count++) {
         for (Entry = HashTable->HashTable[Count]; Entry != NULL;
@@ -274,8 +281,8 @@ int VariableDefinedAndOutOfScope(Picoc *pc, const char* Ident)
     int Count;
     struct TableEntry *Entry;
 
-    struct Table * HashTable = (pc->TopStackFrame == NULL) ?
-        &(pc->GlobalTable) : &(pc->TopStackFrame)->LocalTable;
+    struct Table * HashTable = (THREAD(pc)->TopStackFrame == NULL) ?
+        &(pc->GlobalTable) : &(THREAD(pc)->TopStackFrame)->LocalTable;
 
     for (Count = 0; Count < HashTable->Size; Count++) {
         for (Entry = HashTable->HashTable[Count]; Entry != NULL;
@@ -294,10 +301,10 @@ struct Value *VariableDefine(Picoc *pc, struct ParseState *Parser, char *Ident,
 {
     int ScopeID = Parser ? Parser->ScopeID : -1;
     struct Value * AssignValue;
-    struct Table * currentTable = (pc->TopStackFrame == NULL) ?
-        &(pc->GlobalTable) : &(pc->TopStackFrame)->LocalTable;
+    struct Table * currentTable = (THREAD(pc)->TopStackFrame == NULL) ?
+        &(pc->GlobalTable) : &(THREAD(pc)->TopStackFrame)->LocalTable;
 
-    stats_log_variable_definition(Parser, Ident, Typ, pc->TopStackFrame == NULL);
+    stats_log_variable_definition(Parser, Ident, Typ, THREAD(pc)->TopStackFrame == NULL);
 
 #ifdef DEBUG_VAR_SCOPE
     if (Parser) fprintf(stderr, "def %s %x (%s:%d:%d)\n", Ident, ScopeID,
@@ -309,11 +316,11 @@ struct Value *VariableDefine(Picoc *pc, struct ParseState *Parser, char *Ident,
         if (InitValue->Typ->Base == TypeArray)
             AssignValue = VariableAllocValueShared(Parser, InitValue);
         else
-            AssignValue = VariableAllocValueAndCopy(pc, Parser, InitValue, pc->TopStackFrame == NULL);
+            AssignValue = VariableAllocValueAndCopy(pc, Parser, InitValue, THREAD(pc)->TopStackFrame == NULL);
     }
     else
         AssignValue = VariableAllocValueFromType(pc, Parser, Typ, MakeWritable,
-            NULL, pc->TopStackFrame == NULL);
+            NULL, THREAD(pc)->TopStackFrame == NULL);
 
     AssignValue->IsLValue = MakeWritable;
     AssignValue->ScopeID = ScopeID;
@@ -337,6 +344,7 @@ struct Value *VariableDefineButIgnoreIdentical(struct ParseState *Parser,
     const char *DeclFileName;
     Picoc *pc = Parser->pc;
     struct Value *ExistingValue;
+    struct Value *MirrorValue;
 
     /* is the type a forward declaration? */
     if (TypeIsForwardDeclared(Parser, Typ))
@@ -355,11 +363,11 @@ struct Value *VariableDefineButIgnoreIdentical(struct ParseState *Parser,
         strncpy(MNPos, (char*)Parser->FileName, MNEnd - MNPos);
         MNPos += strlen(MNPos);
 
-        if (pc->TopStackFrame != NULL) {
+        if (THREAD(pc)->TopStackFrame != NULL) {
             /* we're inside a function */
             if (MNEnd - MNPos > 0)
                 *MNPos++ = '/';
-            strncpy(MNPos, (char*)pc->TopStackFrame->FuncName, MNEnd - MNPos);
+            strncpy(MNPos, (char*)THREAD(pc)->TopStackFrame->FuncName, MNEnd - MNPos);
             MNPos += strlen(MNPos);
         }
 
@@ -367,7 +375,9 @@ struct Value *VariableDefineButIgnoreIdentical(struct ParseState *Parser,
         strncpy(MNPos, Ident, MNEnd - MNPos);
         RegisteredMangledName = TableStrRegister(pc, MangledName);
 
-        /* is this static already defined? */
+        /* is this static already defined? threads share it, so only the
+            first one to get here defines it */
+        ThreadLock(pc);
         if (!TableGet(&pc->GlobalTable, RegisteredMangledName, &ExistingValue,
                 &DeclFileName, &DeclLine, &DeclColumn)) {
             /* define the mangled-named static variable store in the global scope */
@@ -378,6 +388,17 @@ struct Value *VariableDefineButIgnoreIdentical(struct ParseState *Parser,
                 Parser->CharacterPos);
             *FirstVisit = true;
         }
+        ThreadUnlock(pc);
+
+        /* the declaration's been run before in this frame, in a loop or by
+            a function called back in the same frame, so the short name's
+            there already */
+        if (TableGet((THREAD(pc)->TopStackFrame == NULL) ? &pc->GlobalTable :
+                    &THREAD(pc)->TopStackFrame->LocalTable, Ident, &MirrorValue,
+                    NULL, NULL, NULL) && MirrorValue->Val == ExistingValue->Val) {
+            MirrorValue->OutOfScope = false;
+            return ExistingValue;
+        }
 
         /* static variable exists in the global scope - now make a
             mirroring variable in our own scope with the short name */
@@ -385,8 +406,8 @@ struct Value *VariableDefineButIgnoreIdentical(struct ParseState *Parser,
             ExistingValue->Val, true);
         return ExistingValue;
     } else {
-        if (Parser->Line != 0 && TableGet((pc->TopStackFrame == NULL) ?
-                    &pc->GlobalTable : &pc->TopStackFrame->LocalTable, Ident,
+        if (Parser->Line != 0 && TableGet((THREAD(pc)->TopStackFrame == NULL) ?
+                    &pc->GlobalTable : &THREAD(pc)->TopStackFrame->LocalTable, Ident,
                     &ExistingValue, &DeclFileName, &DeclLine, &DeclColumn)
                 && DeclFileName == Parser->FileName && DeclLine == Parser->Line &&
                 DeclColumn == Parser->CharacterPos)
@@ -400,8 +421,9 @@ struct Value *VariableDefineButIgnoreIdentical(struct ParseState *Parser,
 int VariableDefined(Picoc *pc, const char *Ident)
 {
     struct Value *FoundValue;
+    struct StackFrame *TopStackFrame = THREAD(pc)->TopStackFrame;
 
-    if (pc->TopStackFrame == NULL || !TableGet(&pc->TopStackFrame->LocalTable,
+    if (TopStackFrame == NULL || !TableGet(&TopStackFrame->LocalTable,
             Ident, &FoundValue, NULL, NULL, NULL)) {
         if (!TableGet(&pc->GlobalTable, Ident, &FoundValue, NULL, NULL, NULL))
             return false;
@@ -414,7 +436,9 @@ int VariableDefined(Picoc *pc, const char *Ident)
 void VariableGet(Picoc *pc, struct ParseState *Parser, const char *Ident,
     struct Value **LVal)
 {
-    if (pc->TopStackFrame == NULL || !TableGet(&pc->TopStackFrame->LocalTable,
+    struct StackFrame *TopStackFrame = THREAD(pc)->TopStackFrame;
+
+    if (TopStackFrame == NULL || !TableGet(&TopStackFrame->LocalTable,
             Ident, LVal, NULL, NULL, NULL)) {
         if (!TableGet(&pc->GlobalTable, Ident, LVal, NULL, NULL, NULL)) {
             if (VariableDefinedAndOutOfScope(pc, Ident))
@@ -429,19 +453,46 @@ void VariableGet(Picoc *pc, struct ParseState *Parser, const char *Ident,
 void VariableDefinePlatformVar(Picoc *pc, struct ParseState *Parser, char *Ident,
     struct ValueType *Typ, union AnyValue *FromValue, int IsWritable)
 {
-    struct Value *SomeValue = VariableAllocValueAndData(pc, NULL, 0, IsWritable,
-        NULL, true);
+    struct Value *SomeValue;
+
+    /* a loaded image just needs to point at this process's variable */
+    if (pc->ImageRebind && TableGet(&pc->GlobalTable,
+            TableStrRegister(pc, Ident), &SomeValue, NULL, NULL, NULL)) {
+        SomeValue->Val = FromValue;
+        return;
+    }
+
+    SomeValue = VariableAllocValueAndData(pc, NULL, 0, IsWritable, NULL, true);
     SomeValue->Typ = Typ;
     SomeValue->Val = FromValue;
 
     if (!TableSet(pc,
-            (pc->TopStackFrame == NULL) ? &pc->GlobalTable : &pc->TopStackFrame->LocalTable,
+            (THREAD(pc)->TopStackFrame == NULL) ? &pc->GlobalTable : &THREAD(pc)->TopStackFrame->LocalTable,
             TableStrRegister(pc, Ident), SomeValue,
             Parser ? Parser->FileName : NULL,
             Parser ? Parser->Line : 0, Parser ? Parser->CharacterPos : 0))
         ProgramFail(Parser, "'%s' is already defined", Ident);
 }
 
+/* find the name a function was defined with, or Default if it can't be
+    found */
+const char *VariableFuncName(Picoc *pc, struct Value *FuncValue,
+    const char *Default)
+{
+    int Count;
+    struct TableEntry *Entry;
+
+    for (Count = 0; Count < pc->GlobalTable.Size; Count++) {
+        for (Entry = pc->GlobalTable.HashTable[Count]; Entry != NULL;
+                Entry = Entry->Next) {
+            if (Entry->p.v.Val->Val == FuncValue->Val)
+                return Entry->p.v.Key;
+        }
+    }
+
+    return Default;
+}
+
 /* free and/or pop the top value off the stack. Var must be
     the top value on the stack! */
 void VariableStackPop(struct ParseState *Parser, struct Value *Var)
@@ -488,8 +539,8 @@ void VariableStackFrameAdd(struct ParseState *Parser, const char *FuncName,
         ((void*)((char*)NewFrame+sizeof(struct StackFrame))) : NULL;
     TableInitTable(&NewFrame->LocalTable, &NewFrame->LocalHashTable[0],
         LOCAL_TABLE_SIZE, false);
-    NewFrame->PreviousStackFrame = Parser->pc->TopStackFrame;
-    Parser->pc->TopStackFrame = NewFrame;
+    NewFrame->PreviousStackFrame = THREAD(Parser->pc)->TopStackFrame;
+    THREAD(Parser->pc)->TopStackFrame = NewFrame;
 
     stats_log_stack_frame_add(Parser, FuncName);
 }
@@ -497,11 +548,13 @@ void VariableStackFrameAdd(struct ParseState *Parser, const char *FuncName,
 /* remove a stack frame */
 void VariableStackFramePop(struct ParseState *Parser)
 {
-    if (Parser->pc->TopStackFrame == NULL)
+    struct ThreadState *Thread = THREAD(Parser->pc);
+
+    if (Thread->TopStackFrame == NULL)
         ProgramFail(Parser, "stack is empty - can't go back");
 
-    ParserCopy(Parser, &Parser->pc->TopStackFrame->ReturnParser);
-    Parser->pc->TopStackFrame = Parser->pc->TopStackFrame->PreviousStackFrame;
+    ParserCopy(Parser, &Thread->TopStackFrame->ReturnParser);
+    Thread->TopStackFrame = Thread->TopStackFrame->PreviousStackFrame;
     HeapPopStackFrame(Parser->pc);
 
     stats_log_stack_frame_pop(Parser);